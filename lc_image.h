@@ -82,14 +82,61 @@ freely, subject to the following restrictions:
 /*
 
 Things to know:
- - supported formats: JPG, PNG
- - lc_load_image and lc_load_image_mem are NOT thread safe
+ - supported formats: JPG, PNG, and uncompressed PNM (PGM, PPM, PAM), BMP and TGA; lc_register_codec
+   adds more
+ - lc_map_image hands out uncompressed images in place, lc_write_pnm, lc_write_bmp and lc_write_tga
+   write them
+ - the loaders may be called from several threads at once (lc_register_codec excepted), lc_load_images_batch
+   loads many images on a pool of threads
+ - define LC_IMAGE_IO_URING on Linux to let lc_load_images_batch open, stat and read files in batches
+   through io_uring, it falls back to plain system calls if the kernel does not support it
+ - lc_load_options.thread_count > 1 splits large PNG IDAT streams across worker threads, and the
+   deinterlacing and color conversion after unfiltering into bands of rows
+ - lc_load_options.cancel is polled during decoding, a non-zero return stops the load (deadlines,
+   cancelled requests)
+ - lc_write_png writes 8 bit PNGs with a fast deflate, lc_write_options.thread_count > 1 compresses
+   horizontal bands in parallel
+ - define LC_IMAGE_LIBDEFLATE and include libdeflate.h before the implementation to inflate with
+   libdeflate (link with -ldeflate) instead of the built in inflater
 
 */
 
 #ifndef LC_IMAGE_H
 #define LC_IMAGE_H
 
+/*
+ lc_preview_fn: progressive preview of an interlaced PNG, called after each Adam7 pass (1..7) with the
+ whole image upscaled from the pixels decoded so far. pixels are RGBA if 0 or 4 channels were requested,
+ RGB otherwise, and are only valid during the call.
+*/
+typedef void (*lc_preview_fn)(void* context, int pass, int width, int height, int channel_count,
+                              const unsigned char* pixels);
+
+/*
+ lc_cancel_fn: polled while an image is decoded, once per row of JPG blocks and about every MB of
+ inflated or unfiltered PNG data. Return non-zero to stop the load, for example once a deadline has
+ passed. May be called from the worker threads of a load.
+*/
+typedef int (*lc_cancel_fn)(void* context);
+
+/*
+ lc_load_options: optional settings for lc_load_image_ex and lc_load_image_mem_ex.
+ Call lc_load_options_init first so that fields added later keep their defaults.
+*/
+typedef struct lc_load_options {
+    int thread_count;   /* threads used to inflate and convert large PNGs, 0 or 1 decodes on the calling thread */
+    int skip_checksums; /* 1 skips PNG chunk CRC and zlib Adler-32 checks, only for trusted input */
+    lc_preview_fn preview;          /* 8 bit loads of interlaced PNGs only, inflates on the calling thread */
+    void*         preview_context;  /* passed to preview */
+    unsigned long long  max_memory;  /* PNG loads fail early if they would hold more bytes at once, 0 for no limit */
+    unsigned long long* peak_memory; /* receives the most bytes a PNG load held at once, may be NULL */
+    lc_cancel_fn  cancel;           /* a non-zero return stops the load, which then returns NULL */
+    void*         cancel_context;   /* passed to cancel */
+    int*          cancelled;        /* set to 1 if cancel stopped the load, left alone otherwise, may be NULL */
+} lc_load_options;
+
+void lc_load_options_init(lc_load_options* options);
+
 unsigned char* lc_load_image(const char* file_name, 
                              int* width, int* height, int* channel_count, 
                              int req_channel_count);
@@ -98,8 +145,253 @@ unsigned char* lc_load_image_mem(unsigned long long size, const unsigned char* d
                                  int* width, int* height, int* channel_count, 
                                  int req_channel_count);
 
+/* Same as lc_load_image and lc_load_image_mem, options may be NULL */
+unsigned char* lc_load_image_ex(const char* file_name, 
+                                int* width, int* height, int* channel_count, 
+                                int req_channel_count, const lc_load_options* options);
+
+unsigned char* lc_load_image_mem_ex(unsigned long long size, const unsigned char* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options);
+
 void lc_free_image(unsigned char* data);
 
+/*
+ lc_codec: an image format that the loaders pick by the first bytes of the data. PNG, JPG, PNM, BMP and
+ TGA are built in, lc_register_codec adds more. Codecs registered later are tried first, so they can also replace a
+ built in one. Only decode is required; the codec must stay valid while images are loaded.
+*/
+typedef struct lc_codec {
+    const char*          name;
+    const unsigned char* signature;      /* first bytes of the format, compared before probe */
+    int                  signature_size; /* at most 16, 0 leaves the match to probe */
+
+    /*
+     Returns 1 if data is in this format, may be NULL if the signature is enough. data holds at least
+     16 bytes, or the whole image if it is smaller. width, height and channel_count may be NULL, else
+     they receive the size of the image and the channels of a load with req_channel_count 0, 0 if the
+     bytes at hand don't tell.
+    */
+    int (*probe)(unsigned long long size, const unsigned char* data,
+                 int* width, int* height, int* channel_count);
+
+    /* like lc_load_image_mem_ex, options is never NULL. The result is released with lc_free_image (free) */
+    unsigned char* (*decode)(unsigned long long size, const unsigned char* data,
+                             int* width, int* height, int* channel_count,
+                             int req_channel_count, const lc_load_options* options);
+
+    /* like lc_load_image_mem_into, options is never NULL. May be NULL, the result of decode is copied then */
+    int (*decode_into)(unsigned long long size, const unsigned char* data,
+                       unsigned char* pixels, unsigned long long capacity,
+                       int* width, int* height, int* channel_count,
+                       int req_channel_count, const lc_load_options* options);
+} lc_codec;
+
+/*
+ Adds codec to the registry, returns 0 if it is full (16 codecs, the 5 built in ones included) or codec has neither a signature
+ nor a probe. Not thread safe: register codecs before images are loaded.
+*/
+int lc_register_codec(const lc_codec* codec);
+
+/*
+ Returns the codec that loads data, NULL if there is none. width, height and channel_count may be NULL,
+ see lc_codec.probe; the built in codecs read them from the PNG header and the JPG frame header.
+*/
+const lc_codec* lc_probe_image_mem(unsigned long long size, const unsigned char* data,
+                                   int* width, int* height, int* channel_count);
+
+/*
+ Decodes into capacity bytes at pixels, as tightly packed rows. Returns 1 on success, 0 if the image
+ can't be decoded or does not fit; width, height and channel_count are set in both cases once the
+ image has been decoded. lc_probe_image_mem tells the size beforehand. options may be NULL.
+*/
+int lc_load_image_into(const char* file_name, unsigned char* pixels, unsigned long long capacity,
+                       int* width, int* height, int* channel_count, 
+                       int req_channel_count, const lc_load_options* options);
+
+int lc_load_image_mem_into(unsigned long long size, const unsigned char* data,
+                           unsigned char* pixels, unsigned long long capacity,
+                           int* width, int* height, int* channel_count, 
+                           int req_channel_count, const lc_load_options* options);
+
+/*
+ lc_image_io: pulls the bytes of an image on demand, for lc_load_image_io. read copies up to size
+ bytes to buffer and returns how many it copied, 0 at the end of the data or on an error.
+*/
+typedef struct lc_image_io {
+    unsigned long long (*read)(void* context, unsigned char* buffer, unsigned long long size);
+    void* context;
+} lc_image_io;
+
+/*
+ Decodes an image read through io, options may be NULL. JPGs are decoded from a window of the
+ stream; for PNGs only the chunks that are decoded are kept, as the image data has to be complete
+ before it is inflated.
+*/
+unsigned char* lc_load_image_io(const lc_image_io* io, 
+                                int* width, int* height, int* channel_count, 
+                                int req_channel_count, const lc_load_options* options);
+
+/* lc_image_segment: one piece of an image that is spread over several buffers */
+typedef struct lc_image_segment {
+    const unsigned char*    data;
+    unsigned long long      size;
+} lc_image_segment;
+
+/*
+ Decodes an image from segment_count buffers that hold its bytes in order, options may be NULL.
+ JPGs are decoded from the buffers in place; PNG chunks are gathered from them while parsing.
+*/
+unsigned char* lc_load_image_segments(int segment_count, const lc_image_segment* segments, 
+                                      int* width, int* height, int* channel_count, 
+                                      int req_channel_count, const lc_load_options* options);
+
+/*
+ High precision variants, options may be NULL. 16 bit PNGs keep all their bits, 8 bit sources are
+ scaled to the full range (v * 257). Float samples are in [0, 1] and can be passed straight to
+ lc_image_resize_float. Free the results with lc_free_image_16 and lc_free_image_float.
+*/
+unsigned short* lc_load_image_16(const char* file_name, 
+                                 int* width, int* height, int* channel_count, 
+                                 int req_channel_count, const lc_load_options* options);
+
+unsigned short* lc_load_image_16_mem(unsigned long long size, const unsigned char* data,
+                                     int* width, int* height, int* channel_count, 
+                                     int req_channel_count, const lc_load_options* options);
+
+float* lc_load_image_float(const char* file_name, 
+                           int* width, int* height, int* channel_count, 
+                           int req_channel_count, const lc_load_options* options);
+
+float* lc_load_image_float_mem(unsigned long long size, const unsigned char* data,
+                               int* width, int* height, int* channel_count, 
+                               int req_channel_count, const lc_load_options* options);
+
+void lc_free_image_16(unsigned short* data);
+
+void lc_free_image_float(float* data);
+
+#if defined(LC_IMAGE_RESIZE_H)
+/*
+ Loads an image resized to dst_width x dst_height, options may be NULL. Include lc_image_resize.h
+ first. One of dst_width and dst_height may be 0 to keep the aspect ratio of the image, width and
+ height receive the size of the result. Decoded rows are resized as they are produced, the full
+ size image is never built. JPGs are decoded at 1/2, 1/4 or 1/8 of their size first when that is
+ still at least the destination size.
+*/
+unsigned char* lc_load_image_resized(const char* file_name, int dst_width, int dst_height, lc_filter filter,
+                                     int* width, int* height, int* channel_count, 
+                                     int req_channel_count, const lc_load_options* options);
+
+unsigned char* lc_load_image_resized_mem(unsigned long long size, const unsigned char* data, 
+                                         int dst_width, int dst_height, lc_filter filter,
+                                         int* width, int* height, int* channel_count, 
+                                         int req_channel_count, const lc_load_options* options);
+#endif
+
+/* lc_batch_item: an image for lc_load_images_batch, read from file_name if not NULL, from data otherwise */
+typedef struct lc_batch_item {
+    const char*          file_name;
+    unsigned long long   size;
+    const unsigned char* data;
+} lc_batch_item;
+
+/*
+ lc_batch_fn: receives the image of items[index], pixels is NULL if it could not be loaded.
+ The callback owns pixels, free them with lc_free_image.
+*/
+typedef void (*lc_batch_fn)(void* context, int index, unsigned char* pixels, 
+                            int width, int height, int channel_count);
+
+/*
+ Loads count images on up to thread_count threads (the calling thread included), reading files ahead
+ of the threads that decode them. callback is called once per item in completion order, one call at
+ a time but from any of the threads. options may be NULL; its thread_count, peak_memory and cancelled
+ are not used, as every image is loaded by a single thread. cancel is polled by all threads. Returns the number of images loaded.
+*/
+int lc_load_images_batch(int count, const lc_batch_item* items, int req_channel_count, int thread_count,
+                         const lc_load_options* options, lc_batch_fn callback, void* context);
+
+/*
+ lc_write_options: optional settings for lc_write_png and lc_write_png_mem.
+ Call lc_write_options_init first so that fields added later keep their defaults.
+*/
+typedef struct lc_write_options {
+    int thread_count;   /* threads compressing horizontal bands, 0 or 1 compresses on the calling thread */
+} lc_write_options;
+
+void lc_write_options_init(lc_write_options* options);
+
+/*
+ Writes 8 bit PNGs with 1 (grey), 2 (grey alpha), 3 (RGB) or 4 (RGBA) channels from tightly packed
+ rows, options may be NULL. Compression favors speed over size. lc_write_png returns 1 on success,
+ lc_write_png_mem returns the PNG bytes, free them with lc_free_image.
+*/
+int lc_write_png(const char* file_name, 
+                 int width, int height, int channel_count, 
+                 const unsigned char* data, const lc_write_options* options);
+
+unsigned char* lc_write_png_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size,
+                                const lc_write_options* options);
+
+/*
+ lc_image_view: the pixels of an image from lc_map_image. Rows are row_stride bytes apart, which is
+ more than width * channel_count if the file pads its rows. The fields after zero_copy are private.
+*/
+typedef struct lc_image_view {
+    const unsigned char* pixels;
+    int                  width;
+    int                  height;
+    int                  channel_count;
+    long long            row_stride;
+    int                  zero_copy;     /* 1 if pixels point into the file (or data), 0 for a decoded copy */
+
+    unsigned char*       buffer;
+    unsigned char*       file_data;
+    unsigned long long   file_size;
+    int                  file_mapped;
+} lc_image_view;
+
+/*
+ Loads an image as a view, options may be NULL. Uncompressed PNM, BMP and TGA files whose rows are
+ stored top down in the requested channel order are not decoded: pixels point into the mapped file,
+ and loading costs only the page faults of reading them. Other files are decoded as by
+ lc_load_image_ex. Returns 1 on success, release the view with lc_unmap_image; the file must not be
+ truncated while it is mapped. lc_map_image_mem points into data, which must outlive the view.
+*/
+int lc_map_image(const char* file_name, lc_image_view* view,
+                 int req_channel_count, const lc_load_options* options);
+
+int lc_map_image_mem(unsigned long long size, const unsigned char* data, lc_image_view* view,
+                     int req_channel_count, const lc_load_options* options);
+
+void lc_unmap_image(lc_image_view* view);
+
+/*
+ Write uncompressed images from tightly packed 8 bit rows, for handing images to another stage
+ without compressing them. Rows are stored top down, so that lc_map_image can use them in place:
+ - lc_write_pnm: 1 channel as PGM, 3 as PPM, 2 and 4 as PAM, all load in place
+ - lc_write_bmp: 1 channel with a grey palette, 3 as BGR, 4 as RGBA bit fields; 1 and 4 load in place
+ - lc_write_tga: 1 channel, 2 as grey alpha, 3 as BGR, 4 as BGRA; 1 and 2 load in place
+ The file functions return 1 on success, the _mem functions return the file bytes, free them with
+ lc_free_image.
+*/
+int lc_write_pnm(const char* file_name, int width, int height, int channel_count, const unsigned char* data);
+
+unsigned char* lc_write_pnm_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size);
+
+int lc_write_bmp(const char* file_name, int width, int height, int channel_count, const unsigned char* data);
+
+unsigned char* lc_write_bmp_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size);
+
+int lc_write_tga(const char* file_name, int width, int height, int channel_count, const unsigned char* data);
+
+unsigned char* lc_write_tga_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size);
+
 #endif /* LC_IMAGE_H */
 
 /**************************************************************************************************/
@@ -126,6 +418,45 @@ void lc_free_image(unsigned char* data);
     #include <Windows.h>
 #elif defined(__linux__)
     #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #if defined(LC_IMAGE_IO_URING)
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+    #endif
+#endif
+
+#if defined(LC_IMAGE_IO_URING) && defined(__linux__)
+    #define LC_IMAGE_URING 1
+#else
+    #define LC_IMAGE_URING 0
+#endif
+
+#if ! defined(_WIN32)
+    #include <pthread.h>
+#endif
+
+#if defined(_MSC_VER)
+    #define LC_THREAD_LOCAL __declspec(thread)
+#else
+    #define LC_THREAD_LOCAL __thread
+#endif
+
+/* x86 SIMD paths are compiled in unless LC_IMAGE_NO_SIMD is defined, and picked at runtime */
+#if ! defined(LC_IMAGE_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+    #define LC_IMAGE_X86 1
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define LC_TARGET(features)
+    #else
+        #include <cpuid.h>
+        #define LC_TARGET(features) __attribute__((target(features)))
+    #endif
+    #include <immintrin.h>
+#else
+    #define LC_IMAGE_X86 0
 #endif
 
 #include <stdio.h>
@@ -141,1326 +472,4664 @@ void lc_free_image(unsigned char* data);
 #define lc_fseek    fseek
 #define lc_ftell    ftell
 #define lc_fread    fread
+#define lc_fwrite   fwrite
 
 typedef unsigned long long  lc_uint64_t;
 typedef unsigned char       lc_data_t;
 
-typedef enum lc_file_type {
-    LC_FILE_TYPE_UNKNOWN = 0,
-    LC_FILE_TYPE_PNG,
-    LC_FILE_TYPE_JPG
-} lc_file_type;
-
 static lc_data_t* lc_load_image_jpg(lc_uint64_t size, const lc_data_t* data,
                              int* width, int* height, int* channel_count, 
-                             int req_channel_count);
+                             int req_channel_count, const lc_load_options* options);
+
+static int lc_load_image_jpg_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options);
 
 static lc_data_t* lc_load_image_png(lc_uint64_t size, const lc_data_t* data,
                              int* width, int* height, int* channel_count, 
-                             int req_channel_count);
+                             int req_channel_count, const lc_load_options* options);
 
-/* lc_load_image */
-unsigned char* lc_load_image(const char* file_name, 
-                             int* width, int* height, 
-                             int* channel_count, 
-                             int req_channel_count)
+static unsigned short* lc_load_image_png_16(lc_uint64_t size, const lc_data_t* data,
+                                     int* width, int* height, int* channel_count, 
+                                     int req_channel_count, const lc_load_options* options);
+
+static int lc_probe_pnm(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count);
+static int lc_probe_bmp(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count);
+static int lc_probe_tga(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count);
+
+static lc_data_t* lc_load_image_pnm(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options);
+
+static lc_data_t* lc_load_image_bmp(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options);
+
+static lc_data_t* lc_load_image_tga(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options);
+
+static int lc_load_image_pnm_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options);
+
+static int lc_load_image_bmp_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options);
+
+static int lc_load_image_tga_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options);
+
+/* lc_stream: reads through an lc_image_io, after handing out the bytes already read into head */
+typedef struct lc_stream {
+    const lc_image_io*  io;
+    const lc_data_t*    head;
+    lc_uint64_t         head_size;
+    lc_uint64_t         head_pos;
+} lc_stream;
+
+/* lc_stream_read: reads up to size bytes, less only at the end of the data */
+static lc_uint64_t lc_stream_read(lc_stream* stream, lc_data_t* buffer, lc_uint64_t size)
 {
-    lc_uint64_t file_size = 0;
-#if defined(_WIN32)
-    {
-        HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 
-                                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (INVALID_HANDLE_VALUE == file_handle) {
-            return NULL;
+    lc_uint64_t done = LC_MATH_MIN(size, stream->head_size - stream->head_pos);
+    memcpy(buffer, stream->head + stream->head_pos, (size_t)done);
+    stream->head_pos += done;
+    while (done < size) {
+        lc_uint64_t bytes_read = stream->io->read(stream->io->context, buffer + done, size - done);
+        if (0 == bytes_read) {
+            break;
         }
+        done += LC_MATH_MIN(bytes_read, size - done);
+    }
+    return done;
+}
 
-        LARGE_INTEGER size;
-        if (! GetFileSizeEx(file_handle, &size)) {
-            CloseHandle(file_handle);
-            return NULL;
-        }
+/* lc_segment_reader: an lc_image_io context that reads a list of segments in order */
+typedef struct lc_segment_reader {
+    const lc_image_segment* segments;
+    int                     segment_count;
+    int                     index;
+    lc_uint64_t             offset;
+} lc_segment_reader;
 
-        CloseHandle(file_handle);
-        file_size = (lc_uint64_t)size.QuadPart;
-    }
-#elif defined(__linux__)
-    {
-        struct stat st;
-        if (-1 == stat(file_name, &st)) {
-            return NULL;
+/* lc_read_segments: lc_image_io read function for an lc_segment_reader */
+static unsigned long long lc_read_segments(void* context, unsigned char* buffer, unsigned long long size)
+{
+    lc_segment_reader* reader = (lc_segment_reader*)context;
+    lc_uint64_t done = 0;
+    while ((done < size) && (reader->index < reader->segment_count)) {
+        const lc_image_segment* segment = &reader->segments[reader->index];
+        lc_uint64_t part = LC_MATH_MIN(size - done, segment->size - reader->offset);
+        memcpy(buffer + done, segment->data + reader->offset, (size_t)part);
+        done += part;
+        reader->offset += part;
+        if (reader->offset >= segment->size) {
+            ++reader->index;
+            reader->offset = 0;
         }
-        file_size = (lc_uint64_t)st.st_size;
     }
-#else
-    {
-        FILE* file = lc_fopen(file_name, "rb");
-        if (NULL == file) {
-            return NULL;
-        }
+    return done;
+}
 
-        if (0 == lc_fseek(file, 0, SEEK_END)) {
-            return NULL;
+/* lc_read_stream_all: the rest of stream in one malloc'd buffer, for codecs that decode from memory */
+static lc_data_t* lc_read_stream_all(lc_stream* stream, lc_uint64_t size_hint, lc_uint64_t* size)
+{
+    lc_uint64_t capacity = LC_MATH_MAX(size_hint, (lc_uint64_t)65536);
+    lc_uint64_t used = 0;
+    lc_data_t* data = (lc_data_t*)malloc((size_t)capacity);
+    assert(NULL != data);
+    for (;;) {
+        lc_uint64_t bytes_read = lc_stream_read(stream, data + used, capacity - used);
+        used += bytes_read;
+        if (used < capacity) {
+            break;
         }
 
-        file_size = lc_ftell(file);
+        capacity *= 2;
+        data = (lc_data_t*)realloc(data, (size_t)capacity);
+        assert(NULL != data);
+    }
+    *size = used;
+    return data;
+}
 
-        lc_fclose(file);
+/* lc_load_image_stream_codec: loads stream with a codec that only decodes from memory */
+static lc_data_t* lc_load_image_stream_codec(const lc_codec* codec, lc_stream* stream, lc_uint64_t size_hint,
+                                             int* width, int* height, int* channel_count, 
+                                             int req_channel_count, const lc_load_options* options)
+{
+    lc_uint64_t size = 0;
+    lc_data_t* data = lc_read_stream_all(stream, size_hint, &size);
+    lc_data_t* result = codec->decode(size, data, width, height, channel_count, req_channel_count, options);
+    free(data);
+    data = NULL;
+    return result;
+}
+
+static lc_data_t* lc_load_image_jpg_stream(lc_stream* stream,
+                                           int* width, int* height, int* channel_count, 
+                                           int req_channel_count, const lc_load_options* options);
+
+static lc_data_t* lc_load_image_jpg_segments(int segment_count, const lc_image_segment* segments,
+                                             int* width, int* height, int* channel_count, 
+                                             int req_channel_count, const lc_load_options* options);
+
+/*
+ Reads the PNG in stream into memory, without the ancillary chunks that are not decoded and with
+ its IDAT chunks joined into one. size_hint is the expected size of the stream, or 0 if unknown.
+ Returns a lodepng error code, free *out with lodepng_free.
+*/
+static unsigned lc_png_read_stream(unsigned char** out, size_t* outsize, lc_stream* stream, 
+                                   size_t size_hint, unsigned check_crc);
+
+#if defined(LC_IMAGE_RESIZE_H)
+/* lc_resize_rows: receives the rows of a decoder for lc_load_image_resized */
+typedef struct lc_resize_rows {
+    int                 dst_width;
+    int                 dst_height;
+    lc_filter           filter;
+    int                 channel_count;
+    lc_data_t*          result;
+    lc_image_resizer*   resizer;
+} lc_resize_rows;
+
+/* lc_resize_rows_begin: called once the source size is known, before the first row */
+static void lc_resize_rows_begin(lc_resize_rows* rows, int src_width, int src_height, int channel_count)
+{
+    if ((rows->dst_width <= 0) && (rows->dst_height <= 0)) {
+        rows->dst_width = src_width;
+        rows->dst_height = src_height;
+    }
+    else if (rows->dst_width <= 0) {
+        rows->dst_width = LC_MATH_MAX((int)((lc_uint64_t)src_width * rows->dst_height / src_height), 1);
+    }
+    else if (rows->dst_height <= 0) {
+        rows->dst_height = LC_MATH_MAX((int)((lc_uint64_t)src_height * rows->dst_width / src_width), 1);
     }
-#endif
 
-    /* file too small to be meaningful */
-    if (file_size < 16) {
+    rows->channel_count = channel_count;
+    rows->result = (lc_data_t*)malloc((lc_uint64_t)rows->dst_width * rows->dst_height * channel_count);
+    assert(NULL != rows->result);
+
+    rows->resizer = lc_image_resizer_create_uint8(src_width, src_height, 
+                                                  rows->dst_width, rows->dst_height, (long long)rows->dst_width * channel_count, rows->result,
+                                                  (unsigned int)channel_count, rows->filter, NULL);
+}
+
+static lc_data_t* lc_load_image_jpg_resized(lc_uint64_t size, const lc_data_t* data,
+                                            int req_channel_count, const lc_load_options* options, lc_resize_rows* rows);
+
+static lc_data_t* lc_load_image_png_resized(lc_uint64_t size, const lc_data_t* data,
+                                            int req_channel_count, const lc_load_options* options, lc_resize_rows* rows);
+
+/* lc_load_image_codec_resized: for registered codecs, which only decode whole images */
+static lc_data_t* lc_load_image_codec_resized(const lc_codec* codec, lc_uint64_t size, const lc_data_t* data,
+                                              int req_channel_count, const lc_load_options* options, lc_resize_rows* rows)
+{
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    lc_data_t* src = codec->decode(size, data, &w, &h, &c, req_channel_count, options);
+    if (NULL == src) {
         return NULL;
     }
-    
-    FILE* file = lc_fopen(file_name, "rb");
-    if (NULL == file) {
-        return NULL;
+
+    lc_resize_rows_begin(rows, w, h, c);
+    for (int y = 0; y < h; ++y) {
+        lc_image_resizer_push_uint8(rows->resizer, src + (lc_uint64_t)y * w * c);
     }
 
-    lc_data_t* file_bytes = (lc_data_t*)calloc(file_size, sizeof(*file_bytes));
-    assert(NULL != file_bytes);
+    lc_image_resizer_destroy(rows->resizer);
+    rows->resizer = NULL;
+    free(src);
+    src = NULL;
 
-    lc_fread(file_bytes, sizeof(*file_bytes), file_size, file);
-    lc_fclose(file);       
+    return rows->result;
+}
+#endif
 
-    lc_data_t* result = lc_load_image_mem(file_size, file_bytes,
-                                          width, height, channel_count,
-                                          req_channel_count);
+/* returns 0 if holding that many bytes at once would exceed options->max_memory */
+static int lc_memory_fits(const lc_load_options* options, lc_uint64_t bytes)
+{
+    return ((0 == options->max_memory) || (bytes <= options->max_memory)) ? 1 : 0;
+}
 
-    free(file_bytes);
-    file_bytes = NULL;
+/*
+ Accounts for buffers the loaders hold next to the decoded image, returns 0 if they would
+ exceed options->max_memory.
+*/
+static int lc_memory_hold(const lc_load_options* options, lc_uint64_t bytes)
+{
+    if (NULL != options->peak_memory) {
+        *options->peak_memory = LC_MATH_MAX(*options->peak_memory, bytes);
+    }
 
-    return result;
+    return lc_memory_fits(options, bytes);
 }
 
-void lc_free_image(unsigned char* data)
+/**************************************************************************************************/
+/* Threads                                                                                        */
+/**************************************************************************************************/
+
+/* lc_task_fn: runs task number index, tasks of one lc_run_tasks call must not depend on each other */
+typedef void (*lc_task_fn)(void* context, int index);
+
+typedef struct lc_task_group {
+    lc_task_fn      fn;
+    void*           context;
+    int             count;
+    volatile long   next;
+} lc_task_group;
+
+#if defined(_WIN32)
+    typedef HANDLE lc_thread_t;
+    typedef CRITICAL_SECTION lc_mutex_t;
+    typedef INIT_ONCE lc_once_t;
+    #define LC_ONCE_INIT                INIT_ONCE_STATIC_INIT
+    #define lc_atomic_fetch_inc(p_value) (InterlockedIncrement(p_value) - 1)
+    #define lc_mutex_init(p_mutex)      InitializeCriticalSection(p_mutex)
+    #define lc_mutex_destroy(p_mutex)   DeleteCriticalSection(p_mutex)
+    #define lc_mutex_lock(p_mutex)      EnterCriticalSection(p_mutex)
+    #define lc_mutex_unlock(p_mutex)    LeaveCriticalSection(p_mutex)
+#else
+    typedef pthread_t lc_thread_t;
+    typedef pthread_mutex_t lc_mutex_t;
+    typedef pthread_once_t lc_once_t;
+    #define LC_ONCE_INIT                PTHREAD_ONCE_INIT
+    #define lc_atomic_fetch_inc(p_value) __sync_fetch_and_add(p_value, 1)
+    #define lc_mutex_init(p_mutex)      pthread_mutex_init(p_mutex, NULL)
+    #define lc_mutex_destroy(p_mutex)   pthread_mutex_destroy(p_mutex)
+    #define lc_mutex_lock(p_mutex)      pthread_mutex_lock(p_mutex)
+    #define lc_mutex_unlock(p_mutex)    pthread_mutex_unlock(p_mutex)
+#endif
+
+#if defined(_WIN32)
+static BOOL CALLBACK lc_once_thunk(PINIT_ONCE once, PVOID parameter, PVOID* context)
 {
-    if (NULL != data) {
-        free(data);
-        data = NULL;
-    }
+    (void)once;
+    (void)context;
+    ((void (*)(void))parameter)();
+    return TRUE;
 }
+#endif
 
-unsigned char* lc_load_image_mem(unsigned long long size, const unsigned char* data,
-                                 int* width, int* height, int* channel_count, 
-                                 int req_channel_count)
+/* lc_call_once: runs fn exactly once per flag, other callers wait until it has returned */
+static void lc_call_once(lc_once_t* flag, void (*fn)(void))
 {
-    /* determine file type */
-    lc_file_type file_type = LC_FILE_TYPE_UNKNOWN;
-    switch (data[0]) {
-        case 0x89: {
-            if (0 == strncmp((const char*)data, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 8)) {
-                file_type = LC_FILE_TYPE_PNG;
-            }
-        }
-        break;
-        case 0xFF: {
-            if (0 == strncmp((const char*)data, "\xFF\xD8\xFF", 3)) {
-                file_type = LC_FILE_TYPE_JPG;
-            }
+#if defined(_WIN32)
+    InitOnceExecuteOnce(flag, lc_once_thunk, (PVOID)fn, NULL);
+#else
+    pthread_once(flag, fn);
+#endif
+}
+
+static void lc_task_group_drain(lc_task_group* group)
+{
+    for (;;) {
+        int index = (int)lc_atomic_fetch_inc(&group->next);
+        if (index >= group->count) {
+            break;
         }
-        break;
-        default: break;
+        group->fn(group->context, index);
     }
-    assert(LC_FILE_TYPE_UNKNOWN != file_type);
+}
 
-    lc_data_t* result = NULL;
-    switch (file_type) {
-        case LC_FILE_TYPE_JPG: {
-            result = lc_load_image_jpg(size, data,
-                                       width, height, channel_count,
-                                       req_channel_count);
+#if defined(_WIN32)
+static DWORD WINAPI lc_task_thread_main(LPVOID arg)
+{
+    lc_task_group_drain((lc_task_group*)arg);
+    return 0;
+}
+#else
+static void* lc_task_thread_main(void* arg)
+{
+    lc_task_group_drain((lc_task_group*)arg);
+    return NULL;
+}
+#endif
+
+/*
+ lc_run_tasks: runs tasks [0..count-1] on up to thread_count threads and waits for all of them.
+ The calling thread takes part, so thread_count <= 1 runs everything inline. If a thread can't
+ be started its share of the work is picked up by the threads that did start.
+*/
+static void lc_run_tasks(int count, int thread_count, lc_task_fn fn, void* context)
+{
+    lc_task_group group;
+    group.fn = fn;
+    group.context = context;
+    group.count = count;
+    group.next = 0;
+
+    enum { k_max_threads = 64 };
+    lc_thread_t threads[k_max_threads];
+    int started = 0;
+    int wanted = LC_MATH_MIN(LC_MATH_MIN(thread_count, count), (int)k_max_threads) - 1;
+    for (int i = 0; i < wanted; ++i) {
+#if defined(_WIN32)
+        threads[started] = CreateThread(NULL, 0, lc_task_thread_main, &group, 0, NULL);
+        if (NULL == threads[started]) {
+            break;
         }
-        break;
-        case LC_FILE_TYPE_PNG: {
-            result = lc_load_image_png(size, data,
-                                       width, height, channel_count,
-                                       req_channel_count);
+#else
+        if (0 != pthread_create(&threads[started], NULL, lc_task_thread_main, &group)) {
+            break;
         }
-        break;
-        default: break;
+#endif
+        ++started;
     }
 
-    return result;
+    lc_task_group_drain(&group);
+
+    for (int i = 0; i < started; ++i) {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
 }
 
 /**************************************************************************************************/
-/* JPG                                                                                            */
+/* CPU features                                                                                   */
 /**************************************************************************************************/
+/* only the x86 SIMD paths ask for them */
+#if LC_IMAGE_X86
+enum {
+    LC_CPU_SSSE3    = 1 << 0,
+    LC_CPU_SSE41    = 1 << 1,
+    LC_CPU_PCLMUL   = 1 << 2,
+    LC_CPU_AVX2     = 1 << 3
+};
 
-/*
- INTRODUCTION
- ============
- 
- This is a minimal decoder for baseline JPEG images. It accepts memory dumps
- of JPEG files as input and generates either 8-bit grayscale or packed 24-bit
- RGB images as output. It does not parse JFIF or Exif headers; all JPEG files
- are assumed to be either grayscale or YCbCr. CMYK or other color spaces are
- not supported. All YCbCr subsampling schemes with power-of-two ratios are
- supported, as are restart intervals. Progressive or lossless JPEG is not
- supported.
- Summed up, NanoJPEG should be able to decode all images from digital cameras
- and most common forms of other non-progressive JPEG images.
- The decoder is not optimized for speed, it's optimized for simplicity and
- small code. Image quality should be at a reasonable level. A bicubic chroma
- upsampling filter ensures that subsampled YCbCr images are rendered in
- decent quality. The decoder is not meant to deal with broken JPEG files in
- a graceful manner; if anything is wrong with the bitstream, decoding will
- simply fail.
- The code should work with every modern C compiler without problems and
- should not emit any warnings. It uses only (at least) 32-bit integer
- arithmetic and is supposed to be endianness independent and 64-bit clean.
- However, it is not thread-safe.
+static int       lc_cpu_feature_bits = 0;
+static lc_once_t lc_cpu_features_once = LC_ONCE_INIT;
 
+static void lc_cpu_detect(void)
+{
+    int features = 0;
+    unsigned int regs[4] = {0, 0, 0, 0};
+    unsigned int regs7[4] = {0, 0, 0, 0};
+  #if defined(_MSC_VER)
+    __cpuid((int*)regs, 1);
+    __cpuidex((int*)regs7, 7, 0);
+  #else
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+    }
+  #endif
+    if (regs[2] & (1 << 9)) {
+        features |= LC_CPU_SSSE3;
+    }
+    if (regs[2] & (1 << 19)) {
+        features |= LC_CPU_SSE41;
+    }
+    if (regs[2] & (1 << 1)) {
+        features |= LC_CPU_PCLMUL;
+    }
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0) */
+    if ((regs[2] & (1 << 27)) && (regs7[1] & (1 << 5))) {
+  #if defined(_MSC_VER)
+        unsigned long long xcr0 = _xgetbv(0);
+  #else
+        unsigned int xcr0_lo = 0, xcr0_hi = 0;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        unsigned long long xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+  #endif
+        if (6 == (xcr0 & 6)) {
+            features |= LC_CPU_AVX2;
+        }
+    }
+    lc_cpu_feature_bits = features;
+}
 
- COMPILE-TIME CONFIGURATION
- ==========================
+/* lc_cpu_features: LC_CPU_* bits of the running CPU, detected once */
+static int lc_cpu_features(void)
+{
+    lc_call_once(&lc_cpu_features_once, lc_cpu_detect);
+    return lc_cpu_feature_bits;
+}
 
- The following aspects of NanoJPEG can be controlled with preprocessor
- defines:
+#define lc_cpu_has(feature) (0 != (lc_cpu_features() & (feature)))
+#endif /* LC_IMAGE_X86 */
 
- _NJ_EXAMPLE_PROGRAM     = Compile a main() function with an example
-                           program.
- _NJ_INCLUDE_HEADER_ONLY = Don't compile anything, just act as a header
-                           file for NanoJPEG. Example:
-                               #define _NJ_INCLUDE_HEADER_ONLY
-                               #include "nanojpeg.c"
-                               int main(void) {
-                                   njInit();
-                                   // your code here
-                                   njDone();
-                               }
- NJ_USE_LIBC=1           = Use the malloc(), free(), memset() and memcpy()
-                           functions from the standard C library (default).
- NJ_USE_LIBC=0           = Don't use the standard C library. In this mode,
-                           external functions njAlloc(), njFreeMem(),
-                           njFillMem() and njCopyMem() need to be defined
-                           and implemented somewhere.
- NJ_USE_WIN32=0          = Normal mode (default).
- NJ_USE_WIN32=1          = If compiling with MSVC for Win32 and
-                           NJ_USE_LIBC=0, NanoJPEG will use its own
-                           implementations of the required C library
-                           functions (default if compiling with MSVC and
-                           NJ_USE_LIBC=0).
- NJ_CHROMA_FILTER=1      = Use the bicubic chroma upsampling filter
-                           (default).
- NJ_CHROMA_FILTER=0      = Use simple pixel repetition for chroma upsampling
-                           (bad quality, but faster and less code).
-*/
+void lc_load_options_init(lc_load_options* options)
+{
+    if (NULL != options) {
+        options->thread_count = 0;
+        options->skip_checksums = 0;
+        options->preview = NULL;
+        options->preview_context = NULL;
+        options->max_memory = 0;
+        options->peak_memory = NULL;
+        options->cancel = NULL;
+        options->cancel_context = NULL;
+        options->cancelled = NULL;
+    }
+}
 
-/* CONFIGURATION SECTION - Adjust the default settings for the NJ_ defines here! */
-#ifndef NJ_USE_LIBC
-    #define NJ_USE_LIBC 1
-#endif
+/* lc_load_image */
+unsigned char* lc_load_image(const char* file_name, 
+                             int* width, int* height, 
+                             int* channel_count, 
+                             int req_channel_count)
+{
+    return lc_load_image_ex(file_name, width, height, channel_count, req_channel_count, NULL);
+}
 
-#ifndef NJ_USE_WIN32
-  #ifdef _MSC_VER
-    #define NJ_USE_WIN32 (!NJ_USE_LIBC)
-  #else
-    #define NJ_USE_WIN32 0
-  #endif
-#endif
+/**************************************************************************************************/
+/* Codecs                                                                                         */
+/**************************************************************************************************/
+#define LC_MAX_CODECS 16
 
-#ifndef NJ_CHROMA_FILTER
-    #define NJ_CHROMA_FILTER 1
-#endif
+/* the smallest input the loaders look at, a 1x1 PGM */
+#define LC_MIN_IMAGE_SIZE 12
 
-/* nj_result_t: Result codes for njDecode(). */
-typedef enum _nj_result {
-    NJ_OK = 0,        /* no error, decoding successful */
-    NJ_NO_JPEG,       /* not a JPEG file */
-    NJ_UNSUPPORTED,   /* unsupported format */
-    NJ_OUT_OF_MEM,    /* out of memory */
-    NJ_INTERNAL_ERR,  /* internal error */
-    NJ_SYNTAX_ERROR,  /* syntax error */
-    __NJ_FINISHED,    /* used internally, will never be reported */
-} nj_result_t;
+/* lc_set_probe_result */
+static int lc_set_probe_result(int* width, int* height, int* channel_count, int w, int h, int c)
+{
+    if (NULL != width) {
+        *width = w;
+    }
 
-/*
- njInit: Initialize NanoJPEG.
- For safety reasons, this should be called at least one time before using
- using any of the other NanoJPEG functions.
-*/
-static void njInit(void);
+    if (NULL != height) {
+        *height = h;
+    }
 
-/*
- njDecode: Decode a JPEG image.
- Decodes a memory dump of a JPEG file into internal buffers.
- Parameters:
-   jpeg = The pointer to the memory dump.
-   size = The size of the JPEG file.
- Return value: The error code in case of failure, or NJ_OK (zero) on success.
-*/
-static nj_result_t njDecode(const void* jpeg, const int size);
+    if (NULL != channel_count) {
+        *channel_count = c;
+    }
 
-/*
- njGetWidth: Return the width (in pixels) of the most recently decoded
- image. If njDecode() failed, the result of njGetWidth() is undefined.
-*/
-static int njGetWidth(void);
+    return 1;
+}
 
-/*
- njGetHeight: Return the height (in pixels) of the most recently decoded
- image. If njDecode() failed, the result of njGetHeight() is undefined.
-*/
-static int njGetHeight(void);
+/* lc_probe_png: the size is in IHDR, which has to be the first chunk */
+static int lc_probe_png(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count)
+{
+    if (size < 24) {
+        return lc_set_probe_result(width, height, channel_count, 0, 0, 4);
+    }
 
-/*
- njIsColor: Return 1 if the most recently decoded image is a color image
- (RGB) or 0 if it is a grayscale image. If njDecode() failed, the result
- of njGetWidth() is undefined.
-*/
-static int njIsColor(void);
+    lc_uint64_t w = ((lc_uint64_t)data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+    lc_uint64_t h = ((lc_uint64_t)data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+    w = (w > 0x7FFFFFFF) ? 0 : w;
+    h = (h > 0x7FFFFFFF) ? 0 : h;
+    return lc_set_probe_result(width, height, channel_count, (int)w, (int)h, 4);
+}
 
-/*
- njGetImage: Returns the decoded image data.
- Returns a pointer to the most recently image. The memory layout it byte-
- oriented, top-down, without any padding between lines. Pixels of color
- images will be stored as three consecutive bytes for the red, green and
- blue channels. This data format is thus compatible with the PGM or PPM
- file formats and the OpenGL texture formats GL_LUMINANCE8 or GL_RGB8.
- If njDecode() failed, the result of njGetImage() is undefined.
-*/
-static unsigned char* njGetImage(void);
+/* lc_probe_jpg: walks the marker segments up to the frame header */
+static int lc_probe_jpg(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count)
+{
+    lc_uint64_t pos = 2;
+    while ((pos + 4 <= size) && (0xFF == data[pos])) {
+        int marker = data[pos + 1];
+        if (0xFF == marker) {
+            ++pos;
+            continue;
+        }
 
-/*
- njGetImageSize: Returns the size (in bytes) of the image data returned
- by njGetImage(). If njDecode() failed, the result of njGetImageSize() is
- undefined.
-*/
-static int njGetImageSize(void);
+        /* SOF0..SOF15, except DHT, JPG and DAC which share the range */
+        int sof = (marker >= 0xC0) && (marker <= 0xCF) && (0xC4 != marker) && (0xC8 != marker) && (0xCC != marker);
+        if (sof && (pos + 10 <= size)) {
+            int h = (data[pos + 5] << 8) | data[pos + 6];
+            int w = (data[pos + 7] << 8) | data[pos + 8];
+            int c = (1 == data[pos + 9]) ? 1 : 3;
+            return lc_set_probe_result(width, height, channel_count, w, h, c);
+        }
 
-/*
- njDone: Uninitialize NanoJPEG.
- Resets NanoJPEG's internal state and frees all memory that has been
- allocated at run-time by NanoJPEG. It is still possible to decode another
- image after a njDone() call.
-*/
-static void njDone(void);
+        if (sof || (0xDA == marker) || (0xD9 == marker)) {
+            break;
+        }
+        pos += 2 + ((data[pos + 2] << 8) | data[pos + 3]);
+    }
 
-/* lc_load_image_jpg */
-static lc_data_t* lc_load_image_jpg(lc_uint64_t size, const lc_data_t* data,
-                                    int* width, int* height, int* channel_count, 
-                                    int req_channel_count)
+    return lc_set_probe_result(width, height, channel_count, 0, 0, 0);
+}
+
+static const lc_codec lc_codec_png = {
+    "png", (const unsigned char*)"\x89\x50\x4E\x47\x0D\x0A\x1A\x0A", 8, 
+    lc_probe_png, lc_load_image_png, NULL
+};
+
+static const lc_codec lc_codec_jpg = {
+    "jpg", (const unsigned char*)"\xFF\xD8\xFF", 3, 
+    lc_probe_jpg, lc_load_image_jpg, lc_load_image_jpg_into
+};
+
+static const lc_codec lc_codec_pnm = {
+    "pnm", (const unsigned char*)"P", 1, 
+    lc_probe_pnm, lc_load_image_pnm, lc_load_image_pnm_into
+};
+
+static const lc_codec lc_codec_bmp = {
+    "bmp", (const unsigned char*)"BM", 2, 
+    lc_probe_bmp, lc_load_image_bmp, lc_load_image_bmp_into
+};
+
+/* TGA has no signature, its probe only checks that the header is plausible */
+static const lc_codec lc_codec_tga = {
+    "tga", NULL, 0, 
+    lc_probe_tga, lc_load_image_tga, lc_load_image_tga_into
+};
+
+/* lc_codecs: searched from the back, so that codecs registered later come first and TGA comes last */
+static const lc_codec* lc_codecs[LC_MAX_CODECS] = { &lc_codec_tga, &lc_codec_png, &lc_codec_jpg, &lc_codec_pnm, &lc_codec_bmp };
+static int lc_codec_count = 5;
+
+int lc_register_codec(const lc_codec* codec)
 {
-    /* cap channel count to 4 max */
-    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    if ((NULL == codec) || (NULL == codec->decode) || (lc_codec_count >= LC_MAX_CODECS)) {
+        return 0;
+    }
 
-    njInit();
-    if (njDecode(data, (const int)size)) {
-        return NULL;
+    if ((codec->signature_size < 0) || (codec->signature_size > 16) || 
+        ((0 == codec->signature_size) && (NULL == codec->probe))) {
+        return 0;
     }
 
-    int w = njGetWidth();
-    int h = njGetHeight();
+    lc_codecs[lc_codec_count] = codec;
+    ++lc_codec_count;
 
-    int src_channel_count = njIsColor() ? 3 : 1;
-    int dst_channel_count = src_channel_count;
-    if (0 != req_channel_count) {
-        dst_channel_count = LC_MATH_MIN(req_channel_count, 4);
-    }
+    return 1;
+}
 
-    lc_uint64_t result_size = w * h * dst_channel_count;
-    lc_data_t* result = (lc_data_t*)calloc(result_size, sizeof(*result));
-    assert(NULL != result);
+/* lc_find_codec: the codec for the first size bytes of an image, width etc. as for lc_codec.probe */
+static const lc_codec* lc_find_codec(lc_uint64_t size, const lc_data_t* data, 
+                                     int* width, int* height, int* channel_count)
+{
+    if ((NULL == data) || (0 == size)) {
+        return NULL;
+    }
 
-    const lc_data_t* src_line = njGetImage();
-    lc_data_t* dst_line = result;
-    lc_uint64_t src_pixel_stride = src_channel_count;
-    lc_uint64_t dst_pixel_stride = dst_channel_count;
-    lc_uint64_t src_row_stride = w * src_pixel_stride;
-    lc_uint64_t dst_row_stride = w * dst_pixel_stride;
-    for (int y = 0; y < h; ++y) {
-        const lc_data_t* src_pixel = src_line;
-        lc_data_t* dst_pixel = dst_line;
-        for (int x = 0; x < w; ++x) {
-            int c = 0;
-            int nc = LC_MATH_MIN(src_channel_count, dst_channel_count);
-            for (; c < nc; ++c) {
-                *(dst_pixel + c) = *(src_pixel + c);
+    for (int i = lc_codec_count - 1; i >= 0; --i) {
+        const lc_codec* codec = lc_codecs[i];
+        if (codec->signature_size > 0) {
+            /* the first byte rules out most codecs without a call */
+            if ((size < (lc_uint64_t)codec->signature_size) || (codec->signature[0] != data[0]) || 
+                (0 != memcmp(codec->signature, data, (size_t)codec->signature_size))) {
+                continue;
             }
-            for (; c < dst_channel_count; ++c) {
-                *(dst_pixel + c) = (3 == c) ? 0xFF : 0x0;
-            }                
-            src_pixel += src_pixel_stride;
-            dst_pixel += dst_pixel_stride;
         }
-        src_line += src_row_stride;
-        dst_line += dst_row_stride;
-    }
 
-    if (NULL != width) {
-        *width = w;
-    }
+        if (NULL == codec->probe) {
+            lc_set_probe_result(width, height, channel_count, 0, 0, 0);
+            return codec;
+        }
 
-    if (NULL != height) {
-        *height = h;
+        if (codec->probe(size, data, width, height, channel_count)) {
+            return codec;
+        }
     }
 
-    if (NULL != channel_count) {
-        *channel_count = dst_channel_count;
-    }
+    return NULL;
+}
 
-    njDone();
-    
-    return result;
+const lc_codec* lc_probe_image_mem(unsigned long long size, const unsigned char* data,
+                                   int* width, int* height, int* channel_count)
+{
+    lc_set_probe_result(width, height, channel_count, 0, 0, 0);
+    return lc_find_codec(size, data, width, height, channel_count);
 }
 
-#ifdef _MSC_VER
-    #define NJ_INLINE static __inline
-    #define NJ_FORCE_INLINE static __forceinline
-#else
-    #define NJ_INLINE static inline
-    #define NJ_FORCE_INLINE static inline
-#endif
+/* lc_file_data: the bytes of a file, mapped or read into memory by lc_open_file_data */
+typedef struct lc_file_data {
+    lc_data_t*  data;
+    lc_uint64_t size;
+    int         mapped;
+} lc_file_data;
 
-#if NJ_USE_LIBC
-    #include <stdlib.h>
-    #include <string.h>
-    #define njAllocMem malloc
-    #define njFreeMem  free
-    #define njFillMem  memset
-    #define njCopyMem  memcpy
-#elif NJ_USE_WIN32
-    #include <windows.h>
-    #define njAllocMem(size) ((void*) LocalAlloc(LMEM_FIXED, (SIZE_T)(size)))
-    #define njFreeMem(block) ((void) LocalFree((HLOCAL) block))
-    NJ_INLINE void njFillMem(void* block, unsigned char value, int count) { __asm {
-        mov edi, block
-        mov al, value
-        mov ecx, count
-        rep stosb
-    } }
-    NJ_INLINE void njCopyMem(void* dest, const void* src, int count) { __asm {
-        mov edi, dest
-        mov esi, src
-        mov ecx, count
-        rep movsb
-    } }
+#if defined(__linux__)
+/* lc_read_fd: reads fd to the end, for pipes and files that can't be mapped */
+static lc_data_t* lc_read_fd(int fd, lc_uint64_t capacity, lc_uint64_t* size)
+{
+    lc_uint64_t file_size = 0;
+    capacity = LC_MATH_MAX(capacity, (lc_uint64_t)65536);
+    lc_data_t* file_bytes = (lc_data_t*)malloc(capacity);
+    assert(NULL != file_bytes);
+
+    for (;;) {
+        if (file_size == capacity) {
+            capacity *= 2;
+            file_bytes = (lc_data_t*)realloc(file_bytes, capacity);
+            assert(NULL != file_bytes);
+        }
+
+        ssize_t bytes_read = read(fd, file_bytes + file_size, (size_t)(capacity - file_size));
+        if (bytes_read > 0) {
+            file_size += (lc_uint64_t)bytes_read;
+        }
+        else if (0 == bytes_read) {
+            break;
+        }
+        else if (EINTR != errno) {
+            free(file_bytes);
+            return NULL;
+        }
+    }
+
+    *size = file_size;
+    return file_bytes;
+}
+#endif
+
+/*
+ lc_open_file_data: the whole file in memory, 0 if it can't be read or is too small to be an image.
+ On Linux regular files are mapped read only with sequential read ahead instead of being copied;
+ the file must not be truncated while it is being decoded. Release with lc_close_file_data.
+*/
+static int lc_open_file_data(const char* file_name, lc_file_data* file_data)
+{
+    lc_uint64_t file_size = 0;
+    lc_data_t* file_bytes = NULL;
+    file_data->data = NULL;
+    file_data->size = 0;
+    file_data->mapped = 0;
+#if defined(_WIN32)
+    {
+        HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, 
+                                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (INVALID_HANDLE_VALUE == file_handle) {
+            return 0;
+        }
+
+        LARGE_INTEGER large_size;
+        if (! GetFileSizeEx(file_handle, &large_size)) {
+            CloseHandle(file_handle);
+            return 0;
+        }
+
+        CloseHandle(file_handle);
+        file_size = (lc_uint64_t)large_size.QuadPart;
+    }
+#elif defined(__linux__)
+    {
+        int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+        if (-1 == fd) {
+            return 0;
+        }
+
+        struct stat st;
+        if (-1 == fstat(fd, &st)) {
+            close(fd);
+            return 0;
+        }
+
+        int regular = S_ISREG(st.st_mode) ? 1 : 0;
+        if (regular && (st.st_size < LC_MIN_IMAGE_SIZE)) {
+            close(fd);
+            return 0;
+        }
+
+        if (regular) {
+            void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED != mapping) {
+                madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+                close(fd);
+                file_data->data = (lc_data_t*)mapping;
+                file_data->size = (lc_uint64_t)st.st_size;
+                file_data->mapped = 1;
+                return 1;
+            }
+        }
+
+        /* pipes, sockets and files that can't be mapped are read */
+        file_bytes = lc_read_fd(fd, regular ? (lc_uint64_t)st.st_size : 0, &file_size);
+        close(fd);
+        if (NULL == file_bytes) {
+            return 0;
+        }
+
+        if (file_size < LC_MIN_IMAGE_SIZE) {
+            free(file_bytes);
+            return 0;
+        }
+
+        file_data->data = file_bytes;
+        file_data->size = file_size;
+        return 1;
+    }
 #else
-    extern void* njAllocMem(int size);
-    extern void njFreeMem(void* block);
-    extern void njFillMem(void* block, unsigned char byte, int size);
-    extern void njCopyMem(void* dest, const void* src, int size);
+    {
+        FILE* file = lc_fopen(file_name, "rb");
+        if (NULL == file) {
+            return 0;
+        }
+
+        if (0 != lc_fseek(file, 0, SEEK_END)) {
+            lc_fclose(file);
+            return 0;
+        }
+
+        file_size = lc_ftell(file);
+
+        lc_fclose(file);
+    }
 #endif
 
-typedef struct _nj_code {
-    unsigned char bits, code;
-} nj_vlc_code_t;
+    /* file too small to be meaningful */
+    if (file_size < LC_MIN_IMAGE_SIZE) {
+        return 0;
+    }
+    
+    FILE* file = lc_fopen(file_name, "rb");
+    if (NULL == file) {
+        return 0;
+    }
 
-typedef struct _nj_cmp {
-    int cid;
-    int ssx, ssy;
-    int width, height;
-    int stride;
-    int qtsel;
-    int actabsel, dctabsel;
-    int dcpred;
-    unsigned char *pixels;
-} nj_component_t;
+    file_bytes = (lc_data_t*)malloc(file_size * sizeof(*file_bytes));
+    assert(NULL != file_bytes);
 
-typedef struct _nj_ctx {
-    nj_result_t error;
-    const unsigned char *pos;
-    int size;
-    int length;
-    int width, height;
-    int mbwidth, mbheight;
-    int mbsizex, mbsizey;
-    int ncomp;
-    nj_component_t comp[3];
-    int qtused, qtavail;
-    unsigned char qtab[4][64];
-    nj_vlc_code_t vlctab[4][65536];
-    int buf, bufbits;
-    int block[64];
-    int rstinterval;
-    unsigned char *rgb;
-} nj_context_t;
+    lc_uint64_t bytes_read = lc_fread(file_bytes, sizeof(*file_bytes), file_size, file);
+    lc_fclose(file);       
+    if (bytes_read != file_size) {
+        free(file_bytes);
+        return 0;
+    }
 
-static nj_context_t nj;
+    file_data->data = file_bytes;
+    file_data->size = file_size;
+    return 1;
+}
 
-static const char njZZ[64] = { 0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18,
-11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35,
-42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45,
-38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+/* lc_close_file_data */
+static void lc_close_file_data(lc_file_data* file_data)
+{
+#if defined(__linux__)
+    if (file_data->mapped) {
+        munmap(file_data->data, (size_t)file_data->size);
+    }
+    else
+#endif
+    {
+        free(file_data->data);
+    }
+    file_data->data = NULL;
+    file_data->size = 0;
+}
 
-NJ_FORCE_INLINE unsigned char njClip(const int x) {
-    return (x < 0) ? 0 : ((x > 0xFF) ? 0xFF : (unsigned char) x);
+unsigned char* lc_load_image_ex(const char* file_name, 
+                                int* width, int* height, 
+                                int* channel_count, 
+                                int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if (! lc_open_file_data(file_name, &file_data)) {
+        return NULL;
+    }
+
+    lc_data_t* result = lc_load_image_mem_ex(file_data.size, file_data.data,
+                                             width, height, channel_count,
+                                             req_channel_count, options);
+
+    lc_close_file_data(&file_data);
+
+    return result;
 }
 
-#define W1 2841
-#define W2 2676
-#define W3 2408
-#define W5 1609
-#define W6 1108
-#define W7 565
+void lc_free_image(unsigned char* data)
+{
+    if (NULL != data) {
+        free(data);
+        data = NULL;
+    }
+}
 
-NJ_INLINE void njRowIDCT(int* blk) {
-    int x0, x1, x2, x3, x4, x5, x6, x7, x8;
-    if (!((x1 = blk[4] << 11)
-        | (x2 = blk[6])
-        | (x3 = blk[2])
-        | (x4 = blk[1])
-        | (x5 = blk[7])
-        | (x6 = blk[5])
-        | (x7 = blk[3])))
-    {
-        blk[0] = blk[1] = blk[2] = blk[3] = blk[4] = blk[5] = blk[6] = blk[7] = blk[0] << 3;
-        return;
+unsigned char* lc_load_image_mem(unsigned long long size, const unsigned char* data,
+                                 int* width, int* height, int* channel_count, 
+                                 int req_channel_count)
+{
+    return lc_load_image_mem_ex(size, data, width, height, channel_count, req_channel_count, NULL);
+}
+
+unsigned char* lc_load_image_mem_ex(unsigned long long size, const unsigned char* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
     }
-    x0 = (blk[0] << 11) + 128;
-    x8 = W7 * (x4 + x5);
-    x4 = x8 + (W1 - W7) * x4;
-    x5 = x8 - (W1 + W7) * x5;
-    x8 = W3 * (x6 + x7);
-    x6 = x8 - (W3 - W5) * x6;
-    x7 = x8 - (W3 + W5) * x7;
-    x8 = x0 + x1;
-    x0 -= x1;
-    x1 = W6 * (x3 + x2);
-    x2 = x1 - (W2 + W6) * x2;
-    x3 = x1 + (W2 - W6) * x3;
-    x1 = x4 + x6;
-    x4 -= x6;
-    x6 = x5 + x7;
-    x5 -= x7;
-    x7 = x8 + x3;
-    x8 -= x3;
-    x3 = x0 + x2;
-    x0 -= x2;
-    x2 = (181 * (x4 + x5) + 128) >> 8;
-    x4 = (181 * (x4 - x5) + 128) >> 8;
-    blk[0] = (x7 + x1) >> 8;
-    blk[1] = (x3 + x2) >> 8;
-    blk[2] = (x0 + x4) >> 8;
-    blk[3] = (x8 + x6) >> 8;
-    blk[4] = (x8 - x6) >> 8;
-    blk[5] = (x0 - x4) >> 8;
-    blk[6] = (x3 - x2) >> 8;
-    blk[7] = (x7 - x1) >> 8;
+
+    const lc_codec* codec = lc_find_codec(size, data, NULL, NULL, NULL);
+    if (NULL == codec) {
+        return NULL;
+    }
+
+    return codec->decode(size, data, width, height, channel_count, req_channel_count, options);
+}
+
+int lc_load_image_into(const char* file_name, unsigned char* pixels, unsigned long long capacity,
+                       int* width, int* height, int* channel_count, 
+                       int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if (! lc_open_file_data(file_name, &file_data)) {
+        return 0;
+    }
+
+    int result = lc_load_image_mem_into(file_data.size, file_data.data, pixels, capacity,
+                                        width, height, channel_count,
+                                        req_channel_count, options);
+
+    lc_close_file_data(&file_data);
+
+    return result;
+}
+
+int lc_load_image_mem_into(unsigned long long size, const unsigned char* data,
+                           unsigned char* pixels, unsigned long long capacity,
+                           int* width, int* height, int* channel_count, 
+                           int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
+
+    const lc_codec* codec = lc_find_codec(size, data, NULL, NULL, NULL);
+    if ((NULL == codec) || (NULL == pixels)) {
+        return 0;
+    }
+
+    if (NULL != codec->decode_into) {
+        return codec->decode_into(size, data, pixels, capacity,
+                                  width, height, channel_count,
+                                  req_channel_count, options);
+    }
+
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    lc_data_t* src = codec->decode(size, data, &w, &h, &c, req_channel_count, options);
+    if (NULL == src) {
+        return 0;
+    }
+
+    lc_uint64_t src_size = (lc_uint64_t)w * h * c;
+    int result = (src_size <= capacity) ? 1 : 0;
+    if (result) {
+        memcpy(pixels, src, (size_t)src_size);
+    }
+    free(src);
+    src = NULL;
+
+    lc_set_probe_result(width, height, channel_count, w, h, c);
+
+    return result;
+}
+
+unsigned char* lc_load_image_io(const lc_image_io* io, 
+                                int* width, int* height, int* channel_count, 
+                                int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
+
+    if ((NULL == io) || (NULL == io->read)) {
+        return NULL;
+    }
+
+    /* enough to tell the file type, handed out again by the stream */
+    lc_data_t head[16];
+    lc_stream stream;
+    stream.io = io;
+    stream.head = head;
+    stream.head_size = 0;
+    stream.head_pos = 0;
+    stream.head_size = lc_stream_read(&stream, head, sizeof(head));
+    stream.head_pos = 0;
+    if (stream.head_size < LC_MIN_IMAGE_SIZE) {
+        return NULL;
+    }
+
+    const lc_codec* codec = lc_find_codec(stream.head_size, head, NULL, NULL, NULL);
+    lc_data_t* result = NULL;
+    if (&lc_codec_jpg == codec) {
+        result = lc_load_image_jpg_stream(&stream,
+                                          width, height, channel_count,
+                                          req_channel_count, options);
+    }
+    else if (&lc_codec_png == codec) {
+        lc_data_t* png = NULL;
+        size_t png_size = 0;
+        if (0 == lc_png_read_stream(&png, &png_size, &stream, 0, options->skip_checksums ? 0 : 1)) {
+            result = lc_load_image_png(png_size, png,
+                                       width, height, channel_count,
+                                       req_channel_count, options);
+        }
+        free(png);
+        png = NULL;
+    }
+    else if (NULL != codec) {
+        result = lc_load_image_stream_codec(codec, &stream, 0,
+                                            width, height, channel_count,
+                                            req_channel_count, options);
+    }
+
+    return result;
+}
+
+unsigned char* lc_load_image_segments(int segment_count, const lc_image_segment* segments, 
+                                      int* width, int* height, int* channel_count, 
+                                      int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
+
+    if ((segment_count <= 0) || (NULL == segments)) {
+        return NULL;
+    }
+
+    if (1 == segment_count) {
+        return lc_load_image_mem_ex(segments[0].size, segments[0].data,
+                                    width, height, channel_count,
+                                    req_channel_count, options);
+    }
+
+    /* the magic bytes may be split over segments too */
+    lc_data_t head[16];
+    lc_segment_reader reader = { segments, segment_count, 0, 0 };
+    lc_uint64_t head_size = lc_read_segments(&reader, head, sizeof(head));
+    if (head_size < LC_MIN_IMAGE_SIZE) {
+        return NULL;
+    }
+
+    const lc_codec* codec = lc_find_codec(head_size, head, NULL, NULL, NULL);
+    if (NULL == codec) {
+        return NULL;
+    }
+
+    if (&lc_codec_jpg == codec) {
+        return lc_load_image_jpg_segments(segment_count, segments,
+                                          width, height, channel_count,
+                                          req_channel_count, options);
+    }
+
+    lc_uint64_t total_size = 0;
+    for (int i = 0; i < segment_count; ++i) {
+        total_size += segments[i].size;
+    }
+
+    lc_image_io io = { lc_read_segments, &reader };
+    lc_stream stream = { &io, head, head_size, 0 };
+    lc_data_t* result = NULL;
+    if (&lc_codec_png == codec) {
+        lc_data_t* png = NULL;
+        size_t png_size = 0;
+        if (0 == lc_png_read_stream(&png, &png_size, &stream, (size_t)total_size, options->skip_checksums ? 0 : 1)) {
+            result = lc_load_image_png(png_size, png,
+                                       width, height, channel_count,
+                                       req_channel_count, options);
+        }
+        free(png);
+        png = NULL;
+    }
+    else {
+        result = lc_load_image_stream_codec(codec, &stream, total_size,
+                                            width, height, channel_count,
+                                            req_channel_count, options);
+    }
+
+    return result;
+}
+
+#if defined(LC_IMAGE_RESIZE_H)
+unsigned char* lc_load_image_resized(const char* file_name, int dst_width, int dst_height, lc_filter filter,
+                                     int* width, int* height, int* channel_count, 
+                                     int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if (! lc_open_file_data(file_name, &file_data)) {
+        return NULL;
+    }
+
+    lc_data_t* result = lc_load_image_resized_mem(file_data.size, file_data.data,
+                                                  dst_width, dst_height, filter,
+                                                  width, height, channel_count,
+                                                  req_channel_count, options);
+
+    lc_close_file_data(&file_data);
+
+    return result;
+}
+
+unsigned char* lc_load_image_resized_mem(unsigned long long size, const unsigned char* data, 
+                                         int dst_width, int dst_height, lc_filter filter,
+                                         int* width, int* height, int* channel_count, 
+                                         int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
+
+    lc_resize_rows rows;
+    memset(&rows, 0, sizeof(rows));
+    rows.dst_width = dst_width;
+    rows.dst_height = dst_height;
+    rows.filter = filter;
+
+    const lc_codec* codec = lc_find_codec(size, data, NULL, NULL, NULL);
+    lc_data_t* result = NULL;
+    if (&lc_codec_jpg == codec) {
+        result = lc_load_image_jpg_resized(size, data, req_channel_count, options, &rows);
+    }
+    else if (&lc_codec_png == codec) {
+        result = lc_load_image_png_resized(size, data, req_channel_count, options, &rows);
+    }
+    else if (NULL != codec) {
+        result = lc_load_image_codec_resized(codec, size, data, req_channel_count, options, &rows);
+    }
+
+    if (NULL != result) {
+        if (NULL != width) {
+            *width = rows.dst_width;
+        }
+
+        if (NULL != height) {
+            *height = rows.dst_height;
+        }
+
+        if (NULL != channel_count) {
+            *channel_count = rows.channel_count;
+        }
+    }
+
+    return result;
+}
+#endif
+
+/**************************************************************************************************/
+/* Batch loading                                                                                  */
+/**************************************************************************************************/
+
+/* lc_prefetch_file: asks the OS to start reading file_name, so that it is cached when it is loaded */
+static void lc_prefetch_file(const char* file_name)
+{
+#if defined(__linux__)
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    if (-1 != fd) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#else
+    (void)file_name;
+#endif
+}
+
+typedef struct lc_batch {
+    const lc_batch_item*    items;
+    int                     count;
+    int                     req_channel_count;
+    int                     prefetch_distance;
+    lc_load_options         options;
+    lc_batch_fn             callback;
+    void*                   context;
+    lc_mutex_t              mutex;
+    int                     loaded;
+} lc_batch;
+
+/* lc_load_batch_item: loads items[index] from file_data if it was read already, hands it to the callback */
+static void lc_load_batch_item(lc_batch* batch, int index, const lc_file_data* file_data)
+{
+    const lc_batch_item* item = &batch->items[index];
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    lc_data_t* pixels = NULL;
+    lc_uint64_t size = item->size;
+    const lc_data_t* data = item->data;
+    if ((NULL != file_data) && (NULL != file_data->data)) {
+        size = file_data->size;
+        data = file_data->data;
+    }
+
+    if ((data == item->data) && (NULL != item->file_name)) {
+        pixels = lc_load_image_ex(item->file_name, &w, &h, &c, batch->req_channel_count, &batch->options);
+    }
+    else if ((NULL != data) && (NULL != lc_find_codec(size, data, NULL, NULL, NULL))) {
+        pixels = lc_load_image_mem_ex(size, data, &w, &h, &c, batch->req_channel_count, &batch->options);
+    }
+
+    lc_mutex_lock(&batch->mutex);
+    if (NULL != pixels) {
+        ++batch->loaded;
+    }
+    batch->callback(batch->context, index, pixels, w, h, c);
+    lc_mutex_unlock(&batch->mutex);
+}
+
+static void lc_load_images_batch_task(void* context, int index)
+{
+    lc_batch* batch = (lc_batch*)context;
+
+    /* tasks start in index order, so this keeps the reads prefetch_distance images ahead */
+    int prefetch_index = index + batch->prefetch_distance;
+    if ((prefetch_index < batch->count) && (NULL != batch->items[prefetch_index].file_name)) {
+        lc_prefetch_file(batch->items[prefetch_index].file_name);
+    }
+
+    lc_load_batch_item(batch, index, NULL);
+}
+
+#if LC_IMAGE_URING
+/*
+ lc_uring: a minimal io_uring through the raw system calls. Requests are submitted in stages of at
+ most sq_entries, each stage is waited for completely, so the completion queue can't overflow.
+*/
+typedef struct lc_uring {
+    int                     fd;
+    int                     failed;     /* io_uring_enter failed, nothing is submitted anymore */
+    int                     lost;       /* waiting failed too, submitted requests may still use their buffers */
+    unsigned                sq_entries;
+    unsigned                to_submit;
+    unsigned                in_flight;  /* submitted requests whose completion was not seen yet */
+    unsigned*               sq_tail;
+    unsigned*               sq_mask;
+    unsigned*               sq_array;
+    unsigned*               cq_head;
+    unsigned*               cq_tail;
+    unsigned*               cq_mask;
+    struct io_uring_sqe*    sqes;
+    struct io_uring_cqe*    cqes;
+    void*                   sq_ring;
+    size_t                  sq_ring_size;
+    void*                   cq_ring;
+    size_t                  cq_ring_size;
+    size_t                  sqes_size;
+} lc_uring;
+
+static void lc_uring_exit(lc_uring* ring)
+{
+    if (NULL != ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if ((NULL != ring->cq_ring) && (ring->cq_ring != ring->sq_ring)) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (NULL != ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (-1 != ring->fd) {
+        close(ring->fd);
+    }
+}
+
+/* lc_uring_init: returns 0 if the kernel has no io_uring or does not allow it */
+static int lc_uring_init(lc_uring* ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return 0;
+    }
+
+    ring->sq_entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_size = LC_MATH_MAX(ring->sq_ring_size, ring->cq_ring_size);
+    }
+
+    void* sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sq_ring) {
+        lc_uring_exit(ring);
+        return 0;
+    }
+    ring->sq_ring = sq_ring;
+
+    void* cq_ring = sq_ring;
+    if (0 == (params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                       ring->fd, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == cq_ring) {
+            lc_uring_exit(ring);
+            return 0;
+        }
+    }
+    ring->cq_ring = cq_ring;
+
+    void* sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                      ring->fd, IORING_OFF_SQES);
+    if (MAP_FAILED == sqes) {
+        lc_uring_exit(ring);
+        return 0;
+    }
+    ring->sqes = (struct io_uring_sqe*)sqes;
+
+    ring->sq_tail = (unsigned*)((char*)sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned*)((char*)cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)cq_ring + params.cq_off.cqes);
+    return 1;
+}
+
+/* lc_uring_push: queues a request, the caller must not queue more than sq_entries per stage */
+static void lc_uring_push(lc_uring* ring, unsigned char opcode, int fd, const void* addr, unsigned len, 
+                          lc_uint64_t off, unsigned flags, lc_uint64_t user_data)
+{
+    if (ring->failed) {
+        return;
+    }
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (lc_uint64_t)(size_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->open_flags = flags; /* shares its place with statx_flags */
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->to_submit;
+}
+
+/*
+ lc_uring_complete: submits the queued requests and calls fn for each of their completions. Returns 0
+ once io_uring_enter has failed with anything but EINTR, EAGAIN or EBUSY; the requests it had already
+ accepted are still waited for, so their buffers and fds are no longer used by the kernel when this
+ returns. If even waiting fails, ring->lost is set and the buffers must be leaked instead of freed.
+*/
+static int lc_uring_complete(lc_uring* ring, void (*fn)(void* context, lc_uint64_t user_data, int res), 
+                             void* context)
+{
+    while (((ring->to_submit > 0) && !ring->failed) || ((ring->in_flight > 0) && !ring->lost)) {
+        unsigned to_submit = ring->failed ? 0 : ring->to_submit;
+        int submitted = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, 
+                                     IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            /* EAGAIN and EBUSY pass once completions are reaped, which happens below */
+            if ((EINTR != errno) && (EAGAIN != errno) && (EBUSY != errno)) {
+                if (ring->failed) {
+                    ring->lost = 1;
+                }
+                ring->failed = 1;
+            }
+        }
+        unsigned accepted = (submitted > 0) ? LC_MATH_MIN((unsigned)submitted, to_submit) : 0;
+        ring->to_submit -= accepted;
+        ring->in_flight += accepted;
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            fn(context, cqe->user_data, cqe->res);
+            --ring->in_flight;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return ring->failed ? 0 : 1;
+}
+
+enum {
+    k_uring_window  = 32,   /* files read per stage, decoded while the next ones are read */
+    k_uring_entries = 64
+};
+
+/* lc_uring_files: reads of one window of batch items, file_data[i].data stays NULL for a failed read */
+typedef struct lc_uring_files {
+    lc_uring*       ring;
+    const lc_batch* batch;
+    int             first;
+    int             count;
+    int             fds[k_uring_window];
+    struct statx    stats[k_uring_window];
+    int             stat_ok[k_uring_window];
+    lc_uint64_t     done[k_uring_window];
+    int             failed[k_uring_window];
+    lc_file_data    file_data[k_uring_window];
+} lc_uring_files;
+
+enum { k_uring_open, k_uring_stat, k_uring_read, k_uring_close };
+
+static void lc_uring_file_done(void* context, lc_uint64_t user_data, int res)
+{
+    lc_uring_files* files = (lc_uring_files*)context;
+    int i = (int)(user_data >> 2);
+    switch ((int)(user_data & 3)) {
+        case k_uring_open: files->fds[i] = res; break;
+        case k_uring_stat: files->stat_ok[i] = (0 == res) ? 1 : 0; break;
+        case k_uring_close: {
+            /* a failed close (IORING_OP_CLOSE needs Linux 5.6) is redone with close() */
+            if (res >= 0) {
+                files->fds[i] = -1;
+            }
+        }
+        break;
+        case k_uring_read: {
+            if (res > 0) {
+                files->done[i] += (lc_uint64_t)res;
+            }
+            else {
+                files->failed[i] = 1;
+            }
+        }
+        break;
+        default: break;
+    }
+}
+
+/*
+ lc_uring_read_files: opens, stats and reads items [first, first + count) in three stages of
+ batched requests. Files that are not regular, are too small or fail on the way are left to
+ lc_load_image_ex, which also covers kernels that don't know one of the opcodes.
+*/
+static void lc_uring_read_files(lc_uring_files* files, int first, int count)
+{
+    lc_uring* ring = files->ring;
+    const lc_batch_item* items = files->batch->items;
+    files->first = first;
+    files->count = count;
+    for (int i = 0; i < count; ++i) {
+        files->fds[i] = -1;
+        files->stat_ok[i] = 0;
+        files->done[i] = 0;
+        files->failed[i] = 0;
+        files->file_data[i].data = NULL;
+        files->file_data[i].size = 0;
+        files->file_data[i].mapped = 0;
+        const char* file_name = items[first + i].file_name;
+        if (NULL != file_name) {
+            lc_uring_push(ring, IORING_OP_OPENAT, AT_FDCWD, file_name, 0, 0, O_RDONLY | O_CLOEXEC, 
+                          ((lc_uint64_t)i << 2) | k_uring_open);
+            lc_uring_push(ring, IORING_OP_STATX, AT_FDCWD, file_name, STATX_TYPE | STATX_SIZE, 
+                          (lc_uint64_t)(size_t)&files->stats[i], 0, ((lc_uint64_t)i << 2) | k_uring_stat);
+        }
+    }
+    lc_uring_complete(ring, lc_uring_file_done, files);
+
+    int reading = 0;
+    for (int i = 0; i < count; ++i) {
+        if ((files->fds[i] >= 0) && files->stat_ok[i] && S_ISREG(files->stats[i].stx_mode) && 
+            (files->stats[i].stx_size >= LC_MIN_IMAGE_SIZE)) {
+            files->file_data[i].size = files->stats[i].stx_size;
+            files->file_data[i].data = (lc_data_t*)malloc(files->file_data[i].size);
+            assert(NULL != files->file_data[i].data);
+            ++reading;
+        }
+    }
+
+    /* short reads are continued where they stopped */
+    while (reading > 0) {
+        for (int i = 0; i < count; ++i) {
+            lc_file_data* file_data = &files->file_data[i];
+            if ((NULL != file_data->data) && !files->failed[i] && (files->done[i] < file_data->size)) {
+                lc_uint64_t remaining = file_data->size - files->done[i];
+                lc_uring_push(ring, IORING_OP_READ, files->fds[i], file_data->data + files->done[i], 
+                              (unsigned)LC_MATH_MIN(remaining, (lc_uint64_t)0x7FFFF000), files->done[i], 0, 
+                              ((lc_uint64_t)i << 2) | k_uring_read);
+            }
+        }
+        int completed = lc_uring_complete(ring, lc_uring_file_done, files);
+
+        reading = 0;
+        for (int i = 0; i < count; ++i) {
+            lc_file_data* file_data = &files->file_data[i];
+            if ((NULL != file_data->data) && 
+                (!completed || files->failed[i] || (files->done[i] > file_data->size))) {
+                if (! ring->lost) {
+                    free(file_data->data);
+                }
+                file_data->data = NULL;
+            }
+            else if ((NULL != file_data->data) && (files->done[i] < file_data->size)) {
+                ++reading;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (files->fds[i] >= 0) {
+            lc_uring_push(ring, IORING_OP_CLOSE, files->fds[i], NULL, 0, 0, 0, 
+                          ((lc_uint64_t)i << 2) | k_uring_close);
+        }
+    }
+    lc_uring_complete(ring, lc_uring_file_done, files);
+
+    /* fds the ring did not close, unless a close of theirs may still be in flight */
+    for (int i = 0; i < count; ++i) {
+        if ((files->fds[i] >= 0) && !ring->lost) {
+            close(files->fds[i]);
+        }
+        files->fds[i] = -1;
+    }
+}
+
+typedef struct lc_uring_batch {
+    lc_batch*       batch;
+    lc_uring_files* current;
+    lc_uring_files* next;
+    int             next_first;
+    int             next_count;
+} lc_uring_batch;
+
+/* task 0 reads the next window, the others decode the current one */
+static void lc_uring_batch_task(void* context, int index)
+{
+    lc_uring_batch* uring_batch = (lc_uring_batch*)context;
+    if (0 == index) {
+        if (uring_batch->next_count > 0) {
+            lc_uring_read_files(uring_batch->next, uring_batch->next_first, uring_batch->next_count);
+        }
+        return;
+    }
+
+    lc_uring_files* files = uring_batch->current;
+    lc_file_data* file_data = &files->file_data[index - 1];
+    lc_load_batch_item(uring_batch->batch, files->first + index - 1, file_data);
+    lc_close_file_data(file_data);
+}
+
+/* lc_load_images_batch_uring: returns 0 without loading anything if io_uring can't be used */
+static int lc_load_images_batch_uring(lc_batch* batch, int thread_count)
+{
+    lc_uring ring;
+    if (! lc_uring_init(&ring, k_uring_entries)) {
+        return 0;
+    }
+
+    lc_uring_files* files = (lc_uring_files*)calloc(2, sizeof(*files));
+    assert(NULL != files);
+    files[0].ring = &ring;
+    files[0].batch = batch;
+    files[1].ring = &ring;
+    files[1].batch = batch;
+
+    lc_uring_batch uring_batch;
+    uring_batch.batch = batch;
+    uring_batch.current = &files[0];
+    uring_batch.next = &files[1];
+    lc_uring_read_files(uring_batch.current, 0, LC_MATH_MIN(batch->count, (int)k_uring_window));
+    while (uring_batch.current->count > 0) {
+        uring_batch.next_first = uring_batch.current->first + uring_batch.current->count;
+        uring_batch.next_count = LC_MATH_MIN(batch->count - uring_batch.next_first, (int)k_uring_window);
+        uring_batch.next->count = 0;
+        lc_run_tasks(uring_batch.current->count + 1, thread_count, lc_uring_batch_task, &uring_batch);
+
+        lc_uring_files* swap = uring_batch.current;
+        uring_batch.current = uring_batch.next;
+        uring_batch.next = swap;
+    }
+
+    /* the statx buffers of requests that may still run are leaked with files */
+    if (! ring.lost) {
+        free(files);
+    }
+    lc_uring_exit(&ring);
+    return 1;
+}
+#endif
+
+int lc_load_images_batch(int count, const lc_batch_item* items, int req_channel_count, int thread_count,
+                         const lc_load_options* options, lc_batch_fn callback, void* context)
+{
+    if ((count <= 0) || (NULL == items) || (NULL == callback)) {
+        return 0;
+    }
+
+    lc_batch batch;
+    batch.items = items;
+    batch.count = count;
+    batch.req_channel_count = req_channel_count;
+    batch.prefetch_distance = LC_MATH_MAX(thread_count, 1);
+    if (NULL != options) {
+        batch.options = *options;
+    }
+    else {
+        lc_load_options_init(&batch.options);
+    }
+    batch.options.thread_count = 0;
+    batch.options.peak_memory = NULL;
+    batch.options.cancelled = NULL;
+    batch.callback = callback;
+    batch.context = context;
+    batch.loaded = 0;
+    lc_mutex_init(&batch.mutex);
+
+#if LC_IMAGE_URING
+    if (lc_load_images_batch_uring(&batch, thread_count)) {
+        lc_mutex_destroy(&batch.mutex);
+        return batch.loaded;
+    }
+#endif
+
+    for (int i = 0; i < LC_MATH_MIN(batch.prefetch_distance, count); ++i) {
+        if (NULL != items[i].file_name) {
+            lc_prefetch_file(items[i].file_name);
+        }
+    }
+
+    lc_run_tasks(count, thread_count, lc_load_images_batch_task, &batch);
+
+    lc_mutex_destroy(&batch.mutex);
+    return batch.loaded;
+}
+
+/**************************************************************************************************/
+/* 16 bit and float output                                                                        */
+/**************************************************************************************************/
+
+#if LC_IMAGE_X86
+/* the SSSE3 kernels below return the number of samples done, the scalar loops do the rest */
+LC_TARGET("ssse3")
+static lc_uint64_t lc_swap_bytes_16_ssse3(unsigned short* dst, const lc_data_t* src, lc_uint64_t count)
+{
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    lc_uint64_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + 2 * i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, swap));
+    }
+    return i;
+}
+
+LC_TARGET("ssse3")
+static lc_uint64_t lc_widen_8_to_16_ssse3(unsigned short* dst, const lc_data_t* src, lc_uint64_t count)
+{
+    lc_uint64_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        /* v | (v << 8) is v * 257 */
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, v));
+    }
+    return i;
+}
+
+LC_TARGET("ssse3")
+static lc_uint64_t lc_convert_16_to_float_ssse3(float* dst, const unsigned short* src, lc_uint64_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+    lc_uint64_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+        _mm_storeu_ps(dst + i, _mm_mul_ps(lo, scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(hi, scale));
+    }
+    return i;
+}
+#endif
+
+/* lc_swap_bytes_16: big endian samples, as PNG stores them, to native unsigned shorts */
+static void lc_swap_bytes_16(unsigned short* dst, const lc_data_t* src, lc_uint64_t count)
+{
+    lc_uint64_t i = 0;
+#if LC_IMAGE_X86
+    if (lc_cpu_has(LC_CPU_SSSE3)) {
+        i = lc_swap_bytes_16_ssse3(dst, src, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = (unsigned short)((src[2 * i] << 8) | src[2 * i + 1]);
+    }
+}
+
+/* lc_widen_8_to_16: scales 8 bit samples to the full 16 bit range */
+static void lc_widen_8_to_16(unsigned short* dst, const lc_data_t* src, lc_uint64_t count)
+{
+    lc_uint64_t i = 0;
+#if LC_IMAGE_X86
+    if (lc_cpu_has(LC_CPU_SSSE3)) {
+        i = lc_widen_8_to_16_ssse3(dst, src, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = (unsigned short)(src[i] * 257);
+    }
+}
+
+/* lc_convert_16_to_float: maps 16 bit samples to [0, 1] */
+static void lc_convert_16_to_float(float* dst, const unsigned short* src, lc_uint64_t count)
+{
+    lc_uint64_t i = 0;
+#if LC_IMAGE_X86
+    if (lc_cpu_has(LC_CPU_SSSE3)) {
+        i = lc_convert_16_to_float_ssse3(dst, src, count);
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = (float)src[i] * (1.0f / 65535.0f);
+    }
+}
+
+unsigned short* lc_load_image_16(const char* file_name, 
+                                 int* width, int* height, int* channel_count, 
+                                 int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if (! lc_open_file_data(file_name, &file_data)) {
+        return NULL;
+    }
+
+    unsigned short* result = lc_load_image_16_mem(file_data.size, file_data.data,
+                                                  width, height, channel_count,
+                                                  req_channel_count, options);
+
+    lc_close_file_data(&file_data);
+
+    return result;
+}
+
+unsigned short* lc_load_image_16_mem(unsigned long long size, const unsigned char* data,
+                                     int* width, int* height, int* channel_count, 
+                                     int req_channel_count, const lc_load_options* options)
+{
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
+
+    const lc_codec* codec = lc_find_codec(size, data, NULL, NULL, NULL);
+    if (NULL == codec) {
+        return NULL;
+    }
+
+    if (&lc_codec_png == codec) {
+        return lc_load_image_png_16(size, data,
+                                    width, height, channel_count,
+                                    req_channel_count, options);
+    }
+
+    /* baseline JPG and registered codecs are 8 bit only */
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    lc_data_t* src = codec->decode(size, data, &w, &h, &c, req_channel_count, options);
+    if (NULL == src) {
+        return NULL;
+    }
+
+    lc_uint64_t count = (lc_uint64_t)w * h * c;
+    unsigned short* result = (unsigned short*)malloc(count * sizeof(*result));
+    assert(NULL != result);
+    lc_widen_8_to_16(result, src, count);
+
+    free(src);
+    src = NULL;
+
+    if (NULL != width) {
+        *width = w;
+    }
+
+    if (NULL != height) {
+        *height = h;
+    }
+
+    if (NULL != channel_count) {
+        *channel_count = c;
+    }
+
+    return result;
+}
+
+float* lc_load_image_float(const char* file_name, 
+                           int* width, int* height, int* channel_count, 
+                           int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if (! lc_open_file_data(file_name, &file_data)) {
+        return NULL;
+    }
+
+    float* result = lc_load_image_float_mem(file_data.size, file_data.data,
+                                            width, height, channel_count,
+                                            req_channel_count, options);
+
+    lc_close_file_data(&file_data);
+
+    return result;
+}
+
+float* lc_load_image_float_mem(unsigned long long size, const unsigned char* data,
+                               int* width, int* height, int* channel_count, 
+                               int req_channel_count, const lc_load_options* options)
+{
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    unsigned short* src = lc_load_image_16_mem(size, data, &w, &h, &c, req_channel_count, options);
+    if (NULL == src) {
+        return NULL;
+    }
+
+    lc_uint64_t count = (lc_uint64_t)w * h * c;
+    if ((NULL != options) && !lc_memory_hold(options, count * (sizeof(*src) + sizeof(float)))) {
+        free(src);
+        return NULL;
+    }
+
+    float* result = (float*)malloc(count * sizeof(*result));
+    assert(NULL != result);
+    lc_convert_16_to_float(result, src, count);
+
+    free(src);
+    src = NULL;
+
+    if (NULL != width) {
+        *width = w;
+    }
+
+    if (NULL != height) {
+        *height = h;
+    }
+
+    if (NULL != channel_count) {
+        *channel_count = c;
+    }
+
+    return result;
+}
+
+void lc_free_image_16(unsigned short* data)
+{
+    if (NULL != data) {
+        free(data);
+        data = NULL;
+    }
+}
+
+void lc_free_image_float(float* data)
+{
+    if (NULL != data) {
+        free(data);
+        data = NULL;
+    }
+}
+
+/**************************************************************************************************/
+/* JPG                                                                                            */
+/**************************************************************************************************/
+
+/*
+ INTRODUCTION
+ ============
+ 
+ This is a minimal decoder for baseline JPEG images. It accepts memory dumps
+ of JPEG files as input and generates either 8-bit grayscale or packed 24-bit
+ RGB images as output. It does not parse JFIF or Exif headers; all JPEG files
+ are assumed to be either grayscale or YCbCr. CMYK or other color spaces are
+ not supported. All YCbCr subsampling schemes with power-of-two ratios are
+ supported, as are restart intervals. Progressive or lossless JPEG is not
+ supported.
+ Summed up, NanoJPEG should be able to decode all images from digital cameras
+ and most common forms of other non-progressive JPEG images.
+ The decoder is not optimized for speed, it's optimized for simplicity and
+ small code. Image quality should be at a reasonable level. A bicubic chroma
+ upsampling filter ensures that subsampled YCbCr images are rendered in
+ decent quality. The decoder is not meant to deal with broken JPEG files in
+ a graceful manner; if anything is wrong with the bitstream, decoding will
+ simply fail.
+ The code should work with every modern C compiler without problems and
+ should not emit any warnings. It uses only (at least) 32-bit integer
+ arithmetic and is supposed to be endianness independent and 64-bit clean.
+ Each thread decodes with its own context, so decoding is thread-safe.
+
+
+ COMPILE-TIME CONFIGURATION
+ ==========================
+
+ The following aspects of NanoJPEG can be controlled with preprocessor
+ defines:
+
+ _NJ_EXAMPLE_PROGRAM     = Compile a main() function with an example
+                           program.
+ _NJ_INCLUDE_HEADER_ONLY = Don't compile anything, just act as a header
+                           file for NanoJPEG. Example:
+                               #define _NJ_INCLUDE_HEADER_ONLY
+                               #include "nanojpeg.c"
+                               int main(void) {
+                                   njInit();
+                                   // your code here
+                                   njDone();
+                               }
+ NJ_USE_LIBC=1           = Use the malloc(), free(), memset() and memcpy()
+                           functions from the standard C library (default).
+ NJ_USE_LIBC=0           = Don't use the standard C library. In this mode,
+                           external functions njAlloc(), njFreeMem(),
+                           njFillMem() and njCopyMem() need to be defined
+                           and implemented somewhere.
+ NJ_USE_WIN32=0          = Normal mode (default).
+ NJ_USE_WIN32=1          = If compiling with MSVC for Win32 and
+                           NJ_USE_LIBC=0, NanoJPEG will use its own
+                           implementations of the required C library
+                           functions (default if compiling with MSVC and
+                           NJ_USE_LIBC=0).
+ NJ_CHROMA_FILTER=1      = Use the bicubic chroma upsampling filter
+                           (default).
+ NJ_CHROMA_FILTER=0      = Use simple pixel repetition for chroma upsampling
+                           (bad quality, but faster and less code).
+*/
+
+/* CONFIGURATION SECTION - Adjust the default settings for the NJ_ defines here! */
+#ifndef NJ_USE_LIBC
+    #define NJ_USE_LIBC 1
+#endif
+
+#ifndef NJ_USE_WIN32
+  #ifdef _MSC_VER
+    #define NJ_USE_WIN32 (!NJ_USE_LIBC)
+  #else
+    #define NJ_USE_WIN32 0
+  #endif
+#endif
+
+#ifndef NJ_CHROMA_FILTER
+    #define NJ_CHROMA_FILTER 1
+#endif
+
+/* nj_result_t: Result codes for njDecode(). */
+typedef enum _nj_result {
+    NJ_OK = 0,        /* no error, decoding successful */
+    NJ_NO_JPEG,       /* not a JPEG file */
+    NJ_UNSUPPORTED,   /* unsupported format */
+    NJ_OUT_OF_MEM,    /* out of memory */
+    NJ_INTERNAL_ERR,  /* internal error */
+    NJ_SYNTAX_ERROR,  /* syntax error */
+    NJ_CANCELLED,     /* stopped by the callback given to njSetCancel() */
+    __NJ_FINISHED,    /* used internally, will never be reported */
+} nj_result_t;
+
+/*
+ njInit: Initialize NanoJPEG.
+ For safety reasons, this should be called at least one time before using
+ using any of the other NanoJPEG functions.
+ Returns NJ_OUT_OF_MEM if the context of this thread can't be allocated.
+*/
+static nj_result_t njInit(void);
+
+/*
+ njSetCancel: Set a callback for the decodes that follow on this thread.
+ cancel is called with context once per row of macroblocks; a non-zero
+ return stops the decode with NJ_CANCELLED. NULL removes the callback.
+*/
+static void njSetCancel(int (*cancel)(void* context), void* context);
+
+/*
+ njDecode: Decode a JPEG image.
+ Decodes a memory dump of a JPEG file into internal buffers.
+ Parameters:
+   jpeg = The pointer to the memory dump.
+   size = The size of the JPEG file.
+ Return value: The error code in case of failure, or NJ_OK (zero) on success.
+*/
+static nj_result_t njDecode(const void* jpeg, const long long size);
+
+/*
+ njDecodeStream: Decode a JPEG image that is read on demand.
+ Works like njDecode, but pulls the file through read, which copies up to
+ size bytes to buffer and returns how many it copied, 0 at the end of the
+ file. Only a window of the file is kept in memory: the current marker
+ segment or a chunk of entropy coded data.
+*/
+static nj_result_t njDecodeStream(int (*read)(void* context, unsigned char* buffer, int size), void* context);
+
+/*
+ njDecodeSegments: Decode a JPEG image that is split over several buffers.
+ Works like njDecode on the bytes of all segments in order. The segments
+ are read in place; only the few bytes that a marker segment or a bit
+ read needs across a segment boundary are copied.
+*/
+static nj_result_t njDecodeSegments(const lc_image_segment* segments, int count);
+
+#if defined(LC_IMAGE_RESIZE_H)
+/*
+ njDecodeRows: Decode a JPEG image to be read row by row with njGetRow().
+ The image is decoded at the smallest of 1/1, 1/2, 1/4 and 1/8 of its size
+ that is still at least min_width x min_height pixels (0 leaves a dimension
+ free); the reduced sizes skip most or all of the inverse DCT work.
+ njGetWidth() and njGetHeight() return the reduced size. The interleaved
+ image is not built, njGetImage() must not be used after this call.
+*/
+static nj_result_t njDecodeRows(const void* jpeg, const long long size, int min_width, int min_height);
+
+/*
+ njGetRow: Copy row y of an image decoded by njDecodeRows() to out, in the
+ format described for njGetImage(): njGetWidth() * (njIsColor() ? 3 : 1)
+ bytes.
+*/
+static void njGetRow(int y, unsigned char* out);
+#endif
+
+/*
+ njGetWidth: Return the width (in pixels) of the most recently decoded
+ image. If njDecode() failed, the result of njGetWidth() is undefined.
+*/
+static int njGetWidth(void);
+
+/*
+ njGetHeight: Return the height (in pixels) of the most recently decoded
+ image. If njDecode() failed, the result of njGetHeight() is undefined.
+*/
+static int njGetHeight(void);
+
+/*
+ njIsColor: Return 1 if the most recently decoded image is a color image
+ (RGB) or 0 if it is a grayscale image. If njDecode() failed, the result
+ of njGetWidth() is undefined.
+*/
+static int njIsColor(void);
+
+/*
+ njGetImage: Returns the decoded image data.
+ Returns a pointer to the most recently image. The memory layout it byte-
+ oriented, top-down, without any padding between lines. Pixels of color
+ images will be stored as three consecutive bytes for the red, green and
+ blue channels. This data format is thus compatible with the PGM or PPM
+ file formats and the OpenGL texture formats GL_LUMINANCE8 or GL_RGB8.
+ If njDecode() failed, the result of njGetImage() is undefined.
+*/
+static unsigned char* njGetImage(void);
+
+/*
+ njGetImageSize: Returns the size (in bytes) of the image data returned
+ by njGetImage(). If njDecode() failed, the result of njGetImageSize() is
+ undefined.
+*/
+static long long njGetImageSize(void);
+
+/*
+ njDone: Uninitialize NanoJPEG.
+ Resets NanoJPEG's internal state and frees all memory that has been
+ allocated at run-time by NanoJPEG. It is still possible to decode another
+ image after a njDone() call.
+*/
+static void njDone(void);
+
+/* lc_jpg_decoded: returns 1 if the NanoJPEG decode succeeded, otherwise ends it and reports a cancel */
+static int lc_jpg_decoded(const lc_load_options* options, nj_result_t result)
+{
+    njSetCancel(NULL, NULL);
+    if (NJ_OK == result) {
+        return 1;
+    }
+
+    if ((NJ_CANCELLED == result) && (NULL != options->cancelled)) {
+        *options->cancelled = 1;
+    }
+
+    njDone();
+    return 0;
+}
+
+/*
+ lc_take_image_jpg: the image NanoJPEG just decoded with req_channel_count channels, ends the decode.
+ Allocates the result if dst is NULL, else writes it to dst and returns NULL if it exceeds capacity.
+*/
+static lc_data_t* lc_take_image_jpg(lc_data_t* dst, lc_uint64_t capacity,
+                                    int* width, int* height, int* channel_count, int req_channel_count)
+{
+    /* cap channel count to 4 max */
+    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+
+    int w = njGetWidth();
+    int h = njGetHeight();
+
+    int src_channel_count = njIsColor() ? 3 : 1;
+    int dst_channel_count = src_channel_count;
+    if (0 != req_channel_count) {
+        dst_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    }
+
+    if (NULL != width) {
+        *width = w;
+    }
+
+    if (NULL != height) {
+        *height = h;
+    }
+
+    if (NULL != channel_count) {
+        *channel_count = dst_channel_count;
+    }
+
+    lc_uint64_t result_size = (lc_uint64_t)w * h * dst_channel_count;
+    lc_data_t* result = dst;
+    if (NULL == result) {
+        result = (lc_data_t*)calloc(result_size, sizeof(*result));
+        assert(NULL != result);
+    }
+    else if (result_size > capacity) {
+        njDone();
+        return NULL;
+    }
+
+    const lc_data_t* src_line = njGetImage();
+    lc_data_t* dst_line = result;
+    lc_uint64_t src_pixel_stride = src_channel_count;
+    lc_uint64_t dst_pixel_stride = dst_channel_count;
+    lc_uint64_t src_row_stride = w * src_pixel_stride;
+    lc_uint64_t dst_row_stride = w * dst_pixel_stride;
+    for (int y = 0; y < h; ++y) {
+        const lc_data_t* src_pixel = src_line;
+        lc_data_t* dst_pixel = dst_line;
+        for (int x = 0; x < w; ++x) {
+            int c = 0;
+            int nc = LC_MATH_MIN(src_channel_count, dst_channel_count);
+            for (; c < nc; ++c) {
+                *(dst_pixel + c) = *(src_pixel + c);
+            }
+            for (; c < dst_channel_count; ++c) {
+                *(dst_pixel + c) = (3 == c) ? 0xFF : 0x0;
+            }                
+            src_pixel += src_pixel_stride;
+            dst_pixel += dst_pixel_stride;
+        }
+        src_line += src_row_stride;
+        dst_line += dst_row_stride;
+    }
+
+    njDone();
+    
+    return result;
+}
+
+/* lc_load_image_jpg */
+static lc_data_t* lc_load_image_jpg(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
+{
+    njInit();
+    njSetCancel(options->cancel, options->cancel_context);
+    if (! lc_jpg_decoded(options, njDecode(data, (long long)size))) {
+        return NULL;
+    }
+
+    return lc_take_image_jpg(NULL, 0, width, height, channel_count, req_channel_count);
+}
+
+/* lc_load_image_jpg_into */
+static int lc_load_image_jpg_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options)
+{
+    njInit();
+    njSetCancel(options->cancel, options->cancel_context);
+    if (! lc_jpg_decoded(options, njDecode(data, (long long)size))) {
+        return 0;
+    }
+
+    return (NULL != lc_take_image_jpg(pixels, capacity, width, height, channel_count, req_channel_count)) ? 1 : 0;
+}
+
+static int lc_read_jpg_stream(void* context, unsigned char* buffer, int size)
+{
+    return (int)lc_stream_read((lc_stream*)context, buffer, (lc_uint64_t)size);
+}
+
+/* lc_load_image_jpg_stream */
+static lc_data_t* lc_load_image_jpg_stream(lc_stream* stream,
+                                           int* width, int* height, int* channel_count, 
+                                           int req_channel_count, const lc_load_options* options)
+{
+    njInit();
+    njSetCancel(options->cancel, options->cancel_context);
+    if (! lc_jpg_decoded(options, njDecodeStream(lc_read_jpg_stream, stream))) {
+        return NULL;
+    }
+
+    return lc_take_image_jpg(NULL, 0, width, height, channel_count, req_channel_count);
+}
+
+/* lc_load_image_jpg_segments */
+static lc_data_t* lc_load_image_jpg_segments(int segment_count, const lc_image_segment* segments,
+                                             int* width, int* height, int* channel_count, 
+                                             int req_channel_count, const lc_load_options* options)
+{
+    njInit();
+    njSetCancel(options->cancel, options->cancel_context);
+    if (! lc_jpg_decoded(options, njDecodeSegments(segments, segment_count))) {
+        return NULL;
+    }
+
+    return lc_take_image_jpg(NULL, 0, width, height, channel_count, req_channel_count);
+}
+
+#ifdef _MSC_VER
+    #define NJ_INLINE static __inline
+    #define NJ_FORCE_INLINE static __forceinline
+#else
+    #define NJ_INLINE static inline
+    #define NJ_FORCE_INLINE static inline
+#endif
+
+#if NJ_USE_LIBC
+    #include <stdlib.h>
+    #include <string.h>
+    #define njAllocMem malloc
+    #define njFreeMem  free
+    #define njFillMem  memset
+    #define njCopyMem  memcpy
+#elif NJ_USE_WIN32
+    #include <windows.h>
+    #define njAllocMem(size) ((void*) LocalAlloc(LMEM_FIXED, (SIZE_T)(size)))
+    #define njFreeMem(block) ((void) LocalFree((HLOCAL) block))
+    NJ_INLINE void njFillMem(void* block, unsigned char value, int count) { __asm {
+        mov edi, block
+        mov al, value
+        mov ecx, count
+        rep stosb
+    } }
+    NJ_INLINE void njCopyMem(void* dest, const void* src, int count) { __asm {
+        mov edi, dest
+        mov esi, src
+        mov ecx, count
+        rep movsb
+    } }
+#else
+    extern void* njAllocMem(size_t size);
+    extern void njFreeMem(void* block);
+    extern void njFillMem(void* block, unsigned char byte, int size);
+    extern void njCopyMem(void* dest, const void* src, int size);
+#endif
+
+typedef struct _nj_code {
+    unsigned char bits, code;
+} nj_vlc_code_t;
+
+typedef struct _nj_cmp {
+    int cid;
+    int ssx, ssy;
+    int width, height;
+    int stride;
+    int qtsel;
+    int actabsel, dctabsel;
+    int dcpred;
+    unsigned char *pixels;
+} nj_component_t;
+
+typedef struct _nj_ctx {
+    nj_result_t error;
+    const unsigned char *pos;
+    long long size;
+    int length;
+    int width, height;
+    int mbwidth, mbheight;
+    int mbsizex, mbsizey;
+    int ncomp;
+    nj_component_t comp[3];
+    int qtused, qtavail;
+    unsigned char qtab[4][64];
+    nj_vlc_code_t vlctab[4][65536];
+    int buf, bufbits;
+    int block[64];
+    int rstinterval;
+    unsigned char *rgb;
+    int (*read)(void* context, unsigned char* buffer, int size);
+    void* read_context;
+    unsigned char *stream;
+    int streamsize;
+    const lc_image_segment *segments;
+    int segcount, seg;
+    unsigned long long segoff;
+    int rows;                   /* decoding for njGetRow, no interleaved image */
+    int minwidth, minheight;    /* smallest size a reduced decode may have */
+    int scale;                  /* blocks are decoded to 8 >> scale pixels square */
+} nj_context_t;
+
+/* each thread decodes with its own context, allocated by njInit */
+static LC_THREAD_LOCAL nj_context_t* nj_current;
+#define nj (*nj_current)
+
+/* kept apart from the context, which every decode clears */
+static LC_THREAD_LOCAL int (*nj_cancel)(void* context);
+static LC_THREAD_LOCAL void* nj_cancel_context;
+
+static const char njZZ[64] = { 0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18,
+11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35,
+42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45,
+38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+NJ_FORCE_INLINE unsigned char njClip(const int x) {
+    return (x < 0) ? 0 : ((x > 0xFF) ? 0xFF : (unsigned char) x);
+}
+
+#define W1 2841
+#define W2 2676
+#define W3 2408
+#define W5 1609
+#define W6 1108
+#define W7 565
+
+NJ_INLINE void njRowIDCT(int* blk) {
+    int x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    if (!((x1 = blk[4] << 11)
+        | (x2 = blk[6])
+        | (x3 = blk[2])
+        | (x4 = blk[1])
+        | (x5 = blk[7])
+        | (x6 = blk[5])
+        | (x7 = blk[3])))
+    {
+        blk[0] = blk[1] = blk[2] = blk[3] = blk[4] = blk[5] = blk[6] = blk[7] = blk[0] << 3;
+        return;
+    }
+    x0 = (blk[0] << 11) + 128;
+    x8 = W7 * (x4 + x5);
+    x4 = x8 + (W1 - W7) * x4;
+    x5 = x8 - (W1 + W7) * x5;
+    x8 = W3 * (x6 + x7);
+    x6 = x8 - (W3 - W5) * x6;
+    x7 = x8 - (W3 + W5) * x7;
+    x8 = x0 + x1;
+    x0 -= x1;
+    x1 = W6 * (x3 + x2);
+    x2 = x1 - (W2 + W6) * x2;
+    x3 = x1 + (W2 - W6) * x3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = (181 * (x4 + x5) + 128) >> 8;
+    x4 = (181 * (x4 - x5) + 128) >> 8;
+    blk[0] = (x7 + x1) >> 8;
+    blk[1] = (x3 + x2) >> 8;
+    blk[2] = (x0 + x4) >> 8;
+    blk[3] = (x8 + x6) >> 8;
+    blk[4] = (x8 - x6) >> 8;
+    blk[5] = (x0 - x4) >> 8;
+    blk[6] = (x3 - x2) >> 8;
+    blk[7] = (x7 - x1) >> 8;
+}
+
+NJ_INLINE void njColIDCT(const int* blk, unsigned char *out, int stride) {
+    int x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    if (!((x1 = blk[8*4] << 8)
+        | (x2 = blk[8*6])
+        | (x3 = blk[8*2])
+        | (x4 = blk[8*1])
+        | (x5 = blk[8*7])
+        | (x6 = blk[8*5])
+        | (x7 = blk[8*3])))
+    {
+        x1 = njClip(((blk[0] + 32) >> 6) + 128);
+        for (x0 = 8;  x0;  --x0) {
+            *out = (unsigned char) x1;
+            out += stride;
+        }
+        return;
+    }
+    x0 = (blk[0] << 8) + 8192;
+    x8 = W7 * (x4 + x5) + 4;
+    x4 = (x8 + (W1 - W7) * x4) >> 3;
+    x5 = (x8 - (W1 + W7) * x5) >> 3;
+    x8 = W3 * (x6 + x7) + 4;
+    x6 = (x8 - (W3 - W5) * x6) >> 3;
+    x7 = (x8 - (W3 + W5) * x7) >> 3;
+    x8 = x0 + x1;
+    x0 -= x1;
+    x1 = W6 * (x3 + x2) + 4;
+    x2 = (x1 - (W2 + W6) * x2) >> 3;
+    x3 = (x1 + (W2 - W6) * x3) >> 3;
+    x1 = x4 + x6;
+    x4 -= x6;
+    x6 = x5 + x7;
+    x5 -= x7;
+    x7 = x8 + x3;
+    x8 -= x3;
+    x3 = x0 + x2;
+    x0 -= x2;
+    x2 = (181 * (x4 + x5) + 128) >> 8;
+    x4 = (181 * (x4 - x5) + 128) >> 8;
+    *out = njClip(((x7 + x1) >> 14) + 128);  out += stride;
+    *out = njClip(((x3 + x2) >> 14) + 128);  out += stride;
+    *out = njClip(((x0 + x4) >> 14) + 128);  out += stride;
+    *out = njClip(((x8 + x6) >> 14) + 128);  out += stride;
+    *out = njClip(((x8 - x6) >> 14) + 128);  out += stride;
+    *out = njClip(((x0 - x4) >> 14) + 128);  out += stride;
+    *out = njClip(((x3 - x2) >> 14) + 128);  out += stride;
+    *out = njClip(((x7 - x1) >> 14) + 128);
+}
+
+#define njThrow(e) do { nj.error = e; return; } while (0)
+#define njCheckError() do { if (nj.error) return; } while (0)
+
+#define NJ_STREAM_CHUNK 65536
+
+/* njSegmentPart: takes up to size bytes of the current segment, returns how many */
+static int njSegmentPart(const unsigned char **part, int size) {
+    unsigned long long rest;
+    while ((nj.seg < nj.segcount) && (nj.segoff >= nj.segments[nj.seg].size)) {
+        ++nj.seg;
+        nj.segoff = 0;
+    }
+    if (nj.seg >= nj.segcount) return 0;
+    rest = nj.segments[nj.seg].size - nj.segoff;
+    if ((unsigned long long) size > rest) size = (int) rest;
+    *part = nj.segments[nj.seg].data + nj.segoff;
+    nj.segoff += size;
+    return size;
+}
+
+/* njFill: when reading a stream or segments, makes at least count bytes available at nj.pos if the file has them */
+static void njFill(int count) {
+    int got;
+    const unsigned char *part;
+    if (nj.size >= count) return;
+    if (nj.size < 0) nj.size = 0;
+    if (nj.segments) {
+        /* the next segment is used in place, unless the bytes needed cross its end */
+        if (!nj.size) nj.size = njSegmentPart(&nj.pos, 0x40000000);
+        if (nj.size >= count) return;
+    } else if (!nj.read) return;
+    if (count + (nj.segments ? 0 : NJ_STREAM_CHUNK) > nj.streamsize) {
+        int streamsize = count + (nj.segments ? 0 : NJ_STREAM_CHUNK);
+        unsigned char *stream = (unsigned char*) njAllocMem(streamsize);
+        if (!stream) { nj.error = NJ_OUT_OF_MEM; return; }
+        if (nj.size) njCopyMem(stream, nj.pos, nj.size);
+        if (nj.stream) njFreeMem((void*) nj.stream);
+        nj.stream = stream;
+        nj.streamsize = streamsize;
+    } else if (nj.size && (nj.pos != nj.stream))
+        memmove(nj.stream, nj.pos, nj.size);
+    nj.pos = nj.stream;
+    while (nj.size < count) {
+        if (nj.segments) {
+            got = njSegmentPart(&part, count - nj.size);
+            if (got) njCopyMem(nj.stream + nj.size, part, got);
+        } else
+            got = nj.read(nj.read_context, nj.stream + nj.size, nj.streamsize - nj.size);
+        if (got <= 0) { nj.read = 0; break; }
+        nj.size += got;
+    }
+}
+
+static int njShowBits(int bits) {
+    unsigned char newbyte;
+    if (!bits) return 0;
+    while (nj.bufbits < bits) {
+        if (nj.size <= 0) njFill(1);
+        if (nj.size <= 0) {
+            nj.buf = (nj.buf << 8) | 0xFF;
+            nj.bufbits += 8;
+            continue;
+        }
+        newbyte = *nj.pos++;
+        nj.size--;
+        nj.bufbits += 8;
+        nj.buf = (nj.buf << 8) | newbyte;
+        if (newbyte == 0xFF) {
+            if (!nj.size) njFill(1);
+            if (nj.size) {
+                unsigned char marker = *nj.pos++;
+                nj.size--;
+                switch (marker) {
+                    case 0x00:
+                    case 0xFF:
+                        break;
+                    case 0xD9: nj.size = 0; nj.read = 0; nj.segcount = 0; break;
+                    default:
+                        if ((marker & 0xF8) != 0xD0)
+                            nj.error = NJ_SYNTAX_ERROR;
+                        else {
+                            nj.buf = (nj.buf << 8) | marker;
+                            nj.bufbits += 8;
+                        }
+                }
+            } else
+                nj.error = NJ_SYNTAX_ERROR;
+        }
+    }
+    return (nj.buf >> (nj.bufbits - bits)) & ((1 << bits) - 1);
+}
+
+NJ_INLINE void njSkipBits(int bits) {
+    if (nj.bufbits < bits)
+        (void) njShowBits(bits);
+    nj.bufbits -= bits;
+}
+
+NJ_INLINE int njGetBits(int bits) {
+    int res = njShowBits(bits);
+    njSkipBits(bits);
+    return res;
+}
+
+NJ_INLINE void njByteAlign(void) {
+    nj.bufbits &= 0xF8;
+}
+
+static void njSkip(int count) {
+    nj.pos += count;
+    nj.size -= count;
+    nj.length -= count;
+    if (nj.size < 0) nj.error = NJ_SYNTAX_ERROR;
+}
+
+NJ_INLINE unsigned short njDecode16(const unsigned char *pos) {
+    return (pos[0] << 8) | pos[1];
+}
+
+static void njDecodeLength(void) {
+    njFill(2);
+    if (nj.size < 2) njThrow(NJ_SYNTAX_ERROR);
+    nj.length = njDecode16(nj.pos);
+    njFill(nj.length);
+    if (nj.length > nj.size) njThrow(NJ_SYNTAX_ERROR);
+    njSkip(2);
+}
+
+NJ_INLINE void njSkipMarker(void) {
+    njDecodeLength();
+    njSkip(nj.length);
+}
+
+NJ_INLINE void njDecodeSOF(void) {
+    int i, ssxmax = 0, ssymax = 0;
+    nj_component_t* c;
+    njDecodeLength();
+    njCheckError();
+    if (nj.length < 9) njThrow(NJ_SYNTAX_ERROR);
+    if (nj.pos[0] != 8) njThrow(NJ_UNSUPPORTED);
+    nj.height = njDecode16(nj.pos+1);
+    nj.width = njDecode16(nj.pos+3);
+    if (!nj.width || !nj.height) njThrow(NJ_SYNTAX_ERROR);
+    nj.ncomp = nj.pos[5];
+    njSkip(6);
+    switch (nj.ncomp) {
+        case 1:
+        case 3:
+            break;
+        default:
+            njThrow(NJ_UNSUPPORTED);
+    }
+    if (nj.length < (nj.ncomp * 3)) njThrow(NJ_SYNTAX_ERROR);
+    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
+        c->cid = nj.pos[0];
+        if (!(c->ssx = nj.pos[1] >> 4)) njThrow(NJ_SYNTAX_ERROR);
+        if (c->ssx & (c->ssx - 1)) njThrow(NJ_UNSUPPORTED);  /* non-power of two */
+        if (!(c->ssy = nj.pos[1] & 15)) njThrow(NJ_SYNTAX_ERROR);
+        if (c->ssy & (c->ssy - 1)) njThrow(NJ_UNSUPPORTED);  /* non-power of two */
+        if ((c->qtsel = nj.pos[2]) & 0xFC) njThrow(NJ_SYNTAX_ERROR);
+        njSkip(3);
+        nj.qtused |= 1 << c->qtsel;
+        if (c->ssx > ssxmax) ssxmax = c->ssx;
+        if (c->ssy > ssymax) ssymax = c->ssy;
+    }
+    if (nj.ncomp == 1) {
+        c = nj.comp;
+        c->ssx = c->ssy = ssxmax = ssymax = 1;
+    }
+    nj.mbsizex = ssxmax << 3;
+    nj.mbsizey = ssymax << 3;
+    nj.mbwidth = (nj.width + nj.mbsizex - 1) / nj.mbsizex;
+    nj.mbheight = (nj.height + nj.mbsizey - 1) / nj.mbsizey;
+    if (nj.rows) {
+        /* halve while the image stays large enough, and its chroma planes can still be upsampled */
+        while (nj.scale < 3) {
+            int w = (nj.width + (2 << nj.scale) - 1) >> (nj.scale + 1);
+            int h = (nj.height + (2 << nj.scale) - 1) >> (nj.scale + 1);
+            if ((w < nj.minwidth) || (h < nj.minheight) || (w < 16) || (h < 16)) break;
+            ++nj.scale;
+        }
+        nj.width = (nj.width + (1 << nj.scale) - 1) >> nj.scale;
+        nj.height = (nj.height + (1 << nj.scale) - 1) >> nj.scale;
+    }
+    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
+        c->width = (nj.width * c->ssx + ssxmax - 1) / ssxmax;
+        c->height = (nj.height * c->ssy + ssymax - 1) / ssymax;
+        c->stride = (nj.mbwidth * c->ssx << 3) >> nj.scale;
+        if (((c->width < 3) && (c->ssx != ssxmax)) || ((c->height < 3) && (c->ssy != ssymax))) njThrow(NJ_UNSUPPORTED);
+        if (!(c->pixels = (unsigned char*) njAllocMem(((size_t)c->stride * nj.mbheight * c->ssy << 3) >> nj.scale))) njThrow(NJ_OUT_OF_MEM);
+    }
+    if ((nj.ncomp == 3) && !nj.rows) {
+        nj.rgb = (unsigned char*) njAllocMem((size_t)nj.width * nj.height * nj.ncomp);
+        if (!nj.rgb) njThrow(NJ_OUT_OF_MEM);
+    }
+    njSkip(nj.length);
+}
+
+NJ_INLINE void njDecodeDHT(void) {
+    int codelen, currcnt, remain, spread, i, j;
+    nj_vlc_code_t *vlc;
+    unsigned char counts[16];
+    njDecodeLength();
+    njCheckError();
+    while (nj.length >= 17) {
+        i = nj.pos[0];
+        if (i & 0xEC) njThrow(NJ_SYNTAX_ERROR);
+        if (i & 0x02) njThrow(NJ_UNSUPPORTED);
+        i = (i | (i >> 3)) & 3;  /* combined DC/AC + tableid value */
+        for (codelen = 1;  codelen <= 16;  ++codelen)
+            counts[codelen - 1] = nj.pos[codelen];
+        njSkip(17);
+        vlc = &nj.vlctab[i][0];
+        remain = spread = 65536;
+        for (codelen = 1;  codelen <= 16;  ++codelen) {
+            spread >>= 1;
+            currcnt = counts[codelen - 1];
+            if (!currcnt) continue;
+            if (nj.length < currcnt) njThrow(NJ_SYNTAX_ERROR);
+            remain -= currcnt << (16 - codelen);
+            if (remain < 0) njThrow(NJ_SYNTAX_ERROR);
+            for (i = 0;  i < currcnt;  ++i) {
+                // NOTE: Clang warns that register is deprecated
+                //register unsigned char code = nj.pos[i];
+                unsigned char code = nj.pos[i];
+                for (j = spread;  j;  --j) {
+                    vlc->bits = (unsigned char) codelen;
+                    vlc->code = code;
+                    ++vlc;
+                }
+            }
+            njSkip(currcnt);
+        }
+        while (remain--) {
+            vlc->bits = 0;
+            ++vlc;
+        }
+    }
+    if (nj.length) njThrow(NJ_SYNTAX_ERROR);
+}
+
+NJ_INLINE void njDecodeDQT(void) {
+    int i;
+    unsigned char *t;
+    njDecodeLength();
+    njCheckError();
+    while (nj.length >= 65) {
+        i = nj.pos[0];
+        if (i & 0xFC) njThrow(NJ_SYNTAX_ERROR);
+        nj.qtavail |= 1 << i;
+        t = &nj.qtab[i][0];
+        for (i = 0;  i < 64;  ++i)
+            t[i] = nj.pos[i + 1];
+        njSkip(65);
+    }
+    if (nj.length) njThrow(NJ_SYNTAX_ERROR);
+}
+
+NJ_INLINE void njDecodeDRI(void) {
+    njDecodeLength();
+    njCheckError();
+    if (nj.length < 2) njThrow(NJ_SYNTAX_ERROR);
+    nj.rstinterval = njDecode16(nj.pos);
+    njSkip(nj.length);
+}
+
+static int njGetVLC(nj_vlc_code_t* vlc, unsigned char* code) {
+    int value = njShowBits(16);
+    int bits = vlc[value].bits;
+    if (!bits) { nj.error = NJ_SYNTAX_ERROR; return 0; }
+    njSkipBits(bits);
+    value = vlc[value].code;
+    if (code) *code = (unsigned char) value;
+    bits = value & 15;
+    if (!bits) return 0;
+    value = njGetBits(bits);
+    if (value < (1 << (bits - 1)))
+        value += ((-1) << bits) + 1;
+    return value;
+}
+
+/* njScaledIDCT: the block in nj.block reduced to (8 >> nj.scale) pixels square */
+NJ_INLINE void njScaledIDCT(unsigned char *out, int stride) {
+    unsigned char full[64];
+    const int size = 8 >> nj.scale, shift = nj.scale << 1;
+    int coef, x, y, i, j, sum;
+    if (nj.scale == 3) {
+        /* the mean of the block is its DC coefficient, as the full IDCT would round it */
+        *out = njClip(((nj.block[0] + 4) >> 3) + 128);
+        return;
+    }
+    for (coef = 0;  coef < 64;  coef += 8)
+        njRowIDCT(&nj.block[coef]);
+    for (coef = 0;  coef < 8;  ++coef)
+        njColIDCT(&nj.block[coef], &full[coef], 8);
+    for (y = 0;  y < size;  ++y, out += stride)
+        for (x = 0;  x < size;  ++x) {
+            sum = 1 << (shift - 1);
+            for (j = 0;  j < (1 << nj.scale);  ++j)
+                for (i = 0;  i < (1 << nj.scale);  ++i)
+                    sum += full[(((y << nj.scale) + j) << 3) + (x << nj.scale) + i];
+            out[x] = (unsigned char) (sum >> shift);
+        }
+}
+
+NJ_INLINE void njDecodeBlock(nj_component_t* c, unsigned char* out) {
+    unsigned char code = 0;
+    int value, coef = 0;
+    njFillMem(nj.block, 0, sizeof(nj.block));
+    c->dcpred += njGetVLC(&nj.vlctab[c->dctabsel][0], NULL);
+    nj.block[0] = (c->dcpred) * nj.qtab[c->qtsel][0];
+    do {
+        value = njGetVLC(&nj.vlctab[c->actabsel][0], &code);
+        if (!code) break;  /* EOB */
+        if (!(code & 0x0F) && (code != 0xF0)) njThrow(NJ_SYNTAX_ERROR);
+        coef += (code >> 4) + 1;
+        if (coef > 63) njThrow(NJ_SYNTAX_ERROR);
+        nj.block[(int) njZZ[coef]] = value * nj.qtab[c->qtsel][coef];
+    } while (coef < 63);
+    if (nj.scale) {
+        njScaledIDCT(out, c->stride);
+        return;
+    }
+    for (coef = 0;  coef < 64;  coef += 8)
+        njRowIDCT(&nj.block[coef]);
+    for (coef = 0;  coef < 8;  ++coef)
+        njColIDCT(&nj.block[coef], &out[coef], c->stride);
+}
+
+NJ_INLINE void njDecodeScan(void) {
+    int i, mbx, mby, sbx, sby;
+    int rstcount = nj.rstinterval, nextrst = 0;
+    nj_component_t* c;
+    njDecodeLength();
+    njCheckError();
+    if (nj.length < (4 + 2 * nj.ncomp)) njThrow(NJ_SYNTAX_ERROR);
+    if (nj.pos[0] != nj.ncomp) njThrow(NJ_UNSUPPORTED);
+    njSkip(1);
+    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
+        if (nj.pos[0] != c->cid) njThrow(NJ_SYNTAX_ERROR);
+        if (nj.pos[1] & 0xEE) njThrow(NJ_SYNTAX_ERROR);
+        c->dctabsel = nj.pos[1] >> 4;
+        c->actabsel = (nj.pos[1] & 1) | 2;
+        njSkip(2);
+    }
+    if (nj.pos[0] || (nj.pos[1] != 63) || nj.pos[2]) njThrow(NJ_UNSUPPORTED);
+    njSkip(nj.length);
+    for (mbx = mby = 0;;) {
+        for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c)
+            for (sby = 0;  sby < c->ssy;  ++sby)
+                for (sbx = 0;  sbx < c->ssx;  ++sbx) {
+                    njDecodeBlock(c, &c->pixels[((size_t)(mby * c->ssy + sby) * c->stride + mbx * c->ssx + sbx) << (3 - nj.scale)]);
+                    njCheckError();
+                }
+        if (++mbx >= nj.mbwidth) {
+            mbx = 0;
+            if (++mby >= nj.mbheight) break;
+            if (nj_cancel && nj_cancel(nj_cancel_context)) njThrow(NJ_CANCELLED);
+        }
+        if (nj.rstinterval && !(--rstcount)) {
+            njByteAlign();
+            i = njGetBits(16);
+            if (((i & 0xFFF8) != 0xFFD0) || ((i & 7) != nextrst)) njThrow(NJ_SYNTAX_ERROR);
+            nextrst = (nextrst + 1) & 7;
+            rstcount = nj.rstinterval;
+            for (i = 0;  i < 3;  ++i)
+                nj.comp[i].dcpred = 0;
+        }
+    }
+    nj.error = __NJ_FINISHED;
+}
+
+#if NJ_CHROMA_FILTER
+
+#define CF4A (-9)
+#define CF4B (111)
+#define CF4C (29)
+#define CF4D (-3)
+#define CF3A (28)
+#define CF3B (109)
+#define CF3C (-9)
+#define CF3X (104)
+#define CF3Y (27)
+#define CF3Z (-3)
+#define CF2A (139)
+#define CF2B (-11)
+#define CF(x) njClip(((x) + 64) >> 7)
+
+NJ_INLINE void njUpsampleH(nj_component_t* c) {
+    const int xmax = c->width - 3;
+    unsigned char *out, *lin, *lout;
+    int x, y;
+    out = (unsigned char*) njAllocMem(((size_t)c->width * c->height) << 1);
+    if (!out) njThrow(NJ_OUT_OF_MEM);
+    lin = c->pixels;
+    lout = out;
+    for (y = c->height;  y;  --y) {
+        lout[0] = CF(CF2A * lin[0] + CF2B * lin[1]);
+        lout[1] = CF(CF3X * lin[0] + CF3Y * lin[1] + CF3Z * lin[2]);
+        lout[2] = CF(CF3A * lin[0] + CF3B * lin[1] + CF3C * lin[2]);
+        for (x = 0;  x < xmax;  ++x) {
+            lout[(x << 1) + 3] = CF(CF4A * lin[x] + CF4B * lin[x + 1] + CF4C * lin[x + 2] + CF4D * lin[x + 3]);
+            lout[(x << 1) + 4] = CF(CF4D * lin[x] + CF4C * lin[x + 1] + CF4B * lin[x + 2] + CF4A * lin[x + 3]);
+        }
+        lin += c->stride;
+        lout += c->width << 1;
+        lout[-3] = CF(CF3A * lin[-1] + CF3B * lin[-2] + CF3C * lin[-3]);
+        lout[-2] = CF(CF3X * lin[-1] + CF3Y * lin[-2] + CF3Z * lin[-3]);
+        lout[-1] = CF(CF2A * lin[-1] + CF2B * lin[-2]);
+    }
+    c->width <<= 1;
+    c->stride = c->width;
+    njFreeMem((void*)c->pixels);
+    c->pixels = out;
+}
+
+NJ_INLINE void njUpsampleV(nj_component_t* c) {
+    const int w = c->width, s1 = c->stride, s2 = s1 + s1;
+    unsigned char *out, *cin, *cout;
+    int x, y;
+    out = (unsigned char*) njAllocMem(((size_t)c->width * c->height) << 1);
+    if (!out) njThrow(NJ_OUT_OF_MEM);
+    for (x = 0;  x < w;  ++x) {
+        cin = &c->pixels[x];
+        cout = &out[x];
+        *cout = CF(CF2A * cin[0] + CF2B * cin[s1]);  cout += w;
+        *cout = CF(CF3X * cin[0] + CF3Y * cin[s1] + CF3Z * cin[s2]);  cout += w;
+        *cout = CF(CF3A * cin[0] + CF3B * cin[s1] + CF3C * cin[s2]);  cout += w;
+        cin += s1;
+        for (y = c->height - 3;  y;  --y) {
+            *cout = CF(CF4A * cin[-s1] + CF4B * cin[0] + CF4C * cin[s1] + CF4D * cin[s2]);  cout += w;
+            *cout = CF(CF4D * cin[-s1] + CF4C * cin[0] + CF4B * cin[s1] + CF4A * cin[s2]);  cout += w;
+            cin += s1;
+        }
+        cin += s1;
+        *cout = CF(CF3A * cin[0] + CF3B * cin[-s1] + CF3C * cin[-s2]);  cout += w;
+        *cout = CF(CF3X * cin[0] + CF3Y * cin[-s1] + CF3Z * cin[-s2]);  cout += w;
+        *cout = CF(CF2A * cin[0] + CF2B * cin[-s1]);
+    }
+    c->height <<= 1;
+    c->stride = c->width;
+    njFreeMem((void*) c->pixels);
+    c->pixels = out;
+}
+
+#else
+
+NJ_INLINE void njUpsample(nj_component_t* c) {
+    int x, y, xshift = 0, yshift = 0;
+    unsigned char *out, *lin, *lout;
+    while (c->width < nj.width) { c->width <<= 1; ++xshift; }
+    while (c->height < nj.height) { c->height <<= 1; ++yshift; }
+    out = (unsigned char*) njAllocMem((size_t)c->width * c->height);
+    if (!out) njThrow(NJ_OUT_OF_MEM);
+    lin = c->pixels;
+    lout = out;
+    for (y = 0;  y < c->height;  ++y) {
+        lin = &c->pixels[(size_t)(y >> yshift) * c->stride];
+        for (x = 0;  x < c->width;  ++x)
+            lout[x] = lin[x >> xshift];
+        lout += c->width;
+    }
+    c->stride = c->width;
+    njFreeMem((void*) c->pixels);
+    c->pixels = out;
+}
+
+#endif
+
+NJ_INLINE void njConvertRow(const unsigned char *py, const unsigned char *pcb, const unsigned char *pcr, unsigned char *prgb) {
+    int x;
+    for (x = 0;  x < nj.width;  ++x) {
+        // NOTE: Clang warns that register is deprecated
+        //register int y = py[x] << 8;
+        //register int cb = pcb[x] - 128;
+        //register int cr = pcr[x] - 128;
+        int y = py[x] << 8;
+        int cb = pcb[x] - 128;
+        int cr = pcr[x] - 128;
+        *prgb++ = njClip((y            + 359 * cr + 128) >> 8);
+        *prgb++ = njClip((y -  88 * cb - 183 * cr + 128) >> 8);
+        *prgb++ = njClip((y + 454 * cb            + 128) >> 8);
+    }
+}
+
+NJ_INLINE void njConvert(void) {
+    int i;
+    nj_component_t* c;
+    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
+        #if NJ_CHROMA_FILTER
+            while ((c->width < nj.width) || (c->height < nj.height)) {
+                if (c->width < nj.width) njUpsampleH(c);
+                njCheckError();
+                if (c->height < nj.height) njUpsampleV(c);
+                njCheckError();
+            }
+        #else
+            if ((c->width < nj.width) || (c->height < nj.height))
+                njUpsample(c);
+        #endif
+        if ((c->width < nj.width) || (c->height < nj.height)) njThrow(NJ_INTERNAL_ERR);
+    }
+    if (nj.rows)
+        return;  /* njGetRow converts from the planes */
+    if (nj.ncomp == 3) {
+        /* convert to RGB */
+        int yy;
+        unsigned char *prgb = nj.rgb;
+        const unsigned char *py  = nj.comp[0].pixels;
+        const unsigned char *pcb = nj.comp[1].pixels;
+        const unsigned char *pcr = nj.comp[2].pixels;
+        for (yy = nj.height;  yy;  --yy) {
+            njConvertRow(py, pcb, pcr, prgb);
+            prgb += nj.width * 3;
+            py += nj.comp[0].stride;
+            pcb += nj.comp[1].stride;
+            pcr += nj.comp[2].stride;
+        }
+    } else if (nj.comp[0].width != nj.comp[0].stride) {
+        /* grayscale -> only remove stride */
+        unsigned char *pin = &nj.comp[0].pixels[nj.comp[0].stride];
+        unsigned char *pout = &nj.comp[0].pixels[nj.comp[0].width];
+        int y;
+        for (y = nj.comp[0].height - 1;  y;  --y) {
+            njCopyMem(pout, pin, nj.comp[0].width);
+            pin += nj.comp[0].stride;
+            pout += nj.comp[0].width;
+        }
+        nj.comp[0].stride = nj.comp[0].width;
+    }
+}
+
+static nj_result_t njInit(void) 
+{
+    if (!nj_current)
+        nj_current = (nj_context_t*) njAllocMem(sizeof(nj_context_t));
+    if (!nj_current) return NJ_OUT_OF_MEM;
+    njFillMem(nj_current, 0, sizeof(nj_context_t));
+    return NJ_OK;
+}
+
+static void njDone(void) 
+{
+    int i;
+    if (!nj_current) return;
+    for (i = 0;  i < 3;  ++i)
+        if (nj.comp[i].pixels) njFreeMem((void*) nj.comp[i].pixels);
+    if (nj.rgb) njFreeMem((void*) nj.rgb);
+    if (nj.stream) njFreeMem((void*) nj.stream);
+    njFreeMem((void*) nj_current);
+    nj_current = NULL;
+}
+
+static nj_result_t njDecodeMarkers(void) 
+{
+    njFill(2);
+    if (nj.size < 2) return NJ_NO_JPEG;
+    if ((nj.pos[0] ^ 0xFF) | (nj.pos[1] ^ 0xD8)) return NJ_NO_JPEG;
+    njSkip(2);
+    while (!nj.error) {
+        njFill(2);
+        if ((nj.size < 2) || (nj.pos[0] != 0xFF)) return NJ_SYNTAX_ERROR;
+        njSkip(2);
+        switch (nj.pos[-1]) {
+            case 0xC0: njDecodeSOF();  break;
+            case 0xC4: njDecodeDHT();  break;
+            case 0xDB: njDecodeDQT();  break;
+            case 0xDD: njDecodeDRI();  break;
+            case 0xDA: njDecodeScan(); break;
+            case 0xFE: njSkipMarker(); break;
+            default:
+                if ((nj.pos[-1] & 0xF0) == 0xE0)
+                    njSkipMarker();
+                else
+                    return NJ_UNSUPPORTED;
+        }
+    }
+    if (nj.error != __NJ_FINISHED) return nj.error;
+    nj.error = NJ_OK;
+    njConvert();
+    return nj.error;
+}
+
+static void njSetCancel(int (*cancel)(void* context), void* context)
+{
+    nj_cancel = cancel;
+    nj_cancel_context = context;
+}
+
+static nj_result_t njDecode(const void* jpeg, const long long size) 
+{
+    njDone();
+    if (njInit()) return NJ_OUT_OF_MEM;
+    nj.pos = (const unsigned char*) jpeg;
+    nj.size = size;
+    return njDecodeMarkers();
+}
+
+static nj_result_t njDecodeStream(int (*read)(void* context, unsigned char* buffer, int size), void* context) 
+{
+    njDone();
+    if (njInit()) return NJ_OUT_OF_MEM;
+    nj.read = read;
+    nj.read_context = context;
+    return njDecodeMarkers();
+}
+
+static nj_result_t njDecodeSegments(const lc_image_segment* segments, int count) 
+{
+    njDone();
+    if (njInit()) return NJ_OUT_OF_MEM;
+    nj.segments = segments;
+    nj.segcount = count;
+    return njDecodeMarkers();
+}
+
+#if defined(LC_IMAGE_RESIZE_H)
+static nj_result_t njDecodeRows(const void* jpeg, const long long size, int min_width, int min_height) 
+{
+    njDone();
+    if (njInit()) return NJ_OUT_OF_MEM;
+    nj.pos = (const unsigned char*) jpeg;
+    nj.size = size;
+    nj.rows = 1;
+    nj.minwidth = min_width;
+    nj.minheight = min_height;
+    return njDecodeMarkers();
+}
+
+static void njGetRow(int y, unsigned char* out)
+{
+    if (nj.ncomp == 3)
+        njConvertRow(&nj.comp[0].pixels[(size_t)y * nj.comp[0].stride],
+                     &nj.comp[1].pixels[(size_t)y * nj.comp[1].stride],
+                     &nj.comp[2].pixels[(size_t)y * nj.comp[2].stride], out);
+    else
+        njCopyMem(out, &nj.comp[0].pixels[(size_t)y * nj.comp[0].stride], nj.width);
+}
+#endif
+
+static int njGetWidth(void)            { return nj.width; }
+static int njGetHeight(void)           { return nj.height; }
+static int njIsColor(void)             { return (nj.ncomp != 1); }
+static unsigned char* njGetImage(void) { return (nj.ncomp == 1) ? nj.comp[0].pixels : nj.rgb; }
+static long long njGetImageSize(void)  { return (long long)nj.width * nj.height * nj.ncomp; }
+
+/**************************************************************************************************/
+/* PNG                                                                                            */
+/**************************************************************************************************/
+#define LODEPNG_COMPILE_PNG
+#define LODEPNG_COMPILE_DECODER
+#define LODEPNG_COMPILE_ZLIB
+
+/* The PNG color types (also used for raw). */
+typedef enum LodePNGColorType
+{
+  LCT_GREY       = 0, /* greyscale: 1,2,4,8,16 bit */
+  LCT_RGB        = 2, /* RGB: 8,16 bit */
+  LCT_PALETTE    = 3, /* palette: 1,2,4,8 bit */
+  LCT_GREY_ALPHA = 4, /* greyscale with alpha: 8,16 bit */
+  LCT_RGBA       = 6  /* RGB with alpha: 8,16 bit */
+} LodePNGColorType;
+
+/*
+ Color mode of an image. Contains all information required to decode the pixel
+ bits to RGBA colors. This information is the same as used in the PNG file
+ format, and is used both for PNG and raw image data in LodePNG.
+*/
+typedef struct LodePNGColorMode
+{
+    /* header (IHDR) */
+    LodePNGColorType colortype; /* color type, see PNG standard or documentation further in this header file */
+    unsigned bitdepth;          /* bits per sample, see PNG standard or documentation further in this header file */
+
+    /*
+     palette (PLTE and tRNS)
+     Dynamically allocated with the colors of the palette, including alpha.
+     When encoding a PNG, to store your colors in the palette of the LodePNGColorMode, first use
+     lodepng_palette_clear, then for each color use lodepng_palette_add.
+     If you encode an image without alpha with palette, don't forget to put value 255 in each A byte of the palette.
+     When decoding, by default you can ignore this palette, since LodePNG already
+     fills the palette colors in the pixels of the raw RGBA output.
+     The palette is only supported for color type 3.
+    */
+    unsigned char* palette; /* palette in RGBARGBA... order. When allocated, must be either 0, or have size 1024 */
+    size_t palettesize;     /* palette size in number of colors (amount of bytes is 4 * palettesize) */
+
+    /*
+     transparent color key (tRNS)
+     This color uses the same bit depth as the bitdepth value in this struct, which can be 1-bit to 16-bit.
+     For greyscale PNGs, r, g and b will all 3 be set to the same.
+     When decoding, by default you can ignore this information, since LodePNG sets
+     pixels with this key to transparent already in the raw RGBA output.
+     The color key is only supported for color types 0 and 2.
+    */
+    unsigned key_defined; /* is a transparent color key given? 0 = false, 1 = true */
+    unsigned key_r;       /* red/greyscale component of color key */
+    unsigned key_g;       /* green component of color key */
+    unsigned key_b;       /* blue component of color key */
+} LodePNGColorMode;
+
+/* Settings for zlib decompression */
+typedef struct LodePNGDecompressSettings
+{
+    /* if 1, continue and don't give an error message if the Adler32 checksum is corrupted */
+    unsigned ignore_adler32; 
+
+    /*
+     number of threads the built in inflater may use for large streams (default: 0, serial).
+     The deflate stream is split at block boundaries and the parts are decoded speculatively,
+     see lodepng_inflatev_parallel.
+    */
+    unsigned num_threads;
+
+    /*
+     called by the built in inflater after each deflate block with all output so far (default: null).
+     The data must not be modified, later blocks may still refer to it. Forces serial inflating.
+    */
+    void (*progress)(void* context, const unsigned char* data, size_t size);
+    void* progress_context;
+
+    /* if not null, receives the most scratch memory the inflater held at once besides its output */
+    size_t* scratch_peak;
+
+    /* inflated size if known in advance (default: 0), lets the inflater allocate its output once */
+    size_t expected_size;
+
+    /*
+     polled by the built in inflater, unfiltering and the color conversion of lodepng_decode about every
+     LODEPNG_CANCEL_INTERVAL bytes of output, from the worker threads too when they run in parallel
+     (default: null). A non-zero return stops decoding with error 121. libdeflate is only polled before
+     it starts.
+    */
+    int (*cancel)(void* context);
+    void* cancel_context;
+
+    /* use custom zlib decoder instead of built in one (default: null) */
+    unsigned (*custom_zlib)(unsigned char**, size_t*,
+                            const unsigned char*, size_t,
+                            const LodePNGDecompressSettings*);
+    /*
+     use custom deflate decoder instead of built in one (default: null)
+     if custom_zlib is used, custom_deflate is ignored since only the built in
+     zlib function will call custom_deflate
+    */
+    unsigned (*custom_inflate)(unsigned char**, size_t*,
+                               const unsigned char*, size_t,
+                               const LodePNGDecompressSettings*);
+
+  const void* custom_context; /*optional custom settings for custom functions*/
+} LodePNGDecompressSettings;
+
+/*
+ Settings for the decoder. This contains settings for the PNG and the Zlib
+ decoder, but not the Info settings from the Info structs.
+*/
+typedef struct LodePNGDecoderSettings
+{
+    LodePNGDecompressSettings zlibsettings;   /* in here is the setting to ignore Adler32 checksums */
+    unsigned ignore_crc;                      /* ignore CRC checksums */
+    unsigned color_convert;                   /* whether to convert the PNG to the color type you want. Default: yes */
+
+    /*
+     Adam7 interlaced images only: called after each of the 7 passes (pass is 1..7) while the image data
+     is still being inflated, with a preview of the whole image in the info_raw color mode. Every pixel
+     known so far is repeated over the pixels of the later passes. Needs color_convert and an info_raw
+     bit depth of 8 or 16 (default: null)
+    */
+    void (*preview)(void* context, unsigned pass, const unsigned char* image, unsigned w, unsigned h,
+                    const LodePNGColorMode* color);
+    void* preview_context;
+
+    /*
+     maximum number of bytes the decoder may hold in buffers at once, 0 for no limit (default). The
+     lowest memory strategy that fits is used (the parallel inflater is skipped if needed), otherwise
+     decoding fails with error 119 before any image buffer is allocated.
+    */
+    size_t max_memory;
+
+    /*
+     number of threads for Adam7 deinterlacing and color conversion of large images (default: 0, serial).
+     Unfiltering stays serial, the stages after it are split into bands of rows.
+    */
+    unsigned num_threads;
+} LodePNGDecoderSettings;
+
+/* Information about the PNG image, except pixels, width and height. */
+typedef struct LodePNGInfo
+{
+    /* header (IHDR), palette (PLTE) and transparency (tRNS) chunks */
+    unsigned compression_method;/* compression method of the original file. Always 0. */
+    unsigned filter_method;     /* filter method of the original file */
+    unsigned interlace_method;  /* interlace method of the original file */
+    LodePNGColorMode color;     /* color type and bits, palette and transparency of the PNG file */
+
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    /*
+     suggested background color chunk (bKGD)
+     This color uses the same color mode as the PNG (except alpha channel), which can be 1-bit to 16-bit.
+     For greyscale PNGs, r, g and b will all 3 be set to the same. When encoding
+     the encoder writes the red one. For palette PNGs: When decoding, the RGB value
+     will be stored, not a palette index. But when encoding, specify the index of
+     the palette in background_r, the other two are then ignored.
+     The decoder does not use this background color to edit the color of pixels.
+    */
+    unsigned background_defined; /* is a suggested background color given?*/
+    unsigned background_r;       /* red component of suggested background color*/
+    unsigned background_g;       /* green component of suggested background color*/
+    unsigned background_b;       /* blue component of suggested background color*/
+
+    /*
+     non-international text chunks (tEXt and zTXt)
+     The char** arrays each contain num strings. The actual messages are in
+     text_strings, while text_keys are keywords that give a short description what
+     the actual text represents, e.g. Title, Author, Description, or anything else.
+     A keyword is minimum 1 character and maximum 79 characters long. It's
+     discouraged to use a single line length longer than 79 characters for texts.
+     Don't allocate these text buffers yourself. Use the init/cleanup functions
+     correctly and use lodepng_add_text and lodepng_clear_text.
+    */
+    size_t text_num;     /* the amount of texts in these char** buffers (there may be more texts in itext) */
+    char** text_keys;    /* the keyword of a text chunk (e.g. "Comment") */
+    char** text_strings; /* the actual text */
+
+    /*
+     international text chunks (iTXt)
+     Similar to the non-international text chunks, but with additional strings
+     "langtags" and "transkeys".
+    */
+    size_t itext_num;       /* the amount of international texts in this PNG */
+    char** itext_keys;      /* the English keyword of the text chunk (e.g. "Comment") */
+    char** itext_langtags;  /* language tag for this text's language, ISO/IEC 646 string, e.g. ISO 639 language tag */
+    char** itext_transkeys; /* keyword translated to the international language - UTF-8 string */
+    char** itext_strings;   /* the actual international text - UTF-8 string */
+
+    /* time chunk (tIME) */
+    unsigned time_defined; /* set to 1 to make the encoder generate a tIME chunk */
+    LodePNGTime time;
+
+    /* phys chunk (pHYs) */
+    unsigned phys_defined; /* if 0, there is no pHYs chunk and the values below are undefined, if 1 else there is one */
+    unsigned phys_x;       /* pixels per unit in x direction */
+    unsigned phys_y;       /* pixels per unit in y direction */
+    unsigned phys_unit;    /* may be 0 (unknown unit) or 1 (metre) */
+
+    /*
+    unknown chunks
+    There are 3 buffers, one for each position in the PNG where unknown chunks can appear
+    each buffer contains all unknown chunks for that position consecutively
+    The 3 buffers are the unknown chunks between certain critical chunks:
+    0: IHDR-PLTE, 1: PLTE-IDAT, 2: IDAT-IEND
+    Do not allocate or traverse this data yourself. Use the chunk traversing functions declared
+    later, such as lodepng_chunk_next and lodepng_chunk_append, to read/write this struct.
+    */
+    unsigned char* unknown_chunks_data[3];
+    size_t unknown_chunks_size[3]; /*size in bytes of the unknown chunks, given for protection*/
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+} LodePNGInfo;
+
+/* The settings, state and information for extended encoding and decoding. */
+typedef struct LodePNGState
+{
+#ifdef LODEPNG_COMPILE_DECODER
+    LodePNGDecoderSettings decoder; /*the decoding settings*/
+#endif /*LODEPNG_COMPILE_DECODER*/
+#ifdef LODEPNG_COMPILE_ENCODER
+    LodePNGEncoderSettings encoder; /*the encoding settings*/
+#endif /*LODEPNG_COMPILE_ENCODER*/
+    LodePNGColorMode info_raw; /*specifies the format in which you would like to get the raw pixel buffer*/
+    LodePNGInfo      info_png; /*info of the PNG image obtained after decoding*/
+  unsigned error;
+  size_t memory_peak; /*most bytes held at once in buffers by the last decode, see decoder.max_memory*/
+  size_t memory_current;
+#ifdef LODEPNG_COMPILE_CPP
+     /* For the lodepng::State subclass. */
+    virtual ~LodePNGState(){}
+#endif
+} LodePNGState;
+
+/*
+ Converts PNG data in memory to raw pixel data, with the decoder settings taken from the
+ lc_load_options passed to lc_load_image_mem_ex.
+ out: Output parameter. Pointer to buffer that will contain the raw pixel data.
+      Must be freed after usage with free(*out).
+ w: Output parameter. Pointer to width of pixel data.
+ h: Output parameter. Pointer to height of pixel data.
+ in: Memory buffer with the PNG file.
+ insize: size of the in buffer.
+ colortype: the desired color type for the raw output image. See explanation on PNG color types.
+ bitdepth: the desired bit depth for the raw output image. See explanation on PNG color types.
+ Return value: LodePNG error code (0 means no error).
+*/
+static unsigned lc_png_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
+                                     const unsigned char* in, size_t insize,
+                                     LodePNGColorType colortype, unsigned bitdepth,
+                                     const lc_load_options* options);
+
+/* width and height from the header of the PNG in memory, without decoding it */
+static unsigned lc_png_read_size(unsigned* w, unsigned* h, const unsigned char* in, size_t insize,
+                                 const lc_load_options* options);
+
+/* rows per band when splitting the rows of an image of the given size over num_threads */
+static unsigned lodepng_band_rows(unsigned h, size_t bytes, unsigned num_threads);
+
+#if defined(LC_IMAGE_RESIZE_H)
+/*
+ Decodes the PNG without converting its pixels: *out holds them in the color mode of the file,
+ copied to *color. Clean *color up with lodepng_color_mode_cleanup.
+*/
+static unsigned lc_png_decode_raw(unsigned char** out, unsigned* w, unsigned* h, LodePNGColorMode* color,
+                                  const unsigned char* in, size_t insize, const lc_load_options* options);
+
+static unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
+                                const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                unsigned w, unsigned h);
+static void lodepng_color_mode_init(LodePNGColorMode* info);
+static void lodepng_color_mode_cleanup(LodePNGColorMode* info);
+static unsigned lodepng_get_bpp(const LodePNGColorMode* info);
+#endif
+
+/* lc_channel_rows: RGB rows copied to rows of 1 or 2 channels by lc_copy_channels_task */
+typedef struct lc_channel_rows {
+    const lc_data_t* src;
+    lc_data_t* dst;
+    int width;
+    int height;
+    int band_height;
+    int src_channel_count;
+    int dst_channel_count;
+} lc_channel_rows;
+
+static void lc_copy_channels_task(void* context, int index)
+{
+    const lc_channel_rows* rows = (const lc_channel_rows*)context;
+    int src_channel_count = rows->src_channel_count;
+    int dst_channel_count = rows->dst_channel_count;
+    lc_uint64_t src_pixel_stride = src_channel_count;
+    lc_uint64_t dst_pixel_stride = dst_channel_count;
+    lc_uint64_t src_row_stride = rows->width * src_pixel_stride;
+    lc_uint64_t dst_row_stride = rows->width * dst_pixel_stride;
+    int y_start = index * rows->band_height;
+    int y_end = LC_MATH_MIN(y_start + rows->band_height, rows->height);
+    const lc_data_t* src_line = rows->src + y_start * src_row_stride;
+    lc_data_t* dst_line = rows->dst + y_start * dst_row_stride;
+    for (int y = y_start; y < y_end; ++y) {
+        const lc_data_t* src_pixel = src_line;
+        lc_data_t* dst_pixel = dst_line;
+        for (int x = 0; x < rows->width; ++x) {
+            int c = 0;
+            int nc = LC_MATH_MIN(src_channel_count, dst_channel_count);
+            for (; c < nc; ++c) {
+                *(dst_pixel + c) = *(src_pixel + c);
+            }
+            for (; c < dst_channel_count; ++c) {
+                *(dst_pixel + c) = (3 == c) ? 0xFF : 0x0;
+            }                
+            src_pixel += src_pixel_stride;
+            dst_pixel += dst_pixel_stride;
+        }
+        src_line += src_row_stride;
+        dst_line += dst_row_stride;
+    }
+}
+
+/* lc_load_image_png */
+static lc_data_t* lc_load_image_png(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
+{
+    /* cap the channel count to 4 max */
+    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    /* load everything if req_channel_count is 0 */
+    req_channel_count = (0 == req_channel_count) ? 4 : req_channel_count;
+
+    unsigned int w = 0;
+    unsigned int h = 0;
+    int dst_channel_count = req_channel_count;
+
+    lc_data_t* result = NULL;
+    if (4 == req_channel_count) {
+        if (0 != lc_png_decode_memory(&result, &w, &h, data, (size_t)size, LCT_RGBA, 8, options)) {
+            return NULL;
+        }
+
+        dst_channel_count = 4;
+    }
+    else {
+        /* gray images are converted from RGB, both are held at once so the limit is checked up front */
+        if ((3 != req_channel_count) &&
+            ((0 != lc_png_read_size(&w, &h, data, (size_t)size, options)) ||
+             !lc_memory_fits(options, (lc_uint64_t)w * h * (3 + req_channel_count)))) {
+            return NULL;
+        }
+
+        lc_data_t* src = NULL;
+        if (0 != lc_png_decode_memory(&src, &w, &h, data, (size_t)size, LCT_RGB, 8, options)) {
+            return NULL;
+        }
+
+        if (3 == req_channel_count) {
+            result = src;
+            dst_channel_count = 3;
+        }
+        else {
+            int src_channel_count = 3;
+            dst_channel_count = req_channel_count;
+
+            /* the decoder reported its own peak, the converted copy is held on top of the source */
+            lc_uint64_t result_size = (lc_uint64_t)w * h * dst_channel_count;
+            if (!lc_memory_hold(options, (lc_uint64_t)w * h * src_channel_count + result_size)) {
+                free(src);
+                return NULL;
+            }
+
+            result = (lc_data_t*)malloc(result_size * sizeof(*result));
+            assert(NULL != result);
+
+            lc_channel_rows rows;
+            rows.src = src;
+            rows.dst = result;
+            rows.width = (int)w;
+            rows.height = (int)h;
+            rows.band_height = (int)lodepng_band_rows(h, (size_t)result_size,
+                                                      (unsigned)LC_MATH_MAX(options->thread_count, 0));
+            rows.src_channel_count = src_channel_count;
+            rows.dst_channel_count = dst_channel_count;
+            int band_count = (0 == h) ? 0 : (int)((h + rows.band_height - 1) / rows.band_height);
+            if (band_count > 1) {
+                lc_run_tasks(band_count, options->thread_count, lc_copy_channels_task, &rows);
+            }
+            else if (1 == band_count) {
+                lc_copy_channels_task(&rows, 0);
+            }
+
+            free(src);
+            src = NULL;
+        }
+    }
+
+    if (NULL != width) {
+        *width = w;
+    }
+
+    if (NULL != height) {
+        *height = h;
+    }
+
+    if (NULL != channel_count) {
+        *channel_count = dst_channel_count;
+    }
+
+    return result;
+}
+
+#if defined(LC_IMAGE_RESIZE_H)
+/* lc_load_image_jpg_resized */
+static lc_data_t* lc_load_image_jpg_resized(lc_uint64_t size, const lc_data_t* data,
+                                            int req_channel_count, const lc_load_options* options, lc_resize_rows* rows)
+{
+    /* decoding at a reduced size needs the destination size of both dimensions */
+    int min_width = rows->dst_width;
+    int min_height = rows->dst_height;
+    if ((min_width <= 0) || (min_height <= 0)) {
+        min_width = 0;
+        min_height = 0;
+    }
+
+    njInit();
+    njSetCancel(options->cancel, options->cancel_context);
+    if (! lc_jpg_decoded(options, njDecodeRows(data, (long long)size, min_width, min_height))) {
+        return NULL;
+    }
+
+    int w = njGetWidth();
+    int h = njGetHeight();
+    int src_channel_count = njIsColor() ? 3 : 1;
+    int dst_channel_count = (0 == req_channel_count) ? src_channel_count : LC_MATH_MIN(req_channel_count, 4);
+    lc_resize_rows_begin(rows, w, h, dst_channel_count);
+
+    lc_data_t* src_row = (lc_data_t*)malloc((lc_uint64_t)w * (src_channel_count + dst_channel_count));
+    assert(NULL != src_row);
+
+    lc_channel_rows channel_rows;
+    channel_rows.src = src_row;
+    channel_rows.dst = src_row + (lc_uint64_t)w * src_channel_count;
+    channel_rows.width = w;
+    channel_rows.height = 1;
+    channel_rows.band_height = 1;
+    channel_rows.src_channel_count = src_channel_count;
+    channel_rows.dst_channel_count = dst_channel_count;
+    for (int y = 0; y < h; ++y) {
+        njGetRow(y, src_row);
+        if (src_channel_count != dst_channel_count) {
+            lc_copy_channels_task(&channel_rows, 0);
+        }
+        lc_image_resizer_push_uint8(rows->resizer, (src_channel_count != dst_channel_count) ? channel_rows.dst : src_row);
+    }
+
+    free(src_row);
+    src_row = NULL;
+    lc_image_resizer_destroy(rows->resizer);
+    rows->resizer = NULL;
+    njDone();
+
+    return rows->result;
+}
+
+/* lc_load_image_png_resized */
+static lc_data_t* lc_load_image_png_resized(lc_uint64_t size, const lc_data_t* data,
+                                            int req_channel_count, const lc_load_options* options, lc_resize_rows* rows)
+{
+    /* same channels as lc_load_image_png */
+    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    req_channel_count = (0 == req_channel_count) ? 4 : req_channel_count;
+
+    unsigned int w = 0;
+    unsigned int h = 0;
+    lc_data_t* raw = NULL;
+    LodePNGColorMode color;
+    lodepng_color_mode_init(&color);
+    if (0 != lc_png_decode_raw(&raw, &w, &h, &color, data, (size_t)size, options)) {
+        lodepng_color_mode_cleanup(&color);
+        return NULL;
+    }
+
+    /* rows are converted in bands of 8, which start on a byte boundary at any bit depth */
+    const int band_height = 8;
+    LodePNGColorMode band_color;
+    lodepng_color_mode_init(&band_color);
+    band_color.colortype = (4 == req_channel_count) ? LCT_RGBA : LCT_RGB;
+    band_color.bitdepth = 8;
+    int src_channel_count = (4 == req_channel_count) ? 4 : 3;
+    int dst_channel_count = req_channel_count;
+    lc_resize_rows_begin(rows, (int)w, (int)h, dst_channel_count);
+
+    lc_data_t* band = (lc_data_t*)malloc((lc_uint64_t)w * (band_height * src_channel_count + dst_channel_count));
+    assert(NULL != band);
+
+    lc_channel_rows channel_rows;
+    channel_rows.dst = band + (lc_uint64_t)w * band_height * src_channel_count;
+    channel_rows.width = (int)w;
+    channel_rows.height = 1;
+    channel_rows.band_height = 1;
+    channel_rows.src_channel_count = src_channel_count;
+    channel_rows.dst_channel_count = dst_channel_count;
+    lc_uint64_t band_bytes = (lc_uint64_t)w * band_height * lodepng_get_bpp(&color) / 8;
+    unsigned error = 0;
+    for (unsigned int y = 0; (y < h) && (0 == error); y += band_height) {
+        unsigned int rows_in_band = LC_MATH_MIN(h - y, (unsigned int)band_height);
+        error = lodepng_convert(band, raw + (y / band_height) * band_bytes, &band_color, &color, w, rows_in_band);
+        for (unsigned int i = 0; (i < rows_in_band) && (0 == error); ++i) {
+            const lc_data_t* src_row = band + (lc_uint64_t)w * i * src_channel_count;
+            if (src_channel_count != dst_channel_count) {
+                channel_rows.src = src_row;
+                lc_copy_channels_task(&channel_rows, 0);
+                src_row = channel_rows.dst;
+            }
+            lc_image_resizer_push_uint8(rows->resizer, src_row);
+        }
+    }
+
+    free(band);
+    band = NULL;
+    free(raw);
+    raw = NULL;
+    lodepng_color_mode_cleanup(&band_color);
+    lodepng_color_mode_cleanup(&color);
+    lc_image_resizer_destroy(rows->resizer);
+    rows->resizer = NULL;
+    if (0 != error) {
+        free(rows->result);
+        rows->result = NULL;
+    }
+
+    return rows->result;
+}
+#endif
+
+/* lc_load_image_png_16 */
+static unsigned short* lc_load_image_png_16(lc_uint64_t size, const lc_data_t* data,
+                                            int* width, int* height, int* channel_count, 
+                                            int req_channel_count, const lc_load_options* options)
+{
+    /* same channel rules as lc_load_image_png */
+    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    req_channel_count = (0 == req_channel_count) ? 4 : req_channel_count;
+
+    unsigned int w = 0;
+    unsigned int h = 0;
+    int src_channel_count = (4 == req_channel_count) ? 4 : 3;
+    int dst_channel_count = req_channel_count;
+
+    /* the decoded image and the swapped copy are held at once, the limit is checked before decoding */
+    if ((0 != lc_png_read_size(&w, &h, data, (size_t)size, options)) ||
+        !lc_memory_fits(options, (lc_uint64_t)w * h * (src_channel_count + dst_channel_count) * 2)) {
+        return NULL;
+    }
+
+    lc_data_t* src = NULL;
+    if (0 != lc_png_decode_memory(&src, &w, &h, data, (size_t)size, 
+                                  (4 == src_channel_count) ? LCT_RGBA : LCT_RGB, 16, options)) {
+        return NULL;
+    }
+
+    /* the decoder reported its own peak, the swapped copy is held on top of the source */
+    lc_uint64_t pixel_count = (lc_uint64_t)w * h;
+    if (!lc_memory_hold(options, pixel_count * (src_channel_count + dst_channel_count) * 2)) {
+        free(src);
+        return NULL;
+    }
+
+    unsigned short* result = (unsigned short*)malloc(pixel_count * dst_channel_count * sizeof(*result));
+    assert(NULL != result);
+
+    if (src_channel_count == dst_channel_count) {
+        lc_swap_bytes_16(result, src, pixel_count * dst_channel_count);
+    }
+    else {
+        const lc_data_t* src_pixel = src;
+        unsigned short* dst_pixel = result;
+        for (lc_uint64_t i = 0; i < pixel_count; ++i) {
+            for (int c = 0; c < dst_channel_count; ++c) {
+                dst_pixel[c] = (unsigned short)((src_pixel[2 * c] << 8) | src_pixel[2 * c + 1]);
+            }
+            src_pixel += 2 * src_channel_count;
+            dst_pixel += dst_channel_count;
+        }
+    }
+
+    free(src);
+    src = NULL;
+
+    if (NULL != width) {
+        *width = w;
+    }
+
+    if (NULL != height) {
+        *height = h;
+    }
+
+    if (NULL != channel_count) {
+        *channel_count = dst_channel_count;
+    }
+
+    return result;
 }
 
-NJ_INLINE void njColIDCT(const int* blk, unsigned char *out, int stride) {
-    int x0, x1, x2, x3, x4, x5, x6, x7, x8;
-    if (!((x1 = blk[8*4] << 8)
-        | (x2 = blk[8*6])
-        | (x3 = blk[8*2])
-        | (x4 = blk[8*1])
-        | (x5 = blk[8*7])
-        | (x6 = blk[8*5])
-        | (x7 = blk[8*3])))
-    {
-        x1 = njClip(((blk[0] + 32) >> 6) + 128);
-        for (x0 = 8;  x0;  --x0) {
-            *out = (unsigned char) x1;
-            out += stride;
-        }
-        return;
+static unsigned lc_png_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
+                                     unsigned w, unsigned h, LodePNGColorType colortype, unsigned num_threads);
+
+void lc_write_options_init(lc_write_options* options)
+{
+    if (NULL != options) {
+        options->thread_count = 0;
     }
-    x0 = (blk[0] << 8) + 8192;
-    x8 = W7 * (x4 + x5) + 4;
-    x4 = (x8 + (W1 - W7) * x4) >> 3;
-    x5 = (x8 - (W1 + W7) * x5) >> 3;
-    x8 = W3 * (x6 + x7) + 4;
-    x6 = (x8 - (W3 - W5) * x6) >> 3;
-    x7 = (x8 - (W3 + W5) * x7) >> 3;
-    x8 = x0 + x1;
-    x0 -= x1;
-    x1 = W6 * (x3 + x2) + 4;
-    x2 = (x1 - (W2 + W6) * x2) >> 3;
-    x3 = (x1 + (W2 - W6) * x3) >> 3;
-    x1 = x4 + x6;
-    x4 -= x6;
-    x6 = x5 + x7;
-    x5 -= x7;
-    x7 = x8 + x3;
-    x8 -= x3;
-    x3 = x0 + x2;
-    x0 -= x2;
-    x2 = (181 * (x4 + x5) + 128) >> 8;
-    x4 = (181 * (x4 - x5) + 128) >> 8;
-    *out = njClip(((x7 + x1) >> 14) + 128);  out += stride;
-    *out = njClip(((x3 + x2) >> 14) + 128);  out += stride;
-    *out = njClip(((x0 + x4) >> 14) + 128);  out += stride;
-    *out = njClip(((x8 + x6) >> 14) + 128);  out += stride;
-    *out = njClip(((x8 - x6) >> 14) + 128);  out += stride;
-    *out = njClip(((x0 - x4) >> 14) + 128);  out += stride;
-    *out = njClip(((x3 - x2) >> 14) + 128);  out += stride;
-    *out = njClip(((x7 - x1) >> 14) + 128);
 }
 
-#define njThrow(e) do { nj.error = e; return; } while (0)
-#define njCheckError() do { if (nj.error) return; } while (0)
+/* lc_write_png_mem */
+unsigned char* lc_write_png_mem(int width, int height, int channel_count, 
+                                const unsigned char* data, unsigned long long* size,
+                                const lc_write_options* options)
+{
+    lc_write_options default_options;
+    if (NULL == options) {
+        lc_write_options_init(&default_options);
+        options = &default_options;
+    }
 
-static int njShowBits(int bits) {
-    unsigned char newbyte;
-    if (!bits) return 0;
-    while (nj.bufbits < bits) {
-        if (nj.size <= 0) {
-            nj.buf = (nj.buf << 8) | 0xFF;
-            nj.bufbits += 8;
-            continue;
-        }
-        newbyte = *nj.pos++;
-        nj.size--;
-        nj.bufbits += 8;
-        nj.buf = (nj.buf << 8) | newbyte;
-        if (newbyte == 0xFF) {
-            if (nj.size) {
-                unsigned char marker = *nj.pos++;
-                nj.size--;
-                switch (marker) {
-                    case 0x00:
-                    case 0xFF:
-                        break;
-                    case 0xD9: nj.size = 0; break;
-                    default:
-                        if ((marker & 0xF8) != 0xD0)
-                            nj.error = NJ_SYNTAX_ERROR;
-                        else {
-                            nj.buf = (nj.buf << 8) | marker;
-                            nj.bufbits += 8;
-                        }
-                }
-            } else
-                nj.error = NJ_SYNTAX_ERROR;
-        }
+    if ((NULL == data) || (width <= 0) || (height <= 0)) {
+        return NULL;
     }
-    return (nj.buf >> (nj.bufbits - bits)) & ((1 << bits) - 1);
+
+    LodePNGColorType colortype = LCT_RGBA;
+    switch (channel_count) {
+        case 1: colortype = LCT_GREY; break;
+        case 2: colortype = LCT_GREY_ALPHA; break;
+        case 3: colortype = LCT_RGB; break;
+        case 4: colortype = LCT_RGBA; break;
+        default: return NULL;
+    }
+
+    unsigned num_threads = (options->thread_count > 1) ? (unsigned)options->thread_count : 0;
+    lc_data_t* result = NULL;
+    size_t result_size = 0;
+    if (0 != lc_png_encode_memory(&result, &result_size, data, (unsigned)width, (unsigned)height, 
+                                  colortype, num_threads)) {
+        return NULL;
+    }
+
+    if (NULL != size) {
+        *size = result_size;
+    }
+
+    return result;
 }
 
-NJ_INLINE void njSkipBits(int bits) {
-    if (nj.bufbits < bits)
-        (void) njShowBits(bits);
-    nj.bufbits -= bits;
+/* lc_write_png */
+int lc_write_png(const char* file_name, 
+                 int width, int height, int channel_count, 
+                 const unsigned char* data, const lc_write_options* options)
+{
+    lc_uint64_t size = 0;
+    lc_data_t* png = lc_write_png_mem(width, height, channel_count, data, &size, options);
+    if (NULL == png) {
+        return 0;
+    }
+
+    FILE* file = lc_fopen(file_name, "wb");
+    if (NULL == file) {
+        free(png);
+        return 0;
+    }
+
+    size_t written = lc_fwrite(png, sizeof(*png), (size_t)size, file);
+    int closed = (0 == lc_fclose(file));
+    free(png);
+    png = NULL;
+
+    return ((written == (size_t)size) && closed) ? 1 : 0;
 }
 
-NJ_INLINE int njGetBits(int bits) {
-    int res = njShowBits(bits);
-    njSkipBits(bits);
-    return res;
+/**************************************************************************************************/
+/* Uncompressed formats                                                                           */
+/**************************************************************************************************/
+
+/* lc_raw_layout: where the pixels of an uncompressed image are and how they are stored */
+typedef struct lc_raw_layout {
+    int              width;
+    int              height;
+    int              channel_count;  /* 1 grey, 2 grey alpha, 3 RGB, 4 RGBA */
+    int              pixel_size;     /* bytes per stored pixel */
+    int              offsets[4];     /* byte offset of each channel in a stored pixel */
+    int              max_value;      /* PNM: samples are 2 bytes, big endian, if more than 255 */
+    const lc_data_t* palette;        /* BMP: BGRX entries indexed by 1 byte pixels, NULL otherwise */
+    int              palette_size;
+    lc_uint64_t      first_row;      /* byte offset of the row stored first, from the header */
+    long long        row_stride;     /* negative for images stored bottom up */
+    const lc_data_t* rows;           /* top row, set by lc_raw_rows_fit once the rows are known to fit */
+} lc_raw_layout;
+
+/*
+ lc_raw_parse_fn: reads the header of an uncompressed image to layout. Returns -1 if data is not
+ such an image, 0 if the header is cut short, 1 once layout is complete; the rows may still be
+ cut short, see lc_raw_rows_fit.
+*/
+typedef int (*lc_raw_parse_fn)(lc_uint64_t size, const lc_data_t* data, lc_raw_layout* layout);
+
+static lc_uint64_t lc_read_le16(const lc_data_t* p)
+{
+    return (lc_uint64_t)p[0] | ((lc_uint64_t)p[1] << 8);
 }
 
-NJ_INLINE void njByteAlign(void) {
-    nj.bufbits &= 0xF8;
+static lc_uint64_t lc_read_le32(const lc_data_t* p)
+{
+    return lc_read_le16(p) | (lc_read_le16(p + 2) << 16);
 }
 
-static void njSkip(int count) {
-    nj.pos += count;
-    nj.size -= count;
-    nj.length -= count;
-    if (nj.size < 0) nj.error = NJ_SYNTAX_ERROR;
+static void lc_write_le16(lc_data_t* p, lc_uint64_t value)
+{
+    p[0] = (lc_data_t)(value & 0xFF);
+    p[1] = (lc_data_t)((value >> 8) & 0xFF);
 }
 
-NJ_INLINE unsigned short njDecode16(const unsigned char *pos) {
-    return (pos[0] << 8) | pos[1];
+static void lc_write_le32(lc_data_t* p, lc_uint64_t value)
+{
+    lc_write_le16(p, value & 0xFFFF);
+    lc_write_le16(p + 2, (value >> 16) & 0xFFFF);
 }
 
-static void njDecodeLength(void) {
-    if (nj.size < 2) njThrow(NJ_SYNTAX_ERROR);
-    nj.length = njDecode16(nj.pos);
-    if (nj.length > nj.size) njThrow(NJ_SYNTAX_ERROR);
-    njSkip(2);
+/* lc_raw_layout_init: a layout of packed 8 bit channels in stored order */
+static void lc_raw_layout_init(lc_raw_layout* layout, int width, int height, int channel_count)
+{
+    memset(layout, 0, sizeof(*layout));
+    layout->width = width;
+    layout->height = height;
+    layout->channel_count = channel_count;
+    layout->pixel_size = channel_count;
+    for (int c = 0; c < 4; ++c) {
+        layout->offsets[c] = c;
+    }
+    layout->max_value = 255;
 }
 
-NJ_INLINE void njSkipMarker(void) {
-    njDecodeLength();
-    njSkip(nj.length);
+/*
+ lc_raw_set_rows: rows start at offset and are row_size bytes apart, bottom_up if the last one comes
+ first. Both come from the header, they stay numbers until lc_raw_rows_fit checks them.
+*/
+static void lc_raw_set_rows(lc_raw_layout* layout, lc_uint64_t offset, lc_uint64_t row_size, int bottom_up)
+{
+    layout->first_row = offset;
+    layout->row_stride = bottom_up ? -(long long)row_size : (long long)row_size;
 }
 
-NJ_INLINE void njDecodeSOF(void) {
-    int i, ssxmax = 0, ssymax = 0;
-    nj_component_t* c;
-    njDecodeLength();
-    njCheckError();
-    if (nj.length < 9) njThrow(NJ_SYNTAX_ERROR);
-    if (nj.pos[0] != 8) njThrow(NJ_UNSUPPORTED);
-    nj.height = njDecode16(nj.pos+1);
-    nj.width = njDecode16(nj.pos+3);
-    if (!nj.width || !nj.height) njThrow(NJ_SYNTAX_ERROR);
-    nj.ncomp = nj.pos[5];
-    njSkip(6);
-    switch (nj.ncomp) {
-        case 1:
-        case 3:
-            break;
-        default:
-            njThrow(NJ_UNSUPPORTED);
+/* lc_raw_rows_fit: 1 if the rows of layout end within the size bytes at data, layout->rows is set then */
+static int lc_raw_rows_fit(lc_raw_layout* layout, lc_uint64_t size, const lc_data_t* data)
+{
+    lc_uint64_t row_size = (lc_uint64_t)(layout->row_stride < 0 ? -layout->row_stride : layout->row_stride);
+    lc_uint64_t pixel_bytes = (lc_uint64_t)layout->width * layout->pixel_size;
+    if ((layout->first_row > size) || (row_size < pixel_bytes) || (pixel_bytes > size - layout->first_row)) {
+        return 0;
     }
-    if (nj.length < (nj.ncomp * 3)) njThrow(NJ_SYNTAX_ERROR);
-    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
-        c->cid = nj.pos[0];
-        if (!(c->ssx = nj.pos[1] >> 4)) njThrow(NJ_SYNTAX_ERROR);
-        if (c->ssx & (c->ssx - 1)) njThrow(NJ_UNSUPPORTED);  /* non-power of two */
-        if (!(c->ssy = nj.pos[1] & 15)) njThrow(NJ_SYNTAX_ERROR);
-        if (c->ssy & (c->ssy - 1)) njThrow(NJ_UNSUPPORTED);  /* non-power of two */
-        if ((c->qtsel = nj.pos[2]) & 0xFC) njThrow(NJ_SYNTAX_ERROR);
-        njSkip(3);
-        nj.qtused |= 1 << c->qtsel;
-        if (c->ssx > ssxmax) ssxmax = c->ssx;
-        if (c->ssy > ssymax) ssymax = c->ssy;
+
+    /* divided rather than multiplied, header values can overflow the product */
+    lc_uint64_t last_row = (lc_uint64_t)(layout->height - 1);
+    if (last_row > (size - layout->first_row - pixel_bytes) / row_size) {
+        return 0;
     }
-    if (nj.ncomp == 1) {
-        c = nj.comp;
-        c->ssx = c->ssy = ssxmax = ssymax = 1;
+
+    layout->rows = data + layout->first_row;
+    if (layout->row_stride < 0) {
+        layout->rows += last_row * row_size;
     }
-    nj.mbsizex = ssxmax << 3;
-    nj.mbsizey = ssymax << 3;
-    nj.mbwidth = (nj.width + nj.mbsizex - 1) / nj.mbsizex;
-    nj.mbheight = (nj.height + nj.mbsizey - 1) / nj.mbsizey;
-    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
-        c->width = (nj.width * c->ssx + ssxmax - 1) / ssxmax;
-        c->height = (nj.height * c->ssy + ssymax - 1) / ssymax;
-        c->stride = nj.mbwidth * c->ssx << 3;
-        if (((c->width < 3) && (c->ssx != ssxmax)) || ((c->height < 3) && (c->ssy != ssymax))) njThrow(NJ_UNSUPPORTED);
-        if (!(c->pixels = (unsigned char*) njAllocMem(c->stride * nj.mbheight * c->ssy << 3))) njThrow(NJ_OUT_OF_MEM);
+
+    return 1;
+}
+
+/* lc_raw_channel_count: the channels of a load, 0 takes those of the image */
+static int lc_raw_channel_count(const lc_raw_layout* layout, int req_channel_count)
+{
+    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
+    return (req_channel_count <= 0) ? layout->channel_count : req_channel_count;
+}
+
+/* lc_raw_in_place: 1 if the stored rows already are 8 bit top down rows of dst_channel_count channels */
+static int lc_raw_in_place(const lc_raw_layout* layout, int dst_channel_count)
+{
+    if ((dst_channel_count != layout->channel_count) || (dst_channel_count != layout->pixel_size) ||
+        (255 != layout->max_value) || (NULL != layout->palette) || (layout->row_stride <= 0)) {
+        return 0;
     }
-    if (nj.ncomp == 3) {
-        nj.rgb = (unsigned char*) njAllocMem(nj.width * nj.height * nj.ncomp);
-        if (!nj.rgb) njThrow(NJ_OUT_OF_MEM);
+
+    for (int c = 0; c < dst_channel_count; ++c) {
+        if (c != layout->offsets[c]) {
+            return 0;
+        }
     }
-    njSkip(nj.length);
+
+    return 1;
 }
 
-NJ_INLINE void njDecodeDHT(void) {
-    int codelen, currcnt, remain, spread, i, j;
-    nj_vlc_code_t *vlc;
-    static unsigned char counts[16];
-    njDecodeLength();
-    njCheckError();
-    while (nj.length >= 17) {
-        i = nj.pos[0];
-        if (i & 0xEC) njThrow(NJ_SYNTAX_ERROR);
-        if (i & 0x02) njThrow(NJ_UNSUPPORTED);
-        i = (i | (i >> 3)) & 3;  /* combined DC/AC + tableid value */
-        for (codelen = 1;  codelen <= 16;  ++codelen)
-            counts[codelen - 1] = nj.pos[codelen];
-        njSkip(17);
-        vlc = &nj.vlctab[i][0];
-        remain = spread = 65536;
-        for (codelen = 1;  codelen <= 16;  ++codelen) {
-            spread >>= 1;
-            currcnt = counts[codelen - 1];
-            if (!currcnt) continue;
-            if (nj.length < currcnt) njThrow(NJ_SYNTAX_ERROR);
-            remain -= currcnt << (16 - codelen);
-            if (remain < 0) njThrow(NJ_SYNTAX_ERROR);
-            for (i = 0;  i < currcnt;  ++i) {
-                // NOTE: Clang warns that register is deprecated
-                //register unsigned char code = nj.pos[i];
-                unsigned char code = nj.pos[i];
-                for (j = spread;  j;  --j) {
-                    vlc->bits = (unsigned char) codelen;
-                    vlc->code = code;
-                    ++vlc;
+/* lc_raw_sample: channel c of the stored pixel p, scaled to 8 bits */
+static lc_data_t lc_raw_sample(const lc_raw_layout* layout, const lc_data_t* p, int c)
+{
+    if (NULL != layout->palette) {
+        /* palettes are stored BGR */
+        int index = *p;
+        if (index >= layout->palette_size) {
+            return 0;
+        }
+
+        const lc_data_t* entry = layout->palette + 4 * index;
+        return (1 == layout->channel_count) ? entry[0] : entry[2 - c];
+    }
+
+    p += layout->offsets[c];
+    if (layout->max_value > 255) {
+        lc_uint64_t value = LC_MATH_MIN((lc_uint64_t)((p[0] << 8) | p[1]), (lc_uint64_t)layout->max_value);
+        return (lc_data_t)((value * 255 + layout->max_value / 2) / layout->max_value);
+    }
+
+    if (layout->max_value < 255) {
+        lc_uint64_t value = LC_MATH_MIN((lc_uint64_t)p[0], (lc_uint64_t)layout->max_value);
+        return (lc_data_t)((value * 255 + layout->max_value / 2) / layout->max_value);
+    }
+
+    return *p;
+}
+
+/*
+ lc_raw_convert: the rows of layout as packed 8 bit rows of dst_channel_count channels. Channel
+ counts that differ from the image take the first channels of its RGBA expansion, as PNGs do.
+*/
+static void lc_raw_convert(const lc_raw_layout* layout, lc_data_t* dst, int dst_channel_count)
+{
+    int src_channel_count = layout->channel_count;
+    int simple = (255 == layout->max_value) && (NULL == layout->palette);
+    const lc_data_t* src_row = layout->rows;
+    for (int y = 0; y < layout->height; ++y) {
+        const lc_data_t* src_pixel = src_row;
+        if (simple && (src_channel_count == dst_channel_count)) {
+            for (int x = 0; x < layout->width; ++x) {
+                for (int c = 0; c < dst_channel_count; ++c) {
+                    dst[c] = src_pixel[layout->offsets[c]];
                 }
+                src_pixel += layout->pixel_size;
+                dst += dst_channel_count;
             }
-            njSkip(currcnt);
         }
-        while (remain--) {
-            vlc->bits = 0;
-            ++vlc;
+        else {
+            for (int x = 0; x < layout->width; ++x) {
+                lc_data_t samples[4] = { 0, 0, 0, 0xFF };
+                for (int c = 0; c < src_channel_count; ++c) {
+                    samples[c] = lc_raw_sample(layout, src_pixel, c);
+                }
+
+                if ((src_channel_count != dst_channel_count) && (src_channel_count <= 2)) {
+                    /* grey, grey alpha to RGBA */
+                    samples[3] = (2 == src_channel_count) ? samples[1] : 0xFF;
+                    samples[1] = samples[0];
+                    samples[2] = samples[0];
+                }
+
+                for (int c = 0; c < dst_channel_count; ++c) {
+                    dst[c] = samples[c];
+                }
+                src_pixel += layout->pixel_size;
+                dst += dst_channel_count;
+            }
         }
+        src_row += layout->row_stride;
     }
-    if (nj.length) njThrow(NJ_SYNTAX_ERROR);
 }
 
-NJ_INLINE void njDecodeDQT(void) {
-    int i;
-    unsigned char *t;
-    njDecodeLength();
-    njCheckError();
-    while (nj.length >= 65) {
-        i = nj.pos[0];
-        if (i & 0xFC) njThrow(NJ_SYNTAX_ERROR);
-        nj.qtavail |= 1 << i;
-        t = &nj.qtab[i][0];
-        for (i = 0;  i < 64;  ++i)
-            t[i] = nj.pos[i + 1];
-        njSkip(65);
+/* lc_raw_probe: lc_codec.probe for a parser */
+static int lc_raw_probe(lc_raw_parse_fn parse, lc_uint64_t size, const lc_data_t* data, 
+                        int* width, int* height, int* channel_count)
+{
+    lc_raw_layout layout;
+    int status = parse(size, data, &layout);
+    if (status < 0) {
+        return 0;
     }
-    if (nj.length) njThrow(NJ_SYNTAX_ERROR);
+
+    if (0 == status) {
+        return lc_set_probe_result(width, height, channel_count, 0, 0, 0);
+    }
+
+    return lc_set_probe_result(width, height, channel_count, layout.width, layout.height, layout.channel_count);
 }
 
-NJ_INLINE void njDecodeDRI(void) {
-    njDecodeLength();
-    njCheckError();
-    if (nj.length < 2) njThrow(NJ_SYNTAX_ERROR);
-    nj.rstinterval = njDecode16(nj.pos);
-    njSkip(nj.length);
+/* lc_raw_load_into: lc_codec.decode_into for a parser, pixels NULL allocates them */
+static lc_data_t* lc_raw_load_into(lc_raw_parse_fn parse, lc_uint64_t size, const lc_data_t* data,
+                                   lc_data_t* pixels, lc_uint64_t capacity,
+                                   int* width, int* height, int* channel_count, int req_channel_count)
+{
+    lc_raw_layout layout;
+    if ((1 != parse(size, data, &layout)) || (! lc_raw_rows_fit(&layout, size, data))) {
+        return NULL;
+    }
+
+    int dst_channel_count = lc_raw_channel_count(&layout, req_channel_count);
+    lc_set_probe_result(width, height, channel_count, layout.width, layout.height, dst_channel_count);
+
+    lc_uint64_t result_size = (lc_uint64_t)layout.width * layout.height * dst_channel_count;
+    lc_data_t* result = pixels;
+    if (NULL == result) {
+        result = (lc_data_t*)malloc((size_t)result_size);
+        assert(NULL != result);
+    }
+    else if (result_size > capacity) {
+        return NULL;
+    }
+
+    lc_raw_convert(&layout, result, dst_channel_count);
+
+    return result;
 }
 
-static int njGetVLC(nj_vlc_code_t* vlc, unsigned char* code) {
-    int value = njShowBits(16);
-    int bits = vlc[value].bits;
-    if (!bits) { nj.error = NJ_SYNTAX_ERROR; return 0; }
-    njSkipBits(bits);
-    value = vlc[value].code;
-    if (code) *code = (unsigned char) value;
-    bits = value & 15;
-    if (!bits) return 0;
-    value = njGetBits(bits);
-    if (value < (1 << (bits - 1)))
-        value += ((-1) << bits) + 1;
-    return value;
+/* lc_pnm_space: PNM headers separate their fields with ASCII white space */
+static int lc_pnm_space(lc_data_t c)
+{
+    return ((' ' == c) || ('\t' == c) || ('\n' == c) || ('\v' == c) || ('\f' == c) || ('\r' == c)) ? 1 : 0;
 }
 
-NJ_INLINE void njDecodeBlock(nj_component_t* c, unsigned char* out) {
-    unsigned char code = 0;
-    int value, coef = 0;
-    njFillMem(nj.block, 0, sizeof(nj.block));
-    c->dcpred += njGetVLC(&nj.vlctab[c->dctabsel][0], NULL);
-    nj.block[0] = (c->dcpred) * nj.qtab[c->qtsel][0];
-    do {
-        value = njGetVLC(&nj.vlctab[c->actabsel][0], &code);
-        if (!code) break;  /* EOB */
-        if (!(code & 0x0F) && (code != 0xF0)) njThrow(NJ_SYNTAX_ERROR);
-        coef += (code >> 4) + 1;
-        if (coef > 63) njThrow(NJ_SYNTAX_ERROR);
-        nj.block[(int) njZZ[coef]] = value * nj.qtab[c->qtsel][coef];
-    } while (coef < 63);
-    for (coef = 0;  coef < 64;  coef += 8)
-        njRowIDCT(&nj.block[coef]);
-    for (coef = 0;  coef < 8;  ++coef)
-        njColIDCT(&nj.block[coef], &out[coef], c->stride);
+/*
+ lc_pnm_number: the next decimal number of a PNM header at *pos, after white space and comments.
+ Returns -1 if there is none, 0 if the header is cut short.
+*/
+static int lc_pnm_number(lc_uint64_t size, const lc_data_t* data, lc_uint64_t* pos, int* value)
+{
+    lc_uint64_t p = *pos;
+    for (;;) {
+        while ((p < size) && lc_pnm_space(data[p])) {
+            ++p;
+        }
+
+        if ((p < size) && ('#' == data[p])) {
+            while ((p < size) && ('\n' != data[p])) {
+                ++p;
+            }
+            continue;
+        }
+        break;
+    }
+
+    lc_uint64_t number = 0;
+    lc_uint64_t start = p;
+    while ((p < size) && (data[p] >= '0') && (data[p] <= '9')) {
+        number = number * 10 + (data[p] - '0');
+        if (number > 0x7FFFFFFF) {
+            return -1;
+        }
+        ++p;
+    }
+
+    if (p == size) {
+        return 0;
+    }
+
+    if ((p == start) || ! lc_pnm_space(data[p])) {
+        return -1;
+    }
+
+    *pos = p;
+    *value = (int)number;
+    return 1;
 }
 
-NJ_INLINE void njDecodeScan(void) {
-    int i, mbx, mby, sbx, sby;
-    int rstcount = nj.rstinterval, nextrst = 0;
-    nj_component_t* c;
-    njDecodeLength();
-    njCheckError();
-    if (nj.length < (4 + 2 * nj.ncomp)) njThrow(NJ_SYNTAX_ERROR);
-    if (nj.pos[0] != nj.ncomp) njThrow(NJ_UNSUPPORTED);
-    njSkip(1);
-    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
-        if (nj.pos[0] != c->cid) njThrow(NJ_SYNTAX_ERROR);
-        if (nj.pos[1] & 0xEE) njThrow(NJ_SYNTAX_ERROR);
-        c->dctabsel = nj.pos[1] >> 4;
-        c->actabsel = (nj.pos[1] & 1) | 2;
-        njSkip(2);
+/* lc_pam_token: 1 if the PAM header line at *pos starts with the keyword token, which is skipped */
+static int lc_pam_token(lc_uint64_t size, const lc_data_t* data, lc_uint64_t* pos, const char* token)
+{
+    lc_uint64_t length = strlen(token);
+    if ((*pos + length >= size) || (0 != memcmp(data + *pos, token, (size_t)length)) || ! lc_pnm_space(data[*pos + length])) {
+        return 0;
     }
-    if (nj.pos[0] || (nj.pos[1] != 63) || nj.pos[2]) njThrow(NJ_UNSUPPORTED);
-    njSkip(nj.length);
-    for (mbx = mby = 0;;) {
-        for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c)
-            for (sby = 0;  sby < c->ssy;  ++sby)
-                for (sbx = 0;  sbx < c->ssx;  ++sbx) {
-                    njDecodeBlock(c, &c->pixels[((mby * c->ssy + sby) * c->stride + mbx * c->ssx + sbx) << 3]);
-                    njCheckError();
+
+    *pos += length;
+    return 1;
+}
+
+/* lc_parse_pnm: binary PGM (P5), PPM (P6) and PAM (P7) */
+static int lc_parse_pnm(lc_uint64_t size, const lc_data_t* data, lc_raw_layout* layout)
+{
+    if ((size < 3) || ('P' != data[0]) || (data[1] < '5') || (data[1] > '7') || ! lc_pnm_space(data[2])) {
+        return -1;
+    }
+
+    int width = 0;
+    int height = 0;
+    int channel_count = ('6' == data[1]) ? 3 : 1;
+    int max_value = 0;
+    lc_uint64_t pos = 2;
+    int status = 1;
+    if ('7' != data[1]) {
+        status = lc_pnm_number(size, data, &pos, &width);
+        status = (1 == status) ? lc_pnm_number(size, data, &pos, &height) : status;
+        status = (1 == status) ? lc_pnm_number(size, data, &pos, &max_value) : status;
+        if (1 != status) {
+            return status;
+        }
+
+        /* a single white space character ends the header */
+        ++pos;
+    }
+    else {
+        channel_count = 0;
+        for (;;) {
+            while ((pos < size) && lc_pnm_space(data[pos])) {
+                ++pos;
+            }
+
+            if (pos == size) {
+                return 0;
+            }
+
+            if ('#' == data[pos]) {
+                while ((pos < size) && ('\n' != data[pos])) {
+                    ++pos;
                 }
-        if (++mbx >= nj.mbwidth) {
-            mbx = 0;
-            if (++mby >= nj.mbheight) break;
+                continue;
+            }
+
+            if (lc_pam_token(size, data, &pos, "ENDHDR")) {
+                while ((pos < size) && ('\n' != data[pos])) {
+                    ++pos;
+                }
+
+                if (pos == size) {
+                    return 0;
+                }
+                ++pos;
+                break;
+            }
+
+            if (lc_pam_token(size, data, &pos, "TUPLTYPE")) {
+                /* the channel count follows from DEPTH */
+                while ((pos < size) && ('\n' != data[pos])) {
+                    ++pos;
+                }
+                continue;
+            }
+
+            int* value = NULL;
+            if (lc_pam_token(size, data, &pos, "WIDTH")) {
+                value = &width;
+            }
+            else if (lc_pam_token(size, data, &pos, "HEIGHT")) {
+                value = &height;
+            }
+            else if (lc_pam_token(size, data, &pos, "DEPTH")) {
+                value = &channel_count;
+            }
+            else if (lc_pam_token(size, data, &pos, "MAXVAL")) {
+                value = &max_value;
+            }
+            else {
+                /* a keyword cut short is not an error yet */
+                return (size - pos < 9) ? 0 : -1;
+            }
+
+            status = lc_pnm_number(size, data, &pos, value);
+            if (1 != status) {
+                return status;
+            }
         }
-        if (nj.rstinterval && !(--rstcount)) {
-            njByteAlign();
-            i = njGetBits(16);
-            if (((i & 0xFFF8) != 0xFFD0) || ((i & 7) != nextrst)) njThrow(NJ_SYNTAX_ERROR);
-            nextrst = (nextrst + 1) & 7;
-            rstcount = nj.rstinterval;
-            for (i = 0;  i < 3;  ++i)
-                nj.comp[i].dcpred = 0;
+    }
+
+    if ((width <= 0) || (height <= 0) || (channel_count < 1) || (channel_count > 4) || 
+        (max_value < 1) || (max_value > 65535)) {
+        return -1;
+    }
+
+    lc_raw_layout_init(layout, width, height, channel_count);
+    layout->max_value = max_value;
+    if (max_value > 255) {
+        layout->pixel_size = 2 * channel_count;
+        for (int c = 0; c < 4; ++c) {
+            layout->offsets[c] = 2 * c;
         }
     }
-    nj.error = __NJ_FINISHED;
+    lc_raw_set_rows(layout, pos, (lc_uint64_t)width * layout->pixel_size, 0);
+
+    return 1;
 }
 
-#if NJ_CHROMA_FILTER
+/*
+ lc_parse_bmp: BMPs with a Windows header (40 bytes or more) and 8 bit palette, 24 bit or 32 bit
+ pixels, uncompressed or as byte aligned bit fields
+*/
+static int lc_parse_bmp(lc_uint64_t size, const lc_data_t* data, lc_raw_layout* layout)
+{
+    if ((size < 2) || ('B' != data[0]) || ('M' != data[1])) {
+        return -1;
+    }
 
-#define CF4A (-9)
-#define CF4B (111)
-#define CF4C (29)
-#define CF4D (-3)
-#define CF3A (28)
-#define CF3B (109)
-#define CF3C (-9)
-#define CF3X (104)
-#define CF3Y (27)
-#define CF3Z (-3)
-#define CF2A (139)
-#define CF2B (-11)
-#define CF(x) njClip(((x) + 64) >> 7)
+    if (size < 14 + 40) {
+        return 0;
+    }
 
-NJ_INLINE void njUpsampleH(nj_component_t* c) {
-    const int xmax = c->width - 3;
-    unsigned char *out, *lin, *lout;
-    int x, y;
-    out = (unsigned char*) njAllocMem((c->width * c->height) << 1);
-    if (!out) njThrow(NJ_OUT_OF_MEM);
-    lin = c->pixels;
-    lout = out;
-    for (y = c->height;  y;  --y) {
-        lout[0] = CF(CF2A * lin[0] + CF2B * lin[1]);
-        lout[1] = CF(CF3X * lin[0] + CF3Y * lin[1] + CF3Z * lin[2]);
-        lout[2] = CF(CF3A * lin[0] + CF3B * lin[1] + CF3C * lin[2]);
-        for (x = 0;  x < xmax;  ++x) {
-            lout[(x << 1) + 3] = CF(CF4A * lin[x] + CF4B * lin[x + 1] + CF4C * lin[x + 2] + CF4D * lin[x + 3]);
-            lout[(x << 1) + 4] = CF(CF4D * lin[x] + CF4C * lin[x + 1] + CF4B * lin[x + 2] + CF4A * lin[x + 3]);
-        }
-        lin += c->stride;
-        lout += c->width << 1;
-        lout[-3] = CF(CF3A * lin[-1] + CF3B * lin[-2] + CF3C * lin[-3]);
-        lout[-2] = CF(CF3X * lin[-1] + CF3Y * lin[-2] + CF3Z * lin[-3]);
-        lout[-1] = CF(CF2A * lin[-1] + CF2B * lin[-2]);
+    lc_uint64_t pixel_offset = lc_read_le32(data + 10);
+    lc_uint64_t header_size = lc_read_le32(data + 14);
+    long long width = (long long)(int)lc_read_le32(data + 18);
+    long long height = (long long)(int)lc_read_le32(data + 22);
+    int planes = (int)lc_read_le16(data + 26);
+    int bit_count = (int)lc_read_le16(data + 28);
+    lc_uint64_t compression = lc_read_le32(data + 30);
+    lc_uint64_t colors_used = lc_read_le32(data + 46);
+    int bottom_up = (height > 0) ? 1 : 0;
+    height = bottom_up ? height : -height;
+    if ((header_size < 40) || (header_size > 1024) || (1 != planes) || 
+        (width <= 0) || (width > 0x7FFFFFFF) || (height <= 0) || (height > 0x7FFFFFFF)) {
+        return -1;
     }
-    c->width <<= 1;
-    c->stride = c->width;
-    njFreeMem((void*)c->pixels);
-    c->pixels = out;
-}
 
-NJ_INLINE void njUpsampleV(nj_component_t* c) {
-    const int w = c->width, s1 = c->stride, s2 = s1 + s1;
-    unsigned char *out, *cin, *cout;
-    int x, y;
-    out = (unsigned char*) njAllocMem((c->width * c->height) << 1);
-    if (!out) njThrow(NJ_OUT_OF_MEM);
-    for (x = 0;  x < w;  ++x) {
-        cin = &c->pixels[x];
-        cout = &out[x];
-        *cout = CF(CF2A * cin[0] + CF2B * cin[s1]);  cout += w;
-        *cout = CF(CF3X * cin[0] + CF3Y * cin[s1] + CF3Z * cin[s2]);  cout += w;
-        *cout = CF(CF3A * cin[0] + CF3B * cin[s1] + CF3C * cin[s2]);  cout += w;
-        cin += s1;
-        for (y = c->height - 3;  y;  --y) {
-            *cout = CF(CF4A * cin[-s1] + CF4B * cin[0] + CF4C * cin[s1] + CF4D * cin[s2]);  cout += w;
-            *cout = CF(CF4D * cin[-s1] + CF4C * cin[0] + CF4B * cin[s1] + CF4A * cin[s2]);  cout += w;
-            cin += s1;
+    /* BI_RGB, BI_BITFIELDS or BI_ALPHABITFIELDS */
+    if ((0 != compression) && (3 != compression) && (6 != compression)) {
+        return -1;
+    }
+
+    lc_raw_layout_init(layout, (int)width, (int)height, 3);
+    if (8 == bit_count) {
+        if (0 != compression) {
+            return -1;
+        }
+
+        lc_uint64_t palette_offset = 14 + header_size;
+        int palette_size = (0 == colors_used) ? 256 : (int)LC_MATH_MIN(colors_used, (lc_uint64_t)256);
+        if (palette_offset + 4 * (lc_uint64_t)palette_size > size) {
+            return 0;
+        }
+
+        /* grey palettes load as one channel, in place if they map each index to itself */
+        const lc_data_t* palette = data + palette_offset;
+        int grey = 1;
+        int identity = 1;
+        for (int i = 0; i < palette_size; ++i) {
+            const lc_data_t* entry = palette + 4 * i;
+            grey = grey && (entry[0] == entry[1]) && (entry[1] == entry[2]);
+            identity = identity && (entry[0] == i);
+        }
+
+        layout->channel_count = grey ? 1 : 3;
+        layout->pixel_size = 1;
+        if (! (grey && identity)) {
+            layout->palette = palette;
+            layout->palette_size = palette_size;
         }
-        cin += s1;
-        *cout = CF(CF3A * cin[0] + CF3B * cin[-s1] + CF3C * cin[-s2]);  cout += w;
-        *cout = CF(CF3X * cin[0] + CF3Y * cin[-s1] + CF3Z * cin[-s2]);  cout += w;
-        *cout = CF(CF2A * cin[0] + CF2B * cin[-s1]);
     }
-    c->height <<= 1;
-    c->stride = c->width;
-    njFreeMem((void*) c->pixels);
-    c->pixels = out;
-}
+    else if ((24 == bit_count) && (0 == compression)) {
+        /* BGR */
+        layout->offsets[0] = 2;
+        layout->offsets[2] = 0;
+    }
+    else if (32 == bit_count) {
+        /* BGRX, or the byte of each channel from its mask */
+        layout->pixel_size = 4;
+        layout->offsets[0] = 2;
+        layout->offsets[2] = 0;
+        if (0 != compression) {
+            /* masks follow a 40 byte header, larger headers hold them; alpha needs a 56 byte one */
+            lc_uint64_t mask_offset = 14 + 40;
+            int mask_count = ((header_size >= 56) || (6 == compression)) ? 4 : 3;
+            if (mask_offset + 4 * mask_count > size) {
+                return 0;
+            }
+
+            lc_uint64_t masks[4] = { 0, 0, 0, 0 };
+            for (int c = 0; c < mask_count; ++c) {
+                masks[c] = lc_read_le32(data + mask_offset + 4 * c);
+            }
+
+            layout->channel_count = (0 != masks[3]) ? 4 : 3;
+            for (int c = 0; c < layout->channel_count; ++c) {
+                int offset = 0;
+                while ((offset < 4) && (masks[c] != ((lc_uint64_t)0xFF << (8 * offset)))) {
+                    ++offset;
+                }
+
+                if (4 == offset) {
+                    return -1;
+                }
+                layout->offsets[c] = offset;
+            }
+        }
+    }
+    else {
+        return -1;
+    }
 
-#else
+    /* rows are padded to 4 bytes */
+    lc_uint64_t row_size = (((lc_uint64_t)width * bit_count + 31) / 32) * 4;
+    lc_raw_set_rows(layout, pixel_offset, row_size, bottom_up);
 
-NJ_INLINE void njUpsample(nj_component_t* c) {
-    int x, y, xshift = 0, yshift = 0;
-    unsigned char *out, *lin, *lout;
-    while (c->width < nj.width) { c->width <<= 1; ++xshift; }
-    while (c->height < nj.height) { c->height <<= 1; ++yshift; }
-    out = (unsigned char*) njAllocMem(c->width * c->height);
-    if (!out) njThrow(NJ_OUT_OF_MEM);
-    lin = c->pixels;
-    lout = out;
-    for (y = 0;  y < c->height;  ++y) {
-        lin = &c->pixels[(y >> yshift) * c->stride];
-        for (x = 0;  x < c->width;  ++x)
-            lout[x] = lin[x >> xshift];
-        lout += c->width;
-    }
-    c->stride = c->width;
-    njFreeMem((void*) c->pixels);
-    c->pixels = out;
+    return 1;
 }
 
-#endif
+/* lc_parse_tga: uncompressed true color (24, 32 bit) and grey (8, 16 bit) TGAs without color map */
+static int lc_parse_tga(lc_uint64_t size, const lc_data_t* data, lc_raw_layout* layout)
+{
+    if (size < 3) {
+        return 0;
+    }
 
-NJ_INLINE void njConvert(void) {
-    int i;
-    nj_component_t* c;
-    for (i = 0, c = nj.comp;  i < nj.ncomp;  ++i, ++c) {
-        #if NJ_CHROMA_FILTER
-            while ((c->width < nj.width) || (c->height < nj.height)) {
-                if (c->width < nj.width) njUpsampleH(c);
-                njCheckError();
-                if (c->height < nj.height) njUpsampleV(c);
-                njCheckError();
-            }
-        #else
-            if ((c->width < nj.width) || (c->height < nj.height))
-                njUpsample(c);
-        #endif
-        if ((c->width < nj.width) || (c->height < nj.height)) njThrow(NJ_INTERNAL_ERR);
+    int id_size = data[0];
+    int color_map_type = data[1];
+    int image_type = data[2];
+    if ((0 != color_map_type) || ((2 != image_type) && (3 != image_type))) {
+        return -1;
     }
-    if (nj.ncomp == 3) {
-        /* convert to RGB */
-        int x, yy;
-        unsigned char *prgb = nj.rgb;
-        const unsigned char *py  = nj.comp[0].pixels;
-        const unsigned char *pcb = nj.comp[1].pixels;
-        const unsigned char *pcr = nj.comp[2].pixels;
-        for (yy = nj.height;  yy;  --yy) {
-            for (x = 0;  x < nj.width;  ++x) {
-                // NOTE: Clang warns that register is deprecated
-                //register int y = py[x] << 8;
-                //register int cb = pcb[x] - 128;
-                //register int cr = pcr[x] - 128;
-                int y = py[x] << 8;
-                int cb = pcb[x] - 128;
-                int cr = pcr[x] - 128;
-                *prgb++ = njClip((y            + 359 * cr + 128) >> 8);
-                *prgb++ = njClip((y -  88 * cb - 183 * cr + 128) >> 8);
-                *prgb++ = njClip((y + 454 * cb            + 128) >> 8);
-            }
-            py += nj.comp[0].stride;
-            pcb += nj.comp[1].stride;
-            pcr += nj.comp[2].stride;
-        }
-    } else if (nj.comp[0].width != nj.comp[0].stride) {
-        /* grayscale -> only remove stride */
-        unsigned char *pin = &nj.comp[0].pixels[nj.comp[0].stride];
-        unsigned char *pout = &nj.comp[0].pixels[nj.comp[0].width];
-        int y;
-        for (y = nj.comp[0].height - 1;  y;  --y) {
-            njCopyMem(pout, pin, nj.comp[0].width);
-            pin += nj.comp[0].stride;
-            pout += nj.comp[0].width;
+
+    /* the color map specification is unused without a color map */
+    for (lc_uint64_t i = 3; i < LC_MATH_MIN(size, (lc_uint64_t)8); ++i) {
+        if (0 != data[i]) {
+            return -1;
         }
-        nj.comp[0].stride = nj.comp[0].width;
     }
+
+    if (size < 18) {
+        return 0;
+    }
+
+    int width = (int)lc_read_le16(data + 12);
+    int height = (int)lc_read_le16(data + 14);
+    int bit_count = data[16];
+    int descriptor = data[17];
+    int alpha_bits = descriptor & 0x0F;
+    if ((0 == width) || (0 == height) || (0 != (descriptor & 0xD0))) {
+        /* right to left and interleaved rows are not supported */
+        return -1;
+    }
+
+    lc_raw_layout_init(layout, width, height, 1);
+    if ((3 == image_type) && (8 == bit_count) && (0 == alpha_bits)) {
+        /* grey */
+    }
+    else if ((3 == image_type) && (16 == bit_count) && (8 == alpha_bits)) {
+        layout->channel_count = 2;
+        layout->pixel_size = 2;
+    }
+    else if ((2 == image_type) && (24 == bit_count) && (0 == alpha_bits)) {
+        /* BGR */
+        layout->channel_count = 3;
+        layout->pixel_size = 3;
+        layout->offsets[0] = 2;
+        layout->offsets[2] = 0;
+    }
+    else if ((2 == image_type) && (32 == bit_count) && ((0 == alpha_bits) || (8 == alpha_bits))) {
+        /* BGRA, or BGRX without alpha bits */
+        layout->channel_count = (8 == alpha_bits) ? 4 : 3;
+        layout->pixel_size = 4;
+        layout->offsets[0] = 2;
+        layout->offsets[2] = 0;
+    }
+    else {
+        return -1;
+    }
+
+    int bottom_up = (0 == (descriptor & 0x20)) ? 1 : 0;
+    lc_raw_set_rows(layout, 18 + id_size, (lc_uint64_t)width * layout->pixel_size, bottom_up);
+
+    return 1;
 }
 
-static void njInit(void) 
+static int lc_probe_pnm(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count)
 {
-    njFillMem(&nj, 0, sizeof(nj_context_t));
+    return lc_raw_probe(lc_parse_pnm, size, data, width, height, channel_count);
 }
 
-static void njDone(void) 
+static int lc_probe_bmp(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count)
 {
-    int i;
-    for (i = 0;  i < 3;  ++i)
-        if (nj.comp[i].pixels) njFreeMem((void*) nj.comp[i].pixels);
-    if (nj.rgb) njFreeMem((void*) nj.rgb);
-    njInit();
+    return lc_raw_probe(lc_parse_bmp, size, data, width, height, channel_count);
 }
 
-static nj_result_t njDecode(const void* jpeg, const int size) 
+static int lc_probe_tga(lc_uint64_t size, const lc_data_t* data, int* width, int* height, int* channel_count)
 {
-    njDone();
-    nj.pos = (const unsigned char*) jpeg;
-    nj.size = size & 0x7FFFFFFF;
-    if (nj.size < 2) return NJ_NO_JPEG;
-    if ((nj.pos[0] ^ 0xFF) | (nj.pos[1] ^ 0xD8)) return NJ_NO_JPEG;
-    njSkip(2);
-    while (!nj.error) {
-        if ((nj.size < 2) || (nj.pos[0] != 0xFF)) return NJ_SYNTAX_ERROR;
-        njSkip(2);
-        switch (nj.pos[-1]) {
-            case 0xC0: njDecodeSOF();  break;
-            case 0xC4: njDecodeDHT();  break;
-            case 0xDB: njDecodeDQT();  break;
-            case 0xDD: njDecodeDRI();  break;
-            case 0xDA: njDecodeScan(); break;
-            case 0xFE: njSkipMarker(); break;
-            default:
-                if ((nj.pos[-1] & 0xF0) == 0xE0)
-                    njSkipMarker();
-                else
-                    return NJ_UNSUPPORTED;
-        }
-    }
-    if (nj.error != __NJ_FINISHED) return nj.error;
-    nj.error = NJ_OK;
-    njConvert();
-    return nj.error;
+    return lc_raw_probe(lc_parse_tga, size, data, width, height, channel_count);
 }
 
-static int njGetWidth(void)            { return nj.width; }
-static int njGetHeight(void)           { return nj.height; }
-static int njIsColor(void)             { return (nj.ncomp != 1); }
-static unsigned char* njGetImage(void) { return (nj.ncomp == 1) ? nj.comp[0].pixels : nj.rgb; }
-static int njGetImageSize(void)        { return nj.width * nj.height * nj.ncomp; }
+static lc_data_t* lc_load_image_pnm(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
+{
+    (void)options;
+    return lc_raw_load_into(lc_parse_pnm, size, data, NULL, 0, width, height, channel_count, req_channel_count);
+}
 
-/**************************************************************************************************/
-/* PNG                                                                                            */
-/**************************************************************************************************/
-#define LODEPNG_COMPILE_PNG
-#define LODEPNG_COMPILE_DECODER
-#define LODEPNG_COMPILE_ZLIB
+static lc_data_t* lc_load_image_bmp(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
+{
+    (void)options;
+    return lc_raw_load_into(lc_parse_bmp, size, data, NULL, 0, width, height, channel_count, req_channel_count);
+}
 
-/* The PNG color types (also used for raw). */
-typedef enum LodePNGColorType
+static lc_data_t* lc_load_image_tga(lc_uint64_t size, const lc_data_t* data,
+                                    int* width, int* height, int* channel_count, 
+                                    int req_channel_count, const lc_load_options* options)
 {
-  LCT_GREY       = 0, /* greyscale: 1,2,4,8,16 bit */
-  LCT_RGB        = 2, /* RGB: 8,16 bit */
-  LCT_PALETTE    = 3, /* palette: 1,2,4,8 bit */
-  LCT_GREY_ALPHA = 4, /* greyscale with alpha: 8,16 bit */
-  LCT_RGBA       = 6  /* RGB with alpha: 8,16 bit */
-} LodePNGColorType;
+    (void)options;
+    return lc_raw_load_into(lc_parse_tga, size, data, NULL, 0, width, height, channel_count, req_channel_count);
+}
 
-/*
- Color mode of an image. Contains all information required to decode the pixel
- bits to RGBA colors. This information is the same as used in the PNG file
- format, and is used both for PNG and raw image data in LodePNG.
-*/
-typedef struct LodePNGColorMode
+static int lc_load_image_pnm_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options)
 {
-    /* header (IHDR) */
-    LodePNGColorType colortype; /* color type, see PNG standard or documentation further in this header file */
-    unsigned bitdepth;          /* bits per sample, see PNG standard or documentation further in this header file */
+    (void)options;
+    return (NULL != lc_raw_load_into(lc_parse_pnm, size, data, pixels, capacity, 
+                                     width, height, channel_count, req_channel_count)) ? 1 : 0;
+}
 
-    /*
-     palette (PLTE and tRNS)
-     Dynamically allocated with the colors of the palette, including alpha.
-     When encoding a PNG, to store your colors in the palette of the LodePNGColorMode, first use
-     lodepng_palette_clear, then for each color use lodepng_palette_add.
-     If you encode an image without alpha with palette, don't forget to put value 255 in each A byte of the palette.
-     When decoding, by default you can ignore this palette, since LodePNG already
-     fills the palette colors in the pixels of the raw RGBA output.
-     The palette is only supported for color type 3.
-    */
-    unsigned char* palette; /* palette in RGBARGBA... order. When allocated, must be either 0, or have size 1024 */
-    size_t palettesize;     /* palette size in number of colors (amount of bytes is 4 * palettesize) */
+static int lc_load_image_bmp_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options)
+{
+    (void)options;
+    return (NULL != lc_raw_load_into(lc_parse_bmp, size, data, pixels, capacity, 
+                                     width, height, channel_count, req_channel_count)) ? 1 : 0;
+}
 
-    /*
-     transparent color key (tRNS)
-     This color uses the same bit depth as the bitdepth value in this struct, which can be 1-bit to 16-bit.
-     For greyscale PNGs, r, g and b will all 3 be set to the same.
-     When decoding, by default you can ignore this information, since LodePNG sets
-     pixels with this key to transparent already in the raw RGBA output.
-     The color key is only supported for color types 0 and 2.
-    */
-    unsigned key_defined; /* is a transparent color key given? 0 = false, 1 = true */
-    unsigned key_r;       /* red/greyscale component of color key */
-    unsigned key_g;       /* green component of color key */
-    unsigned key_b;       /* blue component of color key */
-} LodePNGColorMode;
+static int lc_load_image_tga_into(lc_uint64_t size, const lc_data_t* data,
+                                  lc_data_t* pixels, lc_uint64_t capacity,
+                                  int* width, int* height, int* channel_count, 
+                                  int req_channel_count, const lc_load_options* options)
+{
+    (void)options;
+    return (NULL != lc_raw_load_into(lc_parse_tga, size, data, pixels, capacity, 
+                                     width, height, channel_count, req_channel_count)) ? 1 : 0;
+}
 
-/* Settings for zlib decompression */
-typedef struct LodePNGDecompressSettings
+/* lc_raw_parser: the parser of a built in uncompressed codec, NULL for other codecs */
+static lc_raw_parse_fn lc_raw_parser(const lc_codec* codec)
 {
-    /* if 1, continue and don't give an error message if the Adler32 checksum is corrupted */
-    unsigned ignore_adler32; 
+    if (&lc_codec_pnm == codec) {
+        return lc_parse_pnm;
+    }
 
-    /* use custom zlib decoder instead of built in one (default: null) */
-    unsigned (*custom_zlib)(unsigned char**, size_t*,
-                            const unsigned char*, size_t,
-                            const LodePNGDecompressSettings*);
-    /*
-     use custom deflate decoder instead of built in one (default: null)
-     if custom_zlib is used, custom_deflate is ignored since only the built in
-     zlib function will call custom_deflate
-    */
-    unsigned (*custom_inflate)(unsigned char**, size_t*,
-                               const unsigned char*, size_t,
-                               const LodePNGDecompressSettings*);
+    if (&lc_codec_bmp == codec) {
+        return lc_parse_bmp;
+    }
 
-  const void* custom_context; /*optional custom settings for custom functions*/
-} LodePNGDecompressSettings;
+    if (&lc_codec_tga == codec) {
+        return lc_parse_tga;
+    }
 
-/*
- Settings for the decoder. This contains settings for the PNG and the Zlib
- decoder, but not the Info settings from the Info structs.
-*/
-typedef struct LodePNGDecoderSettings
-{
-    LodePNGDecompressSettings zlibsettings;   /* in here is the setting to ignore Adler32 checksums */
-    unsigned ignore_crc;                      /* ignore CRC checksums */
-    unsigned color_convert;                   /* whether to convert the PNG to the color type you want. Default: yes */
-} LodePNGDecoderSettings;
+    return NULL;
+}
 
-/* Information about the PNG image, except pixels, width and height. */
-typedef struct LodePNGInfo
+int lc_map_image_mem(unsigned long long size, const unsigned char* data, lc_image_view* view,
+                     int req_channel_count, const lc_load_options* options)
 {
-    /* header (IHDR), palette (PLTE) and transparency (tRNS) chunks */
-    unsigned compression_method;/* compression method of the original file. Always 0. */
-    unsigned filter_method;     /* filter method of the original file */
-    unsigned interlace_method;  /* interlace method of the original file */
-    LodePNGColorMode color;     /* color type and bits, palette and transparency of the PNG file */
+    lc_load_options default_options;
+    if (NULL == options) {
+        lc_load_options_init(&default_options);
+        options = &default_options;
+    }
 
-#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
-    /*
-     suggested background color chunk (bKGD)
-     This color uses the same color mode as the PNG (except alpha channel), which can be 1-bit to 16-bit.
-     For greyscale PNGs, r, g and b will all 3 be set to the same. When encoding
-     the encoder writes the red one. For palette PNGs: When decoding, the RGB value
-     will be stored, not a palette index. But when encoding, specify the index of
-     the palette in background_r, the other two are then ignored.
-     The decoder does not use this background color to edit the color of pixels.
-    */
-    unsigned background_defined; /* is a suggested background color given?*/
-    unsigned background_r;       /* red component of suggested background color*/
-    unsigned background_g;       /* green component of suggested background color*/
-    unsigned background_b;       /* blue component of suggested background color*/
+    if (NULL == view) {
+        return 0;
+    }
 
-    /*
-     non-international text chunks (tEXt and zTXt)
-     The char** arrays each contain num strings. The actual messages are in
-     text_strings, while text_keys are keywords that give a short description what
-     the actual text represents, e.g. Title, Author, Description, or anything else.
-     A keyword is minimum 1 character and maximum 79 characters long. It's
-     discouraged to use a single line length longer than 79 characters for texts.
-     Don't allocate these text buffers yourself. Use the init/cleanup functions
-     correctly and use lodepng_add_text and lodepng_clear_text.
-    */
-    size_t text_num;     /* the amount of texts in these char** buffers (there may be more texts in itext) */
-    char** text_keys;    /* the keyword of a text chunk (e.g. "Comment") */
-    char** text_strings; /* the actual text */
+    memset(view, 0, sizeof(*view));
+    const lc_codec* codec = lc_find_codec(size, data, NULL, NULL, NULL);
+    if (NULL == codec) {
+        return 0;
+    }
 
-    /*
-     international text chunks (iTXt)
-     Similar to the non-international text chunks, but with additional strings
-     "langtags" and "transkeys".
-    */
-    size_t itext_num;       /* the amount of international texts in this PNG */
-    char** itext_keys;      /* the English keyword of the text chunk (e.g. "Comment") */
-    char** itext_langtags;  /* language tag for this text's language, ISO/IEC 646 string, e.g. ISO 639 language tag */
-    char** itext_transkeys; /* keyword translated to the international language - UTF-8 string */
-    char** itext_strings;   /* the actual international text - UTF-8 string */
+    lc_raw_parse_fn parse = lc_raw_parser(codec);
+    lc_raw_layout layout;
+    if ((NULL != parse) && (1 == parse(size, data, &layout)) && lc_raw_rows_fit(&layout, size, data) &&
+        lc_raw_in_place(&layout, lc_raw_channel_count(&layout, req_channel_count))) {
+        view->pixels = layout.rows;
+        view->width = layout.width;
+        view->height = layout.height;
+        view->channel_count = layout.channel_count;
+        view->row_stride = layout.row_stride;
+        view->zero_copy = 1;
+        return 1;
+    }
+
+    view->buffer = codec->decode(size, data, &view->width, &view->height, &view->channel_count, 
+                                 req_channel_count, options);
+    if (NULL == view->buffer) {
+        return 0;
+    }
 
-    /* time chunk (tIME) */
-    unsigned time_defined; /* set to 1 to make the encoder generate a tIME chunk */
-    LodePNGTime time;
+    view->pixels = view->buffer;
+    view->row_stride = (long long)view->width * view->channel_count;
+    return 1;
+}
 
-    /* phys chunk (pHYs) */
-    unsigned phys_defined; /* if 0, there is no pHYs chunk and the values below are undefined, if 1 else there is one */
-    unsigned phys_x;       /* pixels per unit in x direction */
-    unsigned phys_y;       /* pixels per unit in y direction */
-    unsigned phys_unit;    /* may be 0 (unknown unit) or 1 (metre) */
+int lc_map_image(const char* file_name, lc_image_view* view,
+                 int req_channel_count, const lc_load_options* options)
+{
+    lc_file_data file_data;
+    if ((NULL == view) || ! lc_open_file_data(file_name, &file_data)) {
+        return 0;
+    }
 
-    /*
-    unknown chunks
-    There are 3 buffers, one for each position in the PNG where unknown chunks can appear
-    each buffer contains all unknown chunks for that position consecutively
-    The 3 buffers are the unknown chunks between certain critical chunks:
-    0: IHDR-PLTE, 1: PLTE-IDAT, 2: IDAT-IEND
-    Do not allocate or traverse this data yourself. Use the chunk traversing functions declared
-    later, such as lodepng_chunk_next and lodepng_chunk_append, to read/write this struct.
-    */
-    unsigned char* unknown_chunks_data[3];
-    size_t unknown_chunks_size[3]; /*size in bytes of the unknown chunks, given for protection*/
-#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-} LodePNGInfo;
+    if (! lc_map_image_mem(file_data.size, file_data.data, view, req_channel_count, options)) {
+        lc_close_file_data(&file_data);
+        return 0;
+    }
 
-/* The settings, state and information for extended encoding and decoding. */
-typedef struct LodePNGState
+    /* the file stays open as long as the view points into it */
+    if (view->zero_copy) {
+        view->file_data = file_data.data;
+        view->file_size = file_data.size;
+        view->file_mapped = file_data.mapped;
+    }
+    else {
+        lc_close_file_data(&file_data);
+    }
+
+    return 1;
+}
+
+void lc_unmap_image(lc_image_view* view)
 {
-#ifdef LODEPNG_COMPILE_DECODER
-    LodePNGDecoderSettings decoder; /*the decoding settings*/
-#endif /*LODEPNG_COMPILE_DECODER*/
-#ifdef LODEPNG_COMPILE_ENCODER
-    LodePNGEncoderSettings encoder; /*the encoding settings*/
-#endif /*LODEPNG_COMPILE_ENCODER*/
-    LodePNGColorMode info_raw; /*specifies the format in which you would like to get the raw pixel buffer*/
-    LodePNGInfo      info_png; /*info of the PNG image obtained after decoding*/
-  unsigned error;
-#ifdef LODEPNG_COMPILE_CPP
-     /* For the lodepng::State subclass. */
-    virtual ~LodePNGState(){}
-#endif
-} LodePNGState;
+    if (NULL == view) {
+        return;
+    }
+
+    if (NULL != view->file_data) {
+        lc_file_data file_data;
+        file_data.data = view->file_data;
+        file_data.size = view->file_size;
+        file_data.mapped = view->file_mapped;
+        lc_close_file_data(&file_data);
+    }
+
+    free(view->buffer);
+    memset(view, 0, sizeof(*view));
+}
+
+typedef enum lc_raw_format {
+    LC_RAW_FORMAT_PNM,
+    LC_RAW_FORMAT_BMP,
+    LC_RAW_FORMAT_TGA
+} lc_raw_format;
+
+/* header of a BMP with a 256 entry palette, the largest written */
+#define LC_RAW_MAX_HEADER_SIZE (14 + 40 + 4 * 256)
 
 /*
- Converts PNG data in memory to raw pixel data.
- out: Output parameter. Pointer to buffer that will contain the raw pixel data.
-      After decoding, its size is w * h * (bytes per pixel) bytes larger than
-      initially. Bytes per pixel depends on colortype and bitdepth.
-      Must be freed after usage with free(*out).
-      Note: for 16-bit per channel colors, uses big endian format like PNG does.
- w: Output parameter. Pointer to width of pixel data.
- h: Output parameter. Pointer to height of pixel data.
- in: Memory buffer with the PNG file.
- insize: size of the in buffer.
- colortype: the desired color type for the raw output image. See explanation on PNG color types.
- bitdepth: the desired bit depth for the raw output image. See explanation on PNG color types.
- Return value: LodePNG error code (0 means no error).
+ lc_raw_header: writes the header of an uncompressed image of width x height x channel_count
+ to header and the size of a stored row to row_size. Returns the header size, 0 if format can't
+ store the image.
 */
-static unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
-                               const unsigned char* in, size_t insize,
-                               LodePNGColorType colortype, unsigned bitdepth);
+static lc_uint64_t lc_raw_header(lc_raw_format format, int width, int height, int channel_count, 
+                                 lc_data_t* header, lc_uint64_t* row_size)
+{
+    if ((width <= 0) || (height <= 0) || (channel_count < 1) || (channel_count > 4)) {
+        return 0;
+    }
 
-/* Same as lodepng_decode_memory, but always decodes to 32-bit RGBA raw image */
-static unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h,
-                          const unsigned char* in, size_t insize);
+    *row_size = (lc_uint64_t)width * channel_count;
+    switch (format) {
+        case LC_RAW_FORMAT_PNM: {
+            static const char* tuple_types[4] = { "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA" };
+            int length = 0;
+            if ((1 == channel_count) || (3 == channel_count)) {
+                length = snprintf((char*)header, LC_RAW_MAX_HEADER_SIZE, "P%c\n%d %d\n255\n", 
+                                  (1 == channel_count) ? '5' : '6', width, height);
+            }
+            else {
+                length = snprintf((char*)header, LC_RAW_MAX_HEADER_SIZE, 
+                                  "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", 
+                                  width, height, channel_count, tuple_types[channel_count - 1]);
+            }
+            return (lc_uint64_t)length;
+        }
+        case LC_RAW_FORMAT_BMP: {
+            if (2 == channel_count) {
+                return 0;
+            }
 
-/* Same as lodepng_decode_memory, but always decodes to 24-bit RGB raw image */
-static unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h,
-                          const unsigned char* in, size_t insize);
+            /* rows are padded to 4 bytes, 4 channels are stored as RGBA bit fields */
+            *row_size = (*row_size + 3) & ~(lc_uint64_t)3;
+            lc_uint64_t info_size = (4 == channel_count) ? 108 : 40;
+            lc_uint64_t palette_size = (1 == channel_count) ? 4 * 256 : 0;
+            lc_uint64_t header_size = 14 + info_size + palette_size;
+            lc_uint64_t pixel_size = *row_size * height;
+            if (header_size + pixel_size > 0xFFFFFFFF) {
+                return 0;
+            }
 
-/* lc_load_image_png */
-static lc_data_t* lc_load_image_png(lc_uint64_t size, const lc_data_t* data,
-                                    int* width, int* height, int* channel_count, 
-                                    int req_channel_count)
-{
-    /* cap the channel count to 4 max */
-    req_channel_count = LC_MATH_MIN(req_channel_count, 4);
-    /* load everything if req_channel_count is 0 */
-    req_channel_count = (0 == req_channel_count) ? 4 : req_channel_count;
+            memset(header, 0, (size_t)header_size);
+            header[0] = 'B';
+            header[1] = 'M';
+            lc_write_le32(header + 2, header_size + pixel_size);
+            lc_write_le32(header + 10, header_size);
+            lc_data_t* info = header + 14;
+            lc_write_le32(info, info_size);
+            lc_write_le32(info + 4, (lc_uint64_t)width);
+            /* negative heights store the rows top down */
+            lc_write_le32(info + 8, (lc_uint64_t)(0x100000000ULL - (lc_uint64_t)height));
+            lc_write_le16(info + 12, 1);
+            lc_write_le16(info + 14, (lc_uint64_t)channel_count * 8);
+            lc_write_le32(info + 16, (4 == channel_count) ? 3 : 0);
+            lc_write_le32(info + 20, pixel_size);
+            lc_write_le32(info + 24, 2835);
+            lc_write_le32(info + 28, 2835);
+            if (4 == channel_count) {
+                lc_write_le32(info + 40, 0x000000FF);
+                lc_write_le32(info + 44, 0x0000FF00);
+                lc_write_le32(info + 48, 0x00FF0000);
+                lc_write_le32(info + 52, 0xFF000000);
+                /* LCS_sRGB */
+                lc_write_le32(info + 56, 0x73524742);
+            }
 
-    unsigned int w = 0;
-    unsigned int h = 0;
-    int dst_channel_count = req_channel_count;
+            for (lc_uint64_t i = 0; i < palette_size / 4; ++i) {
+                lc_data_t* entry = info + info_size + 4 * i;
+                entry[0] = (lc_data_t)i;
+                entry[1] = (lc_data_t)i;
+                entry[2] = (lc_data_t)i;
+            }
+            return header_size;
+        }
+        case LC_RAW_FORMAT_TGA: {
+            if ((width > 0xFFFF) || (height > 0xFFFF)) {
+                return 0;
+            }
 
-    lc_data_t* result = NULL;
-    if (4 == req_channel_count) {
-        if (0 != lodepng_decode32(&result, &w, &h, data, (size_t)size)) {
-            return NULL;
+            memset(header, 0, 18);
+            header[2] = (channel_count <= 2) ? 3 : 2;
+            lc_write_le16(header + 12, (lc_uint64_t)width);
+            lc_write_le16(header + 14, (lc_uint64_t)height);
+            header[16] = (lc_data_t)(channel_count * 8);
+            /* top down, 8 alpha bits with 2 and 4 channels */
+            header[17] = (lc_data_t)(0x20 | ((0 == (channel_count & 1)) ? 8 : 0));
+            return 18;
         }
+    }
 
-        dst_channel_count = 4;
+    return 0;
+}
+
+/* lc_raw_in_order: 1 if format stores rows of channel_count channels as they are */
+static int lc_raw_in_order(lc_raw_format format, int channel_count)
+{
+    return ((LC_RAW_FORMAT_PNM == format) || (1 == channel_count) || 
+            ((LC_RAW_FORMAT_BMP == format) && (4 == channel_count)) ||
+            ((LC_RAW_FORMAT_TGA == format) && (2 == channel_count))) ? 1 : 0;
+}
+
+/* lc_raw_encode_row: a row as format stores it, BGR(A) and padded to row_size */
+static void lc_raw_encode_row(lc_raw_format format, int width, int channel_count, 
+                              const lc_data_t* src, lc_data_t* dst, lc_uint64_t row_size)
+{
+    lc_uint64_t pixel_bytes = (lc_uint64_t)width * channel_count;
+    if (lc_raw_in_order(format, channel_count)) {
+        memcpy(dst, src, (size_t)pixel_bytes);
     }
     else {
-        lc_data_t* src = NULL;
-        if (0 != lodepng_decode24(&src, &w, &h, data, (size_t)size)) {
-            return NULL;
+        lc_data_t* dst_pixel = dst;
+        for (int x = 0; x < width; ++x) {
+            dst_pixel[0] = src[2];
+            dst_pixel[1] = src[1];
+            dst_pixel[2] = src[0];
+            if (4 == channel_count) {
+                dst_pixel[3] = src[3];
+            }
+            src += channel_count;
+            dst_pixel += channel_count;
         }
+    }
 
-        if (3 == req_channel_count) {
-            result = src;
-            dst_channel_count = 3;
-        }
-        else {
-            int src_channel_count = 3;
-            dst_channel_count = req_channel_count;
+    memset(dst + pixel_bytes, 0, (size_t)(row_size - pixel_bytes));
+}
 
-            lc_uint64_t result_size = w * h * dst_channel_count;
-            result = (lc_data_t*)calloc(result_size, sizeof(*result));
-            assert(NULL != result);
+/* lc_write_raw_mem */
+static lc_data_t* lc_write_raw_mem(lc_raw_format format, int width, int height, int channel_count,
+                                   const lc_data_t* data, lc_uint64_t* size)
+{
+    lc_data_t header[LC_RAW_MAX_HEADER_SIZE];
+    lc_uint64_t row_size = 0;
+    lc_uint64_t header_size = (NULL != data) ? lc_raw_header(format, width, height, channel_count, header, &row_size) : 0;
+    if (0 == header_size) {
+        return NULL;
+    }
 
-            const lc_data_t* src_line = src;
-            lc_data_t* dst_line = result;
-            lc_uint64_t src_pixel_stride = src_channel_count;
-            lc_uint64_t dst_pixel_stride = dst_channel_count;
-            lc_uint64_t src_row_stride = w * src_pixel_stride;
-            lc_uint64_t dst_row_stride = w * dst_pixel_stride;
-            for (int y = 0; y < (int)h; ++y) {
-                const lc_data_t* src_pixel = src_line;
-                lc_data_t* dst_pixel = dst_line;
-                for (int x = 0; x < (int)w; ++x) {
-                    int c = 0;
-                    int nc = LC_MATH_MIN(src_channel_count, dst_channel_count);
-                    for (; c < nc; ++c) {
-                        *(dst_pixel + c) = *(src_pixel + c);
-                    }
-                    for (; c < dst_channel_count; ++c) {
-                        *(dst_pixel + c) = (3 == c) ? 0xFF : 0x0;
-                    }                
-                    src_pixel += src_pixel_stride;
-                    dst_pixel += dst_pixel_stride;
-                }
-                src_line += src_row_stride;
-                dst_line += dst_row_stride;
-            }
+    lc_uint64_t result_size = header_size + row_size * height;
+    lc_data_t* result = (lc_data_t*)malloc((size_t)result_size);
+    assert(NULL != result);
 
-            free(src);
-            src = NULL;
-        }
+    memcpy(result, header, (size_t)header_size);
+    lc_uint64_t src_row_size = (lc_uint64_t)width * channel_count;
+    for (int y = 0; y < height; ++y) {
+        lc_raw_encode_row(format, width, channel_count, data + y * src_row_size, 
+                          result + header_size + y * row_size, row_size);
     }
 
-    if (NULL != width) {
-        *width = w;
+    if (NULL != size) {
+        *size = result_size;
     }
 
-    if (NULL != height) {
-        *height = h;
+    return result;
+}
+
+/* lc_write_raw: streams the rows to the file, without a copy if they are stored as they are */
+static int lc_write_raw(lc_raw_format format, const char* file_name, 
+                        int width, int height, int channel_count, const lc_data_t* data)
+{
+    lc_data_t header[LC_RAW_MAX_HEADER_SIZE];
+    lc_uint64_t row_size = 0;
+    lc_uint64_t header_size = (NULL != data) ? lc_raw_header(format, width, height, channel_count, header, &row_size) : 0;
+    if (0 == header_size) {
+        return 0;
     }
 
-    if (NULL != channel_count) {
-        *channel_count = dst_channel_count;
+    FILE* file = lc_fopen(file_name, "wb");
+    if (NULL == file) {
+        return 0;
     }
 
-    return result;
+    int written = (lc_fwrite(header, 1, (size_t)header_size, file) == (size_t)header_size) ? 1 : 0;
+    lc_uint64_t src_row_size = (lc_uint64_t)width * channel_count;
+    if (lc_raw_in_order(format, channel_count) && (row_size == src_row_size)) {
+        lc_uint64_t pixel_size = src_row_size * height;
+        written = written && (lc_fwrite(data, 1, (size_t)pixel_size, file) == (size_t)pixel_size);
+    }
+    else {
+        lc_data_t* row = (lc_data_t*)malloc((size_t)row_size);
+        assert(NULL != row);
+        for (int y = 0; (y < height) && written; ++y) {
+            lc_raw_encode_row(format, width, channel_count, data + y * src_row_size, row, row_size);
+            written = (lc_fwrite(row, 1, (size_t)row_size, file) == (size_t)row_size) ? 1 : 0;
+        }
+        free(row);
+        row = NULL;
+    }
+
+    int closed = (0 == lc_fclose(file));
+
+    return (written && closed) ? 1 : 0;
+}
+
+int lc_write_pnm(const char* file_name, int width, int height, int channel_count, const unsigned char* data)
+{
+    return lc_write_raw(LC_RAW_FORMAT_PNM, file_name, width, height, channel_count, data);
+}
+
+unsigned char* lc_write_pnm_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size)
+{
+    return lc_write_raw_mem(LC_RAW_FORMAT_PNM, width, height, channel_count, data, size);
+}
+
+int lc_write_bmp(const char* file_name, int width, int height, int channel_count, const unsigned char* data)
+{
+    return lc_write_raw(LC_RAW_FORMAT_BMP, file_name, width, height, channel_count, data);
+}
+
+unsigned char* lc_write_bmp_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size)
+{
+    return lc_write_raw_mem(LC_RAW_FORMAT_BMP, width, height, channel_count, data, size);
+}
+
+int lc_write_tga(const char* file_name, int width, int height, int channel_count, const unsigned char* data)
+{
+    return lc_write_raw(LC_RAW_FORMAT_TGA, file_name, width, height, channel_count, data);
+}
+
+unsigned char* lc_write_tga_mem(int width, int height, int channel_count,
+                                const unsigned char* data, unsigned long long* size)
+{
+    return lc_write_raw_mem(LC_RAW_FORMAT_TGA, width, height, channel_count, data, size);
 }
 
 static void* lodepng_malloc(size_t size)
@@ -1654,12 +5323,42 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 static void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings)
 {
   settings->ignore_adler32 = 0;
+  settings->num_threads = 0;
+  settings->progress = 0;
+  settings->progress_context = 0;
+  settings->scratch_peak = 0;
+  settings->expected_size = 0;
+  settings->cancel = 0;
+  settings->cancel_context = 0;
 
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
 }
 
+#define LODEPNG_CANCEL_INTERVAL 1048576 /*output bytes between two polls of LodePNGDecompressSettings.cancel*/
+
+/*polls LodePNGDecompressSettings.cancel while a buffer is produced, hot loops test pos >= next before calling poll*/
+typedef struct LodePNGCancel
+{
+  const LodePNGDecompressSettings* settings; /*null if nothing is polled*/
+  size_t next; /*output size at which cancel is polled next*/
+} LodePNGCancel;
+
+static void LodePNGCancel_init(LodePNGCancel* cancel, const LodePNGDecompressSettings* settings)
+{
+  cancel->settings = settings && settings->cancel ? settings : 0;
+  cancel->next = cancel->settings ? LODEPNG_CANCEL_INTERVAL : (size_t)(-1);
+}
+
+/*returns 1 if decoding has to stop, pos is the amount of output so far*/
+static unsigned LodePNGCancel_poll(LodePNGCancel* cancel, size_t pos)
+{
+  if(pos < cancel->next) return 0;
+  cancel->next = pos + LODEPNG_CANCEL_INTERVAL;
+  return cancel->settings->cancel(cancel->settings->cancel_context) != 0;
+}
+
 static void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
@@ -1668,6 +5367,10 @@ static void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
   settings->remember_unknown_chunks = 0;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
   settings->ignore_crc = 0;
+  settings->preview = 0;
+  settings->preview_context = 0;
+  settings->max_memory = 0;
+  settings->num_threads = 0;
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
@@ -1712,6 +5415,7 @@ static void lodepng_state_init(LodePNGState* state)
   lodepng_color_mode_init(&state->info_raw);
   lodepng_info_init(&state->info_png);
   state->error = 1;
+  state->memory_peak = state->memory_current = 0;
 }
 
 static unsigned lodepng_read32bitInt(const unsigned char* buffer)
@@ -1767,16 +5471,148 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
-/*Return the CRC of the bytes buf[0..len-1].*/
-static unsigned lodepng_crc32(const unsigned char* data, size_t length)
+/*
+Slice-by-8 tables, lodepng_crc32_slices[k][n] is the CRC of byte n followed by k zero bytes.
+Built from lodepng_crc32_table on first use.
+*/
+static unsigned lodepng_crc32_slices[8][256];
+static lc_once_t lodepng_crc32_slices_once = LC_ONCE_INIT;
+
+static void lodepng_crc32_init_slices(void)
 {
-  unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+  unsigned k, n;
+  for(n = 0; n != 256; ++n) lodepng_crc32_slices[0][n] = lodepng_crc32_table[n];
+  for(k = 1; k != 8; ++k)
+  {
+    for(n = 0; n != 256; ++n)
+    {
+      unsigned c = lodepng_crc32_slices[k - 1][n];
+      lodepng_crc32_slices[k][n] = (c >> 8) ^ lodepng_crc32_table[c & 0xff];
+    }
+  }
+}
+
+/*updates the running CRC register r (not inverted) with 8 bytes per step*/
+static unsigned lodepng_crc32_update_slice8(unsigned r, const unsigned char* data, size_t length)
+{
+  lc_call_once(&lodepng_crc32_slices_once, lodepng_crc32_init_slices);
+  while(length >= 8)
+  {
+    unsigned lo = r ^ (data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24));
+    unsigned hi = data[4] | ((unsigned)data[5] << 8) | ((unsigned)data[6] << 16) | ((unsigned)data[7] << 24);
+    r = lodepng_crc32_slices[7][lo & 0xff] ^ lodepng_crc32_slices[6][(lo >> 8) & 0xff]
+      ^ lodepng_crc32_slices[5][(lo >> 16) & 0xff] ^ lodepng_crc32_slices[4][lo >> 24]
+      ^ lodepng_crc32_slices[3][hi & 0xff] ^ lodepng_crc32_slices[2][(hi >> 8) & 0xff]
+      ^ lodepng_crc32_slices[1][(hi >> 16) & 0xff] ^ lodepng_crc32_slices[0][hi >> 24];
+    data += 8;
+    length -= 8;
+  }
+  while(length--) r = lodepng_crc32_table[(r ^ *data++) & 0xff] ^ (r >> 8);
+  return r;
+}
+
+#if LC_IMAGE_X86
+/*
+Carry-less multiplication folding, see Gopal et al. "Fast CRC Computation for Generic Polynomials
+Using PCLMULQDQ Instruction". The constants are for the bit-reflected polynomial 0xedb88320.
+length must be at least 64 and a multiple of 16. Updates the running CRC register r (not inverted).
+*/
+LC_TARGET("pclmul,sse4.1")
+static unsigned lodepng_crc32_update_pclmul(unsigned r, const unsigned char* data, size_t length)
+{
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)r));
+  data += 64;
+  length -= 64;
+
+  /*fold 4 x 128 bits in parallel*/
+  while(length >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+    data += 64;
+    length -= 64;
+  }
+
+  /*fold into 128 bits*/
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  while(length >= 16)
+  {
+    x2 = _mm_loadu_si128((const __m128i*)data);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    data += 16;
+    length -= 16;
+  }
+
+  /*fold 128 bits to 64 bits*/
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /*Barrett reduction to 32 bits*/
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (unsigned)_mm_extract_epi32(x1, 1);
+}
+#endif /*LC_IMAGE_X86*/
+
+/*Continue the CRC r (not inverted, start with 0xffffffff) over the bytes data[0..length-1].*/
+static unsigned lodepng_crc32_update(unsigned r, const unsigned char* data, size_t length)
+{
+#if LC_IMAGE_X86
+  if(length >= 64 && lc_cpu_has(LC_CPU_PCLMUL) && lc_cpu_has(LC_CPU_SSE41))
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    size_t folded = length & ~(size_t)15;
+    r = lodepng_crc32_update_pclmul(r, data, folded);
+    data += folded;
+    length -= folded;
   }
-  return r ^ 0xffffffffu;
+#endif /*LC_IMAGE_X86*/
+  return lodepng_crc32_update_slice8(r, data, length);
+}
+
+/*Return the CRC of the bytes buf[0..len-1].*/
+static unsigned lodepng_crc32(const unsigned char* data, size_t length)
+{
+  return lodepng_crc32_update(0xffffffffu, data, length) ^ 0xffffffffu;
 }
 
 /* PNG chunks */
@@ -2109,11 +5945,11 @@ static void Adam7_getpassvalues(unsigned passw[7], unsigned passh[7], size_t fil
   {
     /*if passw[i] is 0, it's 0 bytes, not 1 (no filtertype-byte)*/
     filter_passstart[i + 1] = filter_passstart[i]
-                            + ((passw[i] && passh[i]) ? passh[i] * (1 + (passw[i] * bpp + 7) / 8) : 0);
+                            + ((passw[i] && passh[i]) ? passh[i] * (1 + ((size_t)passw[i] * bpp + 7) / 8) : 0);
     /*bits padded if needed to fill full byte at end of each scanline*/
-    padded_passstart[i + 1] = padded_passstart[i] + passh[i] * ((passw[i] * bpp + 7) / 8);
+    padded_passstart[i + 1] = padded_passstart[i] + passh[i] * (((size_t)passw[i] * bpp + 7) / 8);
     /*only padded at end of reduced image*/
-    passstart[i + 1] = passstart[i] + (passh[i] * passw[i] * bpp + 7) / 8;
+    passstart[i + 1] = passstart[i] + ((size_t)passh[i] * passw[i] * bpp + 7) / 8;
   }
 }
 
@@ -2191,7 +6027,8 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                         const LodePNGDecompressSettings* settings)
 {
   /*
   For PNG filter method 0
@@ -2199,21 +6036,26 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
   out must have enough bytes allocated already, in must have the scanlines + 1 filtertype byte per scanline
   w and h are image dimensions or dimensions of reduced image, bpp is bits per pixel
   in and out are allowed to be the same memory address (but aren't the same size since in has the extra filter bytes)
+  settings may be null, otherwise its cancel is polled
   */
 
   unsigned y;
   unsigned char* prevline = 0;
+  LodePNGCancel cancel;
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7) / 8;
-  size_t linebytes = (w * bpp + 7) / 8;
+  size_t linebytes = ((size_t)w * bpp + 7) / 8;
 
+  LodePNGCancel_init(&cancel, settings);
   for(y = 0; y < h; ++y)
   {
     size_t outindex = linebytes * y;
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
+    if(outindex >= cancel.next && LodePNGCancel_poll(&cancel, outindex)) return 121;
+
     CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
 
     prevline = &out[outindex];
@@ -2233,13 +6075,39 @@ out must be big enough AND must be 0 everywhere if bpp < 8 in the current implem
 (because that's likely a little bit faster)
 NOTE: comments about padding bits are only relevant if bpp < 8
 */
-static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+#define LODEPNG_PARALLEL_ROWS_MIN_BYTES 262144 /*minimum amount of output bytes per band of rows*/
+
+/*
+rows per band to split work on an image of h rows and the given size over num_threads, h if it is not
+worth it. Bands are a multiple of 8 rows, so that bands of pixels smaller than a byte start at a byte.
+*/
+static unsigned lodepng_band_rows(unsigned h, size_t bytes, unsigned num_threads)
+{
+  size_t numbands = bytes / LODEPNG_PARALLEL_ROWS_MIN_BYTES;
+  unsigned rows;
+  if(num_threads < 2 || numbands < 2) return h;
+  if(numbands > num_threads * 4) numbands = num_threads * 4;
+  rows = (unsigned)((h + numbands - 1) / numbands);
+  rows = (rows + 7) & ~7u;
+  return rows < h ? rows : h;
+}
+
+/*the passes of the Adam7 image in in, put into the output rows ystart..yend-1 only*/
+static void Adam7_deinterlaceRows(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                                  unsigned ystart, unsigned yend)
 {
   unsigned passw[7], passh[7];
   size_t filter_passstart[8], padded_passstart[8], passstart[8];
-  unsigned i;
+  unsigned i, ybegin[7], yfinish[7];
 
   Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+  for(i = 0; i != 7; ++i)
+  {
+    /*rows of the pass that land in ystart..yend-1*/
+    ybegin[i] = ystart > ADAM7_IY[i] ? (ystart - ADAM7_IY[i] + ADAM7_DY[i] - 1) / ADAM7_DY[i] : 0;
+    yfinish[i] = yend > ADAM7_IY[i] ? (yend - ADAM7_IY[i] + ADAM7_DY[i] - 1) / ADAM7_DY[i] : 0;
+    if(yfinish[i] > passh[i]) yfinish[i] = passh[i];
+  }
 
   if(bpp >= 8)
   {
@@ -2247,11 +6115,11 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
     {
       unsigned x, y, b;
       size_t bytewidth = bpp / 8;
-      for(y = 0; y < passh[i]; ++y)
+      for(y = ybegin[i]; y < yfinish[i]; ++y)
       for(x = 0; x < passw[i]; ++x)
       {
-        size_t pixelinstart = passstart[i] + (y * passw[i] + x) * bytewidth;
-        size_t pixeloutstart = ((ADAM7_IY[i] + y * ADAM7_DY[i]) * w + ADAM7_IX[i] + x * ADAM7_DX[i]) * bytewidth;
+        size_t pixelinstart = passstart[i] + ((size_t)y * passw[i] + x) * bytewidth;
+        size_t pixeloutstart = ((size_t)(ADAM7_IY[i] + y * ADAM7_DY[i]) * w + ADAM7_IX[i] + x * ADAM7_DX[i]) * bytewidth;
         for(b = 0; b < bytewidth; ++b)
         {
           out[pixeloutstart + b] = in[pixelinstart + b];
@@ -2264,14 +6132,14 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
     for(i = 0; i != 7; ++i)
     {
       unsigned x, y, b;
-      unsigned ilinebits = bpp * passw[i];
-      unsigned olinebits = bpp * w;
+      size_t ilinebits = (size_t)bpp * passw[i];
+      size_t olinebits = (size_t)bpp * w;
       size_t obp, ibp; /*bit pointers (for out and in buffer)*/
-      for(y = 0; y < passh[i]; ++y)
+      for(y = ybegin[i]; y < yfinish[i]; ++y)
       for(x = 0; x < passw[i]; ++x)
       {
-        ibp = (8 * passstart[i]) + (y * ilinebits + x * bpp);
-        obp = (ADAM7_IY[i] + y * ADAM7_DY[i]) * olinebits + (ADAM7_IX[i] + x * ADAM7_DX[i]) * bpp;
+        ibp = (8 * passstart[i]) + (y * ilinebits + (size_t)x * bpp);
+        obp = (ADAM7_IY[i] + y * ADAM7_DY[i]) * olinebits + (size_t)(ADAM7_IX[i] + x * ADAM7_DX[i]) * bpp;
         for(b = 0; b < bpp; ++b)
         {
           unsigned char bit = readBitFromReversedStream(&ibp, in);
@@ -2283,6 +6151,39 @@ static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsig
   }
 }
 
+typedef struct Adam7Bands
+{
+  unsigned char* out;
+  const unsigned char* in;
+  unsigned w, h, bpp, bandrows;
+} Adam7Bands;
+
+static void Adam7_deinterlaceTask(void* context, int index)
+{
+  const Adam7Bands* bands = (const Adam7Bands*)context;
+  unsigned ystart = (unsigned)index * bands->bandrows;
+  unsigned yend = bands->h - ystart > bands->bandrows ? ystart + bands->bandrows : bands->h;
+  Adam7_deinterlaceRows(bands->out, bands->in, bands->w, bands->h, bands->bpp, ystart, yend);
+}
+
+/*
+out must be buffer big enough to contain full image, and in must contain the reduced images of the 7 passes
+without padding bits between their scanlines. For bpp < 8 out must be all 0.
+*/
+static void Adam7_deinterlace(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                              unsigned num_threads)
+{
+  Adam7Bands bands;
+  bands.out = out;
+  bands.in = in;
+  bands.w = w;
+  bands.h = h;
+  bands.bpp = bpp;
+  bands.bandrows = lodepng_band_rows(h, ((size_t)w * h * bpp + 7) / 8, num_threads);
+  if(bands.bandrows >= h) Adam7_deinterlaceRows(out, in, w, h, bpp, 0, h);
+  else lc_run_tasks((int)((h + bands.bandrows - 1) / bands.bandrows), (int)num_threads, Adam7_deinterlaceTask, &bands);
+}
+
 static void removePaddingBits(unsigned char* out, const unsigned char* in,
                               size_t olinebits, size_t ilinebits, unsigned h)
 {
@@ -2311,10 +6212,11 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 }
 
 /*out must be buffer big enough to contain full image, and in must contain the full decompressed data from
-the IDAT chunks (with filter index bytes and possible padding bits)
+the IDAT chunks (with filter index bytes and possible padding bits). out may be in for non-interlaced images.
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png)
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png,
+                                     const LodePNGDecoderSettings* decoder)
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
@@ -2328,39 +6230,147 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
   if(info_png->interlace_method == 0)
   {
-    if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
+    if(bpp < 8 && (size_t)w * bpp != (((size_t)w * bpp + 7) / 8) * 8)
     {
-      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp));
-      removePaddingBits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
+      size_t bits = (size_t)w * h * bpp;
+      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp, &decoder->zlibsettings));
+      removePaddingBits(out, in, (size_t)w * bpp, (((size_t)w * bpp + 7) / 8) * 8, h);
+      /*out may be in itself, clear the unused bits of the last byte*/
+      if(bits & 7) out[bits / 8] &= (unsigned char)(0xff << (8 - (bits & 7)));
     }
     /*we can immediately filter into the out buffer, no other steps needed*/
-    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp));
+    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp, &decoder->zlibsettings));
   }
   else /*interlace_method is 1 (Adam7)*/
   {
     unsigned passw[7], passh[7]; size_t filter_passstart[8], padded_passstart[8], passstart[8];
     unsigned i;
 
-    Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+    Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
+
+    for(i = 0; i != 7; ++i)
+    {
+      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp,
+                                 &decoder->zlibsettings));
+      /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
+      move bytes instead of bits or move not at all*/
+      if(bpp < 8)
+      {
+        /*remove padding bits in scanlines; after this there still may be padding
+        bits between the different reduced images: each reduced image still starts nicely at a byte*/
+        removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], (size_t)passw[i] * bpp,
+                          (((size_t)passw[i] * bpp + 7) / 8) * 8, passh[i]);
+      }
+    }
+
+    Adam7_deinterlace(out, in, w, h, bpp, decoder->num_threads);
+  }
+
+  return 0;
+}
+
+/*
+Progressive display of Adam7 images. Hooked into the inflater as its progress callback: as soon as all
+filtered scanlines of the next pass are inflated, that pass is unfiltered and converted into separate
+buffers (the inflated data itself must stay untouched) and its pixels are painted into the preview,
+each one covering the rectangle that the later passes will fill in.
+*/
+static unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
+                                const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                unsigned w, unsigned h);
+static int lodepng_color_mode_equal(const LodePNGColorMode* a, const LodePNGColorMode* b);
+
+static const unsigned ADAM7_PREVIEW_W[7] = { 8, 4, 4, 2, 2, 1, 1 }; /*width covered by a pixel of each pass*/
+static const unsigned ADAM7_PREVIEW_H[7] = { 8, 8, 4, 4, 2, 2, 1 }; /*height covered by a pixel of each pass*/
+
+typedef struct Adam7Preview
+{
+  const LodePNGState* state;
+  unsigned w, h;
+  unsigned passw[7], passh[7];
+  size_t filter_passstart[8], padded_passstart[8], passstart[8];
+  unsigned next; /*next pass to show*/
+  unsigned char* pass; /*unfiltered reduced image*/
+  unsigned char* converted; /*the same in the info_raw color mode*/
+  unsigned char* image;
+  unsigned error;
+} Adam7Preview;
+
+static unsigned Adam7Preview_init(Adam7Preview* preview, const LodePNGState* state, unsigned w, unsigned h)
+{
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  unsigned bytes = lodepng_get_bpp(&state->info_raw) / 8;
+  size_t maxpass = 0, maxconverted = 0, i;
+  preview->state = state;
+  preview->w = w;
+  preview->h = h;
+  preview->next = 0;
+  preview->error = 0;
+  Adam7_getpassvalues(preview->passw, preview->passh, preview->filter_passstart,
+                      preview->padded_passstart, preview->passstart, w, h, bpp);
+  for(i = 0; i != 7; ++i)
+  {
+    size_t padded = preview->padded_passstart[i + 1] - preview->padded_passstart[i];
+    size_t converted = (size_t)preview->passw[i] * preview->passh[i] * bytes;
+    if(padded > maxpass) maxpass = padded;
+    if(converted > maxconverted) maxconverted = converted;
+  }
+  preview->pass = (unsigned char*)lodepng_malloc(maxpass + 1);
+  preview->converted = (unsigned char*)lodepng_malloc(maxconverted + 1);
+  preview->image = (unsigned char*)lodepng_malloc((size_t)w * h * bytes);
+  if(!preview->pass || !preview->converted || !preview->image) return 83; /*alloc fail*/
+  return 0;
+}
+
+static void Adam7Preview_cleanup(Adam7Preview* preview)
+{
+  lodepng_free(preview->pass);
+  lodepng_free(preview->converted);
+  lodepng_free(preview->image);
+}
 
-    for(i = 0; i != 7; ++i)
+static void Adam7Preview_progress(void* context, const unsigned char* data, size_t size)
+{
+  Adam7Preview* preview = (Adam7Preview*)context;
+  const LodePNGState* state = preview->state;
+  unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+  unsigned bytes = lodepng_get_bpp(&state->info_raw) / 8;
+
+  while(!preview->error && preview->next != 7 && size >= preview->filter_passstart[preview->next + 1])
+  {
+    unsigned i = preview->next++;
+    unsigned passw = preview->passw[i], passh = preview->passh[i], x, y;
+    if(passw != 0)
     {
-      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
-      /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
-      move bytes instead of bits or move not at all*/
-      if(bpp < 8)
+      preview->error = unfilter(preview->pass, &data[preview->filter_passstart[i]], passw, passh, bpp,
+                                &state->decoder.zlibsettings);
+      if(preview->error) return;
+      if(bpp < 8) removePaddingBits(preview->pass, preview->pass, (size_t)passw * bpp, (((size_t)passw * bpp + 7) / 8) * 8, passh);
+      preview->error = lodepng_convert(preview->converted, preview->pass, &state->info_raw,
+                                       &state->info_png.color, passw, passh);
+      if(preview->error) return;
+
+      for(y = 0; y != passh; ++y)
       {
-        /*remove padding bits in scanlines; after this there still may be padding
-        bits between the different reduced images: each reduced image still starts nicely at a byte*/
-        removePaddingBits(&in[passstart[i]], &in[padded_passstart[i]], passw[i] * bpp,
-                          ((passw[i] * bpp + 7) / 8) * 8, passh[i]);
+        unsigned py = ADAM7_IY[i] + y * ADAM7_DY[i];
+        unsigned ey = py + ADAM7_PREVIEW_H[i] < preview->h ? py + ADAM7_PREVIEW_H[i] : preview->h;
+        for(x = 0; x != passw; ++x)
+        {
+          unsigned px = ADAM7_IX[i] + x * ADAM7_DX[i];
+          unsigned ex = px + ADAM7_PREVIEW_W[i] < preview->w ? px + ADAM7_PREVIEW_W[i] : preview->w;
+          const unsigned char* pixel = &preview->converted[((size_t)y * passw + x) * bytes];
+          unsigned yy, xx;
+          for(yy = py; yy < ey; ++yy)
+          {
+            unsigned char* out = &preview->image[((size_t)yy * preview->w + px) * bytes];
+            for(xx = px; xx < ex; ++xx, out += bytes) memcpy(out, pixel, bytes);
+          }
+        }
       }
     }
-
-    Adam7_deinterlace(out, in, w, h, bpp);
+    state->decoder.preview(state->decoder.preview_context, i + 1, preview->image, preview->w, preview->h,
+                           &state->info_raw);
   }
-
-  return 0;
 }
 
 static unsigned readChunk_PLTE(LodePNGColorMode* color, const unsigned char* data, size_t chunkLength)
@@ -2425,7 +6435,7 @@ static unsigned readChunk_tRNS(LodePNGColorMode* color, const unsigned char* dat
 /*in an idat chunk, each scanline is a multiple of 8 bits, unlike the lodepng output buffer*/
 static size_t lodepng_get_raw_size_idat(unsigned w, unsigned h, const LodePNGColorMode* color)
 {
-  /*will not overflow for any color type if roughly w * h < 268435455*/
+  /*decodeGeneric checks with lodepng_pixel_overflow that this fits*/
   size_t bpp = lodepng_get_bpp(color);
   size_t line = ((w / 8) * bpp) + ((w & 7) * bpp + 7) / 8;
   return h * line;
@@ -2434,15 +6444,102 @@ static size_t lodepng_get_raw_size_idat(unsigned w, unsigned h, const LodePNGCol
 #endif /*LODEPNG_COMPILE_PNG*/
 
 /* Adler32*/
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
+#if LC_IMAGE_X86
+/*
+Processes 32 bytes per step: s1 gets the byte sum, s2 gets 32 * s1 plus the bytes weighted
+32, 31, ... 1. Blocks are kept below the 5552 byte overflow limit before each modulo.
+*/
+LC_TARGET("ssse3")
+static unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data, unsigned len)
+{
+  const unsigned BLOCK = 32;
+  const unsigned NMAX = 5552;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / BLOCK;
+  len -= blocks * BLOCK;
+
+  while(blocks)
+  {
+    unsigned n = NMAX / BLOCK;
+    __m128i v_ps, v_s1, v_s2;
+    if(n > blocks) n = blocks;
+    blocks -= n;
+
+    v_ps = _mm_set_epi32(0, 0, 0, (int)(s1 * n));
+    v_s2 = _mm_set_epi32(0, 0, 0, (int)s2);
+    v_s1 = _mm_setzero_si128();
+
+    do
+    {
+      const __m128i bytes1 = _mm_loadu_si128((const __m128i*)(data));
+      const __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      __m128i mad1, mad2;
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      mad1 = _mm_maddubs_epi16(bytes1, tap1);
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(mad1, ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      mad2 = _mm_maddubs_epi16(bytes2, tap2);
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(mad2, ones));
+      data += BLOCK;
+    } while(--n);
+
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+    /*horizontal sums*/
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+
+    s1 %= 65521;
+    s2 %= 65521;
+  }
+
+  while(len > 0)
+  {
+    s1 += (*data++);
+    s2 += s1;
+    --len;
+  }
+  s1 %= 65521;
+  s2 %= 65521;
+
+  return (s2 << 16) | s1;
+}
+#endif /*LC_IMAGE_X86*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, size_t len)
 {
    unsigned s1 = adler & 0xffff;
    unsigned s2 = (adler >> 16) & 0xffff;
 
+#if LC_IMAGE_X86
+  if(len >= 64 && lc_cpu_has(LC_CPU_SSSE3))
+  {
+    /*the SIMD sum counts in unsigned, feed it at most 1 GB at a time*/
+    while(len > 0)
+    {
+      unsigned amount = len > 0x40000000u ? 0x40000000u : (unsigned)len;
+      adler = update_adler32_ssse3(adler, data, amount);
+      data += amount;
+      len -= amount;
+    }
+    return adler;
+  }
+#endif /*LC_IMAGE_X86*/
+
   while(len > 0)
   {
     /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
-    unsigned amount = len > 5550 ? 5550 : len;
+    unsigned amount = len > 5550 ? 5550 : (unsigned)len;
     len -= amount;
     while(amount > 0)
     {
@@ -2458,7 +6555,7 @@ static unsigned update_adler32(unsigned adler, const unsigned char* data, unsign
 }
 
 /*Return the adler32 of the bytes data[0..len-1]*/
-static unsigned adler32(const unsigned char* data, unsigned len)
+static unsigned adler32(const unsigned char* data, size_t len)
 {
   return update_adler32(1L, data, len);
 }
@@ -2521,6 +6618,8 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
 #define NUM_DISTANCE_SYMBOLS 32
 /*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros*/
 #define NUM_CODE_LENGTH_CODES 19
+/*most scratch memory one inflater holds besides its output: the three trees and code lengths of a dynamic block*/
+#define INFLATE_SCRATCH_SIZE (5 * sizeof(unsigned) * (NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS + NUM_CODE_LENGTH_CODES))
 
 /*the base lengths represented by codes 257-285*/
 static const unsigned LENGTHBASE[29]
@@ -2927,7 +7026,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
 /*inflate a block with dynamic of fixed Huffman tree*/
 static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+                                    size_t* pos, size_t inlength, unsigned btype, LodePNGCancel* cancel)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
@@ -2980,75 +7079,528 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
       }
       distance = DISTANCEBASE[code_d];
 
-      /*part 4: get extra bits from distance*/
-      numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      /*part 4: get extra bits from distance*/
+      numextrabits_d = DISTANCEEXTRA[code_d];
+      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      distance += readBitsFromStream(bp, in, numextrabits_d);
+
+      /*part 5: fill in all the out[n] values based on the length and dist*/
+      start = (*pos);
+      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
+      backward = start - distance;
+
+      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
+      if (distance < length) {
+        for(forward = 0; forward < length; ++forward)
+        {
+          out->data[(*pos)++] = out->data[backward++];
+        }
+      } else {
+        memcpy(out->data + *pos, out->data + backward, length);
+        *pos += length;
+      }
+      /*literals are bounded by the input size, only long runs of references can blow up the output*/
+      if(*pos >= cancel->next && LodePNGCancel_poll(cancel, *pos)) ERROR_BREAK(121);
+    }
+    else if(code_ll == 256)
+    {
+      break; /*end code, break the loop*/
+    }
+    else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+    {
+      /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
+      (10=no endcode, 11=wrong jump outside of tree)*/
+      error = ((*bp) > inlength * 8) ? 10 : 11;
+      break;
+    }
+  }
+
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+
+  return error;
+}
+
+static unsigned lodepng_inflatev(ucvector* out,
+                                 const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings)
+{
+  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
+  size_t bp = 0;
+  unsigned BFINAL = 0;
+  size_t pos = 0; /*byte position in the out buffer*/
+  unsigned error = 0;
+  LodePNGCancel cancel;
+
+  LodePNGCancel_init(&cancel, settings);
+  if(settings->scratch_peak && *settings->scratch_peak < INFLATE_SCRATCH_SIZE) *settings->scratch_peak = INFLATE_SCRATCH_SIZE;
+  while(!BFINAL)
+  {
+    unsigned BTYPE;
+    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = readBitFromStream(&bp, in);
+    BTYPE = 1u * readBitFromStream(&bp, in);
+    BTYPE += 2u * readBitFromStream(&bp, in);
+
+    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
+    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE, &cancel); /*compression, BTYPE 01 or 10*/
+
+    if(error) return error;
+    if(pos >= cancel.next && LodePNGCancel_poll(&cancel, pos)) return 121;
+    if(settings->progress) settings->progress(settings->progress_context, out->data, pos);
+  }
+
+  return error;
+}
+
+/*
+Parallel inflate.
+The deflate stream is cut into parts that start where a new block starts. Each part after the first
+one is found by searching from its nominal split point, first for the empty stored block that ends a
+zlib full flush (00 00 FF FF, the next block starts byte aligned and has no references to earlier
+data), and otherwise for a bit position where a dynamic Huffman block header with a complete code
+length code begins and the whole block decodes. All parts are then decoded on their own thread.
+Back-references to data before the start of a part can't be resolved while decoding, so they are
+stored as window references: 256 + position in the 32K window preceding the part. A serial second
+pass stitches the parts together and resolves the window references from the output of the previous
+parts. Parts starting after a full flush are decoded straight to bytes and need no resolving.
+The boundaries are only guesses until the previous part ends exactly on them. If any part ends
+somewhere else or fails, the whole stream is decoded serially, so the result is always the same
+as the one of lodepng_inflatev.
+*/
+#define LODEPNG_PARALLEL_INFLATE_MIN_PART 262144 /*minimum amount of compressed bytes per part*/
+#define LODEPNG_INFLATE_WINDOW_SIZE 32768
+
+/*dynamic vector of unsigned shorts, holds the output of a part with window references*/
+typedef struct usvector
+{
+  unsigned short* data;
+  size_t size; /*used size*/
+  size_t allocsize; /*allocated size in bytes*/
+} usvector;
+
+static void usvector_init(usvector* p)
+{
+  p->data = NULL;
+  p->size = p->allocsize = 0;
+}
+
+static void usvector_cleanup(usvector* p)
+{
+  p->size = p->allocsize = 0;
+  lodepng_free(p->data);
+  p->data = NULL;
+}
+
+/*returns 1 if success, 0 if failure ==> nothing done*/
+static unsigned usvector_resize(usvector* p, size_t size)
+{
+  size_t allocsize = size * sizeof(unsigned short);
+  if(allocsize > p->allocsize)
+  {
+    size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
+    void* data = lodepng_realloc(p->data, newsize);
+    if(!data) return 0; /*error: not enough memory*/
+    p->allocsize = newsize;
+    p->data = (unsigned short*)data;
+  }
+  p->size = size;
+  return 1;
+}
+
+/*same as inflateNoCompression, but for output with window references*/
+static unsigned inflateNoCompressionMarked(usvector* out, const unsigned char* in, size_t* bp, size_t inlength)
+{
+  size_t p, pos = out->size;
+  unsigned LEN, NLEN, n;
+
+  while(((*bp) & 0x7) != 0) ++(*bp);
+  p = (*bp) / 8;
+
+  if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
+  LEN = in[p] + 256u * in[p + 1]; p += 2;
+  NLEN = in[p] + 256u * in[p + 1]; p += 2;
+  if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
+
+  if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
+  if(!usvector_resize(out, pos + LEN)) return 83; /*alloc fail*/
+  for(n = 0; n < LEN; ++n) out->data[pos++] = in[p++];
+
+  (*bp) = p * 8;
+  return 0;
+}
+
+/*same as inflateHuffmanBlock, but back-references to data before the start of out are stored as
+window references instead of failing*/
+static unsigned inflateHuffmanBlockMarked(usvector* out, const unsigned char* in, size_t* bp,
+                                          size_t inlength, unsigned btype, LodePNGCancel* cancel)
+{
+  unsigned error = 0;
+  HuffmanTree tree_ll;
+  HuffmanTree tree_d;
+  size_t inbitlength = inlength * 8;
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+
+  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+
+  while(!error)
+  {
+    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    if(code_ll <= 255)
+    {
+      if(!usvector_resize(out, out->size + 1)) ERROR_BREAK(83 /*alloc fail*/);
+      out->data[out->size - 1] = (unsigned short)code_ll;
+    }
+    else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX)
+    {
+      unsigned code_d, distance;
+      size_t start, forward, length;
+
+      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      if((*bp + LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX]) > inbitlength) ERROR_BREAK(51);
+      length += readBitsFromStream(bp, in, LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX]);
+
+      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      if(code_d > 29) ERROR_BREAK(18); /*error: invalid distance code or end of memory*/
+      distance = DISTANCEBASE[code_d];
+      if((*bp + DISTANCEEXTRA[code_d]) > inbitlength) ERROR_BREAK(51);
+      distance += readBitsFromStream(bp, in, DISTANCEEXTRA[code_d]);
+
+      start = out->size;
+      if(distance > start + LODEPNG_INFLATE_WINDOW_SIZE) ERROR_BREAK(52); /*too long backward distance*/
+      if(!usvector_resize(out, start + length)) ERROR_BREAK(83 /*alloc fail*/);
+      for(forward = 0; forward < length; ++forward)
+      {
+        size_t pos = start + forward;
+        if(distance > pos) out->data[pos] = (unsigned short)(256 + LODEPNG_INFLATE_WINDOW_SIZE - (distance - pos));
+        else out->data[pos] = out->data[pos - distance];
+      }
+      if(out->size >= cancel->next && LodePNGCancel_poll(cancel, out->size)) ERROR_BREAK(121);
+    }
+    else if(code_ll == 256)
+    {
+      break; /*end code, break the loop*/
+    }
+    else
+    {
+      error = ((*bp) > inlength * 8) ? 10 : 11;
+      break;
+    }
+  }
+
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+
+  return error;
+}
+
+typedef struct InflatePart
+{
+  size_t start_bp; /*bit position of the first block of this part*/
+  size_t end_bp; /*bit position of the first block of the next part, 0 for the last part*/
+  unsigned found; /*start_bp is a verified block start*/
+  unsigned flushed; /*the part starts after a full flush, so it can be decoded straight to bytes*/
+  unsigned marked; /*the output is in symbols rather than in bytes*/
+  ucvector bytes;
+  usvector symbols;
+  unsigned error;
+} InflatePart;
+
+typedef struct InflateParallel
+{
+  const unsigned char* in;
+  size_t insize;
+  const LodePNGDecompressSettings* settings;
+  InflatePart* parts;
+  unsigned numparts;
+} InflateParallel;
+
+/*decodes blocks of a part until its end_bp is reached, or up to BFINAL for the last part.
+maxblocks limits the amount of blocks, 0 means no limit. settings may be null, otherwise its cancel
+is polled. return value is error*/
+static unsigned inflatePartBlocks(InflatePart* part, const unsigned char* in, size_t insize, unsigned maxblocks,
+                                  const LodePNGDecompressSettings* settings)
+{
+  size_t bp = part->start_bp;
+  size_t pos = 0;
+  unsigned BFINAL = 0, blocks = 0, error = 0;
+  LodePNGCancel cancel;
+
+  LodePNGCancel_init(&cancel, settings);
+  while(!BFINAL && !(part->end_bp && bp >= part->end_bp) && !(maxblocks && blocks == maxblocks))
+  {
+    unsigned BTYPE;
+    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = readBitFromStream(&bp, in);
+    BTYPE = 1u * readBitFromStream(&bp, in);
+    BTYPE += 2u * readBitFromStream(&bp, in);
+
+    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+    else if(part->marked && BTYPE == 0) error = inflateNoCompressionMarked(&part->symbols, in, &bp, insize);
+    else if(part->marked) error = inflateHuffmanBlockMarked(&part->symbols, in, &bp, insize, BTYPE, &cancel);
+    else if(BTYPE == 0) error = inflateNoCompression(&part->bytes, in, &bp, &pos, insize);
+    else error = inflateHuffmanBlock(&part->bytes, in, &bp, &pos, insize, BTYPE, &cancel);
+
+    if(error) return error;
+    if(LodePNGCancel_poll(&cancel, part->marked ? part->symbols.size : pos)) return 121;
+    ++blocks;
+  }
+
+  if(!part->marked) part->bytes.size = pos;
+  /*error: the part doesn't end where the next one was assumed to start*/
+  if(part->end_bp && (bp != part->end_bp || BFINAL)) return 95;
+  return 0;
+}
+
+/*quickly rejects bit positions that can't be the start of a non-final dynamic block*/
+static unsigned inflateMayStartDynamicBlock(const unsigned char* in, size_t bp, size_t inbitlength)
+{
+  unsigned HCLEN, i, kraft = 0;
+  if(bp + 17 > inbitlength) return 0;
+  if(readBitsFromStream(&bp, in, 3) != 4) return 0; /*BFINAL 0, BTYPE 2*/
+  if(readBitsFromStream(&bp, in, 5) + 257 > 286) return 0; /*HLIT*/
+  if(readBitsFromStream(&bp, in, 5) + 1 > 30) return 0; /*HDIST*/
+  HCLEN = readBitsFromStream(&bp, in, 4) + 4;
+  if(bp + HCLEN * 3 > inbitlength) return 0;
+  /*the code length code must be complete, its lengths are at most 7*/
+  for(i = 0; i != HCLEN; ++i)
+  {
+    unsigned length = readBitsFromStream(&bp, in, 3);
+    if(length) kraft += 128u >> length;
+  }
+  return kraft == 128;
+}
+
+/*returns the number of used codes if they form a complete prefix code, 0 otherwise*/
+static unsigned HuffmanTree_completeCodes(const HuffmanTree* tree)
+{
+  unsigned i, used = 0;
+  size_t kraft = 0;
+  for(i = 0; i != tree->numcodes; ++i)
+  {
+    if(!tree->lengths[i]) continue;
+    kraft += (size_t)1 << (15 - tree->lengths[i]);
+    ++used;
+  }
+  return kraft == ((size_t)1 << 15) ? used : 0;
+}
+
+/*encoders write complete literal/length trees, and complete distance trees unless only one distance code
+is used. Random bits that happen to parse as a header almost never satisfy that.*/
+static unsigned inflateDynamicTreesComplete(const unsigned char* in, size_t bp, size_t insize)
+{
+  unsigned error, result = 0;
+  HuffmanTree tree_ll, tree_d;
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  bp += 3; /*BFINAL and BTYPE*/
+  error = getTreeInflateDynamic(&tree_ll, &tree_d, in, &bp, insize);
+  if(!error && HuffmanTree_completeCodes(&tree_ll))
+  {
+    unsigned i, used = 0;
+    for(i = 0; i != tree_d.numcodes; ++i) used += tree_d.lengths[i] != 0;
+    result = used <= 1 || HuffmanTree_completeCodes(&tree_d);
+  }
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+  return result;
+}
+
+/*checks that two whole blocks decode from bit position bp, and if so makes bp the start of the part*/
+static unsigned inflateTryPartStart(InflatePart* part, const unsigned char* in, size_t insize, size_t bp)
+{
+  unsigned error;
+  InflatePart trial;
+  trial.start_bp = bp;
+  trial.end_bp = 0;
+  trial.marked = 1;
+  usvector_init(&trial.symbols);
+  error = inflatePartBlocks(&trial, in, insize, 2, 0);
+  usvector_cleanup(&trial.symbols);
+  if(error) return 0;
+  part->start_bp = bp;
+  part->found = 1;
+  return 1;
+}
+
+/*searches the start of the first block in the byte range [from, to) of the input*/
+static void inflateFindPartStart(InflatePart* part, const unsigned char* in, size_t insize, size_t from, size_t to)
+{
+  size_t i, bp;
+  for(i = from; i + 4 <= to; ++i)
+  {
+    if(in[i] == 0 && in[i + 1] == 0 && in[i + 2] == 255 && in[i + 3] == 255
+       && inflateTryPartStart(part, in, insize, (i + 4) * 8))
+    {
+      part->flushed = 1;
+      return;
+    }
+  }
+  for(bp = from * 8; bp < to * 8; ++bp)
+  {
+    if(inflateMayStartDynamicBlock(in, bp, insize * 8) && inflateDynamicTreesComplete(in, bp, insize)
+       && inflateTryPartStart(part, in, insize, bp)) return;
+  }
+}
+
+static void inflateFindPartStartTask(void* context, int index)
+{
+  InflateParallel* p = (InflateParallel*)context;
+  size_t from = p->insize / p->numparts * (size_t)(index + 1);
+  size_t to = (index + 2 == (int)p->numparts) ? p->insize : from + p->insize / p->numparts;
+  inflateFindPartStart(&p->parts[index + 1], p->in, p->insize, from, to);
+}
+
+static void inflateDecodePartTask(void* context, int index)
+{
+  InflateParallel* p = (InflateParallel*)context;
+  InflatePart* part = &p->parts[index];
+  if(!part->found) return;
+  /*only the first part and parts after a full flush can go straight to bytes*/
+  part->marked = !(index == 0 || part->flushed);
+  part->error = inflatePartBlocks(part, p->in, p->insize, 0, p->settings);
+  if(part->error && !part->marked)
+  {
+    /*a sync flush looks the same as a full flush but keeps the window*/
+    ucvector_cleanup(&part->bytes);
+    part->marked = 1;
+    part->error = inflatePartBlocks(part, p->in, p->insize, 0, p->settings);
+  }
+}
+
+/*returns 1 if out holds the inflated stream. returns 0 if the stream couldn't be split or the
+speculation failed somewhere, the caller then has to decode it serially*/
+static unsigned lodepng_inflatev_parallel(ucvector* out, const unsigned char* in, size_t insize,
+                                          const LodePNGDecompressSettings* settings)
+{
+  InflateParallel p;
+  unsigned i, last = 0, ok = 1;
+  size_t total = 0, pos = 0;
+
+  p.in = in;
+  p.insize = insize;
+  p.settings = settings;
+  p.numparts = settings->num_threads;
+  if(p.numparts > insize / LODEPNG_PARALLEL_INFLATE_MIN_PART) p.numparts = (unsigned)(insize / LODEPNG_PARALLEL_INFLATE_MIN_PART);
+  if(p.numparts < 2) return 0;
+
+  p.parts = (InflatePart*)lodepng_malloc(p.numparts * sizeof(InflatePart));
+  if(!p.parts) return 0;
+  for(i = 0; i != p.numparts; ++i)
+  {
+    p.parts[i].start_bp = p.parts[i].end_bp = 0;
+    p.parts[i].found = p.parts[i].flushed = p.parts[i].marked = 0;
+    p.parts[i].error = 0;
+    ucvector_init(&p.parts[i].bytes);
+    usvector_init(&p.parts[i].symbols);
+  }
+  p.parts[0].found = 1;
 
-      /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = (*pos);
-      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
+  /*1: find the part boundaries*/
+  lc_run_tasks((int)p.numparts - 1, (int)settings->num_threads, inflateFindPartStartTask, &p);
 
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-      if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
-      } else {
-        memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
-      }
+  /*parts without a start are merged into the previous part*/
+  for(i = 1; i != p.numparts; ++i)
+  {
+    if(!p.parts[i].found) continue;
+    if(p.parts[i].start_bp <= p.parts[last].start_bp) p.parts[i].found = 0;
+    else
+    {
+      p.parts[last].end_bp = p.parts[i].start_bp;
+      last = i;
     }
-    else if(code_ll == 256)
+  }
+
+  /*2: speculative decode of all parts*/
+  lc_run_tasks((int)p.numparts, (int)settings->num_threads, inflateDecodePartTask, &p);
+  if(settings->scratch_peak)
+  {
+    size_t scratch = p.numparts * (sizeof(InflatePart) + INFLATE_SCRATCH_SIZE);
+    for(i = 0; i != p.numparts; ++i) scratch += p.parts[i].bytes.allocsize + p.parts[i].symbols.allocsize;
+    if(scratch > *settings->scratch_peak) *settings->scratch_peak = scratch;
+  }
+
+  /*3: stitch the parts together and resolve the window references*/
+  for(i = 0; i != p.numparts; ++i)
+  {
+    if(!p.parts[i].found) continue;
+    if(p.parts[i].error) ok = 0;
+    total += p.parts[i].marked ? p.parts[i].symbols.size : p.parts[i].bytes.size;
+  }
+  if(ok && !ucvector_resize(out, total)) ok = 0;
+  for(i = 0; ok && i != p.numparts; ++i)
+  {
+    InflatePart* part = &p.parts[i];
+    if(!part->found) continue;
+    if(!part->marked)
     {
-      break; /*end code, break the loop*/
+      if(part->bytes.size) memcpy(out->data + pos, part->bytes.data, part->bytes.size);
+      pos += part->bytes.size;
     }
-    else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+    else
     {
-      /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-      (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
-      break;
+      size_t j, part_start = pos;
+      for(j = 0; j != part->symbols.size; ++j, ++pos)
+      {
+        unsigned symbol = part->symbols.data[j];
+        if(symbol < 256) out->data[pos] = (unsigned char)symbol;
+        else
+        {
+          /*how far before the start of the part the referenced byte is*/
+          size_t back = LODEPNG_INFLATE_WINDOW_SIZE - (symbol - 256);
+          if(back > part_start) { ok = 0; break; } /*reference before the start of the stream*/
+          out->data[pos] = out->data[part_start - back];
+        }
+      }
     }
   }
 
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
+  for(i = 0; i != p.numparts; ++i)
+  {
+    ucvector_cleanup(&p.parts[i].bytes);
+    usvector_cleanup(&p.parts[i].symbols);
+  }
+  lodepng_free(p.parts);
 
-  return error;
+  return ok;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings)
+#ifdef LC_IMAGE_LIBDEFLATE
+/*
+Inflates with libdeflate, which needs the whole output buffer up front: it is sized from
+settings->expected_size (or a guess) and doubled if the data turns out to be larger. The zlib
+header and Adler-32 stay with lodepng_zlib_decompress.
+*/
+static unsigned libdeflateInflate(ucvector* out, const unsigned char* in, size_t insize,
+                                  const LodePNGDecompressSettings* settings)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
-  unsigned BFINAL = 0;
-  size_t pos = 0; /*byte position in the out buffer*/
-  unsigned error = 0;
-
-  (void)settings;
-
-  while(!BFINAL)
+  struct libdeflate_decompressor* decompressor = libdeflate_alloc_decompressor();
+  size_t start = out->size, avail, actual = 0;
+  enum libdeflate_result result = LIBDEFLATE_INSUFFICIENT_SPACE;
+  if(!decompressor) return 83; /*alloc fail*/
+  avail = settings->expected_size ? settings->expected_size : insize * 4 + 1024;
+  while(result == LIBDEFLATE_INSUFFICIENT_SPACE)
   {
-    unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
-
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
-
-    if(error) return error;
+    if(start + avail < start || !ucvector_resize(out, start + avail))
+    {
+      libdeflate_free_decompressor(decompressor);
+      return 83; /*alloc fail*/
+    }
+    result = libdeflate_deflate_decompress(decompressor, in, insize, out->data + start, avail, &actual);
+    /*the size is exact when the caller knows it, more output than that is corrupt data*/
+    if(settings->expected_size || avail * 2 < avail) break;
+    avail *= 2;
   }
-
-  return error;
+  libdeflate_free_decompressor(decompressor);
+  if(result != LIBDEFLATE_SUCCESS) return 120; /*libdeflate found the deflate data corrupt*/
+  out->size = start + actual;
+  return 0;
 }
+#endif /*LC_IMAGE_LIBDEFLATE*/
 
 static unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
@@ -3057,7 +7609,24 @@ static unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_inflatev(&v, in, insize, settings);
+  /*allocated once up front when the size is known, growing by half from zero overshoots it*/
+  if(settings->expected_size && !ucvector_reserve(&v, v.size + settings->expected_size))
+  {
+    return 83; /*alloc fail*/
+  }
+#ifdef LC_IMAGE_LIBDEFLATE
+  /*the progress callback needs the built in block by block decoding*/
+  if(!settings->progress)
+  {
+    if(settings->cancel && settings->cancel(settings->cancel_context)) return 121;
+    error = libdeflateInflate(&v, in, insize, settings);
+    *out = v.data;
+    *outsize = v.size;
+    return error;
+  }
+#endif /*LC_IMAGE_LIBDEFLATE*/
+  if(settings->num_threads > 1 && !settings->progress && lodepng_inflatev_parallel(&v, in, insize, settings)) error = 0;
+  else error = lodepng_inflatev(&v, in, insize, settings);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -3116,7 +7685,7 @@ static unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, co
   if(!settings->ignore_adler32)
   {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
+    unsigned checksum = adler32(*out, *outsize);
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
@@ -3137,15 +7706,566 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
+/* Deflate - fast encoder */
+/*
+Speed oriented deflate used by lc_write_png, in the spirit of fpng. Matching is greedy with a single
+entry hash table, plus the previous pixel as a second candidate for runs. Positions inside matches
+are not hashed, and incompressible stretches are skipped over faster the longer they last. Every block of symbols gets its own dynamic Huffman code built from its
+symbol counts, or is stored if that would not be smaller.
+*/
+#define FASTDEFLATE_HASH_BITS 15
+#define FASTDEFLATE_BLOCK_SYMBOLS 32768 /*lit/len symbols per Huffman block*/
+#define FASTDEFLATE_MIN_MATCH 4
+#define FASTDEFLATE_MAX_MATCH 258
+#define FASTDEFLATE_WINDOW 32768
+
+/*length - 3 to length code - 257, and distance - 1 to distance code (see zlib's _dist_code)*/
+static unsigned char fastdeflate_lengthcode[256];
+static unsigned char fastdeflate_distcode[512];
+static lc_once_t fastdeflate_tables_once = LC_ONCE_INIT;
+
+static void fastDeflateInitTables(void)
+{
+  unsigned code, i;
+  for(code = 0; code != 28; ++code)
+  {
+    for(i = LENGTHBASE[code]; i < LENGTHBASE[code + 1]; ++i) fastdeflate_lengthcode[i - 3] = (unsigned char)code;
+  }
+  fastdeflate_lengthcode[255] = 28;
+  for(code = 0; code != 16; ++code)
+  {
+    for(i = DISTANCEBASE[code]; i < DISTANCEBASE[code + 1]; ++i) fastdeflate_distcode[i - 1] = (unsigned char)code;
+  }
+  for(code = 16; code != 30; ++code)
+  {
+    unsigned end = code == 29 ? 32769 : DISTANCEBASE[code + 1];
+    for(i = DISTANCEBASE[code]; i < end; i += 128) fastdeflate_distcode[256 + ((i - 1) >> 7)] = (unsigned char)code;
+  }
+}
+
+static unsigned fastDeflateDistCode(unsigned distance)
+{
+  return distance <= 256 ? fastdeflate_distcode[distance - 1] : fastdeflate_distcode[256 + ((distance - 1) >> 7)];
+}
+
+/*bits are collected LSB first and written 32 at a time, the output must have room reserved*/
+typedef struct FastDeflateWriter
+{
+  ucvector* out;
+  unsigned long long bits;
+  unsigned count;
+} FastDeflateWriter;
+
+/*n must be at most 32*/
+static void fastDeflatePutBits(FastDeflateWriter* writer, unsigned value, unsigned n)
+{
+  writer->bits |= (unsigned long long)value << writer->count;
+  writer->count += n;
+  if(writer->count >= 32)
+  {
+    unsigned char* p = writer->out->data + writer->out->size;
+    p[0] = (unsigned char)(writer->bits);
+    p[1] = (unsigned char)(writer->bits >> 8);
+    p[2] = (unsigned char)(writer->bits >> 16);
+    p[3] = (unsigned char)(writer->bits >> 24);
+    writer->out->size += 4;
+    writer->bits >>= 32;
+    writer->count -= 32;
+  }
+}
+
+/*writes out the pending bits, padding the last byte with zeros*/
+static void fastDeflateAlign(FastDeflateWriter* writer)
+{
+  while(writer->count > 0)
+  {
+    writer->out->data[writer->out->size++] = (unsigned char)writer->bits;
+    writer->bits >>= 8;
+    writer->count = writer->count > 8 ? writer->count - 8 : 0;
+  }
+  writer->bits = 0;
+}
+
+/*
+Length limited Huffman code lengths for the n symbols. Code lengths are computed with Moffat and
+Katajainen's in-place algorithm on the symbols sorted by frequency; lengths above maxbitlen are then
+folded back the way zlib and miniz do it. Symbols with frequency 0 get length 0.
+*/
+static void fastDeflateCodeLengths(unsigned* lengths, const unsigned* frequencies, unsigned n, unsigned maxbitlen)
+{
+  unsigned symbols[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned a[NUM_DEFLATE_CODE_SYMBOLS];
+  unsigned numcodes[33];
+  unsigned m = 0, i, j, total;
+  int root, leaf, next, avbl, used, depth;
+
+  for(i = 0; i != n; ++i)
+  {
+    lengths[i] = 0;
+    if(frequencies[i] == 0) continue;
+    /*insertion sort on frequency, n is small*/
+    for(j = m; j > 0 && frequencies[symbols[j - 1]] > frequencies[i]; --j) symbols[j] = symbols[j - 1];
+    symbols[j] = i;
+    ++m;
+  }
+  if(m == 0) return;
+  if(m == 1)
+  {
+    lengths[symbols[0]] = 1;
+    return;
+  }
+
+  for(i = 0; i != m; ++i) a[i] = frequencies[symbols[i]];
+  a[0] += a[1];
+  root = 0;
+  leaf = 2;
+  for(next = 1; next < (int)m - 1; ++next)
+  {
+    if(leaf >= (int)m || a[root] < a[leaf]) { a[next] = a[root]; a[root++] = (unsigned)next; }
+    else a[next] = a[leaf++];
+    if(leaf >= (int)m || (root < next && a[root] < a[leaf])) { a[next] += a[root]; a[root++] = (unsigned)next; }
+    else a[next] += a[leaf++];
+  }
+  a[m - 2] = 0;
+  for(next = (int)m - 3; next >= 0; --next) a[next] = a[a[next]] + 1;
+  avbl = 1;
+  used = depth = 0;
+  root = (int)m - 2;
+  next = (int)m - 1;
+  while(avbl > 0)
+  {
+    while(root >= 0 && (int)a[root] == depth) { ++used; --root; }
+    while(avbl > used) { a[next--] = (unsigned)depth; --avbl; }
+    avbl = 2 * used;
+    ++depth;
+    used = 0;
+  }
+
+  /*a[i] is now the code length of symbols[i], longest first*/
+  for(i = 0; i != 33; ++i) numcodes[i] = 0;
+  for(i = 0; i != m; ++i) ++numcodes[a[i] > 32 ? 32 : a[i]];
+  for(i = maxbitlen + 1; i <= 32; ++i)
+  {
+    numcodes[maxbitlen] += numcodes[i];
+    numcodes[i] = 0;
+  }
+  total = 0;
+  for(i = maxbitlen; i > 0; --i) total += numcodes[i] << (maxbitlen - i);
+  while(total != (1u << maxbitlen))
+  {
+    --numcodes[maxbitlen];
+    for(i = maxbitlen - 1; i > 0; --i)
+    {
+      if(numcodes[i])
+      {
+        --numcodes[i];
+        numcodes[i + 1] += 2;
+        break;
+      }
+    }
+    --total;
+  }
+
+  j = 0;
+  for(i = maxbitlen; i > 0; --i)
+  {
+    unsigned k;
+    for(k = numcodes[i]; k > 0; --k) lengths[symbols[j++]] = i;
+  }
+}
+
+/*canonical codes for the lengths, bit reversed so they can be written LSB first*/
+static void fastDeflateMakeCodes(unsigned* codes, const unsigned* lengths, unsigned n)
+{
+  unsigned blcount[16], nextcode[16];
+  unsigned i, bits, code = 0;
+  for(i = 0; i != 16; ++i) blcount[i] = 0;
+  for(i = 0; i != n; ++i) ++blcount[lengths[i]];
+  blcount[0] = 0;
+  for(bits = 1; bits != 16; ++bits)
+  {
+    code = (code + blcount[bits - 1]) << 1;
+    nextcode[bits] = code;
+  }
+  for(i = 0; i != n; ++i)
+  {
+    unsigned len = lengths[i], c, r = 0, b;
+    if(len == 0) { codes[i] = 0; continue; }
+    c = nextcode[len]++;
+    for(b = 0; b != len; ++b) r |= ((c >> b) & 1u) << (len - 1 - b);
+    codes[i] = r;
+  }
+}
+
+/*
+A symbol is a literal byte, or 0x80000000 | (distance - 1) << 9 | length for a match.
+Writes one block with the symbols, which encode in[0..insize-1].
+*/
+static void fastDeflateWriteBlock(FastDeflateWriter* writer, const unsigned* symbols, size_t numsymbols,
+                                  const unsigned char* in, size_t insize, unsigned final)
+{
+  unsigned litfreq[286], distfreq[30], clfreq[NUM_CODE_LENGTH_CODES];
+  unsigned litlen[286], distlen[30], cllen[NUM_CODE_LENGTH_CODES];
+  unsigned litcode[286], distcode[30], clcode[NUM_CODE_LENGTH_CODES];
+  unsigned lengths[286 + 30], clsymbols[286 + 30];
+  unsigned hlit, hdist, hclen, numlengths, numclsymbols = 0, nonzero, i;
+  unsigned long long dynamicbits, storedbits, extrabits = 0;
+  size_t s;
+
+  for(i = 0; i != 286; ++i) litfreq[i] = 0;
+  for(i = 0; i != 30; ++i) distfreq[i] = 0;
+  for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i) clfreq[i] = 0;
+  for(s = 0; s != numsymbols; ++s)
+  {
+    unsigned symbol = symbols[s];
+    if(symbol & 0x80000000u)
+    {
+      unsigned lcode = fastdeflate_lengthcode[(symbol & 511) - 3];
+      unsigned dcode = fastDeflateDistCode(((symbol >> 9) & 0x7fff) + 1);
+      ++litfreq[FIRST_LENGTH_CODE_INDEX + lcode];
+      ++distfreq[dcode];
+      extrabits += LENGTHEXTRA[lcode] + DISTANCEEXTRA[dcode];
+    }
+    else ++litfreq[symbol];
+  }
+  litfreq[256] = 1;
+  /*keep both codes complete: at least two used symbols each*/
+  for(i = 0, nonzero = 0; i != 286; ++i) nonzero += litfreq[i] != 0;
+  if(nonzero < 2) litfreq[litfreq[0] ? 1 : 0] = 1;
+  for(i = 0, nonzero = 0; i != 30; ++i) nonzero += distfreq[i] != 0;
+  if(nonzero < 2)
+  {
+    if(!distfreq[0]) distfreq[0] = 1;
+    if(!distfreq[1]) distfreq[1] = 1;
+  }
+
+  fastDeflateCodeLengths(litlen, litfreq, 286, 15);
+  fastDeflateCodeLengths(distlen, distfreq, 30, 15);
+  for(hlit = 286; hlit > 257 && litlen[hlit - 1] == 0; --hlit) {}
+  for(hdist = 30; hdist > 1 && distlen[hdist - 1] == 0; --hdist) {}
+
+  /*run length encode the code lengths with symbols 16, 17 and 18, extra bits stored above bit 8*/
+  numlengths = hlit + hdist;
+  for(i = 0; i != hlit; ++i) lengths[i] = litlen[i];
+  for(i = 0; i != hdist; ++i) lengths[hlit + i] = distlen[i];
+  for(i = 0; i < numlengths;)
+  {
+    unsigned value = lengths[i], run = 1;
+    while(i + run < numlengths && lengths[i + run] == value) ++run;
+    if(value == 0 && run >= 3)
+    {
+      if(run > 138) run = 138;
+      if(run <= 10) clsymbols[numclsymbols++] = 17 | ((run - 3) << 8);
+      else clsymbols[numclsymbols++] = 18 | ((run - 11) << 8);
+    }
+    else if(value != 0 && run >= 4)
+    {
+      /*the first one is written as itself, then repeated 3 to 6 times*/
+      if(run > 7) run = 7;
+      clsymbols[numclsymbols++] = value;
+      clsymbols[numclsymbols++] = 16 | ((run - 4) << 8);
+    }
+    else
+    {
+      run = 1;
+      clsymbols[numclsymbols++] = value;
+    }
+    i += run;
+  }
+  for(i = 0; i != numclsymbols; ++i) ++clfreq[clsymbols[i] & 255];
+  for(i = 0, nonzero = 0; i != NUM_CODE_LENGTH_CODES; ++i) nonzero += clfreq[i] != 0;
+  if(nonzero < 2) clfreq[clfreq[0] ? 1 : 0] += 1;
+  fastDeflateCodeLengths(cllen, clfreq, NUM_CODE_LENGTH_CODES, 7);
+  for(hclen = NUM_CODE_LENGTH_CODES; hclen > 4 && cllen[CLCL_ORDER[hclen - 1]] == 0; --hclen) {}
+
+  dynamicbits = 3 + 5 + 5 + 4 + 3 * hclen + extrabits;
+  for(i = 0; i != numclsymbols; ++i)
+  {
+    unsigned symbol = clsymbols[i] & 255;
+    dynamicbits += cllen[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+  }
+  for(i = 0; i != 286; ++i) dynamicbits += (unsigned long long)litfreq[i] * litlen[i];
+  for(i = 0; i != 30; ++i) dynamicbits += (unsigned long long)distfreq[i] * distlen[i];
+  storedbits = (unsigned long long)insize * 8 + ((insize + 65534) / 65535 + 1) * 40;
+
+  if(storedbits <= dynamicbits)
+  {
+    size_t pos = 0;
+    do
+    {
+      size_t length = insize - pos > 65535 ? 65535 : insize - pos;
+      unsigned char* p;
+      fastDeflatePutBits(writer, (final && pos + length == insize) ? 1 : 0, 3);
+      fastDeflateAlign(writer);
+      p = writer->out->data + writer->out->size;
+      p[0] = (unsigned char)length;
+      p[1] = (unsigned char)(length >> 8);
+      p[2] = (unsigned char)~length;
+      p[3] = (unsigned char)(~length >> 8);
+      memcpy(p + 4, in + pos, length);
+      writer->out->size += 4 + length;
+      pos += length;
+    }
+    while(pos < insize);
+    return;
+  }
+
+  fastDeflateMakeCodes(litcode, litlen, 286);
+  fastDeflateMakeCodes(distcode, distlen, 30);
+  fastDeflateMakeCodes(clcode, cllen, NUM_CODE_LENGTH_CODES);
+
+  fastDeflatePutBits(writer, final ? 1 : 0, 1);
+  fastDeflatePutBits(writer, 2, 2); /*BTYPE 10: dynamic Huffman*/
+  fastDeflatePutBits(writer, hlit - 257, 5);
+  fastDeflatePutBits(writer, hdist - 1, 5);
+  fastDeflatePutBits(writer, hclen - 4, 4);
+  for(i = 0; i != hclen; ++i) fastDeflatePutBits(writer, cllen[CLCL_ORDER[i]], 3);
+  for(i = 0; i != numclsymbols; ++i)
+  {
+    unsigned symbol = clsymbols[i] & 255, extra = clsymbols[i] >> 8;
+    fastDeflatePutBits(writer, clcode[symbol], cllen[symbol]);
+    if(symbol == 16) fastDeflatePutBits(writer, extra, 2);
+    else if(symbol == 17) fastDeflatePutBits(writer, extra, 3);
+    else if(symbol == 18) fastDeflatePutBits(writer, extra, 7);
+  }
+
+  for(s = 0; s != numsymbols; ++s)
+  {
+    unsigned symbol = symbols[s];
+    if(symbol & 0x80000000u)
+    {
+      unsigned length = symbol & 511, distance = ((symbol >> 9) & 0x7fff) + 1;
+      unsigned lcode = fastdeflate_lengthcode[length - 3];
+      unsigned dcode = fastDeflateDistCode(distance);
+      fastDeflatePutBits(writer, litcode[FIRST_LENGTH_CODE_INDEX + lcode], litlen[FIRST_LENGTH_CODE_INDEX + lcode]);
+      fastDeflatePutBits(writer, length - LENGTHBASE[lcode], LENGTHEXTRA[lcode]);
+      fastDeflatePutBits(writer, distcode[dcode], distlen[dcode]);
+      fastDeflatePutBits(writer, distance - DISTANCEBASE[dcode], DISTANCEEXTRA[dcode]);
+    }
+    else fastDeflatePutBits(writer, litcode[symbol], litlen[symbol]);
+  }
+  fastDeflatePutBits(writer, litcode[256], litlen[256]);
+}
+
+static unsigned fastDeflateRead32(const unsigned char* p)
+{
+  unsigned v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static size_t fastDeflateMatchLength(const unsigned char* a, const unsigned char* b, size_t maxlength)
+{
+  size_t length = 0;
+  while(length + 8 <= maxlength)
+  {
+    unsigned long long x, y;
+    memcpy(&x, a + length, 8);
+    memcpy(&y, b + length, 8);
+    if(x != y) break;
+    length += 8;
+  }
+  while(length < maxlength && a[length] == b[length]) ++length;
+  return length;
+}
+
+/*
+Deflates in[0..insize-1] without references to anything before it. If final is set the last block has
+BFINAL set, otherwise the stream ends with a full flush: an empty stored block, leaving the output byte
+aligned and the next part independent. stride is the pixel size in bytes, tried as a run distance.
+*/
+static unsigned fastDeflate(ucvector* out, const unsigned char* in, size_t insize, unsigned stride, unsigned final)
+{
+  FastDeflateWriter writer;
+  unsigned* hashtable;
+  unsigned* symbols;
+  size_t pos = 0;
+  unsigned misses = 0;
+
+  lc_call_once(&fastdeflate_tables_once, fastDeflateInitTables);
+  hashtable = (unsigned*)lodepng_malloc(sizeof(unsigned) << FASTDEFLATE_HASH_BITS);
+  symbols = (unsigned*)lodepng_malloc(sizeof(unsigned) * FASTDEFLATE_BLOCK_SYMBOLS);
+  if(!hashtable || !symbols)
+  {
+    lodepng_free(hashtable);
+    lodepng_free(symbols);
+    return 83; /*alloc fail*/
+  }
+  memset(hashtable, 0, sizeof(unsigned) << FASTDEFLATE_HASH_BITS);
+
+  writer.out = out;
+  writer.bits = 0;
+  writer.count = 0;
+
+  do
+  {
+    size_t blockstart = pos, numsymbols = 0;
+    while(pos < insize && numsymbols < FASTDEFLATE_BLOCK_SYMBOLS)
+    {
+      size_t length = 0, distance = 0;
+      if(pos + FASTDEFLATE_MIN_MATCH <= insize)
+      {
+        size_t maxlength = insize - pos < FASTDEFLATE_MAX_MATCH ? insize - pos : FASTDEFLATE_MAX_MATCH;
+        unsigned value = fastDeflateRead32(in + pos);
+        unsigned hash = (value * 2654435761u) >> (32 - FASTDEFLATE_HASH_BITS);
+        size_t candidate = hashtable[hash]; /*position + 1 in this part, 0 if empty*/
+        hashtable[hash] = (unsigned)(pos + 1);
+        if(candidate && pos - (candidate - 1) <= FASTDEFLATE_WINDOW
+           && fastDeflateRead32(in + candidate - 1) == value)
+        {
+          length = fastDeflateMatchLength(in + pos, in + candidate - 1, maxlength);
+          distance = pos - (candidate - 1);
+        }
+        if(pos >= stride && length < maxlength && distance != stride
+           && fastDeflateRead32(in + pos - stride) == value)
+        {
+          size_t runlength = fastDeflateMatchLength(in + pos, in + pos - stride, maxlength);
+          if(runlength > length)
+          {
+            length = runlength;
+            distance = stride;
+          }
+        }
+      }
+      if(length >= FASTDEFLATE_MIN_MATCH)
+      {
+        symbols[numsymbols++] = 0x80000000u | (unsigned)((distance - 1) << 9) | (unsigned)length;
+        pos += length;
+        misses = 0;
+      }
+      else
+      {
+        /*the longer nothing matched, the more bytes are passed as literals without looking (as LZ4 does)*/
+        size_t step = 1 + (++misses >> 5);
+        if(step > insize - pos) step = insize - pos;
+        if(step > FASTDEFLATE_BLOCK_SYMBOLS - numsymbols) step = FASTDEFLATE_BLOCK_SYMBOLS - numsymbols;
+        while(step--) symbols[numsymbols++] = in[pos++];
+      }
+    }
+
+    /*worst case of a dynamic block is well under 6 bytes per symbol, a stored one is the input*/
+    if(!ucvector_reserve(out, out->size + numsymbols * 6 + (pos - blockstart) + 1024))
+    {
+      lodepng_free(hashtable);
+      lodepng_free(symbols);
+      return 83; /*alloc fail*/
+    }
+    fastDeflateWriteBlock(&writer, symbols, numsymbols, in + blockstart, pos - blockstart, final && pos == insize);
+  }
+  while(pos < insize);
+
+  if(!final)
+  {
+    if(!ucvector_reserve(out, out->size + 16))
+    {
+      lodepng_free(hashtable);
+      lodepng_free(symbols);
+      return 83; /*alloc fail*/
+    }
+    fastDeflatePutBits(&writer, 0, 3); /*empty stored block*/
+    fastDeflateAlign(&writer);
+    out->data[out->size++] = 0;
+    out->data[out->size++] = 0;
+    out->data[out->size++] = 0xff;
+    out->data[out->size++] = 0xff;
+  }
+  else
+  {
+    if(!ucvector_reserve(out, out->size + 16))
+    {
+      lodepng_free(hashtable);
+      lodepng_free(symbols);
+      return 83; /*alloc fail*/
+    }
+    fastDeflateAlign(&writer);
+  }
+
+  lodepng_free(hashtable);
+  lodepng_free(symbols);
+  return 0;
+}
+
 size_t lodepng_get_raw_size(unsigned w, unsigned h, const LodePNGColorMode* color)
 {
-  /*will not overflow for any color type if roughly w * h < 268435455*/
+  /*decodeGeneric checks with lodepng_pixel_overflow that this fits*/
   size_t bpp = lodepng_get_bpp(color);
-  size_t n = w * h;
+  size_t n = (size_t)w * h;
   return ((n / 8) * bpp) + ((n & 7) * bpp + 7) / 8;
 }
 
-
+/*Safely check if multiplying two integers will overflow (no undefined
+behavior, compiler removing the code, etc...) and output result.*/
+static int lodepng_mulofl(size_t a, size_t b, size_t* result)
+{
+  *result = a * b; /*Unsigned multiplication is well defined and safe in C90*/
+  return (a != 0 && *result / a != b);
+}
+
+/*Safely check if adding two integers will overflow and output result.*/
+static int lodepng_addofl(size_t a, size_t b, size_t* result)
+{
+  *result = a + b; /*Unsigned addition is well defined and safe in C90*/
+  return *result < a;
+}
+
+/*
+Returns 1 if the sizes of the image buffers, in bytes and in bits for the bit pointers of
+sub-byte formats, do not fit in size_t, 0 if they do. With a 64-bit size_t every w and h
+the PNG header allows fit, the check only rejects images on 32-bit targets.
+*/
+static int lodepng_pixel_overflow(unsigned w, unsigned h,
+                                  const LodePNGColorMode* pngcolor, const LodePNGColorMode* rawcolor)
+{
+  size_t bpp = lodepng_get_bpp(pngcolor) > lodepng_get_bpp(rawcolor) ? lodepng_get_bpp(pngcolor) : lodepng_get_bpp(rawcolor);
+  size_t numpixels, total;
+  size_t line; /*bytes per line in worst case*/
+
+  if(lodepng_mulofl((size_t)w, (size_t)h, &numpixels)) return 1;
+  if(lodepng_mulofl(numpixels, 8, &total)) return 1; /*8 bytes per pixel for 16-bit RGBA*/
+  if(lodepng_mulofl(total, 8, &total)) return 1; /*bit pointers into the largest buffer*/
+
+  /*bytes per scanline with the expression "(w / 8) * bpp) + ((w & 7) * bpp + 7) / 8"*/
+  if(lodepng_mulofl((size_t)(w / 8), bpp, &line)) return 1;
+  if(lodepng_addofl(line, ((w & 7) * bpp + 7) / 8, &line)) return 1;
+
+  if(lodepng_addofl(line, 5, &line)) return 1; /*5 bytes overhead per line: 1 filterbyte, 4 for Adam7 worst case*/
+  if(lodepng_mulofl(line, h, &total)) return 1; /*total bytes in worst case*/
+
+  return 0; /*no overflow*/
+}
+
+
+/*bookkeeping of the buffers held by a decode, for LodePNGState.memory_peak*/
+static void lodepng_memory_hold(LodePNGState* state, size_t bytes)
+{
+  state->memory_current += bytes;
+  if(state->memory_current > state->memory_peak) state->memory_peak = state->memory_current;
+}
+
+static void lodepng_memory_release(LodePNGState* state, size_t bytes)
+{
+  state->memory_current -= bytes < state->memory_current ? bytes : state->memory_current;
+}
+
+/*total length and number of the IDAT chunks, the chunks are checked again while decoding*/
+static void lodepng_idat_size(size_t* idatsize, size_t* numidat, const unsigned char* in, size_t insize)
+{
+  const unsigned char* chunk = &in[33];
+  *idatsize = *numidat = 0;
+  while((size_t)(chunk - in) + 12 <= insize)
+  {
+    unsigned length = lodepng_chunk_length(chunk);
+    if(length > 2147483647 || (size_t)(chunk - in) + length + 12 > insize) break;
+    if(lodepng_chunk_type_equals(chunk, "IDAT"))
+    {
+      *idatsize += length;
+      ++*numidat;
+    }
+    else if(lodepng_chunk_type_equals(chunk, "IEND")) break;
+    chunk += length + 12;
+  }
+}
+
 /* read a PNG, the result will be in the same color type as the PNG (hence "generic") */
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           LodePNGState* state,
@@ -3154,11 +8274,14 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
+  ucvector idat; /*the data from idat chunks, only concatenated if there is more than one*/
+  const unsigned char* idatdata = 0;
+  size_t idatsize, numidat;
   ucvector scanlines;
   size_t predict;
-  size_t numpixels;
   size_t outsize = 0;
+  size_t rawsize, scratch = 0;
+  LodePNGDecompressSettings zlibsettings = state->decoder.zlibsettings;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -3172,15 +8295,60 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
-  numpixels = *w * *h;
+  /*the buffers and bit pointers below are sized in size_t, which is all that limits the image size*/
+  if(lodepng_pixel_overflow(*w, *h, &state->info_png.color, &state->info_raw)) CERROR_RETURN(state->error, 92);
+
+  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
+  If the decompressed size does not match the prediction, the image must be corrupt.*/
+  if(state->info_png.interlace_method == 0)
+  {
+    /*The extra *h is added because this are the filter bytes every scanline starts with*/
+    predict = lodepng_get_raw_size_idat(*w, *h, &state->info_png.color) + *h;
+  }
+  else
+  {
+    /*Adam-7 interlaced: predicted size is the sum of the 7 sub-images sizes*/
+    const LodePNGColorMode* color = &state->info_png.color;
+    predict = 0;
+    predict += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
+    if(*w > 4) predict += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
+    predict += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, color) + ((*h + 3) >> 3);
+    if(*w > 2) predict += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, color) + ((*h + 3) >> 2);
+    predict += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, color) + ((*h + 1) >> 2);
+    if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
+    predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
+  }
 
-  /*multiplication overflow*/
-  if(*h != 0 && numpixels / *h != *w) CERROR_RETURN(state->error, 92);
-  /*multiplication overflow possible further below. Allows up to 2^31-1 pixel
-  bytes with 16-bit RGBA, the rest is room for filter bytes.*/
-  if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
+  /*
+  Peak memory of the phases: inflating (the IDAT copy, the scanlines, the inflater's trees, the parallel
+  inflater's parts and the preview buffers), unfiltering (scanlines, plus the output for Adam7 as
+  non-interlaced images are unfiltered in place) and the color conversion in lodepng_decode (output
+  before and after).
+  */
+  lodepng_idat_size(&idatsize, &numidat, in, insize);
+  outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+  rawsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+  if(state->decoder.max_memory)
+  {
+    size_t inflating = (numidat > 1 ? idatsize : 0) + predict + INFLATE_SCRATCH_SIZE;
+    size_t unfiltering = predict + (state->info_png.interlace_method ? outsize : 0);
+    size_t converting = state->decoder.color_convert && !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)
+                      ? outsize + rawsize : 0;
+    size_t peak;
+    if(state->info_png.interlace_method && state->decoder.preview) inflating += 2 * rawsize + predict;
+    peak = unfiltering > converting ? unfiltering : converting;
+    if(inflating > peak) peak = inflating;
+    /*the parallel inflater keeps about the whole output in its parts, in the worst case as 16-bit symbols*/
+    if(zlibsettings.num_threads > 1 && inflating + 2 * predict > state->decoder.max_memory) zlibsettings.num_threads = 0;
+    if(peak > state->decoder.max_memory) CERROR_RETURN(state->error, 119);
+  }
 
   ucvector_init(&idat);
+  if(numidat > 1)
+  {
+    if(!ucvector_reserve(&idat, idatsize)) CERROR_RETURN(state->error, 83); /*alloc fail*/
+    lodepng_memory_hold(state, idatsize);
+  }
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -3208,9 +8376,19 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(numidat == 1 && !idatdata)
+      {
+        /*a single IDAT chunk is inflated where it is*/
+        idatdata = data;
+        idat.size = chunkLength;
+      }
+      else
+      {
+        size_t oldsize = idat.size;
+        if(idatdata) CERROR_BREAK(state->error, 83); /*more IDAT chunks than counted before*/
+        if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+        memcpy(idat.data + oldsize, data, chunkLength);
+      }
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -3305,45 +8483,67 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   }
 
   ucvector_init(&scanlines);
-  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
-  If the decompressed size does not match the prediction, the image must be corrupt.*/
-  if(state->info_png.interlace_method == 0)
+  if(!state->error)
   {
-    /*The extra *h is added because this are the filter bytes every scanline starts with*/
-    predict = lodepng_get_raw_size_idat(*w, *h, &state->info_png.color) + *h;
+    Adam7Preview preview;
+    unsigned show = state->info_png.interlace_method == 1 && state->decoder.preview && state->decoder.color_convert
+                    && (state->info_raw.bitdepth == 8 || state->info_raw.bitdepth == 16);
+    lodepng_memory_hold(state, predict);
+    if(show)
+    {
+      state->error = Adam7Preview_init(&preview, state, *w, *h);
+      zlibsettings.progress = Adam7Preview_progress;
+      zlibsettings.progress_context = &preview;
+      lodepng_memory_hold(state, 2 * rawsize + predict);
+    }
+    zlibsettings.scratch_peak = &scratch;
+    zlibsettings.expected_size = predict;
+    if(!state->error)
+    {
+      state->error = zlib_decompress(&scanlines.data, &scanlines.size, idatdata ? idatdata : idat.data,
+                                     idat.size, &zlibsettings);
+      if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    }
+    lodepng_memory_hold(state, scratch);
+    lodepng_memory_release(state, scratch);
+    if(show)
+    {
+      Adam7Preview_cleanup(&preview);
+      lodepng_memory_release(state, 2 * rawsize + predict);
+    }
   }
-  else
+  if(!idatdata)
   {
-    /*Adam-7 interlaced: predicted size is the sum of the 7 sub-images sizes*/
-    const LodePNGColorMode* color = &state->info_png.color;
-    predict = 0;
-    predict += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    if(*w > 4) predict += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    predict += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, color) + ((*h + 3) >> 3);
-    if(*w > 2) predict += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, color) + ((*h + 3) >> 2);
-    predict += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, color) + ((*h + 1) >> 2);
-    if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
-    predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
+    ucvector_cleanup(&idat);
+    lodepng_memory_release(state, idatsize);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
-  if(!state->error)
+
+  if(!state->error && state->info_png.interlace_method == 0)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    /*unfiltered in place, the scanlines buffer becomes the output*/
+    state->error = postProcessScanlines(scanlines.data, scanlines.data, *w, *h, &state->info_png,
+                                         &state->decoder);
+    if(!state->error)
+    {
+      void* data = lodepng_realloc(scanlines.data, outsize ? outsize : 1);
+      if(data) scanlines.data = (unsigned char*)data;
+      *out = scanlines.data;
+      ucvector_init(&scanlines);
+      lodepng_memory_release(state, predict - outsize);
+    }
   }
-  ucvector_cleanup(&idat);
-
-  if(!state->error)
+  else if(!state->error)
   {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
     *out = (unsigned char*)lodepng_malloc(outsize);
     if(!*out) state->error = 83; /*alloc fail*/
-  }
-  if(!state->error)
-  {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    else
+    {
+      lodepng_memory_hold(state, outsize);
+      for(i = 0; i < outsize; i++) (*out)[i] = 0;
+      state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png,
+                                          &state->decoder);
+    }
+    lodepng_memory_release(state, predict);
   }
   ucvector_cleanup(&scanlines);
 }
@@ -3705,6 +8905,123 @@ static void getPixelColorRGBA8(unsigned char* r, unsigned char* g,
   }
 }
 
+#if LC_IMAGE_X86
+/*
+SSSE3 kernels for the common conversions to RGBA8 or RGB8, 16 pixels per step. Return the number of
+pixels converted, the caller converts the rest. Only cases where the color key cannot matter are handled.
+*/
+LC_TARGET("ssse3")
+static size_t getPixelColorsRGBA8SSSE3(unsigned char* buffer, size_t numpixels,
+                                       unsigned has_alpha, const unsigned char* in,
+                                       const LodePNGColorMode* mode)
+{
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+  size_t i = 0;
+  if(mode->colortype == LCT_RGB && mode->bitdepth == 8 && has_alpha && !mode->key_defined)
+  {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    for(; i + 16 <= numpixels; i += 16, in += 48, buffer += 64)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*)(in + 0));
+      __m128i b = _mm_loadu_si128((const __m128i*)(in + 16));
+      __m128i c = _mm_loadu_si128((const __m128i*)(in + 32));
+      _mm_storeu_si128((__m128i*)(buffer + 0), _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 32), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 48), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alpha));
+    }
+  }
+  else if(mode->colortype == LCT_RGBA && mode->bitdepth == 8 && !has_alpha)
+  {
+    const __m128i mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for(; i + 16 <= numpixels; i += 16, in += 64, buffer += 48)
+    {
+      __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 0)), mask);
+      __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 16)), mask);
+      __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 32)), mask);
+      __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 48)), mask);
+      _mm_storeu_si128((__m128i*)(buffer + 0), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+      _mm_storeu_si128((__m128i*)(buffer + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+      _mm_storeu_si128((__m128i*)(buffer + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+  }
+  else if(mode->colortype == LCT_GREY && mode->bitdepth == 8 && has_alpha && !mode->key_defined)
+  {
+    const __m128i mask0 = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1);
+    const __m128i four = _mm_setr_epi8(4, 4, 4, 0, 4, 4, 4, 0, 4, 4, 4, 0, 4, 4, 4, 0);
+    const __m128i mask1 = _mm_add_epi8(mask0, four);
+    const __m128i mask2 = _mm_add_epi8(mask1, four);
+    const __m128i mask3 = _mm_add_epi8(mask2, four);
+    for(; i + 16 <= numpixels; i += 16, in += 16, buffer += 64)
+    {
+      __m128i g = _mm_loadu_si128((const __m128i*)in);
+      _mm_storeu_si128((__m128i*)(buffer + 0), _mm_or_si128(_mm_shuffle_epi8(g, mask0), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 16), _mm_or_si128(_mm_shuffle_epi8(g, mask1), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 32), _mm_or_si128(_mm_shuffle_epi8(g, mask2), alpha));
+      _mm_storeu_si128((__m128i*)(buffer + 48), _mm_or_si128(_mm_shuffle_epi8(g, mask3), alpha));
+    }
+  }
+  else if(mode->colortype == LCT_GREY && mode->bitdepth == 8 && !has_alpha)
+  {
+    const __m128i mask0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i mask1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i mask2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+    for(; i + 16 <= numpixels; i += 16, in += 16, buffer += 48)
+    {
+      __m128i g = _mm_loadu_si128((const __m128i*)in);
+      _mm_storeu_si128((__m128i*)(buffer + 0), _mm_shuffle_epi8(g, mask0));
+      _mm_storeu_si128((__m128i*)(buffer + 16), _mm_shuffle_epi8(g, mask1));
+      _mm_storeu_si128((__m128i*)(buffer + 32), _mm_shuffle_epi8(g, mask2));
+    }
+  }
+  else if(mode->colortype == LCT_GREY_ALPHA && mode->bitdepth == 8 && has_alpha)
+  {
+    const __m128i mask0 = _mm_setr_epi8(0, 0, 0, 1, 2, 2, 2, 3, 4, 4, 4, 5, 6, 6, 6, 7);
+    const __m128i mask1 = _mm_add_epi8(mask0, _mm_set1_epi8(8));
+    for(; i + 16 <= numpixels; i += 16, in += 32, buffer += 64)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i*)(in + 0));
+      __m128i b = _mm_loadu_si128((const __m128i*)(in + 16));
+      _mm_storeu_si128((__m128i*)(buffer + 0), _mm_shuffle_epi8(a, mask0));
+      _mm_storeu_si128((__m128i*)(buffer + 16), _mm_shuffle_epi8(a, mask1));
+      _mm_storeu_si128((__m128i*)(buffer + 32), _mm_shuffle_epi8(b, mask0));
+      _mm_storeu_si128((__m128i*)(buffer + 48), _mm_shuffle_epi8(b, mask1));
+    }
+  }
+  else if(mode->bitdepth == 16 && ((mode->colortype == LCT_RGBA && has_alpha) || (mode->colortype == LCT_RGB && !has_alpha)))
+  {
+    /*keep the most significant byte of each big endian sample, 16 samples per step*/
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    size_t j, numsamples;
+    i = numpixels & ~(size_t)15;
+    numsamples = i * (has_alpha ? 4 : 3);
+    for(j = 0; j != numsamples; j += 16, in += 32, buffer += 16)
+    {
+      __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(in + 0)), low);
+      __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(in + 16)), low);
+      _mm_storeu_si128((__m128i*)buffer, _mm_packus_epi16(a, b));
+    }
+  }
+  return i;
+}
+#endif /*LC_IMAGE_X86*/
+
+#if LC_IMAGE_X86
+/*expands 8 bit palette indices to RGBA8 with gathers from the 256 entry table, 8 pixels per step*/
+LC_TARGET("avx2")
+static size_t getPixelColorsPaletteAVX2(unsigned char* buffer, size_t numpixels,
+                                        const unsigned char* in, const unsigned char* table)
+{
+  size_t i = 0;
+  for(; i + 8 <= numpixels; i += 8, buffer += 32)
+  {
+    __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+    _mm256_storeu_si256((__m256i*)buffer, _mm256_i32gather_epi32((const int*)table, index, 4));
+  }
+  return i;
+}
+#endif /*LC_IMAGE_X86*/
+
 /*Similar to getPixelColorRGBA8, but with all the for loops inside of the color
 mode test cases, optimized to convert the colors much faster, when converting
 to RGBA or RGB with 8 bit per cannel. buffer must be RGBA or RGB output with
@@ -3716,6 +9033,15 @@ static void getPixelColorsRGBA8(unsigned char* buffer, size_t numpixels,
 {
   unsigned num_channels = has_alpha ? 4 : 3;
   size_t i;
+#if LC_IMAGE_X86
+  if(numpixels >= 16 && lc_cpu_has(LC_CPU_SSSE3))
+  {
+    size_t done = getPixelColorsRGBA8SSSE3(buffer, numpixels, has_alpha, in, mode);
+    buffer += done * num_channels;
+    in += done * (lodepng_get_bpp(mode) / 8);
+    numpixels -= done;
+  }
+#endif /*LC_IMAGE_X86*/
   if(mode->colortype == LCT_GREY)
   {
     if(mode->bitdepth == 8)
@@ -3775,26 +9101,53 @@ static void getPixelColorsRGBA8(unsigned char* buffer, size_t numpixels,
   }
   else if(mode->colortype == LCT_PALETTE)
   {
-    unsigned index;
-    size_t j = 0;
-    for(i = 0; i != numpixels; ++i, buffer += num_channels)
+    /*RGBA for every possible index, built once so the loops below are plain lookups*/
+    unsigned char table[256 * 4];
+    for(i = 0; i != 256; ++i)
     {
-      if(mode->bitdepth == 8) index = in[i];
-      else index = readBitsFromReversedStream(&j, in, mode->bitdepth);
-
-      if(index >= mode->palettesize)
+      if(i >= mode->palettesize)
       {
         /*This is an error according to the PNG spec, but most PNG decoders make it black instead.
         Done here too, slightly faster due to no error handling needed.*/
-        buffer[0] = buffer[1] = buffer[2] = 0;
-        if(has_alpha) buffer[3] = 255;
+        table[i * 4 + 0] = table[i * 4 + 1] = table[i * 4 + 2] = 0;
+        table[i * 4 + 3] = 255;
+      }
+      else memcpy(&table[i * 4], &mode->palette[i * 4], 4);
+    }
+
+    if(mode->bitdepth == 8)
+    {
+      if(has_alpha)
+      {
+        i = 0;
+#if LC_IMAGE_X86
+        if(numpixels >= 8 && lc_cpu_has(LC_CPU_AVX2))
+        {
+          i = getPixelColorsPaletteAVX2(buffer, numpixels, in, table);
+          buffer += i * 4;
+        }
+#endif /*LC_IMAGE_X86*/
+        for(; i != numpixels; ++i, buffer += 4) memcpy(buffer, &table[in[i] * 4], 4);
       }
       else
       {
-        buffer[0] = mode->palette[index * 4 + 0];
-        buffer[1] = mode->palette[index * 4 + 1];
-        buffer[2] = mode->palette[index * 4 + 2];
-        if(has_alpha) buffer[3] = mode->palette[index * 4 + 3];
+        for(i = 0; i != numpixels; ++i, buffer += 3) memcpy(buffer, &table[in[i] * 4], 3);
+      }
+    }
+    else
+    {
+      /*1, 2 or 4 bit indices, packed from the most significant bit of each byte*/
+      unsigned bits = mode->bitdepth;
+      unsigned mask = (1u << bits) - 1u;
+      size_t j;
+      for(i = 0, j = 0; i != numpixels; ++j)
+      {
+        unsigned value = in[j];
+        int shift;
+        for(shift = 8 - (int)bits; shift >= 0 && i != numpixels; shift -= (int)bits, ++i, buffer += num_channels)
+        {
+          memcpy(buffer, &table[((value >> shift) & mask) * 4], num_channels);
+        }
       }
     }
   }
@@ -3884,7 +9237,7 @@ static unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
 {
   size_t i;
   ColorTree tree;
-  size_t numpixels = w * h;
+  size_t numpixels = (size_t)w * h;
 
   if(lodepng_color_mode_equal(mode_out, mode_in))
   {
@@ -3950,11 +9303,83 @@ static unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
   return 0; /*no error*/
 }
 
+typedef struct ConvertBands
+{
+  unsigned char* out;
+  const unsigned char* in;
+  const LodePNGColorMode* mode_out;
+  const LodePNGColorMode* mode_in;
+  const LodePNGDecompressSettings* settings; /*cancel is polled before each band, may be null*/
+  unsigned w, h, bandrows;
+  unsigned errors[256];
+} ConvertBands;
+
+static void lodepng_convertTask(void* context, int index)
+{
+  ConvertBands* bands = (ConvertBands*)context;
+  unsigned ystart = (unsigned)index * bands->bandrows;
+  unsigned rows = bands->h - ystart > bands->bandrows ? bands->bandrows : bands->h - ystart;
+  if(bands->settings && bands->settings->cancel && bands->settings->cancel(bands->settings->cancel_context))
+  {
+    bands->errors[index] = 121;
+    return;
+  }
+  /*ystart is a multiple of 8, so the bands start at a byte for any bit depth*/
+  bands->errors[index] = lodepng_convert(bands->out + lodepng_get_raw_size(bands->w, ystart, bands->mode_out),
+                                         bands->in + lodepng_get_raw_size(bands->w, ystart, bands->mode_in),
+                                         bands->mode_out, bands->mode_in, bands->w, rows);
+}
+
+/*lodepng_convert split into bands of rows that are converted on up to num_threads threads.
+settings may be null, otherwise its cancel is polled between bands*/
+static unsigned lodepng_convert_threaded(unsigned char* out, const unsigned char* in,
+                                         const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                         unsigned w, unsigned h, unsigned num_threads,
+                                         const LodePNGDecompressSettings* settings)
+{
+  ConvertBands bands;
+  unsigned numbands, i;
+  bands.bandrows = lodepng_band_rows(h, lodepng_get_raw_size(w, h, mode_out), num_threads);
+  numbands = bands.bandrows ? (h + bands.bandrows - 1) / bands.bandrows : 0;
+  if(numbands < 2 || numbands > 256)
+  {
+    /*serial, in bands of about LODEPNG_CANCEL_INTERVAL bytes if cancel has to be polled*/
+    unsigned y, step = h, error = 0;
+    size_t line = lodepng_get_raw_size(w, 1, mode_out);
+    LodePNGCancel cancel;
+    LodePNGCancel_init(&cancel, settings);
+    if(cancel.settings && line && LODEPNG_CANCEL_INTERVAL / line < h) step = (unsigned)(LODEPNG_CANCEL_INTERVAL / line + 7) & ~7u;
+    for(y = 0; y < h && !error; y += step)
+    {
+      size_t done = lodepng_get_raw_size(w, y, mode_out);
+      if(done >= cancel.next && LodePNGCancel_poll(&cancel, done)) return 121;
+      error = lodepng_convert(out + done, in + lodepng_get_raw_size(w, y, mode_in), mode_out, mode_in,
+                              w, h - y < step ? h - y : step);
+    }
+    return error;
+  }
+
+  bands.out = out;
+  bands.in = in;
+  bands.mode_out = mode_out;
+  bands.mode_in = mode_in;
+  bands.settings = settings;
+  bands.w = w;
+  bands.h = h;
+  lc_run_tasks((int)numbands, (int)num_threads, lodepng_convertTask, &bands);
+  for(i = 0; i != numbands; ++i)
+  {
+    if(bands.errors[i]) return bands.errors[i];
+  }
+  return 0;
+}
+
 static unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize)
 {
   *out = 0;
+  state->memory_peak = state->memory_current = 0;
   decodeGeneric(out, w, h, state, in, insize);
   if(state->error) return state->error;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
@@ -3988,9 +9413,14 @@ static unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     {
       state->error = 83; /*alloc fail*/
     }
-    else state->error = lodepng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
+    else
+    {
+      lodepng_memory_hold(state, outsize);
+      state->error = lodepng_convert_threaded(*out, data, &state->info_raw, &state->info_png.color, *w, *h,
+                                              state->decoder.num_threads, &state->decoder.zlibsettings);
+    }
     lodepng_free(data);
+    lodepng_memory_release(state, lodepng_get_raw_size(*w, *h, &state->info_png.color));
   }
   return state->error;
 }
@@ -4012,27 +9442,363 @@ static void lodepng_state_cleanup(LodePNGState* state)
   lodepng_info_cleanup(&state->info_png);
 }
 
-static unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
-                               size_t insize, LodePNGColorType colortype, unsigned bitdepth)
+/*forwards the Adam7 previews to lc_load_options.preview*/
+static void lc_png_preview(void* context, unsigned pass, const unsigned char* image, unsigned w, unsigned h,
+                           const LodePNGColorMode* color)
+{
+  const lc_load_options* options = (const lc_load_options*)context;
+  options->preview(options->preview_context, (int)pass, (int)w, (int)h,
+                   (int)getNumColorChannels(color->colortype), image);
+}
+
+/*the decoder settings that come from lc_load_options*/
+static void lc_png_apply_options(LodePNGState* state, const lc_load_options* options)
+{
+  if(options->thread_count > 1)
+  {
+    state->decoder.zlibsettings.num_threads = (unsigned)options->thread_count;
+    state->decoder.num_threads = (unsigned)options->thread_count;
+  }
+  if(options->skip_checksums)
+  {
+    state->decoder.ignore_crc = 1;
+    state->decoder.zlibsettings.ignore_adler32 = 1;
+  }
+  state->decoder.max_memory = (size_t)options->max_memory;
+  if(options->max_memory > (size_t)-1) state->decoder.max_memory = 0;
+  state->decoder.zlibsettings.cancel = options->cancel;
+  state->decoder.zlibsettings.cancel_context = options->cancel_context;
+}
+
+static unsigned lc_png_decode_memory(unsigned char** out, unsigned* w, unsigned* h,
+                                     const unsigned char* in, size_t insize,
+                                     LodePNGColorType colortype, unsigned bitdepth,
+                                     const lc_load_options* options)
 {
   unsigned error;
   LodePNGState state;
   lodepng_state_init(&state);
+  lc_png_apply_options(&state, options);
   state.info_raw.colortype = colortype;
   state.info_raw.bitdepth = bitdepth;
+  if(options->preview && bitdepth == 8)
+  {
+    state.decoder.preview = lc_png_preview;
+    state.decoder.preview_context = (void*)options;
+  }
+  error = lodepng_decode(out, w, h, &state, in, insize);
+  if(options->peak_memory) *options->peak_memory = state.memory_peak;
+  if(error == 121 && options->cancelled) *options->cancelled = 1;
+  lodepng_state_cleanup(&state);
+  return error;
+}
+
+static unsigned lc_png_read_size(unsigned* w, unsigned* h, const unsigned char* in, size_t insize,
+                                 const lc_load_options* options)
+{
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  lc_png_apply_options(&state, options);
+  error = lodepng_inspect(w, h, &state, in, insize);
+  lodepng_state_cleanup(&state);
+  return error;
+}
+
+#if defined(LC_IMAGE_RESIZE_H)
+static unsigned lc_png_decode_raw(unsigned char** out, unsigned* w, unsigned* h, LodePNGColorMode* color,
+                                  const unsigned char* in, size_t insize, const lc_load_options* options)
+{
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  lc_png_apply_options(&state, options);
+  state.decoder.color_convert = 0;
   error = lodepng_decode(out, w, h, &state, in, insize);
+  if(!error) error = lodepng_color_mode_copy(color, &state.info_png.color);
+  if(error)
+  {
+    lodepng_free(*out);
+    *out = 0;
+  }
+  if(options->peak_memory) *options->peak_memory = state.memory_peak;
+  if(error == 121 && options->cancelled) *options->cancelled = 1;
   lodepng_state_cleanup(&state);
   return error;
 }
+#endif
+
+static unsigned lc_png_read_stream(unsigned char** out, size_t* outsize, lc_stream* stream,
+                                   size_t size_hint, unsigned check_crc)
+{
+  unsigned error = 0;
+  unsigned crc = 0;
+  size_t idatstart = 0; /*position of the joined IDAT chunk in out, 0 before the first one*/
+  unsigned IEND = 0;
+  ucvector png;
+  ucvector_init(&png);
+
+  /*the kept chunks are at most the whole stream, reserving it saves growing the buffer*/
+  if(!ucvector_reserve(&png, size_hint > 8 ? size_hint : 8)) return 83; /*alloc fail*/
+  if(!ucvector_resize(&png, 8)) return 83; /*alloc fail*/
+  if(lc_stream_read(stream, png.data, 8) != 8) error = 27; /*error: the data length is smaller than the length of a PNG header*/
+
+  while(!error && !IEND)
+  {
+    unsigned char header[8];
+    unsigned length;
+    size_t pos = png.size;
+    if(lc_stream_read(stream, header, 8) != 8) CERROR_BREAK(error, 30); /*error: size of the in buffer too small to contain next chunk*/
+    length = lodepng_read32bitInt(header);
+    if(length > 2147483647) CERROR_BREAK(error, 63); /*error: chunk length larger than the max PNG chunk size*/
+
+    if(lodepng_chunk_type_equals(header, "IDAT"))
+    {
+      if(idatstart && png.size != idatstart + 8 + lodepng_read32bitInt(&png.data[idatstart]))
+      {
+        CERROR_BREAK(error, 30); /*IDAT chunks must follow each other*/
+      }
+      if(!idatstart)
+      {
+        idatstart = png.size;
+        if(!ucvector_resize(&png, pos + 8)) CERROR_BREAK(error, 83); /*alloc fail*/
+        memcpy(&png.data[pos], header, 8);
+        lodepng_set32bitInt(&png.data[pos], 0);
+        crc = lodepng_crc32_update(0xffffffffu, &header[4], 4);
+        pos += 8;
+      }
+      if(lodepng_read32bitInt(&png.data[idatstart]) + (size_t)length > 2147483647) CERROR_BREAK(error, 63);
+      if(!ucvector_resize(&png, pos + length + 4)) CERROR_BREAK(error, 83); /*alloc fail*/
+      if(lc_stream_read(stream, &png.data[pos], length + 4) != length + 4) CERROR_BREAK(error, 30);
+      if(check_crc)
+      {
+        unsigned chunkcrc = lodepng_crc32_update(lodepng_crc32_update(0xffffffffu, &header[4], 4), &png.data[pos], length);
+        if((chunkcrc ^ 0xffffffffu) != lodepng_read32bitInt(&png.data[pos + length])) CERROR_BREAK(error, 57); /*invalid CRC*/
+      }
+      crc = lodepng_crc32_update(crc, &png.data[pos], length);
+      lodepng_set32bitInt(&png.data[idatstart], lodepng_read32bitInt(&png.data[idatstart]) + length);
+      png.size = pos + length; /*the CRC of the joined chunk is written when it ends*/
+      continue;
+    }
+
+    if(idatstart && png.size == idatstart + 8 + lodepng_read32bitInt(&png.data[idatstart]))
+    {
+      /*the joined IDAT chunk ends here*/
+      if(!ucvector_resize(&png, pos + 4)) CERROR_BREAK(error, 83); /*alloc fail*/
+      lodepng_set32bitInt(&png.data[pos], crc ^ 0xffffffffu);
+      pos += 4;
+    }
+
+    IEND = lodepng_chunk_type_equals(header, "IEND");
+    if(!(header[4] & 32) || lodepng_chunk_type_equals(header, "tRNS")) /*critical chunks have an uppercase first letter*/
+    {
+      /*kept as it is, lodepng checks its CRC*/
+      if(!ucvector_resize(&png, pos + 8 + length + 4)) CERROR_BREAK(error, 83); /*alloc fail*/
+      memcpy(&png.data[pos], header, 8);
+      if(lc_stream_read(stream, &png.data[pos + 8], length + 4) != length + 4) CERROR_BREAK(error, 30);
+    }
+    else
+    {
+      /*other ancillary chunks are not decoded, they are read past*/
+      unsigned char skip[4096];
+      size_t remaining = (size_t)length + 4;
+      while(remaining > 0)
+      {
+        size_t part = remaining < sizeof(skip) ? remaining : sizeof(skip);
+        if(lc_stream_read(stream, skip, part) != part) break;
+        remaining -= part;
+      }
+      if(remaining) CERROR_BREAK(error, 30);
+    }
+  }
+
+  if(!error && !IEND) error = 30;
+  if(error)
+  {
+    ucvector_cleanup(&png);
+    return error;
+  }
+  *out = png.data;
+  *outsize = png.size;
+  return 0;
+}
+
+/*
+PNG encoding for lc_write_png, 8 bit per channel, not interlaced. Rows get a single fixed filter type
+for speed: Sub for the first row, Up for all others. With more than one thread the rows are cut into
+bands that are filtered and deflated on their own; each band but the last ends with a full flush,
+so the bands also inflate in parallel.
+*/
+typedef struct FastEncodeBand
+{
+  const unsigned char* image;
+  unsigned char* filtered; /*filtered rows of the whole image, each band writes its own*/
+  size_t linebytes; /*bytes per row without the filter type byte*/
+  unsigned bytewidth;
+  unsigned ystart, yend;
+  unsigned final;
+  ucvector deflated;
+  unsigned error;
+} FastEncodeBand;
+
+static void fastEncodeBandTask(void* context, int index)
+{
+  FastEncodeBand* band = &((FastEncodeBand*)context)[index];
+  size_t linebytes = band->linebytes, i;
+  unsigned bytewidth = band->bytewidth, y;
+  unsigned char* start = band->filtered + band->ystart * (linebytes + 1);
+
+  for(y = band->ystart; y != band->yend; ++y)
+  {
+    const unsigned char* scanline = band->image + y * linebytes;
+    unsigned char* out = band->filtered + y * (linebytes + 1);
+    if(y == 0)
+    {
+      out[0] = 1; /*Sub*/
+      for(i = 0; i != bytewidth && i != linebytes; ++i) out[1 + i] = scanline[i];
+      for(; i < linebytes; ++i) out[1 + i] = (unsigned char)(scanline[i] - scanline[i - bytewidth]);
+    }
+    else
+    {
+      const unsigned char* prevline = scanline - linebytes;
+      out[0] = 2; /*Up*/
+      for(i = 0; i != linebytes; ++i) out[1 + i] = (unsigned char)(scanline[i] - prevline[i]);
+    }
+  }
+
+  band->error = fastDeflate(&band->deflated, start, (band->yend - band->ystart) * (linebytes + 1),
+                            bytewidth, band->final);
+}
 
-static unsigned lodepng_decode32(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+/*writes a chunk with its length, type and CRC to out, which must have length + 12 bytes available*/
+static void fastEncodeChunk(unsigned char* out, const char* type, const unsigned char* data, unsigned length)
 {
-  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGBA, 8);
+  lodepng_set32bitInt(out, length);
+  memcpy(out + 4, type, 4);
+  if(length) memcpy(out + 8, data, length);
+  lodepng_chunk_generate_crc(out);
 }
 
-static unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in, size_t insize)
+static unsigned lc_png_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
+                                     unsigned w, unsigned h, LodePNGColorType colortype, unsigned num_threads)
 {
-  return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
+  const size_t maxidat = (size_t)1 << 30; /*chunk lengths must stay below 2^31*/
+  unsigned bytewidth = lodepng_get_bpp_lct(colortype, 8) / 8;
+  size_t linebytes = (size_t)w * bytewidth;
+  size_t filteredsize = (linebytes + 1) * h;
+  size_t zlibsize, numidat, pos, i;
+  unsigned numbands = 1, b, adler = 1;
+  unsigned char* filtered;
+  unsigned char* zlib;
+  unsigned char* p;
+  unsigned char header[13];
+  FastEncodeBand* bands;
+  unsigned error = 0;
+
+  *out = NULL;
+  *outsize = 0;
+  if(w == 0 || h == 0) return 93; /*error: the image has zero width or height*/
+
+  if(num_threads > 1)
+  {
+    size_t maxbands = filteredsize / LODEPNG_PARALLEL_INFLATE_MIN_PART;
+    numbands = num_threads;
+    if(numbands > maxbands) numbands = (unsigned)maxbands;
+    if(numbands > h) numbands = h;
+    if(numbands < 1) numbands = 1;
+  }
+
+  filtered = (unsigned char*)lodepng_malloc(filteredsize);
+  bands = (FastEncodeBand*)lodepng_malloc(numbands * sizeof(FastEncodeBand));
+  if(!filtered || !bands)
+  {
+    lodepng_free(filtered);
+    lodepng_free(bands);
+    return 83; /*alloc fail*/
+  }
+  for(b = 0; b != numbands; ++b)
+  {
+    bands[b].image = image;
+    bands[b].filtered = filtered;
+    bands[b].linebytes = linebytes;
+    bands[b].bytewidth = bytewidth;
+    bands[b].ystart = (unsigned)((unsigned long long)h * b / numbands);
+    bands[b].yend = (unsigned)((unsigned long long)h * (b + 1) / numbands);
+    bands[b].final = b + 1 == numbands;
+    bands[b].error = 0;
+    ucvector_init(&bands[b].deflated);
+  }
+
+  if(numbands > 1) lc_run_tasks((int)numbands, (int)num_threads, fastEncodeBandTask, bands);
+  else fastEncodeBandTask(bands, 0);
+
+  /*zlib header (deflate, 32K window, fastest compression level), the bands, and the Adler-32 of it all*/
+  zlibsize = 2 + 4;
+  for(b = 0; b != numbands; ++b)
+  {
+    if(bands[b].error) error = bands[b].error;
+    zlibsize += bands[b].deflated.size;
+  }
+  if(!error)
+  {
+    for(pos = 0; pos < filteredsize; pos += maxidat)
+    {
+      size_t length = filteredsize - pos < maxidat ? filteredsize - pos : maxidat;
+      adler = update_adler32(adler, filtered + pos, length);
+    }
+  }
+  lodepng_free(filtered);
+
+  numidat = (zlibsize + maxidat - 1) / maxidat;
+  zlib = error ? NULL : (unsigned char*)lodepng_malloc(zlibsize);
+  if(!error && !zlib) error = 83; /*alloc fail*/
+  if(!error)
+  {
+    zlib[0] = 0x78;
+    zlib[1] = 0x01;
+    pos = 2;
+    for(b = 0; b != numbands; ++b)
+    {
+      memcpy(zlib + pos, bands[b].deflated.data, bands[b].deflated.size);
+      pos += bands[b].deflated.size;
+    }
+    lodepng_set32bitInt(zlib + pos, adler);
+  }
+  for(b = 0; b != numbands; ++b) ucvector_cleanup(&bands[b].deflated);
+  lodepng_free(bands);
+  if(error) return error;
+
+  /*signature, IHDR, the IDAT chunks and IEND*/
+  *outsize = 8 + (12 + 13) + numidat * 12 + zlibsize + 12;
+  *out = (unsigned char*)lodepng_malloc(*outsize);
+  if(!*out)
+  {
+    lodepng_free(zlib);
+    *outsize = 0;
+    return 83; /*alloc fail*/
+  }
+  p = *out;
+  memcpy(p, "\211PNG\r\n\032\n", 8);
+  p += 8;
+  lodepng_set32bitInt(header + 0, w);
+  lodepng_set32bitInt(header + 4, h);
+  header[8] = 8; /*bit depth*/
+  header[9] = (unsigned char)colortype;
+  header[10] = 0; /*compression method*/
+  header[11] = 0; /*filter method*/
+  header[12] = 0; /*interlace method*/
+  fastEncodeChunk(p, "IHDR", header, 13);
+  p += 12 + 13;
+  for(i = 0; i != numidat; ++i)
+  {
+    size_t length = zlibsize - i * maxidat < maxidat ? zlibsize - i * maxidat : maxidat;
+    fastEncodeChunk(p, "IDAT", zlib + i * maxidat, (unsigned)length);
+    p += 12 + length;
+  }
+  fastEncodeChunk(p, "IEND", NULL, 0);
+
+  lodepng_free(zlib);
+  return 0;
 }
 
 #if defined(_WIN32)
@@ -4040,4 +9806,4 @@ static unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h,
 #elif defined(__clang__)
     #pragma clang diagnostic pop
 #endif
-#endif /* defined(LC_IMAGE_IMPLEMENTATION) */
\ No newline at end of file
+#endif /* defined(LC_IMAGE_IMPLEMENTATION) */
\ No newline at end of file
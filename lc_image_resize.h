@@ -48,6 +48,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#define LC_IMAGE_RESIZE_H
+
 #include <stdbool.h>
 #include <string.h>
 
@@ -75,18 +77,110 @@ struct lc_filter_args {
     float p0, p2, p3;
 };
 
-void lc_image_resize_uint8(int src_width, int src_height, int src_row_stride, const unsigned char* p_src_data,
-                           int dst_wdith, int dst_height, int dst_row_stride, unsigned char* p_dst_data,
+void lc_image_resize_uint8(int src_width, int src_height, long long src_row_stride, const unsigned char* p_src_data,
+                           int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args);
 
-void lc_image_resize_float(int src_width, int src_height, int src_row_stride, const float* p_src_data,
-                           int dst_wdith, int dst_height, int dst_row_stride, float* p_dst_data,
+void lc_image_resize_float(int src_width, int src_height, long long src_row_stride, const float* p_src_data,
+                           int dst_width, int dst_height, long long dst_row_stride, float* p_dst_data,
                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args);
 
+/*
+ Flags of the _ex functions. LC_RESIZE_PREMULTIPLY_ALPHA resizes images with straight alpha as if
+ their colors were premultiplied by it, so the colors of transparent pixels don't bleed into the
+ edges of opaque ones; the result has straight alpha again. Alpha is the last channel of 2 and 4
+ channel images, the flag does nothing for other channel counts. uint8 colors are within 1 of a
+ float resize where the resulting alpha is 8 or more and within 2 where it is 4 or more; nearly
+ transparent pixels keep fewer bits of color and can be further off, samples/ResizeAccuracyCheck
+ checks these bounds.
+*/
+typedef enum lc_resize_flags {
+    LC_RESIZE_PREMULTIPLY_ALPHA = 1 << 0
+} lc_resize_flags;
+
+void lc_image_resize_uint8_ex(int src_width, int src_height, long long src_row_stride, const unsigned char* p_src_data,
+                              int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
+                              unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args, unsigned int flags);
+
+void lc_image_resize_float_ex(int src_width, int src_height, long long src_row_stride, const float* p_src_data,
+                              int dst_width, int dst_height, long long dst_row_stride, float* p_dst_data,
+                              unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args, unsigned int flags);
+
+/*
+ Resize plan: the filter weights of both axes for one source size, destination size, channel count
+ and filter, computed once. Executing a plan resizes an image without evaluating the filter again,
+ for resizing many images of the same size. Plans are not changed by executing them, so several
+ threads may execute the same plan at once. A plan is created for 8-bit or float images and
+ executed with the matching function.
+*/
+typedef struct lc_resize_plan lc_resize_plan;
+
+lc_resize_plan* lc_resize_plan_create_uint8(int src_width, int src_height, int dst_width, int dst_height,
+                                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args);
+
+lc_resize_plan* lc_resize_plan_create_float(int src_width, int src_height, int dst_width, int dst_height,
+                                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args);
+
+lc_resize_plan* lc_resize_plan_create_uint8_ex(int src_width, int src_height, int dst_width, int dst_height,
+                                               unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args,
+                                               unsigned int flags);
+
+lc_resize_plan* lc_resize_plan_create_float_ex(int src_width, int src_height, int dst_width, int dst_height,
+                                               unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args,
+                                               unsigned int flags);
+
+void lc_resize_execute_uint8(const lc_resize_plan* p_plan, long long src_row_stride, const unsigned char* p_src_data,
+                             long long dst_row_stride, unsigned char* p_dst_data);
+
+void lc_resize_execute_float(const lc_resize_plan* p_plan, long long src_row_stride, const float* p_src_data,
+                             long long dst_row_stride, float* p_dst_data);
+
+void lc_resize_plan_destroy(lc_resize_plan* p_plan);
+
+/*
+ Threaded execute: the destination rows are split into thread_count bands of about the same height,
+ resized at the same time. Every band filters the source rows it needs itself, so the few source
+ rows under the border of two bands are filtered twice. The bands run on threads started for the
+ call, the calling thread running one of them, or on the task scheduler of the caller if scheduler
+ is not NULL: scheduler(scheduler_context, task_count, task, task_context) must call
+ task(task_context, i) once for every i in [0..task_count-1], on any threads, and return when all of
+ them have finished. The result is the same as the single threaded execute.
+*/
+typedef void (*lc_resize_task_fn)(void* task_context, int index);
+typedef void (*lc_resize_scheduler_fn)(void* scheduler_context, int task_count, lc_resize_task_fn task, void* task_context);
+
+void lc_resize_execute_threaded_uint8(const lc_resize_plan* p_plan, long long src_row_stride, const unsigned char* p_src_data,
+                                      long long dst_row_stride, unsigned char* p_dst_data,
+                                      int thread_count, lc_resize_scheduler_fn scheduler, void* scheduler_context);
+
+void lc_resize_execute_threaded_float(const lc_resize_plan* p_plan, long long src_row_stride, const float* p_src_data,
+                                      long long dst_row_stride, float* p_dst_data,
+                                      int thread_count, lc_resize_scheduler_fn scheduler, void* scheduler_context);
+
+/*
+ Row by row variant of lc_image_resize_uint8, for sources that produce their rows in order such
+ as image decoders. Push the src_height source rows one at a time; every destination row is
+ written as soon as the source rows it depends on have been pushed. Only the last few source
+ rows are kept, already filtered horizontally. The result is the same as lc_image_resize_uint8.
+*/
+typedef struct lc_image_resizer lc_image_resizer;
+
+lc_image_resizer* lc_image_resizer_create_uint8(int src_width, int src_height,
+                                                int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
+                                                unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args);
 
+void lc_image_resizer_push_uint8(lc_image_resizer* p_resizer, const unsigned char* p_src_row);
+
+void lc_image_resizer_destroy(lc_image_resizer* p_resizer);
 
 #if defined(LC_IMAGE_RESIZE_IMPLEMENTATION)
 
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
 #if defined(__cplusplus)  
     #define LC_DECLARE_ZERO(type, var) \
             type var = {};                        
@@ -132,6 +226,18 @@ inline lc_uint8_data_t lc_uint8_accum_to_channel(const int in)
     return (lc_uint8_data_t)result;
 }
 
+lc_resize_plan* lc_resize_plan_create_float(int src_width, int src_height, int dst_width, int dst_height,
+                                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
+{
+    return lc_resize_plan_create_float_ex(src_width, src_height, dst_width, dst_height, channel_count, filter, p_filter_args, 0);
+}
+
+lc_resize_plan* lc_resize_plan_create_uint8(int src_width, int src_height, int dst_width, int dst_height,
+                                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
+{
+    return lc_resize_plan_create_uint8_ex(src_width, src_height, dst_width, dst_height, channel_count, filter, p_filter_args, 0);
+}
+
 inline lc_float_data_t lc_float_accum_to_channel(const float in) 
 {
     return in;
@@ -349,381 +455,906 @@ float lc_filter_bessel_blackman(float x, const lc_filter_args* p_params)
     return v * ( 0.42f + 0.50f * cos( 3.14159265358979323846f * x ) + 0.08f * cos( 6.2831853071795862f * x ) );
 }
 
-/**************************************************************************************************/
-/* uint8                                                                                          */
-/**************************************************************************************************/
-void lc_uint8_scanline_accumulate(lc_uint8_sum_t weight, lc_uint8_sum_t* line_buffer, 
-                                  int width, lc_uint8_sum_t* accum)
-{
-    lc_uint8_sum_t *dest = accum;
-    for (int x = 0; x < width; ++x) {
-        *dest++ += *line_buffer++ * weight;
-    }
-}
-
-void lc_uint8_scanline_shift_accum_to_channel(lc_uint8_sum_t* accum, 
-                                              int x1, int y, int width, int pixel_stride, int row_stride, 
-                                              int channel, lc_uint8_data_t* p_data)
-{
-    lc_uint8_sum_t result;
-    lc_uint8_data_t* dst = p_data + (y * row_stride) + (x1 * pixel_stride) + channel;
-    for(int32_t i = 0; i < width; i++) {
-        result = lc_uint8_accum_to_channel(*accum++);
-        *dst = (lc_uint8_data_t)result;
-        dst += pixel_stride;
-    }
-}
-
-void lc_uint8_scanline_filter_channel_to_buffer(lc_uint8_weight_table* weights, 
-                                                int x, int y, int pixel_stride, int row_stride, 
-                                                int channel, const lc_uint8_data_t* p_data, 
-                                                lc_uint8_sum_t* line_buffer, int width)
-{
-    int b, af;
-    lc_uint8_sum_t sum;
-    lc_uint8_sum_t *wp;
-    const lc_uint8_data_t *src_line;
-
-    src_line = p_data + (y * row_stride) + (x * pixel_stride) + channel;
-    for (b = 0; b < width; b++) {
-        sum = 1 << 7;
-        const lc_uint8_data_t* src = src_line + weights->start * pixel_stride;
-        wp = weights->weight;
-        for (af = weights->start; af < weights->end; af++) {
-            sum += *wp++ * *src;
-            src += pixel_stride;
-        }
-        *line_buffer++ = lc_uint8_channel_to_buffer(sum);
-        weights++;
-    }   
-}
-
-void lc_uint8_make_weight_table(int b, float cen, 
-                                lc_filter_fn filter, const lc_filter_args* p_filter_args, 
-                                const lc_filter_params *params, 
-                                int len, bool trimzeros, lc_uint8_weight_table* wtab)
-{
-    int start, end, i, stillzero, lastnonzero, nz;
-    lc_uint8_sum_t *wp, t, sum;
-    float den, sc, tr;
-
-    /* find the source coord range of this positioned filter: [start..end-1] */
-    start = (int)(cen - params->support + 0.5f);
-    end = (int)(cen + params->support + 0.5f);
-    if (start < 0)
-        start = 0;
-    if (end > len)
-        end = len;
-
-    /* the range of source samples to buffer: */
-    wtab->start = start;
-    wtab->end = end;
-
-    /* find scale factor sc to normalize the filter */
-    for (den = 0, i=start; i < end; i++)
-        den += filter((i + 0.5f - cen) / params->scale, p_filter_args);
-
-    /* set sc so that sum of sc*func() is approximately WEIGHTONE */
-    sc = (den == 0.0f) ? (k_lc_uint8_weight_one) : (k_lc_uint8_weight_one / den);
-
-    /* compute the discrete, sampled filter coefficients */
-    stillzero = trimzeros;
-    for (sum = 0, wp = wtab->weight, i = start; i < end; i++) {
-        /* evaluate the filter function: */
-        tr = sc * filter((i + 0.5f - cen) / params->scale, p_filter_args);
-
-        t = (lc_uint8_sum_t)floor(tr + 0.5f);
-        if (stillzero && (t == 0)) {
-            /* find first nonzero */
-            start++;
-        }
-        else {
-            stillzero = 0;
-            /* add weight to table */
-            *wp++ = t;
-            sum += t;
-            if (t != 0) {
-                /* find last nonzero */
-                lastnonzero = i;
-            }
-        }
-    }
-        
-    if (sum == 0) {
-        nz = wtab->end-wtab->start;
-        wtab->start = (wtab->start+wtab->end) >> 1;
-        wtab->end = wtab->start+1;
-        wtab->weight[0] = k_lc_uint8_weight_one;
-    }
-    else {
-        if (trimzeros) {
-            /* skip leading and trailing zeros */
-            /* set wtab->start and ->end to the nonzero support of the filter */
-            nz = wtab->end-wtab->start-(lastnonzero-start+1);
-            wtab->start = start;
-            wtab->end = end = lastnonzero+1;
-        }
-        else {
-            /* keep leading and trailing zeros */
-            nz = 0;
-        }
-
-        if (sum != k_lc_uint8_weight_one) {
-            /*
-                * Fudge the center slightly to make sum=WEIGHTONE exactly.
-                * Is this the best way to normalize a discretely sampled
-                * continuous filter?
-            */
-            i = (int32_t)(cen + 0.5f);
-            if (i < start) {
-                i = start;
-            }
-            else if (i >= end) {
-                i = end - 1;
-            }
-            t = k_lc_uint8_weight_one - sum;
-            /* fudge center sample */
-            wtab->weight[i - start] += t;
-        }
-    }   
-}
-
-void lc_image_resize_uint8(int src_width, int src_height, int src_row_stride, const unsigned char* p_src_data,
-                           int dst_width, int dst_height, int dst_row_stride, unsigned char* p_dst_data,
-                           unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
+/* lc_select_filter: the function for filter, its arguments are p_filter_args or the filter defaults */
+lc_filter_fn lc_select_filter(lc_filter filter, const lc_filter_args* p_filter_args, lc_filter_args* p_args)
 {
-    LC_DECLARE_ZERO(lc_filter_args, filter_args);
     lc_filter_fn filter_fn = NULL;
     switch (filter) {
         case LC_FILTER_BOX: {
             filter_fn = lc_filter_box;
-            if (NULL == p_filter_args) {lc_filter_box_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_box_init(p_args);}
         }
         break;
         case LC_FILTER_TRIANGLE: {
             filter_fn = lc_filter_triangle;
-            if (NULL == p_filter_args) {lc_filter_triangle_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_triangle_init(p_args);}
         }
         break;
         case LC_FILTER_QUADRATIC: {
             filter_fn = lc_filter_quadratic;
-            if (NULL == p_filter_args) {lc_filter_quadratic_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_quadratic_init(p_args);}
         }
         break;
         case LC_FILTER_CUBIC: {
             filter_fn = lc_filter_cubic;
-            if (NULL == p_filter_args) {lc_filter_cubic_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_cubic_init(p_args);}
         }
         break;
         case LC_FILTER_CATMUL_ROM: {
             filter_fn = lc_filter_catmull_rom;
-            if (NULL == p_filter_args) {lc_filter_catmull_rom_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_catmull_rom_init(p_args);}
         }
         break;
         case LC_FILTER_MITCHELL: {
             filter_fn = lc_filter_mitchell;
-            if (NULL == p_filter_args) {lc_filter_mitchell_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_mitchell_init(p_args);}
         }
         break;
         case LC_FILTER_SINC_BLACKMAN: {
             filter_fn = lc_filter_sinc_blackman;
-            if (NULL == p_filter_args) {lc_filter_sinc_blackman_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_sinc_blackman_init(p_args);}
         }
         break;
         case LC_FILTER_GAUSSIAN: {
             filter_fn = lc_filter_gassian;
-            if (NULL == p_filter_args) {lc_filter_gassian_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_gassian_init(p_args);}
         }
         break;
         case LC_FILTER_BESSEL_BLACKMAN: {
             filter_fn = lc_filter_bessel_blackman;
-            if (NULL == p_filter_args) {lc_filter_bessel_blackman_init(&filter_args);}
+            if (NULL == p_filter_args) {lc_filter_bessel_blackman_init(p_args);}
         }
         break;
 
         default: break;
     }
-    assert(NULL != filter_fn);
 
     if (NULL != p_filter_args) {
-        memcpy(&filter_args, p_filter_args, sizeof(*p_filter_args));
-    }
-
-    int src_offset_x = 0;
-    int src_offset_y = 0;
-
-    LC_DECLARE_ZERO(lc_rect, clipped_src_rect);
-    clipped_src_rect.x1 = 0;
-    clipped_src_rect.y1 = 0;
-    clipped_src_rect.x2 = (float)src_width;
-    clipped_src_rect.y2 = (float)src_height;
-    
-    LC_DECLARE_ZERO(lc_rect, clipped_dst_area);
-    clipped_dst_area.x1 = 0;
-    clipped_dst_area.y1 = 0;
-    clipped_dst_area.x2 = (float)dst_width;
-    clipped_dst_area.y2 = (float)dst_height;
-    
-    LC_DECLARE_ZERO(lc_mapping, m);
-    m.sx = dst_width / (float)src_width;
-    m.sy = dst_height / (float)src_height;
-    m.tx = clipped_dst_area.x1 - 0.5f - m.sx * (clipped_src_rect.x1 - 0.5f);
-    m.ty = clipped_dst_area.y1 - 0.5f - m.sy * (clipped_src_rect.y1 - 0.5f);
-    m.ux = clipped_dst_area.x1 - m.sx * (clipped_src_rect.x1 - 0.5f) - m.tx;
-    m.uy = clipped_dst_area.y1 - m.sy * (clipped_src_rect.y1 - 0.5f) - m.ty;
-
-    LC_DECLARE_ZERO(lc_filter_params, filter_params_x);
-    filter_params_x.scale   = LC_MATH_MAX(1.0f, 1.0f / m.sx);
-    filter_params_x.support = LC_MATH_MAX(0.5f, filter_params_x.scale * filter_args.support);
-    filter_params_x.width   = (int)ceil(2.0f * filter_params_x.support);
-
-    LC_DECLARE_ZERO(lc_filter_params, filter_params_y);
-    filter_params_y.scale   = LC_MATH_MAX(1.0f, 1.0f / m.sy);
-    filter_params_y.support = LC_MATH_MAX(0.5f, filter_params_y.scale * filter_args.support);
-    filter_params_y.width   = (int)ceil(2.0f * filter_params_y.support);
-
-    lc_uint8_line_buffer* lines_buffer = (lc_uint8_line_buffer*)calloc(filter_params_y.width, sizeof(*lines_buffer));
-    assert(NULL != lines_buffer);
+        memcpy(p_args, p_filter_args, sizeof(*p_filter_args));
+    }
 
-    for(int i = 0; i < filter_params_y.width; i++) {
-        lines_buffer[i].first  = -1;
-        lines_buffer[i].second = (lc_uint8_sum_t*)calloc(dst_width, sizeof(lines_buffer[i].second));
-        assert(NULL != lines_buffer[i].second);
-    }
-
-    lc_uint8_weight_table* x_weights = (lc_uint8_weight_table*)calloc(dst_width, sizeof(*x_weights));
-    assert(NULL != x_weights);
-
-    lc_uint8_sum_t* x_weight_buffer = (lc_uint8_sum_t*)calloc(dst_width * filter_params_x.width, sizeof(*x_weight_buffer));
-    assert(NULL != x_weight_buffer);
-
-    LC_DECLARE_ZERO(lc_uint8_weight_table, y_weights);
-    y_weights.weight = (lc_uint8_sum_t*)calloc(filter_params_y.width, sizeof(*y_weights.weight));
-    assert(NULL != y_weights.weight);
-
-    lc_uint8_sum_t* accum = (lc_uint8_sum_t*)calloc(dst_width, sizeof(*accum));
-    assert(NULL != accum);
-
-    lc_uint8_sum_t* xWeightPtr = x_weight_buffer;
-    for (int bx = 0; bx < dst_width; ++bx, xWeightPtr += filter_params_x.width) {
-        x_weights[bx].weight = xWeightPtr;
-        lc_uint8_make_weight_table(bx, LC_MAP(bx, m.sx, m.ux), filter_fn, &filter_args, &filter_params_x, src_width, true, &x_weights[bx]);
-    }
-
-    int pixel_stride = channel_count * sizeof(lc_uint8_data_t);
-    for (unsigned int channel = 0; channel < channel_count; ++channel) {
-        /* loop over dest scanlines */
-        for (int dst_y = 0; dst_y < dst_height; ++dst_y) {
-            /* prepare a weight table for dest y position by */
-            lc_uint8_make_weight_table(dst_y, LC_MAP(dst_y, m.sy, m.uy), filter_fn, &filter_args, &filter_params_y, src_height, false, &y_weights);
-            memset(accum, 0, sizeof(*accum) * dst_width);
-            /* loop over source scanlines that influence this dest scanline */
-            for (int ayf = y_weights.start; ayf < y_weights.end; ++ayf) {
-                lc_uint8_sum_t* line = lines_buffer[ayf % filter_params_y.width].second;
-                if (lines_buffer[ayf % filter_params_y.width].first != ayf) {
-                    lc_uint8_scanline_filter_channel_to_buffer(x_weights, src_offset_x, src_offset_y + ayf, pixel_stride, src_row_stride, channel, p_src_data, line, dst_width);
-                    lines_buffer[ayf % filter_params_y.width].first = ayf;
-                }
-                lc_uint8_scanline_accumulate(y_weights.weight[ayf - y_weights.start], line, dst_width, accum);
-            }
-            lc_uint8_scanline_shift_accum_to_channel(accum, (int)clipped_dst_area.x1, (int)(clipped_dst_area.y1 + dst_y), dst_width, pixel_stride, dst_row_stride, channel, p_dst_data);
+    return filter_fn;
+}
+
+/* x86 SIMD kernels are compiled in unless LC_IMAGE_RESIZE_NO_SIMD is defined, and picked at runtime */
+#if ! defined(LC_IMAGE_RESIZE_NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+    #define LC_IMAGE_RESIZE_X86 1
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define LC_RESIZE_TARGET(features)
+    #else
+        #include <cpuid.h>
+        #define LC_RESIZE_TARGET(features) __attribute__((target(features)))
+    #endif
+    #include <immintrin.h>
+#else
+    #define LC_IMAGE_RESIZE_X86 0
+#endif
+
+/* kernel sets, a plan runs the best one the CPU and its weights allow */
+enum {
+    LC_RESIZE_SIMD_NONE = 0,
+    LC_RESIZE_SIMD_SSE41,
+    LC_RESIZE_SIMD_AVX2
+};
+
+static int lc_resize_cpu_level = LC_RESIZE_SIMD_NONE;
+#if defined(_WIN32)
+static INIT_ONCE lc_resize_cpu_level_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t lc_resize_cpu_level_once = PTHREAD_ONCE_INIT;
+#endif
+
+void lc_resize_detect_simd_level(void)
+{
+    int level = LC_RESIZE_SIMD_NONE;
+#if LC_IMAGE_RESIZE_X86
+    unsigned int regs[4] = {0, 0, 0, 0};
+    unsigned int regs7[4] = {0, 0, 0, 0};
+  #if defined(_MSC_VER)
+    __cpuid((int*)regs, 1);
+    __cpuidex((int*)regs7, 7, 0);
+  #else
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+    }
+  #endif
+    if (regs[2] & (1 << 19)) {
+        level = LC_RESIZE_SIMD_SSE41;
+    }
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0) */
+    if ((LC_RESIZE_SIMD_SSE41 == level) && (regs[2] & (1 << 27)) && (regs7[1] & (1 << 5))) {
+  #if defined(_MSC_VER)
+        unsigned long long xcr0 = _xgetbv(0);
+  #else
+        unsigned int xcr0_lo = 0, xcr0_hi = 0;
+        __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        unsigned long long xcr0 = ((unsigned long long)xcr0_hi << 32) | xcr0_lo;
+  #endif
+        if (6 == (xcr0 & 6)) {
+            level = LC_RESIZE_SIMD_AVX2;
         }
     }
+#endif
+    lc_resize_cpu_level = level;
+}
 
-    LC_SAFE_FREE(accum);
-    LC_SAFE_FREE(y_weights.weight );
-    LC_SAFE_FREE(x_weight_buffer);
-    LC_SAFE_FREE(x_weights);
-    for(int i = 0; i < filter_params_y.width; i++) {
-        LC_SAFE_FREE(lines_buffer[i].second);
-    }
-    LC_SAFE_FREE(lines_buffer);
+#if defined(_WIN32)
+BOOL CALLBACK lc_resize_detect_simd_level_once(PINIT_ONCE once, PVOID parameter, PVOID* context)
+{
+    (void)once;
+    (void)parameter;
+    (void)context;
+    lc_resize_detect_simd_level();
+    return TRUE;
+}
+#endif
+
+/* lc_resize_simd_level: the best LC_RESIZE_SIMD_* of the running CPU, detected once */
+int lc_resize_simd_level(void)
+{
+#if defined(_WIN32)
+    InitOnceExecuteOnce(&lc_resize_cpu_level_once, lc_resize_detect_simd_level_once, NULL, NULL);
+#else
+    pthread_once(&lc_resize_cpu_level_once, lc_resize_detect_simd_level);
+#endif
+    return lc_resize_cpu_level;
 }
 
 /**************************************************************************************************/
-/* float                                                                                          */
+/* Plans                                                                                          */
 /**************************************************************************************************/
-void lc_float_scanline_accumulate(lc_float_sum_t weight, lc_float_sum_t* line_buffer, 
-                                  int width, lc_float_sum_t* accum)
+struct lc_resize_plan {
+    int                     src_width;
+    int                     src_height;
+    int                     dst_width;
+    int                     dst_height;
+    unsigned int            channel_count;
+    lc_filter_fn            filter_fn;
+    lc_filter_args          filter_args;
+    lc_mapping              m;
+    lc_filter_params        filter_params_x;
+    lc_filter_params        filter_params_y;
+    int                     simd;           /* LC_RESIZE_SIMD_* kernels to run */
+    bool                    premultiply;    /* LC_RESIZE_PREMULTIPLY_ALPHA, with an alpha channel to do it with */
+
+    /* weights of every destination column and row, for the data type of the plan */
+    lc_uint8_weight_table*  uint8_x_weights;
+    lc_uint8_weight_table*  uint8_y_weights;
+    lc_uint8_sum_t*         uint8_weight_buffer;
+    short*                  uint8_x_weights16;          /* x weights as 16 bits for the SIMD kernels, NULL if they do not fit */
+    int                     uint8_x_weights16_stride;   /* shorts from one destination column to the next */
+    lc_float_weight_table*  float_x_weights;
+    lc_float_weight_table*  float_y_weights;
+    lc_float_sum_t*         float_weight_buffer;
+};
+
+/* lc_resize_plan_alloc: a plan with the mapping and filter sizes of a resize, its weights still missing */
+lc_resize_plan* lc_resize_plan_alloc(int src_width, int src_height, int dst_width, int dst_height,
+                                     unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args,
+                                     unsigned int flags)
 {
-    lc_float_sum_t *dest = accum;
-    for (int x = 0; x < width; ++x) {
-        *dest++ += *line_buffer++ * weight;
-    }
+    lc_resize_plan* p_plan = (lc_resize_plan*)calloc(1, sizeof(*p_plan));
+    assert(NULL != p_plan);
+
+    p_plan->filter_fn = lc_select_filter(filter, p_filter_args, &p_plan->filter_args);
+    assert(NULL != p_plan->filter_fn);
+
+    p_plan->src_width = src_width;
+    p_plan->src_height = src_height;
+    p_plan->dst_width = dst_width;
+    p_plan->dst_height = dst_height;
+    p_plan->channel_count = channel_count;
+    p_plan->simd = lc_resize_simd_level();
+    p_plan->premultiply = (0 != (flags & LC_RESIZE_PREMULTIPLY_ALPHA)) && ((2 == channel_count) || (4 == channel_count));
+
+    /* the whole source image maps to the whole destination image */
+    lc_mapping* m = &p_plan->m;
+    m->sx = dst_width / (float)src_width;
+    m->sy = dst_height / (float)src_height;
+    m->tx = -0.5f - m->sx * -0.5f;
+    m->ty = -0.5f - m->sy * -0.5f;
+    m->ux = -m->sx * -0.5f - m->tx;
+    m->uy = -m->sy * -0.5f - m->ty;
+
+    lc_filter_params* filter_params_x = &p_plan->filter_params_x;
+    filter_params_x->scale   = LC_MATH_MAX(1.0f, 1.0f / m->sx);
+    filter_params_x->support = LC_MATH_MAX(0.5f, filter_params_x->scale * p_plan->filter_args.support);
+    filter_params_x->width   = (int)ceil(2.0f * filter_params_x->support);
+
+    lc_filter_params* filter_params_y = &p_plan->filter_params_y;
+    filter_params_y->scale   = LC_MATH_MAX(1.0f, 1.0f / m->sy);
+    filter_params_y->support = LC_MATH_MAX(0.5f, filter_params_y->scale * p_plan->filter_args.support);
+    filter_params_y->width   = (int)ceil(2.0f * filter_params_y->support);
+
+    return p_plan;
 }
 
-void lc_float_scanline_shift_accum_to_channel(lc_float_sum_t* accum, 
-                                              int x1, int y, int width, int pixel_stride, int row_stride, 
-                                              int channel, lc_float_data_t* p_data)
+void lc_resize_plan_destroy(lc_resize_plan* p_plan)
 {
-    lc_float_sum_t result;
-    unsigned char* dst = (unsigned char*)p_data + (y * row_stride) + (x1 * pixel_stride) + (channel * sizeof(*p_data));
-    for(int32_t i = 0; i < width; i++) {
-        result = lc_float_accum_to_channel(*accum++);
-        *((float *)dst) = (lc_float_data_t)result;
-        dst += pixel_stride;
+    if (NULL == p_plan) {
+        return;
     }
+
+    LC_SAFE_FREE(p_plan->uint8_x_weights);
+    LC_SAFE_FREE(p_plan->uint8_y_weights);
+    LC_SAFE_FREE(p_plan->uint8_weight_buffer);
+    LC_SAFE_FREE(p_plan->uint8_x_weights16);
+    LC_SAFE_FREE(p_plan->float_x_weights);
+    LC_SAFE_FREE(p_plan->float_y_weights);
+    LC_SAFE_FREE(p_plan->float_weight_buffer);
+    LC_SAFE_FREE(p_plan);
+}
+
+/**************************************************************************************************/
+/* Threads                                                                                        */
+/**************************************************************************************************/
+typedef struct lc_resize_thread_task {
+    lc_resize_task_fn   task;
+    void*               task_context;
+    int                 index;
+} lc_resize_thread_task;
+
+#if defined(_WIN32)
+DWORD WINAPI lc_resize_thread_main(LPVOID arg)
+{
+    lc_resize_thread_task* p_task = (lc_resize_thread_task*)arg;
+    p_task->task(p_task->task_context, p_task->index);
+    return 0;
+}
+#else
+void* lc_resize_thread_main(void* arg)
+{
+    lc_resize_thread_task* p_task = (lc_resize_thread_task*)arg;
+    p_task->task(p_task->task_context, p_task->index);
+    return NULL;
 }
+#endif
 
-void lc_float_scanline_filter_channel_to_buffer(lc_float_weight_table* weights, 
-                                                int x, int y, int pixel_stride, int row_stride, 
-                                                int channel, const lc_float_data_t* p_data, 
-                                                lc_float_sum_t* line_buffer, int width)
+/*
+ lc_resize_run_tasks: runs tasks [0..task_count-1] and waits for all of them, on scheduler if it is not
+ NULL, else one thread per task with the calling thread running task 0. A task whose thread can't be
+ started runs on the calling thread.
+*/
+void lc_resize_run_tasks(int task_count, lc_resize_task_fn task, void* task_context, 
+                         lc_resize_scheduler_fn scheduler, void* scheduler_context)
 {
-    int b, af;
-    lc_float_sum_t sum;
-    lc_float_sum_t *wp;
-    const unsigned char *src_line;
+    if (NULL != scheduler) {
+        scheduler(scheduler_context, task_count, task, task_context);
+        return;
+    }
 
-    src_line = (const unsigned char*)p_data + (y * row_stride) + (x * pixel_stride) + (channel * sizeof(*p_data));
-    for (b = 0; b < width; b++) {
-        sum = 0.0f;
-        const unsigned char* src = src_line + weights->start * pixel_stride;
-        wp = weights->weight;
-        for (af = weights->start; af < weights->end; af++) {
-            sum += *wp++ * *((const float*)src);
-            src += pixel_stride;
+#if defined(_WIN32)
+    typedef HANDLE lc_resize_thread_t;
+#else
+    typedef pthread_t lc_resize_thread_t;
+#endif
+    lc_resize_thread_task* tasks = (lc_resize_thread_task*)calloc(task_count, sizeof(*tasks));
+    assert(NULL != tasks);
+
+    lc_resize_thread_t* threads = (lc_resize_thread_t*)calloc(task_count, sizeof(*threads));
+    assert(NULL != threads);
+
+    bool* started = (bool*)calloc(task_count, sizeof(*started));
+    assert(NULL != started);
+
+    for (int i = 1; i < task_count; ++i) {
+        tasks[i].task = task;
+        tasks[i].task_context = task_context;
+        tasks[i].index = i;
+#if defined(_WIN32)
+        threads[i] = CreateThread(NULL, 0, lc_resize_thread_main, &tasks[i], 0, NULL);
+        started[i] = (NULL != threads[i]);
+#else
+        started[i] = (0 == pthread_create(&threads[i], NULL, lc_resize_thread_main, &tasks[i]));
+#endif
+    }
+
+    if (task_count > 0) {
+        task(task_context, 0);
+    }
+
+    for (int i = 1; i < task_count; ++i) {
+        if (! started[i]) {
+            task(task_context, i);
+            continue;
         }
-        *line_buffer++ = lc_float_channel_to_buffer(sum);
-        weights++;
-    }   
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+
+    LC_SAFE_FREE(started);
+    LC_SAFE_FREE(threads);
+    LC_SAFE_FREE(tasks);
 }
 
-void lc_float_make_weight_table(int b, float cen, 
-                                lc_filter_fn filter, const lc_filter_args* p_filter_args, 
-                                const lc_filter_params *params, 
-                                int len, bool trimzeros, lc_float_weight_table* wtab)
+/* lc_resize_band: destination rows [*p_dst_y_begin..*p_dst_y_end-1] of band index of band_count */
+void lc_resize_band(const lc_resize_plan* p_plan, int band_count, int index, int* p_dst_y_begin, int* p_dst_y_end)
 {
-    int start, end, i, stillzero, lastnonzero, nz;
-    lc_float_sum_t *wp, t, sum;
-    float den, sc, tr;
+    *p_dst_y_begin = (int)(((long long)p_plan->dst_height * index) / band_count);
+    *p_dst_y_end   = (int)(((long long)p_plan->dst_height * (index + 1)) / band_count);
+}
 
-    /* find the source coord range of this positioned filter: [start..end-1] */
-    start = (int)(cen - params->support + 0.5f);
-    end = (int)(cen + params->support + 0.5f);
-    if (start < 0)
-        start = 0;
-    if (end > len)
-        end = len;
+/* the number of bands to split a threaded execute into: thread_count, with at least one row per band */
+int lc_resize_band_count(const lc_resize_plan* p_plan, int thread_count)
+{
+    return LC_MATH_MAX(1, LC_MATH_MIN(thread_count, p_plan->dst_height));
+}
 
-    /* the range of source samples to buffer: */
-    wtab->start = start;
-    wtab->end = end;
+/**************************************************************************************************/
+/* uint8                                                                                          */
+/**************************************************************************************************/
+void lc_uint8_scanline_accumulate(lc_uint8_sum_t weight, const lc_uint8_sum_t* line_buffer, 
+                                  size_t count, lc_uint8_sum_t* accum)
+{
+    lc_uint8_sum_t *dest = accum;
+    for (size_t i = 0; i < count; ++i) {
+        *dest++ += *line_buffer++ * weight;
+    }
+}
 
-    /* find scale factor sc to normalize the filter */
-    for (den = 0, i=start; i < end; i++)
-        den += filter((i + 0.5f - cen) / params->scale, p_filter_args);
+void lc_uint8_scanline_accum_to_pixels(const lc_uint8_sum_t* accum, size_t count, lc_uint8_data_t* p_dst_row)
+{
+    for (size_t i = 0; i < count; ++i) {
+        p_dst_row[i] = lc_uint8_accum_to_channel(accum[i]);
+    }
+}
 
-    /* set sc so that sum of sc*func() is approximately WEIGHTONE */
-    sc = (den == 0.0f) ? (k_lc_float_weight_one) : (k_lc_float_weight_one / den);
+/* 
+    horizontal pass over one row of interleaved pixels: line_buffer receives width pixels with all
+    their channels, in the channel order of the source. Each source pixel is read once for all channels.
+*/
+void lc_uint8_scanline_filter_1(const lc_uint8_weight_table* weights, const lc_uint8_data_t* p_src_row, 
+                                lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + weights->start;
+        const lc_uint8_sum_t* wp = weights->weight;
+        lc_uint8_sum_t sum0 = 1 << 7;
+        for (int af = weights->start; af < weights->end; ++af) {
+            sum0 += *wp++ * *src++;
+        }
+        *line_buffer++ = lc_uint8_channel_to_buffer(sum0);
+    }
+}
 
-    /* compute the discrete, sampled filter coefficients */
-    stillzero = trimzeros;
-    for (sum = 0, wp = wtab->weight, i = start; i < end; i++) {
-        /* evaluate the filter function: */
-        tr = sc * filter((i + 0.5f - cen) / params->scale, p_filter_args);
+void lc_uint8_scanline_filter_2(const lc_uint8_weight_table* weights, const lc_uint8_data_t* p_src_row, 
+                                lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 2;
+        const lc_uint8_sum_t* wp = weights->weight;
+        lc_uint8_sum_t sum0 = 1 << 7;
+        lc_uint8_sum_t sum1 = 1 << 7;
+        for (int af = weights->start; af < weights->end; ++af, src += 2) {
+            lc_uint8_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
+        }
+        line_buffer[0] = lc_uint8_channel_to_buffer(sum0);
+        line_buffer[1] = lc_uint8_channel_to_buffer(sum1);
+        line_buffer += 2;
+    }
+}
 
-        t = (lc_float_sum_t)tr;
+void lc_uint8_scanline_filter_3(const lc_uint8_weight_table* weights, const lc_uint8_data_t* p_src_row, 
+                                lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 3;
+        const lc_uint8_sum_t* wp = weights->weight;
+        lc_uint8_sum_t sum0 = 1 << 7;
+        lc_uint8_sum_t sum1 = 1 << 7;
+        lc_uint8_sum_t sum2 = 1 << 7;
+        for (int af = weights->start; af < weights->end; ++af, src += 3) {
+            lc_uint8_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
+            sum2 += w * src[2];
+        }
+        line_buffer[0] = lc_uint8_channel_to_buffer(sum0);
+        line_buffer[1] = lc_uint8_channel_to_buffer(sum1);
+        line_buffer[2] = lc_uint8_channel_to_buffer(sum2);
+        line_buffer += 3;
+    }
+}
+
+void lc_uint8_scanline_filter_4(const lc_uint8_weight_table* weights, const lc_uint8_data_t* p_src_row, 
+                                lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 4;
+        const lc_uint8_sum_t* wp = weights->weight;
+        lc_uint8_sum_t sum0 = 1 << 7;
+        lc_uint8_sum_t sum1 = 1 << 7;
+        lc_uint8_sum_t sum2 = 1 << 7;
+        lc_uint8_sum_t sum3 = 1 << 7;
+        for (int af = weights->start; af < weights->end; ++af, src += 4) {
+            lc_uint8_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
+            sum2 += w * src[2];
+            sum3 += w * src[3];
+        }
+        line_buffer[0] = lc_uint8_channel_to_buffer(sum0);
+        line_buffer[1] = lc_uint8_channel_to_buffer(sum1);
+        line_buffer[2] = lc_uint8_channel_to_buffer(sum2);
+        line_buffer[3] = lc_uint8_channel_to_buffer(sum3);
+        line_buffer += 4;
+    }
+}
+
+/* any other channel count, the sums are kept in line_buffer */
+void lc_uint8_scanline_filter_n(const lc_uint8_weight_table* weights, unsigned int channel_count, 
+                                const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * channel_count;
+        const lc_uint8_sum_t* wp = weights->weight;
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = 1 << 7;
+        }
+        for (int af = weights->start; af < weights->end; ++af, src += channel_count) {
+            lc_uint8_sum_t w = *wp++;
+            for (unsigned int c = 0; c < channel_count; ++c) {
+                line_buffer[c] += w * src[c];
+            }
+        }
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = lc_uint8_channel_to_buffer(line_buffer[c]);
+        }
+        line_buffer += channel_count;
+    }
+}
+
+void lc_uint8_scanline_filter_to_buffer(const lc_uint8_weight_table* weights, unsigned int channel_count, 
+                                        const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    switch (channel_count) {
+        case 1:  lc_uint8_scanline_filter_1(weights, p_src_row, line_buffer, width); break;
+        case 2:  lc_uint8_scanline_filter_2(weights, p_src_row, line_buffer, width); break;
+        case 3:  lc_uint8_scanline_filter_3(weights, p_src_row, line_buffer, width); break;
+        case 4:  lc_uint8_scanline_filter_4(weights, p_src_row, line_buffer, width); break;
+        default: lc_uint8_scanline_filter_n(weights, channel_count, p_src_row, line_buffer, width); break;
+    }
+}
+
+/* 
+    horizontal pass with premultiplied alpha, alpha being the last channel. Colors are multiplied by
+    their alpha and halved to fit in 15 bits, alpha by 128, and the sums are shifted by 15: alpha ends
+    up as in lc_uint8_scanline_filter_*, 64 * a, colors as c * a / 4. At low alpha that leaves colors
+    with only a few bits, hence the larger error of nearly transparent pixels.
+*/
+void lc_uint8_scanline_filter_premultiplied(const lc_uint8_weight_table* weights, unsigned int channel_count, 
+                                            const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    unsigned int alpha_channel = channel_count - 1;
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * channel_count;
+        const lc_uint8_sum_t* wp = weights->weight;
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = 1 << 14;
+        }
+        for (int af = weights->start; af < weights->end; ++af, src += channel_count) {
+            lc_uint8_sum_t w = *wp++;
+            lc_uint8_sum_t alpha = src[alpha_channel];
+            for (unsigned int c = 0; c < alpha_channel; ++c) {
+                line_buffer[c] += w * ((src[c] * alpha) >> 1);
+            }
+            line_buffer[alpha_channel] += w * (alpha << 7);
+        }
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = (lc_uint8_sum_t)((int)line_buffer[c] >> 15);
+        }
+        line_buffer += channel_count;
+    }
+}
+
+/* 
+    lc_uint8_scanline_accum_to_pixels for premultiplied alpha: alpha sums to 2^20 * a as usual, colors to 
+    2^12 * c * a, so 256 * color sum / alpha sum is the color with straight alpha again
+*/
+void lc_uint8_scanline_unpremultiply_to_pixels(const lc_uint8_sum_t* accum, unsigned int channel_count, 
+                                               int width, lc_uint8_data_t* p_dst_row)
+{
+    unsigned int alpha_channel = channel_count - 1;
+    for (int x = 0; x < width; ++x, accum += channel_count, p_dst_row += channel_count) {
+        int alpha_sum = (int)accum[alpha_channel];
+        float scale = (alpha_sum > 0) ? 256.0f / (float)alpha_sum : 0.0f;
+        for (unsigned int c = 0; c < alpha_channel; ++c) {
+            float color = (float)(int)accum[c] * scale;
+            color = LC_MATH_MIN(color, 255.0f);
+            p_dst_row[c] = (color > 0.0f) ? (lc_uint8_data_t)lrintf(color) : 0;
+        }
+        p_dst_row[alpha_channel] = lc_uint8_accum_to_channel(alpha_sum);
+    }
+}
+
+#if LC_IMAGE_RESIZE_X86
+/*
+    SSE4.1 and AVX2 kernels. The horizontal pass multiplies pixels by the 16-bit copy of the x weights
+    with pmaddwd, two source pixels per instruction; the vertical pass works on 4 or 8 sums at once.
+    The sums wrap the same way as the scalar ones, so the results are identical.
+*/
+LC_RESIZE_TARGET("sse4.1")
+inline __m128i lc_uint8_load_4(const lc_uint8_data_t* p_src)
+{
+    int bytes;
+    memcpy(&bytes, p_src, sizeof(bytes));
+    return _mm_cvtsi32_si128(bytes);
+}
+
+/* 3 or 2 bytes, for the last pixel of a row which may end the buffer */
+LC_RESIZE_TARGET("sse4.1")
+inline __m128i lc_uint8_load_3(const lc_uint8_data_t* p_src)
+{
+    return _mm_cvtsi32_si128(p_src[0] | (p_src[1] << 8) | (p_src[2] << 16));
+}
+
+LC_RESIZE_TARGET("sse4.1")
+inline __m128i lc_uint8_load_2(const lc_uint8_data_t* p_src)
+{
+    return _mm_cvtsi32_si128(p_src[0] | (p_src[1] << 8));
+}
+
+LC_RESIZE_TARGET("sse4.1")
+inline int lc_uint8_load_weight_pair(const short* p_weights)
+{
+    int pair;
+    memcpy(&pair, p_weights, sizeof(pair));
+    return pair;
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_filter_1_sse41(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                      const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + weights->start;
+        int count = weights->end - weights->start;
+        __m128i sums = _mm_setzero_si128();
+        int i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(src + i)));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_loadu_si128((const __m128i*)(weights16 + i))));
+        }
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+        sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+        lc_uint8_sum_t sum = (1 << 7) + (lc_uint8_sum_t)_mm_cvtsi128_si32(sums);
+        for (; i < count; ++i) {
+            sum += (lc_uint8_sum_t)(weights16[i] * src[i]);
+        }
+        *line_buffer++ = lc_uint8_channel_to_buffer(sum);
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_filter_2_sse41(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                      const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    /* two pixels a b, c d become a c b d: the same channel of both pixels side by side */
+    const __m128i pair_channels = _mm_setr_epi8(0, 2, 1, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 2;
+        int count = weights->end - weights->start;
+        __m128i sums = _mm_set1_epi32(1 << 7);
+        int i = 0;
+        for (; i + 2 <= count; i += 2, src += 4) {
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(lc_uint8_load_4(src), pair_channels));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_set1_epi32(lc_uint8_load_weight_pair(weights16 + i))));
+        }
+        if (i < count) {
+            __m128i pixel = _mm_cvtepu8_epi32(lc_uint8_load_2(src));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(pixel, _mm_set1_epi32(weights16[i])));
+        }
+        _mm_storel_epi64((__m128i*)line_buffer, _mm_srai_epi32(sums, 8));
+        line_buffer += 2;
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_filter_3_sse41(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                      const lc_uint8_data_t* p_src_row, int src_width, lc_uint8_sum_t* line_buffer, int width)
+{
+    /* two pixels are loaded as 8 bytes, except at the end of the row */
+    const lc_uint8_data_t* p_src_end = p_src_row + (long long)src_width * 3;
+    const __m128i pair_channels = _mm_setr_epi8(0, 3, 1, 4, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 3;
+        int count = weights->end - weights->start;
+        __m128i sums = _mm_set1_epi32(1 << 7);
+        int i = 0;
+        for (; i + 2 <= count; i += 2, src += 6) {
+            __m128i bytes = (src + 8 <= p_src_end) ? _mm_loadl_epi64((const __m128i*)src) : _mm_insert_epi16(lc_uint8_load_4(src), src[4] | (src[5] << 8), 2);
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(bytes, pair_channels));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_set1_epi32(lc_uint8_load_weight_pair(weights16 + i))));
+        }
+        if (i < count) {
+            __m128i pixel = _mm_cvtepu8_epi32(lc_uint8_load_3(src));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(pixel, _mm_set1_epi32(weights16[i])));
+        }
+        sums = _mm_srai_epi32(sums, 8);
+        _mm_storel_epi64((__m128i*)line_buffer, sums);
+        line_buffer[2] = (lc_uint8_sum_t)_mm_extract_epi32(sums, 2);
+        line_buffer += 3;
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_filter_4_sse41(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                      const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    const __m128i pair_channels = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 4;
+        int count = weights->end - weights->start;
+        __m128i sums = _mm_set1_epi32(1 << 7);
+        int i = 0;
+        for (; i + 2 <= count; i += 2, src += 8) {
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)src), pair_channels));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_set1_epi32(lc_uint8_load_weight_pair(weights16 + i))));
+        }
+        if (i < count) {
+            __m128i pixel = _mm_cvtepu8_epi32(lc_uint8_load_4(src));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(pixel, _mm_set1_epi32(weights16[i])));
+        }
+        _mm_storeu_si128((__m128i*)line_buffer, _mm_srai_epi32(sums, 8));
+        line_buffer += 4;
+    }
+}
+
+LC_RESIZE_TARGET("avx2")
+void lc_uint8_scanline_filter_4_avx2(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                     const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    /* four pixels: pixels 0 and 1 paired in the low lane, pixels 2 and 3 in the high lane */
+    const __m128i pair_channels = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+    /* weights 0 and 1 over the low lane, 2 and 3 over the high lane */
+    const __m256i spread_pairs = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 4;
+        int count = weights->end - weights->start;
+        __m256i sums4 = _mm256_setzero_si256();
+        int i = 0;
+        for (; i + 4 <= count; i += 4, src += 16) {
+            __m256i pixels = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), pair_channels));
+            __m256i pairs = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)(weights16 + i))), spread_pairs);
+            sums4 = _mm256_add_epi32(sums4, _mm256_madd_epi16(pixels, pairs));
+        }
+        __m128i sums = _mm_add_epi32(_mm_set1_epi32(1 << 7), 
+                                     _mm_add_epi32(_mm256_castsi256_si128(sums4), _mm256_extracti128_si256(sums4, 1)));
+        for (; i + 2 <= count; i += 2, src += 8) {
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)src), pair_channels));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(pixels, _mm_set1_epi32(lc_uint8_load_weight_pair(weights16 + i))));
+        }
+        if (i < count) {
+            __m128i pixel = _mm_cvtepu8_epi32(lc_uint8_load_4(src));
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(pixel, _mm_set1_epi32(weights16[i])));
+        }
+        _mm_storeu_si128((__m128i*)line_buffer, _mm_srai_epi32(sums, 8));
+        line_buffer += 4;
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_accumulate_sse41(lc_uint8_sum_t weight, const lc_uint8_sum_t* line_buffer, 
+                                        size_t count, lc_uint8_sum_t* accum)
+{
+    const __m128i weights = _mm_set1_epi32((int)weight);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i line = _mm_loadu_si128((const __m128i*)(line_buffer + i));
+        __m128i sums = _mm_loadu_si128((const __m128i*)(accum + i));
+        _mm_storeu_si128((__m128i*)(accum + i), _mm_add_epi32(sums, _mm_mullo_epi32(line, weights)));
+    }
+    lc_uint8_scanline_accumulate(weight, line_buffer + i, count - i, accum + i);
+}
+
+LC_RESIZE_TARGET("avx2")
+void lc_uint8_scanline_accumulate_avx2(lc_uint8_sum_t weight, const lc_uint8_sum_t* line_buffer, 
+                                       size_t count, lc_uint8_sum_t* accum)
+{
+    const __m256i weights = _mm256_set1_epi32((int)weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i line = _mm256_loadu_si256((const __m256i*)(line_buffer + i));
+        __m256i sums = _mm256_loadu_si256((const __m256i*)(accum + i));
+        _mm256_storeu_si256((__m256i*)(accum + i), _mm256_add_epi32(sums, _mm256_mullo_epi32(line, weights)));
+    }
+    lc_uint8_scanline_accumulate(weight, line_buffer + i, count - i, accum + i);
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_accum_to_pixels_sse41(const lc_uint8_sum_t* accum, size_t count, lc_uint8_data_t* p_dst_row)
+{
+    /* the saturating packs clamp to [0, 255] like lc_uint8_accum_to_channel */
+    const __m128i half = _mm_set1_epi32(k_lc_uint8_half_final_shift);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v0 = _mm_srai_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(accum + i)), half), k_lc_uint8_final_shift);
+        __m128i v1 = _mm_srai_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(accum + i + 4)), half), k_lc_uint8_final_shift);
+        __m128i v2 = _mm_srai_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(accum + i + 8)), half), k_lc_uint8_final_shift);
+        __m128i v3 = _mm_srai_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(accum + i + 12)), half), k_lc_uint8_final_shift);
+        _mm_storeu_si128((__m128i*)(p_dst_row + i), _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3)));
+    }
+    lc_uint8_scanline_accum_to_pixels(accum + i, count - i, p_dst_row + i);
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_filter_premultiplied_4_sse41(const lc_uint8_weight_table* weights, const short* weights16, int weights16_stride, 
+                                                    const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer, int width)
+{
+    const __m128i pair_channels = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (int b = 0; b < width; ++b, ++weights, weights16 += weights16_stride) {
+        const lc_uint8_data_t* src = p_src_row + (long long)weights->start * 4;
+        int count = weights->end - weights->start;
+        __m128i sums = _mm_set1_epi32(1 << 14);
+        int i = 0;
+        for (; i + 2 <= count; i += 2, src += 8) {
+            /* colors times the alpha of their pixel, alpha times 256; the products fit in 16 unsigned bits */
+            __m128i pixels = _mm_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)src), pair_channels));
+            __m128i factors = _mm_blend_epi16(_mm_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_epi16(256), 0xC0);
+            __m128i premultiplied = _mm_srli_epi16(_mm_mullo_epi16(pixels, factors), 1);
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(premultiplied, _mm_set1_epi32(lc_uint8_load_weight_pair(weights16 + i))));
+        }
+        if (i < count) {
+            __m128i pixel = _mm_cvtepu8_epi32(lc_uint8_load_4(src));
+            __m128i factors = _mm_blend_epi16(_mm_shuffle_epi32(pixel, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_epi32(256), 0xC0);
+            __m128i premultiplied = _mm_srli_epi32(_mm_mullo_epi32(pixel, factors), 1);
+            sums = _mm_add_epi32(sums, _mm_mullo_epi32(premultiplied, _mm_set1_epi32(weights16[i])));
+        }
+        _mm_storeu_si128((__m128i*)line_buffer, _mm_srai_epi32(sums, 15));
+        line_buffer += 4;
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+inline __m128i lc_uint8_unpremultiply_pixel_sse41(__m128i sums)
+{
+    const __m128i half = _mm_set1_epi32(k_lc_uint8_half_final_shift);
+    __m128 alpha_sum = _mm_cvtepi32_ps(_mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 3, 3, 3)));
+    __m128 scale = _mm_and_ps(_mm_div_ps(_mm_set1_ps(256.0f), alpha_sum), _mm_cmpgt_ps(alpha_sum, _mm_setzero_ps()));
+    __m128i colors = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(sums), scale), _mm_set1_ps(255.0f)));
+    __m128i alpha = _mm_srai_epi32(_mm_add_epi32(sums, half), k_lc_uint8_final_shift);
+    return _mm_blend_epi16(colors, alpha, 0xC0);
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_uint8_scanline_unpremultiply_to_pixels_4_sse41(const lc_uint8_sum_t* accum, int width, lc_uint8_data_t* p_dst_row)
+{
+    /* the saturating packs clamp colors below 0 and alpha to [0, 255] */
+    int x = 0;
+    for (; x + 4 <= width; x += 4, accum += 16, p_dst_row += 16) {
+        __m128i v0 = lc_uint8_unpremultiply_pixel_sse41(_mm_loadu_si128((const __m128i*)accum));
+        __m128i v1 = lc_uint8_unpremultiply_pixel_sse41(_mm_loadu_si128((const __m128i*)(accum + 4)));
+        __m128i v2 = lc_uint8_unpremultiply_pixel_sse41(_mm_loadu_si128((const __m128i*)(accum + 8)));
+        __m128i v3 = lc_uint8_unpremultiply_pixel_sse41(_mm_loadu_si128((const __m128i*)(accum + 12)));
+        _mm_storeu_si128((__m128i*)p_dst_row, _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3)));
+    }
+    lc_uint8_scanline_unpremultiply_to_pixels(accum, 4, width - x, p_dst_row);
+}
+#endif /* LC_IMAGE_RESIZE_X86 */
+
+/* lc_uint8_resize_filter_row: horizontal pass of one source row with the kernel of the plan */
+void lc_uint8_resize_filter_row(const lc_resize_plan* p_plan, const lc_uint8_data_t* p_src_row, lc_uint8_sum_t* line_buffer)
+{
+    const lc_uint8_weight_table* weights = p_plan->uint8_x_weights;
+    int width = p_plan->dst_width;
+#if LC_IMAGE_RESIZE_X86
+    const short* weights16 = p_plan->uint8_x_weights16;
+    int stride = p_plan->uint8_x_weights16_stride;
+#endif
+    if (p_plan->premultiply) {
+#if LC_IMAGE_RESIZE_X86
+        if ((p_plan->simd >= LC_RESIZE_SIMD_SSE41) && (NULL != weights16) && (4 == p_plan->channel_count)) {
+            lc_uint8_scanline_filter_premultiplied_4_sse41(weights, weights16, stride, p_src_row, line_buffer, width);
+            return;
+        }
+#endif
+        lc_uint8_scanline_filter_premultiplied(weights, p_plan->channel_count, p_src_row, line_buffer, width);
+        return;
+    }
+#if LC_IMAGE_RESIZE_X86
+    if ((p_plan->simd >= LC_RESIZE_SIMD_SSE41) && (NULL != weights16)) {
+        switch (p_plan->channel_count) {
+            case 1: lc_uint8_scanline_filter_1_sse41(weights, weights16, stride, p_src_row, line_buffer, width); return;
+            case 2: lc_uint8_scanline_filter_2_sse41(weights, weights16, stride, p_src_row, line_buffer, width); return;
+            case 3: lc_uint8_scanline_filter_3_sse41(weights, weights16, stride, p_src_row, p_plan->src_width, line_buffer, width); return;
+            case 4: 
+                if (p_plan->simd >= LC_RESIZE_SIMD_AVX2) {
+                    lc_uint8_scanline_filter_4_avx2(weights, weights16, stride, p_src_row, line_buffer, width); 
+                }
+                else {
+                    lc_uint8_scanline_filter_4_sse41(weights, weights16, stride, p_src_row, line_buffer, width); 
+                }
+                return;
+            default: break;
+        }
+    }
+#endif
+    lc_uint8_scanline_filter_to_buffer(weights, p_plan->channel_count, p_src_row, line_buffer, width);
+}
+
+void lc_uint8_resize_accumulate_row(const lc_resize_plan* p_plan, lc_uint8_sum_t weight, const lc_uint8_sum_t* line_buffer, 
+                                    size_t count, lc_uint8_sum_t* accum)
+{
+#if LC_IMAGE_RESIZE_X86
+    if (p_plan->simd >= LC_RESIZE_SIMD_AVX2) {
+        lc_uint8_scanline_accumulate_avx2(weight, line_buffer, count, accum);
+        return;
+    }
+    if (p_plan->simd >= LC_RESIZE_SIMD_SSE41) {
+        lc_uint8_scanline_accumulate_sse41(weight, line_buffer, count, accum);
+        return;
+    }
+#else
+    (void)p_plan;
+#endif
+    lc_uint8_scanline_accumulate(weight, line_buffer, count, accum);
+}
+
+void lc_uint8_resize_store_row(const lc_resize_plan* p_plan, const lc_uint8_sum_t* accum, size_t count, lc_uint8_data_t* p_dst_row)
+{
+    if (p_plan->premultiply) {
+#if LC_IMAGE_RESIZE_X86
+        if ((p_plan->simd >= LC_RESIZE_SIMD_SSE41) && (4 == p_plan->channel_count)) {
+            lc_uint8_scanline_unpremultiply_to_pixels_4_sse41(accum, p_plan->dst_width, p_dst_row);
+            return;
+        }
+#endif
+        lc_uint8_scanline_unpremultiply_to_pixels(accum, p_plan->channel_count, p_plan->dst_width, p_dst_row);
+        return;
+    }
+#if LC_IMAGE_RESIZE_X86
+    if (p_plan->simd >= LC_RESIZE_SIMD_SSE41) {
+        lc_uint8_scanline_accum_to_pixels_sse41(accum, count, p_dst_row);
+        return;
+    }
+#endif
+    lc_uint8_scanline_accum_to_pixels(accum, count, p_dst_row);
+}
+
+void lc_uint8_make_weight_table(int b, float cen, 
+                                lc_filter_fn filter, const lc_filter_args* p_filter_args, 
+                                const lc_filter_params *params, 
+                                int len, bool trimzeros, lc_uint8_weight_table* wtab)
+{
+    int start, end, i, stillzero, lastnonzero, nz;
+    lc_uint8_sum_t *wp, t, sum;
+    float den, sc, tr;
+
+    /* find the source coord range of this positioned filter: [start..end-1] */
+    start = (int)(cen - params->support + 0.5f);
+    end = (int)(cen + params->support + 0.5f);
+    if (start < 0)
+        start = 0;
+    if (end > len)
+        end = len;
+
+    /* the range of source samples to buffer: */
+    wtab->start = start;
+    wtab->end = end;
+
+    /* find scale factor sc to normalize the filter */
+    for (den = 0, i=start; i < end; i++)
+        den += filter((i + 0.5f - cen) / params->scale, p_filter_args);
+
+    /* set sc so that sum of sc*func() is approximately WEIGHTONE */
+    sc = (den == 0.0f) ? (k_lc_uint8_weight_one) : (k_lc_uint8_weight_one / den);
+
+    /* compute the discrete, sampled filter coefficients */
+    stillzero = trimzeros;
+    for (sum = 0, wp = wtab->weight, i = start; i < end; i++) {
+        /* evaluate the filter function: */
+        tr = sc * filter((i + 0.5f - cen) / params->scale, p_filter_args);
+
+        /* negative lobes go through int, converting a negative float to unsigned is undefined */
+        t = (lc_uint8_sum_t)(int)floor(tr + 0.5f);
         if (stillzero && (t == 0)) {
             /* find first nonzero */
             start++;
@@ -744,7 +1375,7 @@ void lc_float_make_weight_table(int b, float cen,
         nz = wtab->end-wtab->start;
         wtab->start = (wtab->start+wtab->end) >> 1;
         wtab->end = wtab->start+1;
-        wtab->weight[0] = k_lc_float_weight_one;
+        wtab->weight[0] = k_lc_uint8_weight_one;
     }
     else {
         if (trimzeros) {
@@ -759,7 +1390,7 @@ void lc_float_make_weight_table(int b, float cen,
             nz = 0;
         }
 
-        if (sum != k_lc_float_weight_one) {
+        if (sum != k_lc_uint8_weight_one) {
             /*
                 * Fudge the center slightly to make sum=WEIGHTONE exactly.
                 * Is this the best way to normalize a discretely sampled
@@ -772,163 +1403,769 @@ void lc_float_make_weight_table(int b, float cen,
             else if (i >= end) {
                 i = end - 1;
             }
-            t = k_lc_float_weight_one - sum;
+            t = k_lc_uint8_weight_one - sum;
             /* fudge center sample */
             wtab->weight[i - start] += t;
         }
     }   
 }
 
-void lc_image_resize_float(int src_width, int src_height, int src_row_stride, const float* p_src_data,
-                           int dst_width, int dst_height, int dst_row_stride, float* p_dst_data,
+lc_resize_plan* lc_resize_plan_create_uint8_ex(int src_width, int src_height, int dst_width, int dst_height,
+                                               unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args,
+                                               unsigned int flags)
+{
+    lc_resize_plan* p_plan = lc_resize_plan_alloc(src_width, src_height, dst_width, dst_height,
+                                                  channel_count, filter, p_filter_args, flags);
+    const lc_mapping* m = &p_plan->m;
+    int width_x = p_plan->filter_params_x.width;
+    int width_y = p_plan->filter_params_y.width;
+
+    p_plan->uint8_x_weights = (lc_uint8_weight_table*)calloc(dst_width, sizeof(*p_plan->uint8_x_weights));
+    assert(NULL != p_plan->uint8_x_weights);
+
+    p_plan->uint8_y_weights = (lc_uint8_weight_table*)calloc(dst_height, sizeof(*p_plan->uint8_y_weights));
+    assert(NULL != p_plan->uint8_y_weights);
+
+    p_plan->uint8_weight_buffer = (lc_uint8_sum_t*)calloc((size_t)dst_width * width_x + (size_t)dst_height * width_y,
+                                                          sizeof(*p_plan->uint8_weight_buffer));
+    assert(NULL != p_plan->uint8_weight_buffer);
+
+    lc_uint8_sum_t* p_weight = p_plan->uint8_weight_buffer;
+    for (int bx = 0; bx < dst_width; ++bx, p_weight += width_x) {
+        p_plan->uint8_x_weights[bx].weight = p_weight;
+        lc_uint8_make_weight_table(bx, LC_MAP(bx, m->sx, m->ux), p_plan->filter_fn, &p_plan->filter_args, &p_plan->filter_params_x, src_width, true, &p_plan->uint8_x_weights[bx]);
+    }
+
+    for (int by = 0; by < dst_height; ++by, p_weight += width_y) {
+        p_plan->uint8_y_weights[by].weight = p_weight;
+        lc_uint8_make_weight_table(by, LC_MAP(by, m->sy, m->uy), p_plan->filter_fn, &p_plan->filter_args, &p_plan->filter_params_y, src_height, false, &p_plan->uint8_y_weights[by]);
+    }
+
+    /* 
+        the SIMD kernels multiply with 16-bit weights; the tables are padded to 8 weights, 16 bytes, so 
+        every column starts aligned. Filters with a weight beyond 16 bits keep the scalar horizontal pass.
+    */
+    if (LC_RESIZE_SIMD_NONE != p_plan->simd) {
+        p_plan->uint8_x_weights16_stride = (width_x + 7) & ~7;
+        p_plan->uint8_x_weights16 = (short*)calloc((size_t)dst_width * p_plan->uint8_x_weights16_stride, sizeof(*p_plan->uint8_x_weights16));
+        assert(NULL != p_plan->uint8_x_weights16);
+
+        bool fits = true;
+        for (int bx = 0; (bx < dst_width) && fits; ++bx) {
+            const lc_uint8_weight_table* x_weights = &p_plan->uint8_x_weights[bx];
+            short* weights16 = p_plan->uint8_x_weights16 + (size_t)bx * p_plan->uint8_x_weights16_stride;
+            for (int i = 0; i < x_weights->end - x_weights->start; ++i) {
+                int weight = (int)x_weights->weight[i];
+                if ((weight < -32768) || (weight > 32767)) {
+                    fits = false;
+                    break;
+                }
+                weights16[i] = (short)weight;
+            }
+        }
+
+        if (! fits) {
+            LC_SAFE_FREE(p_plan->uint8_x_weights16);
+        }
+    }
+
+    return p_plan;
+}
+
+/* lc_uint8_resize_rows: destination rows [dst_y_begin..dst_y_end-1] with a line ring of their own */
+void lc_uint8_resize_rows(const lc_resize_plan* p_plan, long long src_row_stride, const unsigned char* p_src_data,
+                          long long dst_row_stride, unsigned char* p_dst_data, int dst_y_begin, int dst_y_end)
+{
+    assert(NULL != p_plan->uint8_x_weights);
+
+    int line_count = p_plan->filter_params_y.width;
+    unsigned int channel_count = p_plan->channel_count;
+    lc_uint8_line_buffer* lines_buffer = (lc_uint8_line_buffer*)calloc(line_count, sizeof(*lines_buffer));
+    assert(NULL != lines_buffer);
+
+    /* line_count filtered lines of interleaved pixels, then the accumulator */
+    size_t line_size = (size_t)p_plan->dst_width * channel_count;
+    lc_uint8_sum_t* lines_data = (lc_uint8_sum_t*)calloc((line_count + 1) * line_size, sizeof(*lines_data));
+    assert(NULL != lines_data);
+
+    for (int i = 0; i < line_count; ++i) {
+        lines_buffer[i].first  = -1;
+        lines_buffer[i].second = lines_data + i * line_size;
+    }
+    lc_uint8_sum_t* accum = lines_data + line_count * line_size;
+
+    /* loop over dest scanlines */
+    for (int dst_y = dst_y_begin; dst_y < dst_y_end; ++dst_y) {
+        const lc_uint8_weight_table* y_weights = &p_plan->uint8_y_weights[dst_y];
+        memset(accum, 0, sizeof(*accum) * line_size);
+        /* loop over source scanlines that influence this dest scanline */
+        for (int ayf = y_weights->start; ayf < y_weights->end; ++ayf) {
+            lc_uint8_line_buffer* line = &lines_buffer[ayf % line_count];
+            if (line->first != ayf) {
+                lc_uint8_resize_filter_row(p_plan, p_src_data + ayf * src_row_stride, line->second);
+                line->first = ayf;
+            }
+            lc_uint8_resize_accumulate_row(p_plan, y_weights->weight[ayf - y_weights->start], line->second, line_size, accum);
+        }
+        lc_uint8_resize_store_row(p_plan, accum, line_size, p_dst_data + dst_y * dst_row_stride);
+    }
+
+    LC_SAFE_FREE(lines_data);
+    LC_SAFE_FREE(lines_buffer);
+}
+
+void lc_resize_execute_uint8(const lc_resize_plan* p_plan, long long src_row_stride, const unsigned char* p_src_data,
+                             long long dst_row_stride, unsigned char* p_dst_data)
+{
+    lc_uint8_resize_rows(p_plan, src_row_stride, p_src_data, dst_row_stride, p_dst_data, 0, p_plan->dst_height);
+}
+
+typedef struct lc_uint8_band_context {
+    const lc_resize_plan*   p_plan;
+    long long               src_row_stride;
+    const unsigned char*    p_src_data;
+    long long               dst_row_stride;
+    unsigned char*          p_dst_data;
+    int                     band_count;
+} lc_uint8_band_context;
+
+void lc_uint8_band_task(void* task_context, int index)
+{
+    const lc_uint8_band_context* p_context = (const lc_uint8_band_context*)task_context;
+    int dst_y_begin = 0;
+    int dst_y_end = 0;
+    lc_resize_band(p_context->p_plan, p_context->band_count, index, &dst_y_begin, &dst_y_end);
+    lc_uint8_resize_rows(p_context->p_plan, p_context->src_row_stride, p_context->p_src_data, 
+                         p_context->dst_row_stride, p_context->p_dst_data, dst_y_begin, dst_y_end);
+}
+
+void lc_resize_execute_threaded_uint8(const lc_resize_plan* p_plan, long long src_row_stride, const unsigned char* p_src_data,
+                                      long long dst_row_stride, unsigned char* p_dst_data,
+                                      int thread_count, lc_resize_scheduler_fn scheduler, void* scheduler_context)
+{
+    LC_DECLARE_ZERO(lc_uint8_band_context, context);
+    context.p_plan = p_plan;
+    context.src_row_stride = src_row_stride;
+    context.p_src_data = p_src_data;
+    context.dst_row_stride = dst_row_stride;
+    context.p_dst_data = p_dst_data;
+    context.band_count = lc_resize_band_count(p_plan, thread_count);
+    lc_resize_run_tasks(context.band_count, lc_uint8_band_task, &context, scheduler, scheduler_context);
+}
+
+void lc_image_resize_uint8_ex(int src_width, int src_height, long long src_row_stride, const unsigned char* p_src_data,
+                              int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
+                              unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args, unsigned int flags)
+{
+    lc_resize_plan* p_plan = lc_resize_plan_create_uint8_ex(src_width, src_height, dst_width, dst_height,
+                                                            channel_count, filter, p_filter_args, flags);
+    lc_resize_execute_uint8(p_plan, src_row_stride, p_src_data, dst_row_stride, p_dst_data);
+    lc_resize_plan_destroy(p_plan);
+}
+
+void lc_image_resize_uint8(int src_width, int src_height, long long src_row_stride, const unsigned char* p_src_data,
+                           int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
                            unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
 {
-    LC_DECLARE_ZERO(lc_filter_args, filter_args);
-    lc_filter_fn filter_fn = NULL;
-    switch (filter) {
-        case LC_FILTER_BOX: {
-            filter_fn = lc_filter_box;
-            if (NULL == p_filter_args) {lc_filter_box_init(&filter_args);}
+    lc_image_resize_uint8_ex(src_width, src_height, src_row_stride, p_src_data, dst_width, dst_height, dst_row_stride, p_dst_data,
+                             channel_count, filter, p_filter_args, 0);
+}
+
+struct lc_image_resizer {
+    lc_resize_plan*         p_plan;
+    long long               dst_row_stride;
+    unsigned char*          p_dst_data;
+    int                     src_y;          /* source rows pushed so far */
+    int                     dst_y;          /* next destination row to write */
+    lc_uint8_line_buffer*   lines_buffer;   /* filter_params_y.width filtered rows, all channels */
+    lc_uint8_sum_t*         lines_data;
+    lc_uint8_sum_t*         accum;
+};
+
+lc_image_resizer* lc_image_resizer_create_uint8(int src_width, int src_height,
+                                                int dst_width, int dst_height, long long dst_row_stride, unsigned char* p_dst_data,
+                                                unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
+{
+    lc_image_resizer* p_resizer = (lc_image_resizer*)calloc(1, sizeof(*p_resizer));
+    assert(NULL != p_resizer);
+
+    /* same weights as lc_image_resize_uint8 */
+    p_resizer->p_plan = lc_resize_plan_create_uint8(src_width, src_height, dst_width, dst_height,
+                                                    channel_count, filter, p_filter_args);
+    p_resizer->dst_row_stride = dst_row_stride;
+    p_resizer->p_dst_data = p_dst_data;
+
+    /* a row holds dst_width pixels of channel_count sums */
+    int line_count = p_resizer->p_plan->filter_params_y.width;
+    size_t line_size = (size_t)dst_width * channel_count;
+    p_resizer->lines_buffer = (lc_uint8_line_buffer*)calloc(line_count, sizeof(*p_resizer->lines_buffer));
+    assert(NULL != p_resizer->lines_buffer);
+
+    p_resizer->lines_data = (lc_uint8_sum_t*)calloc((size_t)line_count * line_size, sizeof(*p_resizer->lines_data));
+    assert(NULL != p_resizer->lines_data);
+
+    for (int i = 0; i < line_count; ++i) {
+        p_resizer->lines_buffer[i].first  = -1;
+        p_resizer->lines_buffer[i].second = p_resizer->lines_data + i * line_size;
+    }
+
+    p_resizer->accum = (lc_uint8_sum_t*)calloc(line_size, sizeof(*p_resizer->accum));
+    assert(NULL != p_resizer->accum);
+
+    return p_resizer;
+}
+
+void lc_image_resizer_push_uint8(lc_image_resizer* p_resizer, const unsigned char* p_src_row)
+{
+    const lc_resize_plan* p_plan = p_resizer->p_plan;
+    assert(p_resizer->src_y < p_plan->src_height);
+
+    int ayf = p_resizer->src_y++;
+    int line_count = p_plan->filter_params_y.width;
+    size_t line_size = (size_t)p_plan->dst_width * p_plan->channel_count;
+
+    /* 
+        the slot of the row filter_params_y.width rows back is free: the next destination row 
+        needs at least the row just pushed, and its filter spans at most filter_params_y.width rows
+    */
+    lc_uint8_line_buffer* slot = &p_resizer->lines_buffer[ayf % line_count];
+    lc_uint8_resize_filter_row(p_plan, p_src_row, slot->second);
+    slot->first = ayf;
+
+    /* write the destination rows that have all their source rows */
+    while ((p_resizer->dst_y < p_plan->dst_height) && (p_plan->uint8_y_weights[p_resizer->dst_y].end <= p_resizer->src_y)) {
+        const lc_uint8_weight_table* y_weights = &p_plan->uint8_y_weights[p_resizer->dst_y];
+        memset(p_resizer->accum, 0, sizeof(*p_resizer->accum) * line_size);
+        for (int y = y_weights->start; y < y_weights->end; ++y) {
+            lc_uint8_line_buffer* line = &p_resizer->lines_buffer[y % line_count];
+            assert(line->first == y);
+            lc_uint8_resize_accumulate_row(p_plan, y_weights->weight[y - y_weights->start], line->second, line_size, p_resizer->accum);
         }
-        break;
-        case LC_FILTER_TRIANGLE: {
-            filter_fn = lc_filter_triangle;
-            if (NULL == p_filter_args) {lc_filter_triangle_init(&filter_args);}
+        lc_uint8_resize_store_row(p_plan, p_resizer->accum, line_size, p_resizer->p_dst_data + p_resizer->dst_y * p_resizer->dst_row_stride);
+        ++p_resizer->dst_y;
+    }
+}
+
+void lc_image_resizer_destroy(lc_image_resizer* p_resizer)
+{
+    if (NULL == p_resizer) {
+        return;
+    }
+
+    LC_SAFE_FREE(p_resizer->accum);
+    LC_SAFE_FREE(p_resizer->lines_data);
+    LC_SAFE_FREE(p_resizer->lines_buffer);
+    lc_resize_plan_destroy(p_resizer->p_plan);
+    LC_SAFE_FREE(p_resizer);
+}
+
+/**************************************************************************************************/
+/* float                                                                                          */
+/**************************************************************************************************/
+void lc_float_scanline_accumulate(lc_float_sum_t weight, const lc_float_sum_t* line_buffer, 
+                                  size_t count, lc_float_sum_t* accum)
+{
+    lc_float_sum_t *dest = accum;
+    for (size_t i = 0; i < count; ++i) {
+        *dest++ += *line_buffer++ * weight;
+    }
+}
+
+void lc_float_scanline_accum_to_pixels(const lc_float_sum_t* accum, size_t count, lc_float_data_t* p_dst_row)
+{
+    for (size_t i = 0; i < count; ++i) {
+        p_dst_row[i] = lc_float_accum_to_channel(accum[i]);
+    }
+}
+
+void lc_float_scanline_filter_1(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + weights->start;
+        const lc_float_sum_t* wp = weights->weight;
+        lc_float_sum_t sum0 = 0.0f;
+        for (int af = weights->start; af < weights->end; ++af) {
+            sum0 += *wp++ * *src++;
         }
-        break;
-        case LC_FILTER_QUADRATIC: {
-            filter_fn = lc_filter_quadratic;
-            if (NULL == p_filter_args) {lc_filter_quadratic_init(&filter_args);}
+        *line_buffer++ = lc_float_channel_to_buffer(sum0);
+    }
+}
+
+void lc_float_scanline_filter_2(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * 2;
+        const lc_float_sum_t* wp = weights->weight;
+        lc_float_sum_t sum0 = 0.0f;
+        lc_float_sum_t sum1 = 0.0f;
+        for (int af = weights->start; af < weights->end; ++af, src += 2) {
+            lc_float_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
         }
-        break;
-        case LC_FILTER_CUBIC: {
-            filter_fn = lc_filter_cubic;
-            if (NULL == p_filter_args) {lc_filter_cubic_init(&filter_args);}
+        line_buffer[0] = lc_float_channel_to_buffer(sum0);
+        line_buffer[1] = lc_float_channel_to_buffer(sum1);
+        line_buffer += 2;
+    }
+}
+
+void lc_float_scanline_filter_3(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * 3;
+        const lc_float_sum_t* wp = weights->weight;
+        lc_float_sum_t sum0 = 0.0f;
+        lc_float_sum_t sum1 = 0.0f;
+        lc_float_sum_t sum2 = 0.0f;
+        for (int af = weights->start; af < weights->end; ++af, src += 3) {
+            lc_float_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
+            sum2 += w * src[2];
         }
-        break;
-        case LC_FILTER_CATMUL_ROM: {
-            filter_fn = lc_filter_catmull_rom;
-            if (NULL == p_filter_args) {lc_filter_catmull_rom_init(&filter_args);}
+        line_buffer[0] = lc_float_channel_to_buffer(sum0);
+        line_buffer[1] = lc_float_channel_to_buffer(sum1);
+        line_buffer[2] = lc_float_channel_to_buffer(sum2);
+        line_buffer += 3;
+    }
+}
+
+void lc_float_scanline_filter_4(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * 4;
+        const lc_float_sum_t* wp = weights->weight;
+        lc_float_sum_t sum0 = 0.0f;
+        lc_float_sum_t sum1 = 0.0f;
+        lc_float_sum_t sum2 = 0.0f;
+        lc_float_sum_t sum3 = 0.0f;
+        for (int af = weights->start; af < weights->end; ++af, src += 4) {
+            lc_float_sum_t w = *wp++;
+            sum0 += w * src[0];
+            sum1 += w * src[1];
+            sum2 += w * src[2];
+            sum3 += w * src[3];
         }
-        break;
-        case LC_FILTER_MITCHELL: {
-            filter_fn = lc_filter_mitchell;
-            if (NULL == p_filter_args) {lc_filter_mitchell_init(&filter_args);}
+        line_buffer[0] = lc_float_channel_to_buffer(sum0);
+        line_buffer[1] = lc_float_channel_to_buffer(sum1);
+        line_buffer[2] = lc_float_channel_to_buffer(sum2);
+        line_buffer[3] = lc_float_channel_to_buffer(sum3);
+        line_buffer += 4;
+    }
+}
+
+/* any other channel count, the sums are kept in line_buffer */
+void lc_float_scanline_filter_n(const lc_float_weight_table* weights, unsigned int channel_count, 
+                                const lc_float_data_t* p_src_row, lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * channel_count;
+        const lc_float_sum_t* wp = weights->weight;
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = 0.0f;
         }
-        break;
-        case LC_FILTER_SINC_BLACKMAN: {
-            filter_fn = lc_filter_sinc_blackman;
-            if (NULL == p_filter_args) {lc_filter_sinc_blackman_init(&filter_args);}
+        for (int af = weights->start; af < weights->end; ++af, src += channel_count) {
+            lc_float_sum_t w = *wp++;
+            for (unsigned int c = 0; c < channel_count; ++c) {
+                line_buffer[c] += w * src[c];
+            }
         }
-        break;
-        case LC_FILTER_GAUSSIAN: {
-            filter_fn = lc_filter_gassian;
-            if (NULL == p_filter_args) {lc_filter_gassian_init(&filter_args);}
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = lc_float_channel_to_buffer(line_buffer[c]);
         }
-        break;
-        case LC_FILTER_BESSEL_BLACKMAN: {
-            filter_fn = lc_filter_bessel_blackman;
-            if (NULL == p_filter_args) {lc_filter_bessel_blackman_init(&filter_args);}
+        line_buffer += channel_count;
+    }
+}
+
+void lc_float_scanline_filter_to_buffer(const lc_float_weight_table* weights, unsigned int channel_count, 
+                                        const lc_float_data_t* p_src_row, lc_float_sum_t* line_buffer, int width)
+{
+    switch (channel_count) {
+        case 1:  lc_float_scanline_filter_1(weights, p_src_row, line_buffer, width); break;
+        case 2:  lc_float_scanline_filter_2(weights, p_src_row, line_buffer, width); break;
+        case 3:  lc_float_scanline_filter_3(weights, p_src_row, line_buffer, width); break;
+        case 4:  lc_float_scanline_filter_4(weights, p_src_row, line_buffer, width); break;
+        default: lc_float_scanline_filter_n(weights, channel_count, p_src_row, line_buffer, width); break;
+    }
+}
+
+/* horizontal pass with premultiplied alpha, alpha being the last channel */
+void lc_float_scanline_filter_premultiplied(const lc_float_weight_table* weights, unsigned int channel_count, 
+                                            const lc_float_data_t* p_src_row, lc_float_sum_t* line_buffer, int width)
+{
+    unsigned int alpha_channel = channel_count - 1;
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * channel_count;
+        const lc_float_sum_t* wp = weights->weight;
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            line_buffer[c] = 0.0f;
         }
-        break;
+        for (int af = weights->start; af < weights->end; ++af, src += channel_count) {
+            lc_float_sum_t w = *wp++;
+            lc_float_data_t alpha = src[alpha_channel];
+            for (unsigned int c = 0; c < alpha_channel; ++c) {
+                line_buffer[c] += w * (src[c] * alpha);
+            }
+            line_buffer[alpha_channel] += w * alpha;
+        }
+        line_buffer += channel_count;
+    }
+}
 
-        default: break;
+void lc_float_scanline_unpremultiply_to_pixels(const lc_float_sum_t* accum, unsigned int channel_count, 
+                                               int width, lc_float_data_t* p_dst_row)
+{
+    unsigned int alpha_channel = channel_count - 1;
+    for (int x = 0; x < width; ++x, accum += channel_count, p_dst_row += channel_count) {
+        lc_float_sum_t alpha_sum = accum[alpha_channel];
+        for (unsigned int c = 0; c < alpha_channel; ++c) {
+            p_dst_row[c] = (alpha_sum > 0.0f) ? accum[c] / alpha_sum : 0.0f;
+        }
+        p_dst_row[alpha_channel] = alpha_sum;
     }
-    assert(NULL != filter_fn);
+}
 
-    if (NULL != p_filter_args) {
-        memcpy(&filter_args, p_filter_args, sizeof(*p_filter_args));
-    }
-
-    int src_offset_x = 0;
-    int src_offset_y = 0;
-
-    LC_DECLARE_ZERO(lc_rect, clipped_src_rect);
-    clipped_src_rect.x1 = 0;
-    clipped_src_rect.y1 = 0;
-    clipped_src_rect.x2 = (float)src_width;
-    clipped_src_rect.y2 = (float)src_height;
-    
-    LC_DECLARE_ZERO(lc_rect, clipped_dst_area);
-    clipped_dst_area.x1 = 0;
-    clipped_dst_area.y1 = 0;
-    clipped_dst_area.x2 = (float)dst_width;
-    clipped_dst_area.y2 = (float)dst_height;
-    
-    LC_DECLARE_ZERO(lc_mapping, m);
-    m.sx = dst_width / (float)src_width;
-    m.sy = dst_height / (float)src_height;
-    m.tx = clipped_dst_area.x1 - 0.5f - m.sx * (clipped_src_rect.x1 - 0.5f);
-    m.ty = clipped_dst_area.y1 - 0.5f - m.sy * (clipped_src_rect.y1 - 0.5f);
-    m.ux = clipped_dst_area.x1 - m.sx * (clipped_src_rect.x1 - 0.5f) - m.tx;
-    m.uy = clipped_dst_area.y1 - m.sy * (clipped_src_rect.y1 - 0.5f) - m.ty;
-
-    LC_DECLARE_ZERO(lc_filter_params, filter_params_x);
-    filter_params_x.scale   = LC_MATH_MAX(1.0f, 1.0f / m.sx);
-    filter_params_x.support = LC_MATH_MAX(0.5f, filter_params_x.scale * filter_args.support);
-    filter_params_x.width   = (int)ceil(2.0f * filter_params_x.support);
-
-    LC_DECLARE_ZERO(lc_filter_params, filter_params_y);
-    filter_params_y.scale   = LC_MATH_MAX(1.0f, 1.0f / m.sy);
-    filter_params_y.support = LC_MATH_MAX(0.5f, filter_params_y.scale * filter_args.support);
-    filter_params_y.width   = (int)ceil(2.0f * filter_params_y.support);
-
-    lc_float_line_buffer* lines_buffer = (lc_float_line_buffer*)calloc(filter_params_y.width, sizeof(*lines_buffer));
+#if LC_IMAGE_RESIZE_X86
+/*
+    SSE and AVX2 kernels. Each sum is built with the same operations in the same order as in the
+    scalar kernels, so the results are identical: the horizontal pass keeps the four channels of a
+    pixel in one register, the vertical pass works on 4 or 8 sums at once.
+*/
+LC_RESIZE_TARGET("sse4.1")
+void lc_float_scanline_filter_4_sse41(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                      lc_float_sum_t* line_buffer, int width)
+{
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * 4;
+        const lc_float_sum_t* wp = weights->weight;
+        __m128 sums = _mm_setzero_ps();
+        for (int af = weights->start; af < weights->end; ++af, src += 4) {
+            sums = _mm_add_ps(sums, _mm_mul_ps(_mm_set1_ps(*wp++), _mm_loadu_ps(src)));
+        }
+        _mm_storeu_ps(line_buffer, sums);
+        line_buffer += 4;
+    }
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_float_scanline_accumulate_sse41(lc_float_sum_t weight, const lc_float_sum_t* line_buffer, 
+                                        size_t count, lc_float_sum_t* accum)
+{
+    const __m128 weights = _mm_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 line = _mm_loadu_ps(line_buffer + i);
+        _mm_storeu_ps(accum + i, _mm_add_ps(_mm_loadu_ps(accum + i), _mm_mul_ps(line, weights)));
+    }
+    lc_float_scanline_accumulate(weight, line_buffer + i, count - i, accum + i);
+}
+
+LC_RESIZE_TARGET("avx2")
+void lc_float_scanline_accumulate_avx2(lc_float_sum_t weight, const lc_float_sum_t* line_buffer, 
+                                       size_t count, lc_float_sum_t* accum)
+{
+    const __m256 weights = _mm256_set1_ps(weight);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 line = _mm256_loadu_ps(line_buffer + i);
+        _mm256_storeu_ps(accum + i, _mm256_add_ps(_mm256_loadu_ps(accum + i), _mm256_mul_ps(line, weights)));
+    }
+    lc_float_scanline_accumulate(weight, line_buffer + i, count - i, accum + i);
+}
+
+LC_RESIZE_TARGET("sse4.1")
+void lc_float_scanline_filter_premultiplied_4_sse41(const lc_float_weight_table* weights, const lc_float_data_t* p_src_row, 
+                                                    lc_float_sum_t* line_buffer, int width)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (int b = 0; b < width; ++b, ++weights) {
+        const lc_float_data_t* src = p_src_row + (long long)weights->start * 4;
+        const lc_float_sum_t* wp = weights->weight;
+        __m128 sums = _mm_setzero_ps();
+        for (int af = weights->start; af < weights->end; ++af, src += 4) {
+            __m128 pixel = _mm_loadu_ps(src);
+            __m128 factors = _mm_blend_ps(_mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(3, 3, 3, 3)), one, 0x8);
+            sums = _mm_add_ps(sums, _mm_mul_ps(_mm_set1_ps(*wp++), _mm_mul_ps(pixel, factors)));
+        }
+        _mm_storeu_ps(line_buffer, sums);
+        line_buffer += 4;
+    }
+}
+#endif /* LC_IMAGE_RESIZE_X86 */
+
+void lc_float_resize_filter_row(const lc_resize_plan* p_plan, const lc_float_data_t* p_src_row, lc_float_sum_t* line_buffer)
+{
+    if (p_plan->premultiply) {
+#if LC_IMAGE_RESIZE_X86
+        if ((p_plan->simd >= LC_RESIZE_SIMD_SSE41) && (4 == p_plan->channel_count)) {
+            lc_float_scanline_filter_premultiplied_4_sse41(p_plan->float_x_weights, p_src_row, line_buffer, p_plan->dst_width);
+            return;
+        }
+#endif
+        lc_float_scanline_filter_premultiplied(p_plan->float_x_weights, p_plan->channel_count, p_src_row, line_buffer, p_plan->dst_width);
+        return;
+    }
+#if LC_IMAGE_RESIZE_X86
+    if ((p_plan->simd >= LC_RESIZE_SIMD_SSE41) && (4 == p_plan->channel_count)) {
+        lc_float_scanline_filter_4_sse41(p_plan->float_x_weights, p_src_row, line_buffer, p_plan->dst_width);
+        return;
+    }
+#endif
+    lc_float_scanline_filter_to_buffer(p_plan->float_x_weights, p_plan->channel_count, p_src_row, line_buffer, p_plan->dst_width);
+}
+
+void lc_float_resize_accumulate_row(const lc_resize_plan* p_plan, lc_float_sum_t weight, const lc_float_sum_t* line_buffer, 
+                                    size_t count, lc_float_sum_t* accum)
+{
+#if LC_IMAGE_RESIZE_X86
+    if (p_plan->simd >= LC_RESIZE_SIMD_AVX2) {
+        lc_float_scanline_accumulate_avx2(weight, line_buffer, count, accum);
+        return;
+    }
+    if (p_plan->simd >= LC_RESIZE_SIMD_SSE41) {
+        lc_float_scanline_accumulate_sse41(weight, line_buffer, count, accum);
+        return;
+    }
+#else
+    (void)p_plan;
+#endif
+    lc_float_scanline_accumulate(weight, line_buffer, count, accum);
+}
+
+void lc_float_resize_store_row(const lc_resize_plan* p_plan, const lc_float_sum_t* accum, size_t count, lc_float_data_t* p_dst_row)
+{
+    if (p_plan->premultiply) {
+        lc_float_scanline_unpremultiply_to_pixels(accum, p_plan->channel_count, p_plan->dst_width, p_dst_row);
+        return;
+    }
+    lc_float_scanline_accum_to_pixels(accum, count, p_dst_row);
+}
+
+void lc_float_make_weight_table(int b, float cen, 
+                                lc_filter_fn filter, const lc_filter_args* p_filter_args, 
+                                const lc_filter_params *params, 
+                                int len, bool trimzeros, lc_float_weight_table* wtab)
+{
+    int start, end, i, stillzero, lastnonzero, nz;
+    lc_float_sum_t *wp, t, sum;
+    float den, sc, tr;
+
+    /* find the source coord range of this positioned filter: [start..end-1] */
+    start = (int)(cen - params->support + 0.5f);
+    end = (int)(cen + params->support + 0.5f);
+    if (start < 0)
+        start = 0;
+    if (end > len)
+        end = len;
+
+    /* the range of source samples to buffer: */
+    wtab->start = start;
+    wtab->end = end;
+
+    /* find scale factor sc to normalize the filter */
+    for (den = 0, i=start; i < end; i++)
+        den += filter((i + 0.5f - cen) / params->scale, p_filter_args);
+
+    /* set sc so that sum of sc*func() is approximately WEIGHTONE */
+    sc = (den == 0.0f) ? (k_lc_float_weight_one) : (k_lc_float_weight_one / den);
+
+    /* compute the discrete, sampled filter coefficients */
+    stillzero = trimzeros;
+    for (sum = 0, wp = wtab->weight, i = start; i < end; i++) {
+        /* evaluate the filter function: */
+        tr = sc * filter((i + 0.5f - cen) / params->scale, p_filter_args);
+
+        t = (lc_float_sum_t)tr;
+        if (stillzero && (t == 0)) {
+            /* find first nonzero */
+            start++;
+        }
+        else {
+            stillzero = 0;
+            /* add weight to table */
+            *wp++ = t;
+            sum += t;
+            if (t != 0) {
+                /* find last nonzero */
+                lastnonzero = i;
+            }
+        }
+    }
+        
+    if (sum == 0) {
+        nz = wtab->end-wtab->start;
+        wtab->start = (wtab->start+wtab->end) >> 1;
+        wtab->end = wtab->start+1;
+        wtab->weight[0] = k_lc_float_weight_one;
+    }
+    else {
+        if (trimzeros) {
+            /* skip leading and trailing zeros */
+            /* set wtab->start and ->end to the nonzero support of the filter */
+            nz = wtab->end-wtab->start-(lastnonzero-start+1);
+            wtab->start = start;
+            wtab->end = end = lastnonzero+1;
+        }
+        else {
+            /* keep leading and trailing zeros */
+            nz = 0;
+        }
+
+        if (sum != k_lc_float_weight_one) {
+            /*
+                * Fudge the center slightly to make sum=WEIGHTONE exactly.
+                * Is this the best way to normalize a discretely sampled
+                * continuous filter?
+            */
+            i = (int32_t)(cen + 0.5f);
+            if (i < start) {
+                i = start;
+            }
+            else if (i >= end) {
+                i = end - 1;
+            }
+            t = k_lc_float_weight_one - sum;
+            /* fudge center sample */
+            wtab->weight[i - start] += t;
+        }
+    }   
+}
+
+lc_resize_plan* lc_resize_plan_create_float_ex(int src_width, int src_height, int dst_width, int dst_height,
+                                               unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args,
+                                               unsigned int flags)
+{
+    lc_resize_plan* p_plan = lc_resize_plan_alloc(src_width, src_height, dst_width, dst_height,
+                                                  channel_count, filter, p_filter_args, flags);
+    const lc_mapping* m = &p_plan->m;
+    int width_x = p_plan->filter_params_x.width;
+    int width_y = p_plan->filter_params_y.width;
+
+    p_plan->float_x_weights = (lc_float_weight_table*)calloc(dst_width, sizeof(*p_plan->float_x_weights));
+    assert(NULL != p_plan->float_x_weights);
+
+    p_plan->float_y_weights = (lc_float_weight_table*)calloc(dst_height, sizeof(*p_plan->float_y_weights));
+    assert(NULL != p_plan->float_y_weights);
+
+    p_plan->float_weight_buffer = (lc_float_sum_t*)calloc((size_t)dst_width * width_x + (size_t)dst_height * width_y,
+                                                          sizeof(*p_plan->float_weight_buffer));
+    assert(NULL != p_plan->float_weight_buffer);
+
+    lc_float_sum_t* p_weight = p_plan->float_weight_buffer;
+    for (int bx = 0; bx < dst_width; ++bx, p_weight += width_x) {
+        p_plan->float_x_weights[bx].weight = p_weight;
+        lc_float_make_weight_table(bx, LC_MAP(bx, m->sx, m->ux), p_plan->filter_fn, &p_plan->filter_args, &p_plan->filter_params_x, src_width, true, &p_plan->float_x_weights[bx]);
+    }
+
+    for (int by = 0; by < dst_height; ++by, p_weight += width_y) {
+        p_plan->float_y_weights[by].weight = p_weight;
+        lc_float_make_weight_table(by, LC_MAP(by, m->sy, m->uy), p_plan->filter_fn, &p_plan->filter_args, &p_plan->filter_params_y, src_height, false, &p_plan->float_y_weights[by]);
+    }
+
+    return p_plan;
+}
+
+/* lc_float_resize_rows: destination rows [dst_y_begin..dst_y_end-1] with a line ring of their own */
+void lc_float_resize_rows(const lc_resize_plan* p_plan, long long src_row_stride, const float* p_src_data,
+                          long long dst_row_stride, float* p_dst_data, int dst_y_begin, int dst_y_end)
+{
+    assert(NULL != p_plan->float_x_weights);
+
+    int line_count = p_plan->filter_params_y.width;
+    unsigned int channel_count = p_plan->channel_count;
+    lc_float_line_buffer* lines_buffer = (lc_float_line_buffer*)calloc(line_count, sizeof(*lines_buffer));
     assert(NULL != lines_buffer);
 
-    for(int i = 0; i < filter_params_y.width; i++) {
+    /* line_count filtered lines of interleaved pixels, then the accumulator */
+    size_t line_size = (size_t)p_plan->dst_width * channel_count;
+    lc_float_sum_t* lines_data = (lc_float_sum_t*)calloc((line_count + 1) * line_size, sizeof(*lines_data));
+    assert(NULL != lines_data);
+
+    for (int i = 0; i < line_count; ++i) {
         lines_buffer[i].first  = -1;
-        lines_buffer[i].second = (lc_float_sum_t*)calloc(dst_width, sizeof(lines_buffer[i].second));
-        assert(NULL != lines_buffer[i].second);
-    }
-
-    lc_float_weight_table* x_weights = (lc_float_weight_table*)calloc(dst_width, sizeof(*x_weights));
-    assert(NULL != x_weights);
-
-    lc_float_sum_t* x_weight_buffer = (lc_float_sum_t*)calloc(dst_width * filter_params_x.width, sizeof(*x_weight_buffer));
-    assert(NULL != x_weight_buffer);
-
-    LC_DECLARE_ZERO(lc_float_weight_table, y_weights);
-    y_weights.weight = (lc_float_sum_t*)calloc(filter_params_y.width, sizeof(*y_weights.weight));
-    assert(NULL != y_weights.weight);
-
-    lc_float_sum_t* accum = (lc_float_sum_t*)calloc(dst_width, sizeof(*accum));
-    assert(NULL != accum);
-
-    lc_float_sum_t* xWeightPtr = x_weight_buffer;
-    for (int bx = 0; bx < dst_width; ++bx, xWeightPtr += filter_params_x.width) {
-        x_weights[bx].weight = xWeightPtr;
-        lc_float_make_weight_table(bx, LC_MAP(bx, m.sx, m.ux), filter_fn, &filter_args, &filter_params_x, src_width, true, &x_weights[bx]);
-    }
-
-    int pixel_stride = channel_count * sizeof(lc_float_data_t);
-    for (unsigned int channel = 0; channel < channel_count; ++channel) {
-        /* loop over dest scanlines */
-        for (int dst_y = 0; dst_y < dst_height; ++dst_y) {
-            /* prepare a weight table for dest y position by */
-            lc_float_make_weight_table(dst_y, LC_MAP(dst_y, m.sy, m.uy), filter_fn, &filter_args, &filter_params_y, src_height, false, &y_weights);
-            memset(accum, 0, sizeof(*accum) * dst_width);
-            /* loop over source scanlines that influence this dest scanline */
-            for (int ayf = y_weights.start; ayf < y_weights.end; ++ayf) {
-                lc_float_sum_t* line = lines_buffer[ayf % filter_params_y.width].second;
-                if (lines_buffer[ayf % filter_params_y.width].first != ayf) {
-                    lc_float_scanline_filter_channel_to_buffer(x_weights, src_offset_x, src_offset_y + ayf, pixel_stride, src_row_stride, channel, p_src_data, line, dst_width);
-                    lines_buffer[ayf % filter_params_y.width].first = ayf;
-                }
-                lc_float_scanline_accumulate(y_weights.weight[ayf - y_weights.start], line, dst_width, accum);
+        lines_buffer[i].second = lines_data + i * line_size;
+    }
+    lc_float_sum_t* accum = lines_data + line_count * line_size;
+
+    /* loop over dest scanlines */
+    for (int dst_y = dst_y_begin; dst_y < dst_y_end; ++dst_y) {
+        const lc_float_weight_table* y_weights = &p_plan->float_y_weights[dst_y];
+        memset(accum, 0, sizeof(*accum) * line_size);
+        /* loop over source scanlines that influence this dest scanline */
+        for (int ayf = y_weights->start; ayf < y_weights->end; ++ayf) {
+            lc_float_line_buffer* line = &lines_buffer[ayf % line_count];
+            if (line->first != ayf) {
+                lc_float_resize_filter_row(p_plan, (const lc_float_data_t*)((const unsigned char*)p_src_data + ayf * src_row_stride), line->second);
+                line->first = ayf;
             }
-            lc_float_scanline_shift_accum_to_channel(accum, (int)clipped_dst_area.x1, (int)(clipped_dst_area.y1 + dst_y), dst_width, pixel_stride, dst_row_stride, channel, p_dst_data);
+            lc_float_resize_accumulate_row(p_plan, y_weights->weight[ayf - y_weights->start], line->second, line_size, accum);
         }
+        lc_float_resize_store_row(p_plan, accum, line_size, (lc_float_data_t*)((unsigned char*)p_dst_data + dst_y * dst_row_stride));
     }
 
-    LC_SAFE_FREE(accum);
-    LC_SAFE_FREE(y_weights.weight );
-    LC_SAFE_FREE(x_weight_buffer);
-    LC_SAFE_FREE(x_weights);
-    for(int i = 0; i < filter_params_y.width; i++) {
-        LC_SAFE_FREE(lines_buffer[i].second);
-    }
+    LC_SAFE_FREE(lines_data);
     LC_SAFE_FREE(lines_buffer);
 }
 
-#endif /* defined(LC_IMAGE_RESIZE_IMPLEMENTATION) */
\ No newline at end of file
+void lc_resize_execute_float(const lc_resize_plan* p_plan, long long src_row_stride, const float* p_src_data,
+                             long long dst_row_stride, float* p_dst_data)
+{
+    lc_float_resize_rows(p_plan, src_row_stride, p_src_data, dst_row_stride, p_dst_data, 0, p_plan->dst_height);
+}
+
+typedef struct lc_float_band_context {
+    const lc_resize_plan*   p_plan;
+    long long               src_row_stride;
+    const float*            p_src_data;
+    long long               dst_row_stride;
+    float*                  p_dst_data;
+    int                     band_count;
+} lc_float_band_context;
+
+void lc_float_band_task(void* task_context, int index)
+{
+    const lc_float_band_context* p_context = (const lc_float_band_context*)task_context;
+    int dst_y_begin = 0;
+    int dst_y_end = 0;
+    lc_resize_band(p_context->p_plan, p_context->band_count, index, &dst_y_begin, &dst_y_end);
+    lc_float_resize_rows(p_context->p_plan, p_context->src_row_stride, p_context->p_src_data, 
+                         p_context->dst_row_stride, p_context->p_dst_data, dst_y_begin, dst_y_end);
+}
+
+void lc_resize_execute_threaded_float(const lc_resize_plan* p_plan, long long src_row_stride, const float* p_src_data,
+                                      long long dst_row_stride, float* p_dst_data,
+                                      int thread_count, lc_resize_scheduler_fn scheduler, void* scheduler_context)
+{
+    LC_DECLARE_ZERO(lc_float_band_context, context);
+    context.p_plan = p_plan;
+    context.src_row_stride = src_row_stride;
+    context.p_src_data = p_src_data;
+    context.dst_row_stride = dst_row_stride;
+    context.p_dst_data = p_dst_data;
+    context.band_count = lc_resize_band_count(p_plan, thread_count);
+    lc_resize_run_tasks(context.band_count, lc_float_band_task, &context, scheduler, scheduler_context);
+}
+
+void lc_image_resize_float_ex(int src_width, int src_height, long long src_row_stride, const float* p_src_data,
+                              int dst_width, int dst_height, long long dst_row_stride, float* p_dst_data,
+                              unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args, unsigned int flags)
+{
+    lc_resize_plan* p_plan = lc_resize_plan_create_float_ex(src_width, src_height, dst_width, dst_height,
+                                                            channel_count, filter, p_filter_args, flags);
+    lc_resize_execute_float(p_plan, src_row_stride, p_src_data, dst_row_stride, p_dst_data);
+    lc_resize_plan_destroy(p_plan);
+}
+
+void lc_image_resize_float(int src_width, int src_height, long long src_row_stride, const float* p_src_data,
+                           int dst_width, int dst_height, long long dst_row_stride, float* p_dst_data,
+                           unsigned int channel_count, lc_filter filter, const lc_filter_args* p_filter_args)
+{
+    lc_image_resize_float_ex(src_width, src_height, src_row_stride, p_src_data, dst_width, dst_height, dst_row_stride, p_dst_data,
+                             channel_count, filter, p_filter_args, 0);
+}
+
+#endif /* defined(LC_IMAGE_RESIZE_IMPLEMENTATION) */
\ No newline at end of file
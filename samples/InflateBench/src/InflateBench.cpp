@@ -0,0 +1,104 @@
+/*
+ Times PNG decoding with the built in inflater against libdeflate. Build it twice and run both
+ binaries on the same files:
+
+   g++ -O2 -I../../.. InflateBench.cpp -o bench_builtin -lpthread
+   g++ -O2 -I../../.. -DLC_IMAGE_LIBDEFLATE InflateBench.cpp -o bench_libdeflate -ldeflate -lpthread
+
+   ./bench_builtin image.png ...
+   ./bench_libdeflate image.png ...
+
+ On Windows, InflateBench.sln builds the built in backend. For libdeflate add LC_IMAGE_LIBDEFLATE to
+ the preprocessor definitions, the libdeflate include directory to the include directories and
+ libdeflate.lib to the linker inputs.
+
+ Each file is decoded from memory several times, the best time is reported as megabytes of
+ decoded pixels per second.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+
+#if defined(LC_IMAGE_LIBDEFLATE)
+    #include <libdeflate.h>
+    #define BENCH_BACKEND "libdeflate"
+#else
+    #define BENCH_BACKEND "built in"
+#endif
+
+#define LC_IMAGE_IMPLEMENTATION
+#include "lc_image.h"
+
+static const int kRunCount = 10;
+
+static unsigned char* read_file(const char* file_name, long* size)
+{
+    FILE* file = fopen(file_name, "rb");
+    if (NULL == file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* data = (unsigned char*)malloc(*size);
+    assert(NULL != data);
+    if (fread(data, 1, *size, file) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("usage: %s image.png ...\n", argv[0]);
+        return 1;
+    }
+
+    printf("inflate backend: %s\n", BENCH_BACKEND);
+    for (int i = 1; i < argc; ++i) {
+        long size = 0;
+        unsigned char* file_bytes = read_file(argv[i], &size);
+        if (NULL == file_bytes) {
+            printf("%s: cannot read\n", argv[i]);
+            continue;
+        }
+
+        double best = 1e30;
+        int w = 0;
+        int h = 0;
+        int c = 0;
+        for (int run = 0; run < kRunCount; ++run) {
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            unsigned char* pixels = lc_load_image_mem(size, file_bytes, &w, &h, &c, 0);
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            if (NULL == pixels) {
+                break;
+            }
+
+            lc_free_image(pixels);
+            best = (seconds < best) ? seconds : best;
+        }
+
+        if (best < 1e30) {
+            double megabytes = (double)w * h * c / (1024.0 * 1024.0);
+            printf("%s: %dx%dx%d %8.2f ms %8.1f MB/s\n", argv[i], w, h, c, best * 1000.0, megabytes / best);
+        }
+        else {
+            printf("%s: decode failed\n", argv[i]);
+        }
+
+        free(file_bytes);
+        file_bytes = NULL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ Checks the uncompressed formats: images of every channel count are written as PNM, BMP and TGA,
+ then probed, loaded, loaded into a buffer and mapped as views, and must come back unchanged.
+ Truncated files and headers that point past the end of the data must be rejected:
+
+   g++ -O2 -I../../.. RawFormatCheck.cpp -o raw_format_check -lpthread
+   ./raw_format_check
+
+ The exit code is 0 if every check passes, 1 otherwise. The Visual Studio project runs the check
+ after every build, so a failure fails the build.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+#define LC_IMAGE_IMPLEMENTATION
+#include "lc_image.h"
+
+typedef unsigned char* (*write_mem_fn)(int width, int height, int channel_count,
+                                       const unsigned char* data, unsigned long long* size);
+
+typedef struct format {
+    const char*  name;
+    write_mem_fn write_mem;
+    int          written[5];    /* 1 if the channel count can be written */
+    int          in_place[5];   /* 1 if the written rows are mapped without decoding */
+} format;
+
+static const format kFormats[] = {
+    { "pnm", lc_write_pnm_mem, { 0, 1, 1, 1, 1 }, { 0, 1, 1, 1, 1 } },
+    { "bmp", lc_write_bmp_mem, { 0, 1, 0, 1, 1 }, { 0, 1, 0, 0, 1 } },
+    { "tga", lc_write_tga_mem, { 0, 1, 1, 1, 1 }, { 0, 1, 1, 0, 0 } }
+};
+
+/* widths that pad BMP rows in every way, heights with a single row */
+static const int kSizes[][2] = {
+    {   1,   1 },
+    {   3,   2 },
+    {  17,   1 },
+    {  64,  48 },
+    { 333,  77 }
+};
+
+static int g_failures = 0;
+
+#define CHECK(condition, ...)                   \
+    do {                                        \
+        if (!(condition)) {                     \
+            printf(__VA_ARGS__);                \
+            printf(": %s\n", #condition);       \
+            ++g_failures;                       \
+        }                                       \
+    } while (0)
+
+static void check_round_trip(const format* fmt, int width, int height, int channel_count)
+{
+    size_t pixel_bytes = (size_t)width * height * channel_count;
+    unsigned char* pixels = (unsigned char*)malloc(pixel_bytes);
+    assert(NULL != pixels);
+    for (size_t i = 0; i < pixel_bytes; ++i) {
+        pixels[i] = (unsigned char)(rand() & 0xFF);
+    }
+
+    unsigned long long size = 0;
+    unsigned char* file = fmt->write_mem(width, height, channel_count, pixels, &size);
+    if (!fmt->written[channel_count]) {
+        CHECK(NULL == file, "%s %dx%dx%d", fmt->name, width, height, channel_count);
+        lc_free_image(file);
+        free(pixels);
+        return;
+    }
+    CHECK(NULL != file, "%s %dx%dx%d", fmt->name, width, height, channel_count);
+    if (NULL == file) {
+        free(pixels);
+        return;
+    }
+
+    int w = 0;
+    int h = 0;
+    int c = 0;
+    const lc_codec* codec = lc_probe_image_mem(size, file, &w, &h, &c);
+    CHECK((NULL != codec) && (0 == strcmp(codec->name, fmt->name)) && (w == width) && (h == height) && (c == channel_count),
+          "%s %dx%dx%d probe", fmt->name, width, height, channel_count);
+
+    unsigned char* loaded = lc_load_image_mem(size, file, &w, &h, &c, 0);
+    CHECK((NULL != loaded) && (w == width) && (h == height) && (c == channel_count) && (0 == memcmp(loaded, pixels, pixel_bytes)),
+          "%s %dx%dx%d load", fmt->name, width, height, channel_count);
+    lc_free_image(loaded);
+
+    unsigned char* into = (unsigned char*)malloc(pixel_bytes);
+    assert(NULL != into);
+    CHECK(lc_load_image_mem_into(size, file, into, pixel_bytes, &w, &h, &c, 0, NULL) && (0 == memcmp(into, pixels, pixel_bytes)),
+          "%s %dx%dx%d load into", fmt->name, width, height, channel_count);
+    CHECK(!lc_load_image_mem_into(size, file, into, pixel_bytes - 1, &w, &h, &c, 0, NULL),
+          "%s %dx%dx%d load into a short buffer", fmt->name, width, height, channel_count);
+    free(into);
+
+    lc_image_view view;
+    int mapped = lc_map_image_mem(size, file, &view, 0, NULL);
+    CHECK(mapped && (view.zero_copy == fmt->in_place[channel_count]) && (view.channel_count == channel_count),
+          "%s %dx%dx%d map", fmt->name, width, height, channel_count);
+    if (mapped) {
+        size_t row_bytes = (size_t)width * channel_count;
+        for (int y = 0; y < height; ++y) {
+            if (0 != memcmp(view.pixels + y * view.row_stride, pixels + y * row_bytes, row_bytes)) {
+                CHECK(0, "%s %dx%dx%d map row %d", fmt->name, width, height, channel_count, y);
+                break;
+            }
+        }
+        lc_unmap_image(&view);
+    }
+
+    /* a file cut into its last pixel must fail, BMP rows may end in up to 3 bytes of padding */
+    unsigned long long cut_size = size - 4;
+    unsigned char* cut = (unsigned char*)malloc((size_t)cut_size);
+    assert(NULL != cut);
+    memcpy(cut, file, (size_t)cut_size);
+    loaded = lc_load_image_mem(cut_size, cut, &w, &h, &c, 0);
+    CHECK(NULL == loaded, "%s %dx%dx%d truncated", fmt->name, width, height, channel_count);
+    lc_free_image(loaded);
+    free(cut);
+
+    lc_free_image(file);
+    free(pixels);
+}
+
+static void write_le32(unsigned char* p, unsigned int value)
+{
+    p[0] = (unsigned char)(value & 0xFF);
+    p[1] = (unsigned char)((value >> 8) & 0xFF);
+    p[2] = (unsigned char)((value >> 16) & 0xFF);
+    p[3] = (unsigned char)((value >> 24) & 0xFF);
+}
+
+/* BMP headers whose pixel offset, width or height put the rows past the end of the file */
+static void check_bad_bmp_headers(void)
+{
+    static const unsigned int kOffsets[] = { 54, 0xFFFFFFF0u, 100000 };
+    static const int kHeights[] = { 0x7FFFFFFF, -0x7FFFFFFF, 1000 };
+    static const int kWidths[] = { 1, 0x7FFFFFFF };
+
+    unsigned char file[256];
+    for (size_t o = 0; o < sizeof(kOffsets) / sizeof(kOffsets[0]); ++o) {
+        for (size_t h = 0; h < sizeof(kHeights) / sizeof(kHeights[0]); ++h) {
+            for (size_t w = 0; w < sizeof(kWidths) / sizeof(kWidths[0]); ++w) {
+                memset(file, 0, sizeof(file));
+                file[0] = 'B';
+                file[1] = 'M';
+                write_le32(file + 10, kOffsets[o]);
+                write_le32(file + 14, 40);
+                write_le32(file + 18, (unsigned int)kWidths[w]);
+                write_le32(file + 22, (unsigned int)kHeights[h]);
+                file[26] = 1;
+                file[28] = 24;
+
+                int width = 0;
+                int height = 0;
+                int channel_count = 0;
+                unsigned char* loaded = lc_load_image_mem(sizeof(file), file, &width, &height, &channel_count, 0);
+                CHECK(NULL == loaded, "bmp offset %u, %dx%d", kOffsets[o], kWidths[w], kHeights[h]);
+                lc_free_image(loaded);
+
+                lc_image_view view;
+                int mapped = lc_map_image_mem(sizeof(file), file, &view, 0, NULL);
+                CHECK(!mapped, "bmp offset %u, %dx%d map", kOffsets[o], kWidths[w], kHeights[h]);
+                if (mapped) {
+                    lc_unmap_image(&view);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    srand(1);
+    int checks = 0;
+    for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); ++f) {
+        for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+            for (int channel_count = 1; channel_count <= 4; ++channel_count) {
+                check_round_trip(&kFormats[f], kSizes[s][0], kSizes[s][1], channel_count);
+                ++checks;
+            }
+        }
+    }
+    check_bad_bmp_headers();
+
+    printf("%d round trips checked, %d failures\n", checks, g_failures);
+
+    return (0 == g_failures) ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+/*
+ Checks that 8-bit resizes stay within the documented distance of float resizes of the same
+ image. Every combination of sizes, channel counts and filters is resized as uint8 and as float,
+ with and without LC_RESIZE_PREMULTIPLY_ALPHA, and the uint8 result is compared with the float
+ one rounded to 8 bits:
+
+   g++ -O2 -I../../.. ResizeAccuracyCheck.cpp -o resize_accuracy_check -lpthread
+   ./resize_accuracy_check
+
+ Without the flag every channel is within 1. With it, colors are within 1 where the resulting
+ alpha is 8 or more and within 2 where it is 4 or more; more transparent pixels keep too few bits
+ of color to bound, and the colors of fully transparent ones are arbitrary. The exit code is 0 if
+ all results are within their bounds, 1 otherwise. The Visual Studio project runs the check after
+ every build, so a result out of bounds fails the build.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+#define LC_IMAGE_RESIZE_IMPLEMENTATION
+#include "lc_image_resize.h"
+
+/* source width, source height, destination width, destination height */
+static const int kSizes[][4] = {
+    {    7,   5,   3,   9 },
+    {   64,  48,  17,  13 },
+    {  100,  80, 250, 190 },
+    {  333, 211,  97, 143 },
+    {    2, 900,   5,  37 },
+    {   31,  29,  31,  29 },
+    {   40,  40, 160, 160 }
+};
+
+static const unsigned int kMaxChannelCount = 6;
+
+/* the largest distance from the float result allowed for a channel, -1 if there is none */
+static int allowed_distance(const unsigned char* pixel, unsigned int channel, unsigned int channel_count, unsigned int flags)
+{
+    bool premultiplied = (0 != (flags & LC_RESIZE_PREMULTIPLY_ALPHA)) && ((2 == channel_count) || (4 == channel_count));
+    if (!premultiplied || (channel == channel_count - 1)) {
+        return 1;
+    }
+
+    int alpha = pixel[channel_count - 1];
+    if (alpha >= 8) {
+        return 1;
+    }
+
+    return (alpha >= 4) ? 2 : -1;
+}
+
+static int check(const int* size, unsigned int channel_count, lc_filter filter, unsigned int flags)
+{
+    int src_width = size[0];
+    int src_height = size[1];
+    int dst_width = size[2];
+    int dst_height = size[3];
+    size_t src_count = (size_t)src_width * src_height * channel_count;
+    size_t dst_count = (size_t)dst_width * dst_height * channel_count;
+
+    unsigned char* src = (unsigned char*)malloc(src_count);
+    float* src_float = (float*)malloc(src_count * sizeof(float));
+    unsigned char* result = (unsigned char*)calloc(dst_count, 1);
+    float* expected = (float*)calloc(dst_count, sizeof(float));
+    assert((NULL != src) && (NULL != src_float) && (NULL != result) && (NULL != expected));
+    for (size_t i = 0; i < src_count; ++i) {
+        src[i] = (unsigned char)(rand() & 0xFF);
+    }
+    /* transparent, opaque and nearly transparent pixels, the last ones are where precision runs out */
+    if ((2 == channel_count) || (4 == channel_count)) {
+        for (size_t i = channel_count - 1; i < src_count; i += channel_count) {
+            switch (rand() & 3) {
+                case 0: src[i] = 0; break;
+                case 1: src[i] = 255; break;
+                case 2: src[i] = (unsigned char)(rand() & 0x0F); break;
+                default: break;
+            }
+        }
+    }
+    for (size_t i = 0; i < src_count; ++i) {
+        src_float[i] = (float)src[i] / 255.0f;
+    }
+
+    lc_image_resize_uint8_ex(src_width, src_height, (long long)src_width * channel_count, src,
+                             dst_width, dst_height, (long long)dst_width * channel_count, result,
+                             channel_count, filter, NULL, flags);
+    lc_image_resize_float_ex(src_width, src_height, (long long)src_width * channel_count * sizeof(float), src_float,
+                             dst_width, dst_height, (long long)dst_width * channel_count * sizeof(float), expected,
+                             channel_count, filter, NULL, flags);
+
+    int worst = 0;
+    long long failures = 0;
+    for (size_t i = 0; i < dst_count; i += channel_count) {
+        for (unsigned int c = 0; c < channel_count; ++c) {
+            int allowed = allowed_distance(result + i, c, channel_count, flags);
+            if (allowed < 0) {
+                continue;
+            }
+
+            float value = LC_MATH_MIN(LC_MATH_MAX(expected[i + c] * 255.0f, 0.0f), 255.0f);
+            int distance = abs((int)result[i + c] - (int)lrintf(value));
+            if (distance > allowed) {
+                worst = LC_MATH_MAX(worst, distance);
+                ++failures;
+            }
+        }
+    }
+
+    if (0 != failures) {
+        printf("%dx%d -> %dx%d, %u channels, filter %d, flags %u: %lld samples out of bounds, off by up to %d\n",
+               src_width, src_height, dst_width, dst_height, channel_count, (int)filter, flags, failures, worst);
+    }
+
+    free(src);
+    free(src_float);
+    free(result);
+    free(expected);
+
+    return (0 == failures) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    srand(1);
+    int checks = 0;
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+        for (int filter = LC_FILTER_UNDEFINED + 1; filter < LC_FILTER_MAX; ++filter) {
+            for (unsigned int channel_count = 1; channel_count <= kMaxChannelCount; ++channel_count) {
+                for (unsigned int flags = 0; flags <= LC_RESIZE_PREMULTIPLY_ALPHA; ++flags) {
+                    failures += check(kSizes[i], channel_count, (lc_filter)filter, flags);
+                    ++checks;
+                }
+            }
+        }
+    }
+
+    printf("%d resizes checked, %d out of bounds\n", checks, failures);
+
+    return (0 == failures) ? 0 : 1;
+}
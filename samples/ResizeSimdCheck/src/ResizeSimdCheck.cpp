@@ -0,0 +1,174 @@
+/*
+ Checks that the SIMD resize kernels give byte for byte the results of the scalar ones. Every
+ combination of sizes, channel counts, filters and alpha handling is resized with the kernels
+ forced off and then with each SIMD level the CPU has, for uint8 and float images:
+
+   g++ -O2 -I../../.. ResizeSimdCheck.cpp -o resize_simd_check -lpthread
+   ./resize_simd_check
+
+ The exit code is 0 if all outputs match, 1 otherwise. A build with LC_IMAGE_RESIZE_NO_SIMD has
+ nothing to compare and passes. The Visual Studio project runs the check after every build, so a
+ mismatch fails the build.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+
+#define LC_IMAGE_RESIZE_IMPLEMENTATION
+#include "lc_image_resize.h"
+
+/* source width, source height, destination width, destination height */
+static const int kSizes[][4] = {
+    {    1,   1,   1,   1 },
+    {    7,   5,   3,   9 },
+    {   64,  48,  17,  13 },
+    {  100,  80, 250, 190 },
+    {  333, 211,  97, 143 },
+    { 1025,   3,  31,   2 },
+    {    2, 900,   5,  37 },
+    {  400, 300, 399, 301 }
+};
+
+static const unsigned int kMaxChannelCount = 6;
+
+/* rows are padded so that the kernels can't rely on tightly packed images */
+static const int kSrcPadding = 5;
+static const int kDstPadding = 3;
+
+static const char* simd_name(int level)
+{
+    switch (level) {
+        case LC_RESIZE_SIMD_SSE41: return "SSE4.1";
+        case LC_RESIZE_SIMD_AVX2: return "AVX2";
+        default: break;
+    }
+    return "scalar";
+}
+
+static int check_uint8(const int* size, unsigned int channel_count, lc_filter filter, unsigned int flags)
+{
+    int src_width = size[0];
+    int src_height = size[1];
+    int dst_width = size[2];
+    int dst_height = size[3];
+    long long src_row_stride = (long long)src_width * channel_count + kSrcPadding;
+    long long dst_row_stride = (long long)dst_width * channel_count + kDstPadding;
+    size_t src_size = (size_t)(src_row_stride * src_height);
+    size_t dst_size = (size_t)(dst_row_stride * dst_height);
+
+    unsigned char* src = (unsigned char*)malloc(src_size);
+    unsigned char* expected = (unsigned char*)calloc(dst_size, 1);
+    unsigned char* result = (unsigned char*)calloc(dst_size, 1);
+    assert((NULL != src) && (NULL != expected) && (NULL != result));
+    for (size_t i = 0; i < src_size; ++i) {
+        src[i] = (unsigned char)(rand() & 0xFF);
+    }
+    /* fully transparent and fully opaque pixels take their own paths when premultiplying */
+    for (size_t i = 0; i < src_size; i += 17) {
+        src[i] = (i & 1) ? 0 : 255;
+    }
+
+    lc_resize_plan* p_plan = lc_resize_plan_create_uint8_ex(src_width, src_height, dst_width, dst_height,
+                                                            channel_count, filter, NULL, flags);
+    int top_level = p_plan->simd;
+    /* the plan is visible in the implementation, its kernel set is lowered to compare against */
+    p_plan->simd = LC_RESIZE_SIMD_NONE;
+    lc_resize_execute_uint8(p_plan, src_row_stride, src, dst_row_stride, expected);
+
+    int failures = 0;
+    for (int level = LC_RESIZE_SIMD_NONE + 1; level <= top_level; ++level) {
+        memset(result, 0, dst_size);
+        p_plan->simd = level;
+        lc_resize_execute_uint8(p_plan, src_row_stride, src, dst_row_stride, result);
+        if (0 != memcmp(expected, result, dst_size)) {
+            printf("uint8 %dx%d -> %dx%d, %u channels, filter %d, flags %u: %s differs from scalar\n",
+                   src_width, src_height, dst_width, dst_height, channel_count, (int)filter, flags, simd_name(level));
+            ++failures;
+        }
+    }
+
+    lc_resize_plan_destroy(p_plan);
+    free(src);
+    free(expected);
+    free(result);
+
+    return failures;
+}
+
+static int check_float(const int* size, unsigned int channel_count, lc_filter filter, unsigned int flags)
+{
+    int src_width = size[0];
+    int src_height = size[1];
+    int dst_width = size[2];
+    int dst_height = size[3];
+    long long src_row_stride = ((long long)src_width * channel_count + kSrcPadding) * (long long)sizeof(float);
+    long long dst_row_stride = ((long long)dst_width * channel_count + kDstPadding) * (long long)sizeof(float);
+    size_t src_count = (size_t)(src_row_stride / sizeof(float) * src_height);
+    size_t dst_size = (size_t)(dst_row_stride * dst_height);
+
+    float* src = (float*)malloc(src_count * sizeof(float));
+    float* expected = (float*)calloc(dst_size, 1);
+    float* result = (float*)calloc(dst_size, 1);
+    assert((NULL != src) && (NULL != expected) && (NULL != result));
+    for (size_t i = 0; i < src_count; ++i) {
+        src[i] = (float)rand() / (float)RAND_MAX;
+    }
+    for (size_t i = 0; i < src_count; i += 17) {
+        src[i] = (i & 1) ? 0.0f : 1.0f;
+    }
+
+    lc_resize_plan* p_plan = lc_resize_plan_create_float_ex(src_width, src_height, dst_width, dst_height,
+                                                            channel_count, filter, NULL, flags);
+    int top_level = p_plan->simd;
+    p_plan->simd = LC_RESIZE_SIMD_NONE;
+    lc_resize_execute_float(p_plan, src_row_stride, src, dst_row_stride, expected);
+
+    int failures = 0;
+    for (int level = LC_RESIZE_SIMD_NONE + 1; level <= top_level; ++level) {
+        memset(result, 0, dst_size);
+        p_plan->simd = level;
+        lc_resize_execute_float(p_plan, src_row_stride, src, dst_row_stride, result);
+        if (0 != memcmp(expected, result, dst_size)) {
+            printf("float %dx%d -> %dx%d, %u channels, filter %d, flags %u: %s differs from scalar\n",
+                   src_width, src_height, dst_width, dst_height, channel_count, (int)filter, flags, simd_name(level));
+            ++failures;
+        }
+    }
+
+    lc_resize_plan_destroy(p_plan);
+    free(src);
+    free(expected);
+    free(result);
+
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    printf("SIMD level: %s\n", simd_name(lc_resize_simd_level()));
+
+    srand(1);
+    int checks = 0;
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+        for (int filter = LC_FILTER_UNDEFINED + 1; filter < LC_FILTER_MAX; ++filter) {
+            for (unsigned int channel_count = 1; channel_count <= kMaxChannelCount; ++channel_count) {
+                for (unsigned int flags = 0; flags <= LC_RESIZE_PREMULTIPLY_ALPHA; ++flags) {
+                    failures += check_uint8(kSizes[i], channel_count, (lc_filter)filter, flags);
+                    failures += check_float(kSizes[i], channel_count, (lc_filter)filter, flags);
+                    checks += 2;
+                }
+            }
+        }
+    }
+
+    printf("%d resizes checked, %d mismatches\n", checks, failures);
+
+    return (0 == failures) ? 0 : 1;
+}